@@ -0,0 +1,115 @@
+#include "AudioCapture.h"
+
+#include <string.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    AudioCapture::AudioCapture()
+    {
+      lost = 0;
+    }
+
+
+    AudioCapture::~AudioCapture()
+    {
+      free_blocks();
+    }
+
+
+    bool AudioCapture::init(unsigned int sampleRate, unsigned int channels,
+			    unsigned int blockSamples, unsigned int blocks)
+    {
+      if(sampleRate == 0 || channels == 0 || blockSamples == 0 || blocks == 0)
+	return false;
+
+      free_blocks();
+
+      if(freeBlocks.init(blocks) == false || filledBlocks.init(blocks) == false)
+	return false;
+
+      this->sampleRate = sampleRate;
+      this->channels = channels;
+      this->blockSamples = blockSamples;
+
+      for(unsigned int i=0;i<blocks;i++){
+	AudioCapture::block* b = new AudioCapture::block;
+	b->samples.resize(blockSamples*channels);
+	b->length = 0;
+	b->timeMS = 0;
+	b->lost = 0;
+
+	this->blocks.push_back(b);
+	freeBlocks.push(b);
+      }
+
+      lost = 0;
+      lostBeforeNext = 0;
+
+      return true;
+    }
+
+
+    void AudioCapture::write(const int16_t* samples, unsigned int length, long long timeMS)
+    {
+      // splits buffers longer than a block
+      while(length > 0){
+	const unsigned int n = (length < blockSamples) ? length : blockSamples;
+
+	void* p = nullptr;
+
+	if(freeBlocks.pop(p) == false){
+	  lost += length; // reader is too slow
+	  lostBeforeNext += length;
+	  return;
+	}
+
+	AudioCapture::block* b = (AudioCapture::block*)p;
+
+	memcpy(b->samples.data(), samples, n*channels*sizeof(int16_t));
+	b->length = n;
+	b->timeMS = timeMS;
+	b->lost = lostBeforeNext;
+	lostBeforeNext = 0;
+
+	filledBlocks.push(b); // never full: there are only capacity blocks
+
+	samples += n*channels;
+	length -= n;
+	timeMS += (1000LL*n)/sampleRate;
+      }
+    }
+
+
+    bool AudioCapture::pop(AudioCapture::block*& b)
+    {
+      void* p = nullptr;
+
+      if(filledBlocks.pop(p) == false)
+	return false;
+
+      b = (AudioCapture::block*)p;
+
+      return true;
+    }
+
+
+    void AudioCapture::release(AudioCapture::block* b)
+    {
+      if(b) freeBlocks.push(b);
+    }
+
+
+    void AudioCapture::free_blocks()
+    {
+      for(auto b : blocks)
+	delete b;
+
+      blocks.clear();
+    }
+
+  };
+};
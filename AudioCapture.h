@@ -0,0 +1,81 @@
+/*
+ * AudioCapture
+ *
+ * lock-free tap of synthesized PCM audio. audio callback copies its
+ * buffer into preallocated blocks (with time the samples become audible)
+ * and the video encoder thread takes them for encoding. blocks are passed
+ * between threads with two FrameQueues (free and filled blocks) so the
+ * audio thread never blocks or allocates memory: if the encoder falls
+ * behind, new samples are dropped and counted so that the reader can
+ * replace them with silence.
+ */
+
+#ifndef AudioCapture_h
+#define AudioCapture_h
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+#include "FrameQueue.h"
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    class AudioCapture
+    {
+    public:
+
+      struct block {
+	std::vector<int16_t> samples; // interleaved samples (capacity blockSamples*channels)
+	unsigned int length;          // number of (multichannel) samples in block
+	long long timeMS;             // time of the first sample (msecs since epoch)
+	unsigned long long lost;      // samples dropped just before this block
+      };
+
+      AudioCapture();
+      ~AudioCapture();
+
+      // (re)allocates blocks, must not be called while capture is used by other threads
+      bool init(unsigned int sampleRate, unsigned int channels,
+		unsigned int blockSamples, unsigned int blocks = DEFAULT_BLOCKS);
+
+      unsigned int getSampleRate() const { return sampleRate; }
+      unsigned int getChannels() const { return channels; }
+
+      // called by audio thread: copies samples (length * channels values)
+      // audible at timeMS, never blocks
+      void write(const int16_t* samples, unsigned int length, long long timeMS);
+
+      // called by reader: takes the oldest filled block, returns false if there is none.
+      // block must be given back with release()
+      bool pop(AudioCapture::block*& b);
+      void release(AudioCapture::block* b);
+
+      // samples dropped because reader was too slow
+      unsigned long long getLostSamples() const { return lost; }
+
+      static const unsigned int DEFAULT_BLOCKS = 64;
+
+    private:
+
+      void free_blocks();
+
+      unsigned int sampleRate = 0, channels = 0, blockSamples = 0;
+
+      std::vector<AudioCapture::block*> blocks;
+
+      FrameQueue freeBlocks, filledBlocks;
+
+      std::atomic<unsigned long long> lost;
+      unsigned long long lostBeforeNext = 0; // used only by audio thread
+    };
+
+  };
+};
+
+
+#endif
@@ -0,0 +1,583 @@
+#include "BrainStateTrainer.h"
+
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <iostream>
+
+#include <math.h>
+#include <stdio.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    BrainStateTrainer::BrainStateTrainer()
+    {
+      thread_running = false;
+      phase = 0;
+      iteration = 0;
+      kmeansError = 0.0;
+      logLikelihood = 0.0;
+      finished = false;
+    }
+
+
+    BrainStateTrainer::~BrainStateTrainer()
+    {
+      this->stopTrain();
+    }
+
+
+    bool BrainStateTrainer::startTrain(const whiteice::dataset<>& eegData,
+				       unsigned int K, unsigned int S,
+				       const whiteice::KMeans<>* warmKMeans,
+				       const whiteice::HMM* warmHMM)
+    {
+      std::lock_guard<std::mutex> lock(thread_mutex);
+
+      if(thread_running)
+	return false; // already training
+
+      if(trainer_thread){
+	trainer_thread->join(); // finished thread
+	delete trainer_thread;
+	trainer_thread = nullptr;
+      }
+
+      if(eegData.getNumberOfClusters() < 1 || K == 0 || S == 0)
+	return false;
+
+      if(eegData.size(0) < K || eegData.size(0) < 2)
+	return false;
+
+      {
+	std::lock_guard<std::mutex> mlock(model_mutex);
+
+	this->N = eegData.size(0);
+	this->D = eegData.dimension(0);
+	this->K = K;
+	this->S = S;
+
+	X.resize(((size_t)N)*D);
+
+	for(unsigned int i=0;i<N;i++){
+	  auto v = eegData.access(0, i);
+
+	  for(unsigned int d=0;d<D && d<v.size();d++)
+	    X[((size_t)i)*D + d] = v[d].c[0];
+	}
+
+	// warm start models
+	warmKMeansOk = false;
+
+	if(warmKMeans != nullptr && warmKMeans->size() == K && (*warmKMeans)[0].size() == D){
+	  centroids.resize(K*D);
+
+	  for(unsigned int k=0;k<K;k++)
+	    for(unsigned int d=0;d<D;d++)
+	      centroids[k*D + d] = (*warmKMeans)[k][d].c[0];
+
+	  warmKMeansOk = true;
+	}
+
+	warmHMMOk = false;
+
+	if(warmKMeansOk && warmHMM != nullptr &&
+	   warmHMM->getNumHiddenStates() == S && warmHMM->getNumVisibleStates() == K)
+	{
+	  const auto& hpi = warmHMM->getPI();
+	  const auto& hA = warmHMM->getA();
+	  const auto& hB = warmHMM->getB();
+
+	  pi.resize(S);
+	  A.resize(S*S);
+	  B.resize(S*S*K);
+
+	  for(unsigned int i=0;i<S;i++){
+	    pi[i] = hpi[i].getDouble();
+
+	    for(unsigned int j=0;j<S;j++){
+	      A[i*S + j] = hA[i][j].getDouble();
+
+	      for(unsigned int o=0;o<K;o++)
+		B[(i*S + j)*K + o] = hB[i][j][o].getDouble();
+	    }
+	  }
+
+	  warmHMMOk = true;
+	}
+
+	observations.clear();
+	finished = false;
+	phase = 0;
+	iteration = 0;
+	kmeansError = 0.0;
+	logLikelihood = 0.0;
+      }
+
+      thread_running = true;
+
+      try{
+	trainer_thread = new std::thread(std::bind(&BrainStateTrainer::train_loop, this));
+      }
+      catch(std::exception& e){
+	thread_running = false;
+	trainer_thread = nullptr;
+	return false;
+      }
+
+      return true;
+    }
+
+
+    bool BrainStateTrainer::isRunning() const
+    {
+      return thread_running;
+    }
+
+
+    bool BrainStateTrainer::stopTrain()
+    {
+      std::lock_guard<std::mutex> lock(thread_mutex);
+
+      const bool running = thread_running;
+
+      thread_running = false;
+
+      if(trainer_thread){
+	trainer_thread->join();
+	delete trainer_thread;
+      }
+
+      trainer_thread = nullptr;
+
+      return running;
+    }
+
+
+    bool BrainStateTrainer::getModels(whiteice::KMeans<>& kmeans, whiteice::HMM& hmm) const
+    {
+      std::lock_guard<std::mutex> lock(model_mutex);
+
+      if(finished == false)
+	return false;
+
+      if(hmm.getNumHiddenStates() != S || hmm.getNumVisibleStates() != K)
+	return false;
+
+      if(kmeans.size() != K){
+	// learning from K centroids only gives model K clusters, values are set below
+	std::vector< whiteice::math::vertex<> > seeds(K);
+
+	for(unsigned int k=0;k<K;k++){
+	  seeds[k].resize(D);
+	  for(unsigned int d=0;d<D;d++)
+	    seeds[k][d] = centroids[k*D + d];
+	}
+
+	if(kmeans.learn(K, seeds) == false || kmeans.size() != K)
+	  return false;
+      }
+
+      for(unsigned int k=0;k<K;k++){
+	kmeans[k].resize(D);
+
+	for(unsigned int d=0;d<D;d++)
+	  kmeans[k][d] = centroids[k*D + d];
+      }
+
+      auto& hpi = hmm.getPI();
+      auto& hA = hmm.getA();
+      auto& hB = hmm.getB();
+
+      for(unsigned int i=0;i<S;i++){
+	hpi[i] = whiteice::math::realnumber(pi[i]);
+
+	for(unsigned int j=0;j<S;j++){
+	  hA[i][j] = whiteice::math::realnumber(A[i*S + j]);
+
+	  for(unsigned int o=0;o<K;o++)
+	    hB[i][j][o] = whiteice::math::realnumber(B[(i*S + j)*K + o]);
+	}
+      }
+
+      return true;
+    }
+
+
+    std::string BrainStateTrainer::getStatus() const
+    {
+      char buffer[256];
+
+      if(finished)
+	snprintf(buffer, 256, "K-Means error %f, HMM log(prob) %f",
+		 (double)kmeansError, (double)logLikelihood);
+      else if(phase == 0)
+	snprintf(buffer, 256, "K-Means mini-batch %d (error %f)",
+		 (int)iteration, (double)kmeansError);
+      else if(phase == 1)
+	snprintf(buffer, 256, "K-Means assignment of %d EEG rows", (int)N);
+      else
+	snprintf(buffer, 256, "HMM Baum-Welch iteration %d (log(prob) %f)",
+		 (int)iteration, (double)logLikelihood);
+
+      return buffer;
+    }
+
+
+    void BrainStateTrainer::train_loop()
+    {
+      try{
+	if(train_kmeans() && thread_running && train_hmm() && thread_running){
+	  finished = true;
+	}
+      }
+      catch(std::exception& e){
+	std::cout << "BrainStateTrainer::train_loop(). Unexpected exception: " << e.what() << std::endl;
+      }
+
+      thread_running = false;
+    }
+
+
+    unsigned int BrainStateTrainer::nearest(const float* x, float& d2) const
+    {
+      unsigned int best = 0;
+      d2 = INFINITY;
+
+      for(unsigned int k=0;k<K;k++){
+	const float* c = &(centroids[k*D]);
+	float s = 0.0f;
+
+	for(unsigned int d=0;d<D;d++){
+	  const float e = x[d] - c[d];
+	  s += e*e;
+	}
+
+	if(s < d2){
+	  d2 = s;
+	  best = k;
+	}
+      }
+
+      return best;
+    }
+
+
+    bool BrainStateTrainer::train_kmeans()
+    {
+      std::mt19937 rng((unsigned int)std::chrono::steady_clock::now().time_since_epoch().count());
+
+      phase = 0;
+      iteration = 0;
+
+      if(warmKMeansOk == false){
+	// k-means++ initialization from sample of rows
+	const unsigned int M = std::min(N, (unsigned int)KMEANS_INIT_SAMPLES);
+	std::vector<unsigned int> sample(M);
+
+	for(unsigned int i=0;i<M;i++)
+	  sample[i] = (M == N) ? i : std::uniform_int_distribution<unsigned int>(0, N-1)(rng);
+
+	std::vector<float> dist(M, INFINITY);
+	centroids.resize(K*D);
+
+	unsigned int chosen = sample[std::uniform_int_distribution<unsigned int>(0, M-1)(rng)];
+
+	for(unsigned int k=0;k<K;k++){
+	  for(unsigned int d=0;d<D;d++)
+	    centroids[k*D + d] = X[((size_t)chosen)*D + d];
+
+	  if(k+1 >= K) break;
+
+	  const float* c = &(centroids[k*D]);
+	  double total = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:total)
+	  for(unsigned int i=0;i<M;i++){
+	    const float* x = &(X[((size_t)sample[i])*D]);
+	    float s = 0.0f;
+
+	    for(unsigned int d=0;d<D;d++){
+	      const float e = x[d] - c[d];
+	      s += e*e;
+	    }
+
+	    if(s < dist[i]) dist[i] = s;
+	    total += dist[i];
+	  }
+
+	  // next center with probability proportional to squared distance
+	  double r = std::uniform_real_distribution<double>(0.0, total)(rng);
+	  unsigned int next = M-1;
+
+	  for(unsigned int i=0;i<M;i++){
+	    r -= dist[i];
+	    if(r <= 0.0){ next = i; break; }
+	  }
+
+	  chosen = sample[next];
+
+	  if(thread_running == false) return false;
+	}
+      }
+
+      // mini-batch K-Means (per center learning rates 1/count)
+      const unsigned int BATCH = std::min(N, (unsigned int)KMEANS_BATCH_SIZE);
+      unsigned int iterations = std::max(50U, (unsigned int)std::min((unsigned long long)KMEANS_MAX_ITERATIONS,
+								     20ULL*N/BATCH));
+      if(warmKMeansOk) iterations = std::max(50U, iterations/4);
+
+      std::vector<double> counts(K, warmKMeansOk ? (double)BATCH : 0.0);
+      std::vector<unsigned int> batch(BATCH), assign(BATCH);
+      std::vector<float> d2(BATCH);
+
+      double ema = -1.0, previous = -1.0;
+
+      for(unsigned int it=0;it<iterations && thread_running;it++){
+	for(unsigned int b=0;b<BATCH;b++)
+	  batch[b] = std::uniform_int_distribution<unsigned int>(0, N-1)(rng);
+
+	double error = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:error)
+	for(unsigned int b=0;b<BATCH;b++){
+	  assign[b] = nearest(&(X[((size_t)batch[b])*D]), d2[b]);
+	  error += d2[b];
+	}
+
+	for(unsigned int b=0;b<BATCH;b++){
+	  const unsigned int k = assign[b];
+	  const float* x = &(X[((size_t)batch[b])*D]);
+	  float* c = &(centroids[k*D]);
+
+	  counts[k] += 1.0;
+	  const float eta = (float)(1.0/counts[k]);
+
+	  for(unsigned int d=0;d<D;d++)
+	    c[d] += eta*(x[d] - c[d]);
+	}
+
+	error /= BATCH;
+	ema = (ema < 0.0) ? error : (0.9*ema + 0.1*error);
+
+	kmeansError = ema;
+	iteration = it;
+
+	if((it % 20) == 19){
+	  // moves unused centers to random rows
+	  for(unsigned int k=0;k<K;k++){
+	    if(counts[k] > 0.0) continue;
+
+	    const unsigned int r = std::uniform_int_distribution<unsigned int>(0, N-1)(rng);
+	    for(unsigned int d=0;d<D;d++)
+	      centroids[k*D + d] = X[((size_t)r)*D + d];
+	  }
+
+	  if(previous > 0.0 && (previous - ema) < 1e-3*previous)
+	    break; // converged
+
+	  previous = ema;
+	}
+      }
+
+      if(thread_running == false) return false;
+
+      // assigns all rows to clusters (observations of HMM)
+      phase = 1;
+      observations.resize(N);
+
+      double error = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:error)
+      for(unsigned int i=0;i<N;i++){
+	float e = 0.0f;
+	observations[i] = nearest(&(X[((size_t)i)*D]), e);
+	error += e;
+      }
+
+      kmeansError = error/N;
+
+      return true;
+    }
+
+
+    double BrainStateTrainer::forward_backward(unsigned int start, unsigned int end,
+					       std::vector<double>& piCounts,
+					       std::vector<double>& transitionCounts,
+					       std::vector<double>& emissionCounts) const
+    {
+      const unsigned int T = end - start;
+
+      // alpha(t) is state distribution after t observations (scaled)
+      std::vector<double> alpha(((size_t)T+1)*S);
+      std::vector<double> scale(T+1, 1.0);
+      std::vector<double> beta(S), prev(S);
+
+      double ll = 0.0;
+
+      for(unsigned int i=0;i<S;i++)
+	alpha[i] = pi[i];
+
+      for(unsigned int t=1;t<=T;t++){
+	const unsigned int o = observations[start + t - 1];
+	const double* a0 = &(alpha[((size_t)t-1)*S]);
+	double* a1 = &(alpha[((size_t)t)*S]);
+
+	for(unsigned int j=0;j<S;j++)
+	  a1[j] = 0.0;
+
+	for(unsigned int i=0;i<S;i++){
+	  if(a0[i] <= 0.0) continue;
+
+	  for(unsigned int j=0;j<S;j++)
+	    a1[j] += a0[i]*A[i*S + j]*B[(i*S + j)*K + o];
+	}
+
+	double c = 0.0;
+	for(unsigned int j=0;j<S;j++) c += a1[j];
+	if(c <= 1e-300) c = 1e-300;
+
+	for(unsigned int j=0;j<S;j++) a1[j] /= c;
+
+	scale[t] = c;
+	ll += log(c);
+      }
+
+      // backward pass, adds expected transitions xi(t,i,j)
+      for(unsigned int j=0;j<S;j++)
+	beta[j] = 1.0;
+
+      for(unsigned int t=T;t>=1;t--){
+	const unsigned int o = observations[start + t - 1];
+	const double* a0 = &(alpha[((size_t)t-1)*S]);
+
+	for(unsigned int i=0;i<S;i++){
+	  double b = 0.0;
+
+	  for(unsigned int j=0;j<S;j++){
+	    const double p = A[i*S + j]*B[(i*S + j)*K + o]*beta[j]/scale[t];
+	    const double xi = a0[i]*p;
+
+	    transitionCounts[i*S + j] += xi;
+	    emissionCounts[(i*S + j)*K + o] += xi;
+
+	    b += p;
+	  }
+
+	  prev[i] = b;
+	}
+
+	std::swap(beta, prev);
+      }
+
+      for(unsigned int i=0;i<S;i++)
+	piCounts[i] += alpha[i]*beta[i];
+
+      return ll;
+    }
+
+
+    bool BrainStateTrainer::train_hmm()
+    {
+      phase = 2;
+      iteration = 0;
+
+      const double EPSILON = 1e-6; // smoothing of probabilities
+
+      if(warmHMMOk == false){
+	std::mt19937 rng((unsigned int)std::chrono::steady_clock::now().time_since_epoch().count());
+	std::uniform_real_distribution<double> u(0.5, 1.5);
+
+	pi.resize(S);
+	A.resize(S*S);
+	B.resize(S*S*K);
+
+	for(auto& p : pi) p = u(rng);
+	for(auto& p : A) p = u(rng);
+	for(auto& p : B) p = u(rng);
+      }
+
+      // normalizes model (warm start model may have zero probabilities)
+      auto normalize = [&](double* p, unsigned int n) {
+	double sum = 0.0;
+	for(unsigned int i=0;i<n;i++){ p[i] += EPSILON; sum += p[i]; }
+	for(unsigned int i=0;i<n;i++) p[i] /= sum;
+      };
+
+      normalize(pi.data(), S);
+      for(unsigned int i=0;i<S;i++){
+	normalize(&(A[i*S]), S);
+	for(unsigned int j=0;j<S;j++)
+	  normalize(&(B[(i*S + j)*K]), K);
+      }
+
+      const unsigned int CHUNKS = (N + HMM_CHUNK_SIZE - 1)/HMM_CHUNK_SIZE;
+
+      std::vector<double> piCounts(S), transitionCounts(S*S), emissionCounts(S*S*K);
+      double previous = 0.0;
+
+      for(unsigned int it=0;it<HMM_MAX_ITERATIONS && thread_running;it++){
+	std::fill(piCounts.begin(), piCounts.end(), 0.0);
+	std::fill(transitionCounts.begin(), transitionCounts.end(), 0.0);
+	std::fill(emissionCounts.begin(), emissionCounts.end(), 0.0);
+
+	double ll = 0.0;
+
+#pragma omp parallel
+	{
+	  // per thread expected counts
+	  std::vector<double> p(S, 0.0), t(S*S, 0.0), e(S*S*K, 0.0);
+	  double l = 0.0;
+
+#pragma omp for schedule(dynamic)
+	  for(unsigned int c=0;c<CHUNKS;c++){
+	    if(thread_running == false) continue;
+
+	    const unsigned int start = c*HMM_CHUNK_SIZE;
+	    const unsigned int end = std::min(N, (unsigned int)(start + HMM_CHUNK_SIZE));
+
+	    l += forward_backward(start, end, p, t, e);
+	  }
+
+#pragma omp critical
+	  {
+	    for(unsigned int i=0;i<p.size();i++) piCounts[i] += p[i];
+	    for(unsigned int i=0;i<t.size();i++) transitionCounts[i] += t[i];
+	    for(unsigned int i=0;i<e.size();i++) emissionCounts[i] += e[i];
+	    ll += l;
+	  }
+	}
+
+	if(thread_running == false) return false;
+
+	// M-step: B(i,j,o) counts sum to transition counts of (i,j)
+	pi = piCounts;
+	A = transitionCounts;
+	B = emissionCounts;
+
+	normalize(pi.data(), S);
+	for(unsigned int i=0;i<S;i++){
+	  normalize(&(A[i*S]), S);
+	  for(unsigned int j=0;j<S;j++)
+	    normalize(&(B[(i*S + j)*K]), K);
+	}
+
+	logLikelihood = ll;
+	iteration = it;
+
+	if(it > 0 && (ll - previous) < 1e-6*fabs(ll))
+	  break; // converged
+
+	previous = ll;
+      }
+
+      return (thread_running == true);
+    }
+
+  };
+};
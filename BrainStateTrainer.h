@@ -0,0 +1,121 @@
+/*
+ * BrainStateTrainer
+ *
+ * trains K-Means and HMM brain state models of EEG data in a background
+ * thread (used by optimize command).
+ *
+ * K-Means: k-means++ initialization from a sample of EEG rows, mini-batch
+ * updates with parallel assignment steps and final parallel assignment of
+ * all rows to observation sequence.
+ *
+ * HMM: Baum-Welch with scaled forward-backward. long observation sequence
+ * is partitioned into chunks that are processed in parallel and whose
+ * expected counts are summed (each chunk starts from initial state
+ * probabilities). models use transition emissions like whiteice::HMM:
+ * B(i,j,o) is probability of observing o when moving from state i to j.
+ *
+ * training can be warm started from earlier K-Means and HMM models so
+ * re-optimization after new measurement sessions converges in a few
+ * iterations.
+ */
+
+#ifndef BrainStateTrainer_h
+#define BrainStateTrainer_h
+
+#include <dinrhiw.h>
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class BrainStateTrainer
+    {
+    public:
+
+      BrainStateTrainer();
+      ~BrainStateTrainer();
+
+      // starts training K clusters and S hidden states of EEG data (cluster 0).
+      // warm start models are used if not nullptr and dimensions match
+      bool startTrain(const whiteice::dataset<>& eegData,
+		      unsigned int K, unsigned int S,
+		      const whiteice::KMeans<>* warmKMeans = nullptr,
+		      const whiteice::HMM* warmHMM = nullptr);
+
+      bool isRunning() const;
+
+      bool stopTrain();
+
+      // true if training has finished successfully
+      bool hasResults() const { return finished; }
+
+      // copies trained models (kmeans is resized to K clusters)
+      bool getModels(whiteice::KMeans<>& kmeans, whiteice::HMM& hmm) const;
+
+      // human readable training phase and progress
+      std::string getStatus() const;
+
+      double getKMeansError() const { return kmeansError; }
+      double getLogLikelihood() const { return logLikelihood; }
+
+      static const unsigned int KMEANS_BATCH_SIZE = 1024;    // rows per mini-batch
+      static const unsigned int KMEANS_INIT_SAMPLES = 20000; // rows used by k-means++
+      static const unsigned int KMEANS_MAX_ITERATIONS = 2000;
+      static const unsigned int HMM_CHUNK_SIZE = 4096;       // observations per forward-backward job
+      static const unsigned int HMM_MAX_ITERATIONS = 200;
+
+    private:
+
+      void train_loop();
+
+      bool train_kmeans();
+      bool train_hmm();
+
+      // nearest centroid and its squared distance
+      unsigned int nearest(const float* x, float& d2) const;
+
+      // scaled forward-backward of observations [start,end), adds expected counts,
+      // returns log-likelihood of chunk
+      double forward_backward(unsigned int start, unsigned int end,
+			      std::vector<double>& piCounts,
+			      std::vector<double>& transitionCounts,
+			      std::vector<double>& emissionCounts) const;
+
+      std::mutex thread_mutex;
+      std::atomic<bool> thread_running;
+      std::thread* trainer_thread = nullptr;
+
+      // training data (row major N x D)
+      std::vector<float> X;
+      unsigned int N = 0, D = 0;
+
+      // models
+      unsigned int K = 0, S = 0;
+      std::vector<float> centroids;       // K x D
+      std::vector<unsigned int> observations;
+      std::vector<double> pi;             // S
+      std::vector<double> A;              // S x S
+      std::vector<double> B;              // S x S x K
+      bool warmKMeansOk = false, warmHMMOk = false;
+
+      // progress
+      std::atomic<unsigned int> phase;    // 0 = K-Means, 1 = assignment, 2 = HMM
+      std::atomic<unsigned int> iteration;
+      std::atomic<double> kmeansError;
+      std::atomic<double> logLikelihood;
+      std::atomic<bool> finished;
+
+      mutable std::mutex model_mutex;
+    };
+
+  };
+};
+
+
+#endif
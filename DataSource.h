@@ -10,6 +10,9 @@
 
 #include <vector>
 #include <string>
+#include <limits>
+
+#include "SampleRingBuffer.h"
 
 class DataSource {
 public:
@@ -33,6 +36,36 @@ public:
   virtual bool getSignalNames(std::vector<std::string>& names) const = 0;
 
   virtual unsigned int getNumberOfSignals() const = 0;
+
+  /**
+   * returns all buffered samples measured after time t [msecs since epoch]
+   * in measurement order. returns false if device doesn't buffer samples.
+   */
+  virtual bool dataSince(long long t,
+			 std::vector< std::vector<float> >& x,
+			 std::vector<long long>& times) const
+  {
+    if(t == std::numeric_limits<long long>::max()) return false;
+    return dataWindow(t + 1, std::numeric_limits<long long>::max(), x, times);
+  }
+
+  /**
+   * returns buffered samples measured at time interval [t0, t1] [msecs since epoch]
+   * in measurement order. returns false if device doesn't buffer samples.
+   */
+  virtual bool dataWindow(long long t0, long long t1,
+			  std::vector< std::vector<float> >& x,
+			  std::vector<long long>& times) const
+  {
+    if(sampleBuffer.initialized() == false) return false;
+    sampleBuffer.window(t0, t1, x, times);
+    return true;
+  }
+  
+protected:
+  
+  // device worker thread pushes all measured samples here
+  SampleRingBuffer sampleBuffer;
 };
 
 #endif /* DATASOURCE_H_ */
@@ -17,6 +17,7 @@
 #include <vector>
 #include <sys/time.h>
 #include <stdexcept>
+#include <chrono>
 #include "timing.h"
 
 #include "IEmoStateDLL.h"
@@ -55,6 +56,8 @@ EmotivInsight::EmotivInsight() {
 
 	latest_data_received_t = 0;
 
+	sampleBuffer.init(NUMBER_OF_SIGNALS);
+
 	if(pthread_mutex_init(&emotiv_lock, NULL) != 0){
 		if(connection == EDK_OK) IEE_EngineDisconnect();
 		IEE_EmoStateFree(eState);
@@ -436,6 +439,12 @@ void EmotivInsight::update_tick(double t0, double t1)
 		}
 	}
 
+	{
+		auto duration1 = std::chrono::system_clock::now().time_since_epoch();
+		sampleBuffer.push(latest_value,
+			     std::chrono::duration_cast<std::chrono::milliseconds>(duration1).count());
+	}
+
 	pthread_mutex_unlock(&data_lock);
 
 	//////////////////////////////////////////////////////////////
@@ -0,0 +1,239 @@
+
+#include "EngineScheduler.h"
+#include <thread>
+#include <stdio.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    EngineScheduler::EngineScheduler()
+    {
+    }
+
+
+    EngineScheduler::~EngineScheduler()
+    {
+    }
+
+
+    unsigned int EngineScheduler::addTask(const std::string& name, unsigned int periodMS)
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+      if(periodMS == 0) periodMS = 1;
+
+      task t;
+      t.name = name;
+      t.period = std::chrono::milliseconds(periodMS);
+      t.start = now();
+      t.deadline = t.start;
+      t.tick = 0;
+      t.runs = 0;
+      t.missed = 0;
+      t.sumJitterMS = 0.0;
+      t.maxJitterMS = 0.0;
+
+      tasks.push_back(t);
+
+      return (tasks.size() - 1);
+    }
+
+
+    bool EngineScheduler::setPeriod(unsigned int task, unsigned int periodMS)
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+      if(task >= tasks.size() || periodMS == 0) return false;
+
+      const clock::duration period = std::chrono::milliseconds(periodMS);
+
+      if(tasks[task].period == period) return true;
+
+      // keeps tick numbering continuous: tick(t) = tick + (t - start)/period
+      auto& t = tasks[task];
+      const auto current = now();
+
+      t.period = period;
+      t.start = current - t.tick*period;
+      t.deadline = current;
+
+      return true;
+    }
+
+
+    void EngineScheduler::reset()
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+      const auto current = now();
+
+      for(auto& t : tasks){
+	t.start = current;
+	t.deadline = current;
+	t.tick = 0;
+	t.runs = 0;
+	t.missed = 0;
+	t.sumJitterMS = 0.0;
+	t.maxJitterMS = 0.0;
+      }
+    }
+
+
+    void EngineScheduler::clear()
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+      tasks.clear();
+    }
+
+
+    unsigned int EngineScheduler::waitNext()
+    {
+      unsigned int next = 0;
+      clock::time_point deadline;
+      bool virtualTime = false;
+
+      {
+	std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+	if(tasks.size() == 0) return 0;
+
+	for(unsigned int i=1;i<tasks.size();i++)
+	  if(tasks[i].deadline < tasks[next].deadline)
+	    next = i;
+
+	deadline = tasks[next].deadline;
+
+	// virtual time jumps to the deadline
+	virtualTime = virtualClock;
+	if(virtualClock && deadline > virtualNow)
+	  virtualNow = deadline;
+      }
+
+      if(virtualTime == false)
+	std::this_thread::sleep_until(deadline);
+
+      {
+	std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+	if(next >= tasks.size()) return next; // tasks were cleared
+
+	auto& t = tasks[next];
+	const auto current = now();
+
+	const double jitter =
+	  std::chrono::duration<double, std::milli>(current - t.deadline).count();
+
+	if(jitter > 0.0){
+	  t.sumJitterMS += jitter;
+	  if(jitter > t.maxJitterMS) t.maxJitterMS = jitter;
+	}
+
+	t.runs++;
+
+	// next deadline is the first period boundary after now,
+	// missed deadlines are not executed again
+	const long long currentTick = (current - t.start)/t.period;
+
+	if(currentTick > t.tick + 1)
+	  t.missed += (currentTick - t.tick - 1);
+
+	t.tick = (currentTick > t.tick) ? currentTick : t.tick;
+	t.deadline = t.start + (t.tick + 1)*t.period;
+      }
+
+      return next;
+    }
+
+
+    long long EngineScheduler::getTaskTick(unsigned int task) const
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+      if(task >= tasks.size()) return 0;
+
+      return tasks[task].tick;
+    }
+
+
+    void EngineScheduler::setVirtualClock(bool enabled)
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+      if(enabled == virtualClock) return;
+
+      const auto current = clock::now();
+
+      if(enabled){
+	virtualStart = current;
+	virtualNow = current;
+      }
+      else{
+	// virtual deadlines may be far in the future: continues from now
+	for(auto& t : tasks){
+	  t.start = current - t.tick*t.period;
+	  t.deadline = current;
+	}
+      }
+
+      virtualClock = enabled;
+    }
+
+
+    bool EngineScheduler::isVirtualClock() const
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+      return virtualClock;
+    }
+
+
+    long long EngineScheduler::getVirtualMS() const
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+      if(virtualClock == false) return 0;
+
+      return std::chrono::duration_cast<std::chrono::milliseconds>(virtualNow - virtualStart).count();
+    }
+
+
+    EngineScheduler::clock::time_point EngineScheduler::now() const
+    {
+      return virtualClock ? virtualNow : clock::now();
+    }
+
+
+    std::string EngineScheduler::getStatistics() const
+    {
+      std::lock_guard<std::mutex> lock(scheduler_mutex);
+
+      std::string report;
+
+      for(const auto& t : tasks){
+	char buffer[256];
+
+	const double mean = (t.runs > 0) ? (t.sumJitterMS/t.runs) : 0.0;
+	const long long periodMS =
+	  std::chrono::duration_cast<std::chrono::milliseconds>(t.period).count();
+
+	snprintf(buffer, 256, "%s%s %lldms jitter %.1f/%.1fms missed %llu",
+		 (report.length() > 0) ? ", " : "",
+		 t.name.c_str(), periodMS, mean, t.maxJitterMS, t.missed);
+
+	report += buffer;
+      }
+
+      return report;
+    }
+
+
+    long long EngineScheduler::steadyMS()
+    {
+      auto t = clock::now().time_since_epoch();
+      return std::chrono::duration_cast<std::chrono::milliseconds>(t).count();
+    }
+
+  };
+};
@@ -0,0 +1,97 @@
+/*
+ * EngineScheduler
+ *
+ * deadline driven scheduler of engine's periodic tasks using monotonic clock.
+ * waitNext() sleeps until the earliest task deadline (no busy waiting) and
+ * collects start time jitter statistics of each task.
+ *
+ * with virtual clock waitNext() doesn't sleep but advances virtual time to
+ * the earliest deadline: tasks run as fast as possible and no deadline is
+ * missed (headless rendering).
+ */
+
+#ifndef EngineScheduler_h
+#define EngineScheduler_h
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class EngineScheduler
+    {
+    public:
+
+      EngineScheduler();
+      ~EngineScheduler();
+
+      // adds periodic task, returns task number
+      unsigned int addTask(const std::string& name, unsigned int periodMS);
+
+      // changes task period (deadlines are recalculated from the current time)
+      bool setPeriod(unsigned int task, unsigned int periodMS);
+
+      // restarts all tasks: first deadlines are now
+      void reset();
+
+      // removes all tasks
+      void clear();
+
+      // sleeps until the next task deadline and returns task number of the due task
+      // (returns a task immediately if its deadline has already passed)
+      unsigned int waitNext();
+
+      // number of the latest deadline of the task (task period count since reset)
+      long long getTaskTick(unsigned int task) const;
+
+      // switches between monotonic and virtual clock (virtual time starts from now)
+      void setVirtualClock(bool enabled);
+      bool isVirtualClock() const;
+
+      // milliseconds virtual clock has advanced since it was enabled
+      long long getVirtualMS() const;
+
+      // jitter statistics of all tasks in human readable form
+      std::string getStatistics() const;
+
+      // milliseconds from monotonic clock
+      static long long steadyMS();
+
+    private:
+
+      typedef std::chrono::steady_clock clock;
+
+      struct task {
+	std::string name;
+	clock::duration period;
+	clock::time_point start;     // time of tick 0
+	clock::time_point deadline;
+	long long tick;
+
+	// jitter statistics: how late task was started after its deadline
+	unsigned long long runs;
+	unsigned long long missed;   // skipped deadlines (overruns)
+	double sumJitterMS;
+	double maxJitterMS;
+      };
+
+      std::vector<task> tasks;
+      mutable std::mutex scheduler_mutex;
+
+      // current time of the scheduler clock (scheduler_mutex must be held)
+      clock::time_point now() const;
+
+      bool virtualClock = false;
+      clock::time_point virtualStart, virtualNow;
+
+    };
+
+  };
+};
+
+
+#endif
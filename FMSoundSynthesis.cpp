@@ -13,6 +13,33 @@
 #define M_PI 3.141592653
 #endif
 
+
+// sine wavetable used by phase accumulator oscillators
+static const unsigned int SINE_TABLE_BITS = 12;
+static const unsigned int SINE_TABLE_SIZE = (1 << SINE_TABLE_BITS);
+
+static struct sine_table {
+  float v[SINE_TABLE_SIZE+1];
+  
+  sine_table(){
+    for(unsigned int i=0;i<=SINE_TABLE_SIZE;i++)
+      v[i] = (float)sin(2.0*M_PI*((double)i)/SINE_TABLE_SIZE);
+  }
+} __fm_sine_table;
+
+
+// linearly interpolated sine of phase (2^32 = 2*pi)
+static inline float __fm_sine(uint32_t phase)
+{
+  const unsigned int FRAC_BITS = 32 - SINE_TABLE_BITS;
+  const uint32_t index = phase >> FRAC_BITS;
+  const float frac = (phase & ((1U << FRAC_BITS) - 1))*(1.0f/(1U << FRAC_BITS));
+  
+  const float* v = __fm_sine_table.v;
+  
+  return v[index] + frac*(v[index+1] - v[index]);
+}
+
 FMSoundSynthesis::FMSoundSynthesis() {
   
   // default parameters: silence
@@ -21,17 +48,21 @@ FMSoundSynthesis::FMSoundSynthesis() {
   for(auto& pi : currentp)
     pi = 0.0f;
   
-  Ac = 0.0;
-  Fc = 0.0;
-  Fm = 0.0;
-  Am = 0.0;
+  current.Ac = 0.0;
+  current.Fc = 0.0;
+  current.Fm = 0.0;
+  current.Am = 0.0;
+  current.carrierPhase = 0;
+  current.modulatorPhase = 0;
+  
+  old = current;
   
-  oldAc = 0.0;
-  oldFc = 0.0;
-  oldFm = 0.0;
-  oldAm = 0.0;
+  resetPhases = false;
   
-  tbase = 0.0;
+  // allocated here so that audio callback never allocates memory
+  delayLine.resize(DELAYLINE_SIZE);
+  for(auto& d : delayLine)
+    d = 0.0f;
   
   fadeoutTime = 1000.0; // 1000ms fade out between parameter changes
 }
@@ -49,8 +80,8 @@ std::string FMSoundSynthesis::getSynthesizerName()
 
 bool FMSoundSynthesis::reset()
 {
-  // resets sound generation (timer)
-  tbase = 0.0;
+  // resets sound generation (oscillator phases)
+  resetPhases = true;
   return true;
 }
 
@@ -77,12 +108,7 @@ bool FMSoundSynthesis::setParameters(const std::vector<float>& p_)
   
   currentp = p; // copies values for getParameters()
   
-  oldAc = Ac;
-  oldFc = Fc;
-  oldFm = Fm;
-  oldAm = Am;
-  
-  Ac = p[0];
+  const double Ac = p[0];
   
   // sound base frquency: [55 Hz, 880 Hz] => note interval: A-1 - A-5
   float f = 220.0;
@@ -97,7 +123,8 @@ bool FMSoundSynthesis::setParameters(const std::vector<float>& p_)
   }
   
   
-  Fc = f;
+  const double Fc = f;
+  double Fm, Am;
   
   {
     // harmonicity ratio: Fm/Fc [0,1] => [0,3] values possible
@@ -118,8 +145,9 @@ bool FMSoundSynthesis::setParameters(const std::vector<float>& p_)
     Am = m*Fm;
   }
   
-  resetTime = getMilliseconds();
-  // tbase = 0.0;
+  // audio thread picks up new parameters at the next buffer and fades to them
+  std::vector<double> params = { Ac, Fc, Fm, Am };
+  publishParameters(params);
   
   // std::cout << "Ac  = " << Ac << std::endl;
   // std::cout << "Fc = " << Fc << std::endl;
@@ -161,139 +189,155 @@ double FMSoundSynthesis::getSynthPower()
 
 bool FMSoundSynthesis::synthesize(int16_t* buffer, int samples)
 {
-  double hz = (double)snd.freq;
+  // real-time audio thread: no memory allocations, locks or system calls here
+  
+  const double hz = (double)snd.freq;
+  
+  if(hz <= 0.0 || samples <= 0)
+    return false;
+  
+  if(resetPhases){
+    current.carrierPhase = 0;
+    current.modulatorPhase = 0;
+    old.carrierPhase = 0;
+    old.modulatorPhase = 0;
+    tailSamples = 0;
+    resetPhases = false;
+  }
+  
+  const double NOTE_FADEOUT_TIME = 1000.0;
   
-  double timeSinceReset = (double)(getMilliseconds() - resetTime);
+  // crossfade weight of old voice [output is continuous at parameter
+  // change because old voice continues the current sound]
+  auto oldWeight = [&](unsigned long long n) -> float {
+    const double now = n*1000.0/hz; // ms since parameter change
+    if(now >= NOTE_FADEOUT_TIME) return 0.0f;
+    const double r = 1.0 - now/NOTE_FADEOUT_TIME;
+    return (float)(r*r*r*r);
+  };
   
-  for(int i=0;i<samples;i++){
-    const double dt = ((double)i)/hz;
-    const double t = tbase + dt;
+  const unsigned int TAIL_LENGTH = (unsigned int)(0.010*hz) + 1; // 10ms
+  
+  const std::vector<double>* params = nullptr;
+  
+  if(acquireParameters(params) && params->size() == 4){
+    const float w = oldWeight(fadeSamples);
     
-    const double now = timeSinceReset + dt*1000.0;
+    // previous old voice is still audible: fades it out quickly
+    tail = old;
+    tail.Ac *= w;
+    tailSamples = (w > 0.0f) ? TAIL_LENGTH : 0;
     
-    double Fc_ = Fc;
-    double oldFc_ = oldFc;
+    // old voice continues from the current phase and fades out
+    old = current;
+    old.Ac *= (1.0f - w);
     
-    double Fm_ = Fm;
-    double oldFm_ = oldFm;
+    current.Ac = (*params)[0];
+    current.Fc = (*params)[1];
+    current.Fm = (*params)[2];
+    current.Am = (*params)[3];
     
-    double Am_ = Am;
-    double oldAm_ = oldAm;
+    fadeSamples = 0;
+  }
+  
+  // delay effect: (feedback) taps of earlier output
+  const unsigned int NTAPS = 3;
+  const double delay[NTAPS]  = { 100/1000.0, 200/1000.0, 300/1000.0 };
+  const float  delayA[NTAPS] = { -0.50f, +0.05f, -0.01f };
+  
+  unsigned int delaySamples[NTAPS];
+  
+  for(unsigned int efx=0;efx<NTAPS;efx++){
+    delaySamples[efx] = (unsigned int)(hz*delay[efx]);
+    if(delaySamples[efx] >= DELAYLINE_SIZE)
+      delaySamples[efx] = DELAYLINE_SIZE - 1;
+  }
+  
+  const unsigned int DELAYLINE_MASK = DELAYLINE_SIZE - 1;
+  
+  const double PHASE_SCALE = 4294967296.0/hz; // frequency => phase increment
+  
+  // parameters are smoothed block-wise (constant within small blocks)
+  const int BLOCKSIZE = 32;
+  
+  double power = 0.0;
+  
+  for(int start=0;start<samples;start+=BLOCKSIZE){
+    const int end = (start + BLOCKSIZE < samples) ? (start + BLOCKSIZE) : samples;
     
-    double delayF = Fc_;
+    const double now = fadeSamples*1000.0/hz; // ms since parameter change
+    
+    double Fm_ = current.Fm;
+    double Am_ = current.Am;
     
     if(now < fadeoutTime){
-      double c = now/fadeoutTime;
-      double f = c*Fc_ + (1.0 - c)*oldFc_;
-      delayF;
-      // Fc_ = f;
-      // oldFc_ = f;
-
-      double fm = c*Fm_ + (1.0 - c)*oldFm_;
-      Fm_ = fm;
-      oldFm_ = fm;
-
-      double am = c*Am_ + (1.0 - c)*oldAm_;
-      Am_ = am;
-      oldAm_ = am;
+      const double c = now/fadeoutTime;
+      Fm_ = c*current.Fm + (1.0 - c)*old.Fm;
+      Am_ = c*current.Am + (1.0 - c)*old.Am;
     }
     
-    double F = (Am_*cos(2.0*M_PI*Fm_*t) + Fc_);
-    double value = Ac*cos(2.0*M_PI*F*t);
-
-    double oldF = (oldAm_*cos(2.0*M_PI*oldFm_*t) + oldFc_);
-    double oldvalue = oldAc*cos(2.0*M_PI*oldF*t);
+    // crossfade weight of old voice (interpolated within block)
+    const float w0 = oldWeight(fadeSamples);
+    const float w1 = oldWeight(fadeSamples + (end - start));
     
-    double NOTE_FADEOUT_TIME = 1000.0;
-
-    if(now < NOTE_FADEOUT_TIME){
-      double c = now/NOTE_FADEOUT_TIME;
-      double r = (1.0 - c);
-      value  = value  + r*r*r*r*oldvalue;
-    }
+    const uint32_t modulatorInc = (uint32_t)(long long)(Fm_*PHASE_SCALE);
+    const float dw = (w1 - w0)/(end - start);
+    
+    float w = w0;
     
-    // delay effect
-    {
-      std::vector<double> delay;
-      std::vector<double> delayA;
+    for(int i=start;i<end;i++){
+      // frequency modulated carrier: F = Fc + Am*cos(2*pi*Fm*t)
+      float value;
       
-      // delay.push_back(25.3/delayF);
-      // delay.push_back(50.7/delayF);
-      // delay.push_back(75.0/delayF);
+      {
+	const float m = __fm_sine(current.modulatorPhase + 0x40000000U); // cos()
+	current.modulatorPhase += modulatorInc;
+	
+	value = (1.0f - w)*((float)current.Ac)*__fm_sine(current.carrierPhase + 0x40000000U);
+	current.carrierPhase += (uint32_t)(long long)((current.Fc + Am_*m)*PHASE_SCALE);
+      }
       
-      delay.push_back(100/1000.0);
-      delay.push_back(200/1000.0);
-      delay.push_back(300/1000.0);
-      delayA.push_back(-0.50);
-      delayA.push_back(+0.05);
-      delayA.push_back(-0.01);
+      if(w > 0.0f){
+	const float m = __fm_sine(old.modulatorPhase + 0x40000000U);
+	old.modulatorPhase += modulatorInc;
+	
+	value += w*((float)old.Ac)*__fm_sine(old.carrierPhase + 0x40000000U);
+	old.carrierPhase += (uint32_t)(long long)((old.Fc + Am_*m)*PHASE_SCALE);
+      }
       
+      w += dw;
       
-      for(unsigned int efx=0;efx<delay.size();efx++){
-	int delaysamples = int(hz*delay[efx]);
-	int index = i - delaysamples;
+      if(tailSamples > 0){
+	const float m = __fm_sine(tail.modulatorPhase + 0x40000000U);
+	tail.modulatorPhase += modulatorInc;
 	
-	if(index >= 0)
-	  value += delayA[efx]*buffer[i - delaysamples]/32767.0;
-	else{
-	  for(unsigned int b=0;b<NBUFFERS;b++){
-	    index += prevbuffer[b].size();
-	    if(index >= 0 && index < (int)prevbuffer[b].size()){
-	      value += delayA[efx]*prevbuffer[b][index]/32767.0;
-	      break;
-	    }
-	  }
-	}
-      }
-    }
-    
-    if(value <= -1.0) value = -1.0;
-    else if(value >= 1.0) value = 1.0;
-    
-    value = value; // non-sinusoid..
-    
-    buffer[i] = (int16_t)( value*32767 );
-  }
-  
-  for(int i=(NBUFFERS-2);i>=0;i--){ // should swap pointers instead..    
-    prevbuffer[i+1] = prevbuffer[i];
-  }
-  
-  prevbuffer[0].resize(samples);
-
-  double power = 0.0;
-
-  for(int i=0;i<samples;i++){
-    prevbuffer[0][i] = buffer[i];
-
-    power += ((double)buffer[i])*((double)buffer[i])/((double)samples);
-    
-#if 0
-    // does simple low pass filtering take sum of recent samples
-    int sum = 0;
-    for(int j=0;j<10;j++){
-      if(i-j >= 0){
-	sum += ((int)buffer[i-j]);
-      }
-      else{
-	int index = i-j+prevbuffer[1].size();
+	const float g = ((float)tailSamples)/TAIL_LENGTH;
 	
-	if(index >= 0){
-	  sum += (int)prevbuffer[1][index];
-	}
+	value += g*((float)tail.Ac)*__fm_sine(tail.carrierPhase + 0x40000000U);
+	tail.carrierPhase += (uint32_t)(long long)((tail.Fc + Am_*m)*PHASE_SCALE);
+	
+	tailSamples--;
       }
+      
+      // delay effect
+      for(unsigned int efx=0;efx<NTAPS;efx++)
+	value += delayA[efx]*delayLine[(delayPos - delaySamples[efx]) & DELAYLINE_MASK];
+      
+      if(value <= -1.0f) value = -1.0f;
+      else if(value >= 1.0f) value = 1.0f;
+      
+      buffer[i] = (int16_t)( value*32767 );
+      
+      delayLine[delayPos] = buffer[i]/32767.0f;
+      delayPos = (delayPos + 1) & DELAYLINE_MASK;
+      
+      power += ((double)buffer[i])*((double)buffer[i])/((double)samples);
     }
-    sum /= 10;
     
-    prevbuffer[0][i] = sum;
-#endif
+    fadeSamples += (end - start);
   }
-
-  currentPower = power;
   
-  tbase += ((double)samples)/hz;
+  currentPower = power;
   
   return true;
 }
-
-
@@ -8,6 +8,7 @@
 
 #include "SDLSoundSynthesis.h"
 #include <vector>
+#include <atomic>
 
 
 class FMSoundSynthesis: public SDLSoundSynthesis {
@@ -33,28 +34,37 @@ public:
   // milliseconds since epoch
   unsigned long long getMilliseconds();
   
-  double tbase;
-  
-  double Ac; // amplitude/volume of carrier
-  double Fc; // carrier frequency
-  double Fm; // modulating frequency
-  double Am; // amplitude of modulator: delta of frequency
-  
   std::vector<float> currentp;
   
-  unsigned long long resetTime = 0ULL;
   double fadeoutTime;
   
-  double oldAc;
-  double oldFc;
-  double oldFm;
-  double oldAm;
-  
-  static const unsigned int NBUFFERS = 10;
-  std::vector<int16_t> prevbuffer[NBUFFERS];
+  std::atomic<bool> resetPhases; // set by reset()
   
   virtual bool synthesize(int16_t* buffer, int samples);
 
+  
+  // state of the audio thread (not touched by other threads)
+  
+  struct voice {
+    double Ac; // amplitude/volume of carrier
+    double Fc; // carrier frequency
+    double Fm; // modulating frequency
+    double Am; // amplitude of modulator: delta of frequency
+
+    uint32_t carrierPhase;   // phase accumulators (2^32 = full cycle)
+    uint32_t modulatorPhase;
+  };
+  
+  voice current, old; // old voice fades out after parameter change
+  voice tail; // old voice of the previous change when parameters change during fade out
+  unsigned int tailSamples = 0; // samples left of tail voice fade out
+  
+  unsigned long long fadeSamples = 0; // samples since latest parameter change
+  
+  // circular delay line of output samples for delay effect (preallocated)
+  static const unsigned int DELAYLINE_SIZE = 65536; // 2^16 (> 300ms at 192kHz)
+  std::vector<float> delayLine;
+  unsigned int delayPos = 0;
 
   double currentPower = 0.0; // current output signal power
   
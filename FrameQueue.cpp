@@ -0,0 +1,121 @@
+
+#include "FrameQueue.h"
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    FrameQueue::FrameQueue()
+    {
+      CAPACITY = 0;
+      seq = nullptr;
+      data = nullptr;
+      head = 0;
+      tail = 0;
+    }
+
+
+    FrameQueue::~FrameQueue()
+    {
+      if(seq) delete[] seq;
+      if(data) delete[] data;
+    }
+
+
+    bool FrameQueue::init(unsigned int capacity)
+    {
+      if(capacity == 0) return false;
+
+      if(seq) delete[] seq;
+      if(data) delete[] data;
+
+      seq = new std::atomic<unsigned long long>[capacity];
+      data = new void*[capacity];
+
+      for(unsigned int i=0;i<capacity;i++){
+	seq[i].store(i, std::memory_order_relaxed);
+	data[i] = nullptr;
+      }
+
+      head.store(0ULL, std::memory_order_relaxed);
+      tail.store(0ULL, std::memory_order_relaxed);
+
+      CAPACITY = capacity;
+
+      std::atomic_thread_fence(std::memory_order_release);
+
+      return true;
+    }
+
+
+    unsigned int FrameQueue::size() const
+    {
+      const unsigned long long h = head.load(std::memory_order_acquire);
+      const unsigned long long t = tail.load(std::memory_order_acquire);
+
+      if(t <= h) return 0;
+      if(t - h > CAPACITY) return CAPACITY;
+
+      return (unsigned int)(t - h);
+    }
+
+
+    bool FrameQueue::push(void* p)
+    {
+      if(CAPACITY == 0) return false;
+
+      unsigned long long n = tail.load(std::memory_order_relaxed);
+
+      while(true){
+	const unsigned int slot = (unsigned int)(n % CAPACITY);
+	const unsigned long long s = seq[slot].load(std::memory_order_acquire);
+
+	if(s == n){
+	  // slot is free: reserves position n
+	  if(tail.compare_exchange_weak(n, n+1, std::memory_order_relaxed)){
+	    data[slot] = p;
+	    seq[slot].store(n+1, std::memory_order_release);
+	    return true;
+	  }
+	}
+	else if(s < n){
+	  return false; // full: slot still holds element of the previous round
+	}
+	else{
+	  n = tail.load(std::memory_order_relaxed);
+	}
+      }
+    }
+
+
+    bool FrameQueue::pop(void*& p)
+    {
+      if(CAPACITY == 0) return false;
+
+      unsigned long long n = head.load(std::memory_order_relaxed);
+
+      while(true){
+	const unsigned int slot = (unsigned int)(n % CAPACITY);
+	const unsigned long long s = seq[slot].load(std::memory_order_acquire);
+
+	if(s == n+1){
+	  // slot holds element of position n
+	  if(head.compare_exchange_weak(n, n+1, std::memory_order_relaxed)){
+	    p = data[slot];
+	    seq[slot].store(n + CAPACITY, std::memory_order_release);
+	    return true;
+	  }
+	}
+	else if(s < n+1){
+	  return false; // empty
+	}
+	else{
+	  n = head.load(std::memory_order_relaxed);
+	}
+      }
+    }
+
+  };
+};
@@ -0,0 +1,57 @@
+/*
+ * FrameQueue
+ *
+ * fixed-capacity lock-free (multi-producer/multi-consumer) queue of
+ * pointers. each slot has a sequence number which tells whether it is
+ * free for the producer of position n (seq == n) or holds element of
+ * position n for a consumer (seq == n+1). used to pass video frames from
+ * engine thread to encoder thread: producer may also pop (drop) the
+ * oldest frames when the queue is full.
+ */
+
+#ifndef FrameQueue_h
+#define FrameQueue_h
+
+#include <atomic>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    class FrameQueue
+    {
+    public:
+
+      FrameQueue();
+      ~FrameQueue();
+
+      // (re)allocates queue, must not be called while queue is used by other threads
+      bool init(unsigned int capacity);
+
+      unsigned int capacity() const { return CAPACITY; }
+
+      // number of queued elements (approximate while other threads use queue)
+      unsigned int size() const;
+
+      // returns false if queue is full/empty
+      bool push(void* p);
+      bool pop(void*& p);
+
+    private:
+
+      unsigned int CAPACITY;
+
+      std::atomic<unsigned long long>* seq;
+      void** data;
+
+      std::atomic<unsigned long long> head; // next position to pop
+      std::atomic<unsigned long long> tail; // next position to push
+    };
+
+  };
+};
+
+
+#endif
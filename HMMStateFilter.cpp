@@ -0,0 +1,222 @@
+#include "HMMStateFilter.h"
+
+#include <math.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    HMMStateFilter::HMMStateFilter()
+    {
+      modelOk = false;
+      sequence = 0;
+      numStates = 0;
+      state = 0;
+      cluster = 0;
+      updates = 0;
+
+      for(unsigned int i=0;i<MAX_STATES;i++)
+	posterior[i] = 0.0f;
+    }
+
+
+    bool HMMStateFilter::setModel(const whiteice::KMeans<>& kmeans, const whiteice::HMM& hmm)
+    {
+      const unsigned int S = hmm.getNumHiddenStates();
+      const unsigned int V = hmm.getNumVisibleStates();
+
+      if(S == 0 || S > MAX_STATES || V == 0 || V != kmeans.size())
+	return false;
+
+      const unsigned int D = kmeans[0].size();
+
+      model n;
+      n.S = S;
+      n.V = V;
+      n.D = D;
+
+      n.centroids.resize(V*D);
+
+      for(unsigned int k=0;k<V;k++){
+	const auto& c = kmeans[k];
+	if(c.size() != D) return false;
+
+	for(unsigned int d=0;d<D;d++)
+	  n.centroids[k*D + d] = c[d].c[0];
+      }
+
+      const auto& pi = hmm.getPI();
+      const auto& A = hmm.getA();
+      const auto& B = hmm.getB(); // B[i][j][o]: i->j transition emits o
+
+      n.pi.resize(S);
+      n.A.resize(S*S);
+      n.AB.resize(V*S*S);
+
+      for(unsigned int i=0;i<S;i++){
+	n.pi[i] = (float)pi[i].getDouble();
+
+	for(unsigned int j=0;j<S;j++){
+	  n.A[i*S + j] = (float)A[i][j].getDouble();
+
+	  for(unsigned int o=0;o<V;o++)
+	    n.AB[(o*S + i)*S + j] = n.A[i*S + j]*(float)B[i][j][o].getDouble();
+	}
+      }
+
+      m = n;
+      modelOk = true;
+
+      reset();
+
+      return true;
+    }
+
+
+    void HMMStateFilter::clearModel()
+    {
+      modelOk = false;
+      m = model();
+      alpha.clear();
+      next.clear();
+      updates = 0;
+    }
+
+
+    void HMMStateFilter::reset()
+    {
+      if(modelOk == false) return;
+
+      alpha = m.pi;
+      next.resize(m.S);
+      updates = 0;
+
+      publish(alpha.data(), m.S);
+    }
+
+
+    bool HMMStateFilter::update(const std::vector<float>& eeg)
+    {
+      if(modelOk == false || eeg.size() != m.D)
+	return false;
+
+      const unsigned int S = m.S;
+      const unsigned int D = m.D;
+
+      // K-Means: nearest centroid
+      unsigned int o = 0;
+      float best = INFINITY;
+
+      for(unsigned int k=0;k<m.V;k++){
+	const float* c = &(m.centroids[k*D]);
+	float d2 = 0.0f;
+
+	for(unsigned int d=0;d<D;d++){
+	  const float e = eeg[d] - c[d];
+	  d2 += e*e;
+	}
+
+	if(d2 < best){
+	  best = d2;
+	  o = k;
+	}
+      }
+
+      // forward step: alpha'(j) ~ sum_i alpha(i)*A(i,j)*B(i,j,o)
+      auto step = [&](const float* M) -> float {
+	for(unsigned int j=0;j<S;j++)
+	  next[j] = 0.0f;
+
+	for(unsigned int i=0;i<S;i++){
+	  const float a = alpha[i];
+	  if(a <= 0.0f) continue;
+
+	  const float* row = &(M[i*S]);
+
+	  for(unsigned int j=0;j<S;j++)
+	    next[j] += a*row[j];
+	}
+
+	float sum = 0.0f;
+	for(unsigned int j=0;j<S;j++)
+	  sum += next[j];
+
+	return sum;
+      };
+
+      float sum = step(&(m.AB[o*S*S]));
+
+      if(sum <= 1e-30f || isfinite(sum) == false){
+	// observation is impossible in the current state: uses only transitions
+	sum = step(m.A.data());
+
+	if(sum <= 1e-30f || isfinite(sum) == false){
+	  next = m.pi;
+	  sum = 0.0f;
+	  for(const auto& p : next) sum += p;
+	}
+      }
+
+      if(sum > 0.0f){
+	for(unsigned int j=0;j<S;j++)
+	  next[j] /= sum;
+      }
+
+      std::swap(alpha, next);
+
+      cluster = o;
+      updates++;
+
+      publish(alpha.data(), S);
+
+      return true;
+    }
+
+
+    bool HMMStateFilter::getPosterior(std::vector<float>& p) const
+    {
+      while(true){
+	const unsigned int s1 = sequence.load(std::memory_order_acquire);
+
+	if(s1 & 1) continue; // being written
+
+	const unsigned int N = numStates.load(std::memory_order_relaxed);
+	p.resize(N);
+
+	for(unsigned int i=0;i<N && i<MAX_STATES;i++)
+	  p[i] = posterior[i].load(std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	if(sequence.load(std::memory_order_relaxed) == s1)
+	  return (N > 0);
+      }
+    }
+
+
+    void HMMStateFilter::publish(const float* p, unsigned int N)
+    {
+      unsigned int MAP = 0;
+
+      for(unsigned int i=1;i<N;i++)
+	if(p[i] > p[MAP]) MAP = i;
+
+      const unsigned int s = sequence.load(std::memory_order_relaxed);
+
+      sequence.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      numStates.store(N, std::memory_order_relaxed);
+
+      for(unsigned int i=0;i<N;i++)
+	posterior[i].store(p[i], std::memory_order_relaxed);
+
+      sequence.store(s + 2, std::memory_order_release);
+
+      state = MAP;
+    }
+
+  };
+};
@@ -0,0 +1,99 @@
+/*
+ * HMMStateFilter
+ *
+ * streaming forward filter of HMM brain state. keeps posterior
+ * probabilities of hidden states given all EEG measurements so far
+ * instead of sampling a single (noisy) state trajectory. update() classifies
+ * EEG measurement with K-Means (nearest centroid) and does one forward step
+ * in O(S^2) where S is number of hidden states.
+ *
+ * K-Means centroids and HMM parameters are copied by setModel() so
+ * update() doesn't touch engine's K-Means/HMM models (or hmm_mutex).
+ * setModel(), clearModel(), reset() and update() are called by the
+ * updating (engine) thread. posterior is published with a sequence lock
+ * so readers of other threads never block the updating thread.
+ */
+
+#ifndef HMMStateFilter_h
+#define HMMStateFilter_h
+
+#include <dinrhiw.h>
+
+#include <vector>
+#include <atomic>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class HMMStateFilter
+    {
+    public:
+
+      HMMStateFilter();
+
+      // copies K-Means and HMM parameters and resets posterior to initial
+      // state probabilities. returns false if models don't match
+      bool setModel(const whiteice::KMeans<>& kmeans, const whiteice::HMM& hmm);
+
+      // removes model (update() does nothing)
+      void clearModel();
+
+      bool hasModel() const { return modelOk; }
+
+      // resets posterior to initial state probabilities
+      void reset();
+
+      // filters new EEG measurement
+      bool update(const std::vector<float>& eeg);
+
+      unsigned int getNumStates() const { return numStates; }
+
+      // K-Means cluster of the latest EEG measurement
+      unsigned int getCluster() const { return cluster; }
+
+      // most probable (MAP) hidden state
+      unsigned int getState() const { return state; }
+
+      // posterior probabilities of hidden states
+      bool getPosterior(std::vector<float>& p) const;
+
+      // number of measurements filtered after setModel()/reset()
+      unsigned long long getUpdates() const { return updates; }
+
+      static const unsigned int MAX_STATES = 64;
+
+    private:
+
+      struct model {
+	unsigned int S = 0; // hidden states
+	unsigned int V = 0; // visible states (K-Means clusters)
+	unsigned int D = 0; // EEG dimension
+
+	std::vector<float> centroids; // V*D
+	std::vector<float> pi;        // S
+	std::vector<float> A;         // S*S transition probabilities
+	std::vector<float> AB;        // V*S*S: A(i,j)*B(i,j,o) for observation o
+      };
+
+      // writes new posterior (and MAP state) for readers
+      void publish(const float* p, unsigned int N);
+
+      // updating thread's state
+      model m;
+      std::vector<float> alpha, next;
+      std::atomic<bool> modelOk;
+
+      std::atomic<unsigned int> sequence; // odd while posterior is written
+      std::atomic<float> posterior[MAX_STATES];
+      std::atomic<unsigned int> numStates;
+      std::atomic<unsigned int> state;
+      std::atomic<unsigned int> cluster;
+      std::atomic<unsigned long long> updates;
+    };
+
+  };
+};
+
+
+#endif
@@ -1,6 +1,9 @@
 
 #include "HMMStateUpdator.h"
 #include <functional>
+#include <algorithm>
+#include <limits>
+#include <iostream>
 
 
 namespace whiteice
@@ -14,7 +17,8 @@ namespace whiteice
 						 whiteice::dataset<>* eegData,
 						 std::vector< whiteice::dataset<> >* pictureData,
 						 std::vector< whiteice::dataset<> >* keywordData,
-						 whiteice::dataset<>* synthData)
+						 whiteice::dataset<>* synthData,
+						 std::vector<unsigned int>* labelled)
     {
       this->kmeans = kmeans;
       this->hmm = hmm;
@@ -23,6 +27,13 @@ namespace whiteice
       this->pictureData = pictureData;
       this->keywordData = keywordData;
       this->synthData = synthData;
+      this->labelled = labelled;
+
+      thread_running = false;
+      processingPicIndex = 0;
+      processingKeyIndex = 0;
+      processingSynthIndex = 0;
+      relabelled = 0;
 
       updator_thread = nullptr;
     }
@@ -49,10 +60,15 @@ namespace whiteice
       processingPicIndex = 0;
       processingKeyIndex = 0;
       processingSynthIndex = 0;
+      relabelled = 0;
       thread_running = true;
 
       try{
-	if(updator_thread){ delete updator_thread; updator_thread = nullptr; }
+	if(updator_thread){
+	  updator_thread->join(); // finished thread
+	  delete updator_thread;
+	  updator_thread = nullptr;
+	}
 	updator_thread = new std::thread(std::bind(&HMMStateUpdatorThread::updator_loop, this));
       }
       catch(std::exception& e){
@@ -78,11 +94,11 @@ namespace whiteice
     {
       std::lock_guard<std::mutex> lock(thread_mutex);
       
-      if(thread_running == false)
-	return false;
+      const bool running = thread_running;
       
       thread_running = false;
       
+      // thread may have finished by itself and must still be joined
       if(updator_thread){
 	updator_thread->join();
 	delete updator_thread;
@@ -90,283 +106,199 @@ namespace whiteice
       
       updator_thread = nullptr;
       
-      return true;
+      return running;
     }
 
 
-    // does binary search of strictly increasing sequences of eeg_index numbers in
-    // eegData and returns EEG DATA INDEX value for given eeg_index value
-    unsigned int HMMStateUpdatorThread::find_eegData_index(unsigned int eeg_index)
+    void HMMStateUpdatorThread::compute_states(unsigned int startRow)
     {
-      try{
-	
-	// searches for the index starting position
-	float start = 0;
-	float end = eegData->size(0) - 1.0f;
-	
-	float guess = start;
-	float guess_index = (float)(eegData->access(1, (unsigned int)guess)[0].c[0]);
-	
-	while(((unsigned int)guess_index) != ((unsigned int)eeg_index)){
-	  
-	  guess = start + (end-start)/2.0f;
-	  guess_index = (float)(eegData->access(1, (unsigned int)guess)[0].c[0]);
-	  
-	  if(((unsigned int)guess_index) < eeg_index){
-	    start = guess;
-	  }
-	  else{
-	    end = guess;
-	  }
-	}
-	
-	return (unsigned int)guess;
+      const unsigned int N = eegData->size(0);
+
+      if(startRow > N) startRow = N;
+
+      // K-Means clusters of EEG rows (rows are independent)
+      std::vector<unsigned int> clusters(N - startRow);
+
+      const unsigned int chunks = (N - startRow + EEG_CHUNK_SIZE - 1)/EEG_CHUNK_SIZE;
+
+#pragma omp parallel for schedule(dynamic)
+      for(unsigned int c=0;c<chunks;c++){
+	const unsigned int begin = startRow + c*EEG_CHUNK_SIZE;
+	const unsigned int end = std::min(N, begin + EEG_CHUNK_SIZE);
+
+	for(unsigned int r=begin;r<end;r++)
+	  clusters[r - startRow] = kmeans->getClusterIndex(eegData->access(0, r));
       }
-      catch(std::exception& e){
-	std::cout << "HMMStateUpdatorThread::find_eegData_index(). Unexpected exception: " << e.what() << std::endl;
 
-	exit(-1);
-	
-	return 0;
+      // HMM state sequence (sampled from the initial state once)
+      firstStateRow = startRow;
+      initialState = hmm->sample(hmm->getPI());
+      eegState.resize(N - startRow);
+
+      unsigned int HMMstate = initialState;
+
+      for(unsigned int r=startRow;r<N;r++){
+	unsigned int nextState = 0;
+	hmm->next_state(HMMstate, nextState, clusters[r - startRow]);
+	HMMstate = nextState;
+
+	eegState[r - startRow] = HMMstate;
       }
     }
-    
+
+
+    unsigned int HMMStateUpdatorThread::find_state(unsigned int eeg_index) const
+    {
+      // EEG rows [0,r) have smaller index value (index values are strictly increasing)
+      const unsigned int r =
+	std::lower_bound(eegIndex.begin(), eegIndex.end(), eeg_index) - eegIndex.begin();
+
+      if(r <= firstStateRow)
+	return initialState;
+
+      return eegState[r - 1 - firstStateRow];
+    }
+
+
+    bool HMMStateUpdatorThread::relabel(whiteice::dataset<>& data, unsigned int firstRow,
+					bool hmmAtEnd)
+    {
+      if(data.getNumberOfClusters() < 3 || firstRow >= data.size(0))
+	return false;
+
+      const unsigned int H = hmm->getNumHiddenStates();
+      const unsigned int eegDimension = eegData->dimension(0);
+
+      for(unsigned int i=firstRow;i<data.size(0);i++){
+	const unsigned int cindex = (unsigned int)(data.access(2, i)[0].c[0]);
+	const unsigned int HMMstate = find_state(cindex);
+
+	// row is relabelled in raw values and preprocessed back with
+	// the same parameters (O(relabelled rows))
+	auto v = data.access(0, i);
+
+	if(data.invpreprocess(0, v) == false)
+	  return false;
+
+	// HMM state is after EEG values (keyword, picture) or at the end (synth)
+	const unsigned int offset = hmmAtEnd ? (v.size() - H) : eegDimension;
+
+	for(unsigned int j=0;j<H && (offset+j)<v.size();j++){
+	  if(j == HMMstate) v[offset+j] = 1.0f;
+	  else v[offset+j] = 0.0f;
+	}
+
+	if(data.preprocess(0, v) == false)
+	  return false;
+
+	data.access(0, i) = v;
+      }
+
+      relabelled += data.size(0) - firstRow;
+
+      return true;
+    }
+
 
     void HMMStateUpdatorThread::updator_loop()
     {
       try{
-	
-	// pictureData
-	for(unsigned int p=0;p<pictureData->size();p++, processingPicIndex++)
-	{
-	  auto& pic = (*pictureData)[p];
-	  
-	  std::vector< whiteice::dataset<>::data_normalization > norms;
-	  
-	  pic.getPreprocessings(0, norms);
-	  pic.convert(0);
-	  
-	  for(unsigned int i=0;i<pic.size(0);i++){
-	    
-	    whiteice::math::vertex<> eeg;
-	    
-	    auto w = eegData->access(0, 0);
-	    eeg.resize(w.size());
-	    eeg.zero();
-
-	    
-	    // finds historical EEG values (10 last) and approximates current HMM state from them
-	    unsigned int HMMstate = 0;
-	    
-	    {
-	      const unsigned int cindex = (unsigned int)(pic.access(2, i)[0].c[0]);
-
-	      int index = ((int)cindex) - 10;
-	      if(index < 0) index = 0;
-	      
-	      unsigned int eeg_index = find_eegData_index((unsigned int)index);
-	      
-	      HMMstate = hmm->sample(hmm->getPI());
-	      
-	      while(((unsigned int)(eegData->access(1, eeg_index)[0].c[0])) < cindex){
-		
-		auto v = eegData->access(0, eeg_index);
-		
-		eeg.resize(v.size());
-		
-		for(unsigned int j=0;j<eeg.size();j++){
-		  eeg[j] = v[j];
-		}
-		
-		unsigned int kcluster = kmeans->getClusterIndex(eeg);
-		
-		unsigned int nextState = 0;
-		hmm->next_state(HMMstate, nextState, kcluster);
-		HMMstate = nextState;
-		
-		eeg_index++;
-	      }
-	      
-	    }
-	    
-	    
-	    auto v = pic.access(0, i);
-
-	    for(unsigned int j=eeg.size();j<(eeg.size()+(hmm->getNumHiddenStates()));j++){
-	      unsigned int index = j-eeg.size();
-	      
-	      if(index == HMMstate) v[j] = 1.0f;
-	      else v[j] = 0.0f;
-	    }
-	    
-	    pic.access(0, i) = v;
-	  }
-	  
-	  for(const auto& p : norms)
-	    pic.preprocess(0, p);
+	const unsigned int P = pictureData->size();
+	const unsigned int K = keywordData->size();
+	const unsigned int D = P + K + 1;
 
-	  pic.preprocess(0); // always do mean-variance normalization
+	auto dataset_of = [&](unsigned int j) -> whiteice::dataset<>* {
+	  if(j < P) return &((*pictureData)[j]);
+	  else if(j < P + K) return &((*keywordData)[j - P]);
+	  else return synthData;
+	};
+
+	// first unlabelled row of each dataset
+	std::vector<unsigned int>& first = firstRow;
+	first.assign(D, 0);
+
+	if(labelled != nullptr && labelled->size() == D)
+	  first = *labelled;
+
+	// EEG index value of the earliest unlabelled measurement
+	unsigned int minIndex = std::numeric_limits<unsigned int>::max();
+
+	for(unsigned int j=0;j<D;j++){
+	  auto data = dataset_of(j);
+
+	  if(data == nullptr || data->getNumberOfClusters() < 3) continue;
+
+	  if(first[j] > data->size(0))
+	    first[j] = 0; // rows have been removed => relabels everything
+
+	  for(unsigned int i=first[j];i<data->size(0);i++){
+	    const unsigned int cindex = (unsigned int)(data->access(2, i)[0].c[0]);
+	    if(cindex < minIndex) minIndex = cindex;
+	  }
 	}
-	
-	
-	
-	// keywordData
-	for(unsigned int p=0;p<keywordData->size();p++, processingKeyIndex++)
+
+	// HMM states of EEG rows needed by unlabelled measurements
 	{
-	  auto& key = (*keywordData)[p];
-	  
-	  std::vector< whiteice::dataset<>::data_normalization > norms;
-	  
-	  key.getPreprocessings(0, norms);
-	  key.convert(0);
-	  
-	  
-	  for(unsigned int i=0;i<key.size(0);i++){
-	    
-	    whiteice::math::vertex<> eeg;
-	    
-	    auto w = eegData->access(0, 0);
-	    eeg.resize(w.size());
-	    eeg.zero();
-
-	    // finds historical EEG values (10 last) and approximates current HMM state from them
-	    unsigned int HMMstate = 0;
-	    
-	    {
-	      const unsigned int cindex = (unsigned int)(key.access(2, i)[0].c[0]);
-	      
-	      int index = ((int)cindex) - 10;
-	      if(index < 0) index = 0;
-	      
-	      unsigned int eeg_index = find_eegData_index((unsigned int)index);
-	      
-	      HMMstate = hmm->sample(hmm->getPI());
-	      
-	      while(((unsigned int)(eegData->access(1, eeg_index)[0].c[0])) < cindex){
-		
-		auto v = eegData->access(0, eeg_index);
-		
-		eeg.resize(v.size());
-		
-		for(unsigned int j=0;j<eeg.size();j++){
-		  eeg[j] = v[j];
-		}
-		
-		unsigned int kcluster = kmeans->getClusterIndex(eeg);
-		
-		unsigned int nextState = 0;
-		hmm->next_state(HMMstate, nextState, kcluster);
-		HMMstate = nextState;
-		
-		eeg_index++;
-	      }
-	      
-	    }
-	    
-	    
-	    auto v = key.access(0, i);
-	    
-	    for(unsigned int j=eeg.size();j<v.size();j++){
-	      unsigned int index = j-eeg.size();
-	      
-	      if(index == HMMstate) v[j] = 1.0f;
-	      else v[j] = 0.0f;
-	    }
-	    
-	    key.access(0, i) = v;
+	  const unsigned int N = eegData->size(0);
+	  eegIndex.resize(N);
+
+	  for(unsigned int r=0;r<N;r++)
+	    eegIndex[r] = (unsigned int)(eegData->access(1, r)[0].c[0]);
+
+	  unsigned int startRow =
+	    std::lower_bound(eegIndex.begin(), eegIndex.end(), minIndex) - eegIndex.begin();
+
+	  if(startRow > HMM_WARMUP_ROWS) startRow -= HMM_WARMUP_ROWS;
+	  else startRow = 0;
+
+	  compute_states(startRow);
+	}
+
+	// relabels datasets in parallel (table lookups)
+	std::vector<char> done(D, 0);
+	changed.assign(D, 0);
+
+#pragma omp parallel for schedule(dynamic)
+	for(unsigned int j=0;j<D;j++){
+	  if(thread_running == false) continue; // stops between datasets
+
+	  auto data = dataset_of(j);
+
+	  try{
+	    if(data && relabel(*data, first[j], j >= P + K))
+	      changed[j] = 1;
+	    done[j] = 1;
 	  }
-	  
-	  for(const auto& p : norms)
-	    key.preprocess(0, p);
-	  
-	  key.preprocess(0); // always do mean-variance normalization
+	  catch(std::exception& e){
+	    std::cout << "HMMStateUpdatorThread::updator_loop(). Unexpected exception: " << e.what() << std::endl;
+	  }
+
+	  if(j < P) processingPicIndex++;
+	  else if(j < P + K) processingKeyIndex++;
+	  else processingSynthIndex++;
 	}
-	
-	
-	
-	// synthData
-	{
-	  auto& synth = (*synthData);
-	  
-	  std::vector< whiteice::dataset<>::data_normalization > norms;
-	  
-	  synth.getPreprocessings(0, norms);
-	  synth.convert(0);
-	  
-	  for(unsigned int i=0;i<synth.size(0);i++){
-	    
-	    
-	    whiteice::math::vertex<> eeg;
-	    
-	    auto w = eegData->access(0, 0);
-	    eeg.resize(w.size());
-	    eeg.zero();
-	    
-	    
-	    // finds historical EEG values (10 last) and approximates current HMM state from them
-	    unsigned int HMMstate = 0;
-	    
-	    {
-	      const unsigned int cindex = (unsigned int)(synth.access(2, i)[0].c[0]);
-	      
-	      int index = ((int)cindex) - 10;
-	      if(index < 0) index = 0;
-	      
-	      unsigned int eeg_index = find_eegData_index((unsigned int)index);
-	      
-	      HMMstate = hmm->sample(hmm->getPI());
-	      
-	      while(((unsigned int)(eegData->access(1, eeg_index)[0].c[0])) < cindex){
-		
-		auto v = eegData->access(0, eeg_index);
-		
-		eeg.resize(v.size());
-		
-		for(unsigned int j=0;j<eeg.size();j++){
-		  eeg[j] = v[j];
-		}
-		
-		unsigned int kcluster = kmeans->getClusterIndex(eeg);
-		
-		unsigned int nextState = 0;
-		hmm->next_state(HMMstate, nextState, kcluster);
-		HMMstate = nextState;
-		
-		eeg_index++;
-	      }
-	    
-	    }
-	    
-	    
-	    auto v = synth.access(0, i);
-	    
-	    for(unsigned int j=0;j<(hmm->getNumHiddenStates());j++){
-	      unsigned int index = (v.size() - (hmm->getNumHiddenStates())) + j;
-	      
-	      if(j == HMMstate) v[index] = 1.0f;
-	      else v[index] = 0.0f;
-	    }
-	    
-	    synth.access(0, i) = v;
+
+	if(labelled != nullptr){
+	  labelled->resize(D);
+
+	  for(unsigned int j=0;j<D;j++){
+	    auto data = dataset_of(j);
+
+	    if(done[j] && data && data->getNumberOfClusters() >= 3)
+	      (*labelled)[j] = data->size(0);
+	    else
+	      (*labelled)[j] = first[j];
 	  }
-	  
-	  
-	  for(const auto& p : norms)
-	    synth.preprocess(0, p);
-	  
-	  synth.preprocess(0); // always do mean-variance normalization
-
-	  processingSynthIndex++;
 	}
 
       }
       catch(std::exception& e){
 	std::cout << "HMMStateUpdatorThread::updator_loop(). Unexpected exception: " << e.what() << std::endl;
       }
-	
-      
+
+
       thread_running = false;
     }
-    
+
   };
 };
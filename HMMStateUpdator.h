@@ -2,6 +2,14 @@
  * HMMStateUpdatorThread
  *
  * reclassifies dataset<> classification field using K-Means and HMM model
+ *
+ * K-Means cluster and HMM state are computed once per EEG data row
+ * (K-Means in parallel over chunks of rows) and dataset rows are
+ * relabelled in parallel by looking up the state of the EEG row preceding
+ * the measurement. only rows after labelled[] count (rows already labelled
+ * with the same K-Means and HMM models) are relabelled. relabelled rows
+ * are transformed using dataset's current preprocessing parameters
+ * (cluster is not preprocessed again).
  */
 
 #ifndef HMMStateUpdator_h
@@ -11,6 +19,8 @@
 #include <dinrhiw.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <vector>
 
 namespace whiteice {
   namespace resonanz {
@@ -19,37 +29,61 @@ namespace whiteice {
     {
     public:
 
+      // labelled has number of already labelled rows of pictureData,
+      // keywordData and synthData datasets (in this order) and is updated
+      // when relabelling finishes. nullptr relabels all rows
       HMMStateUpdatorThread(whiteice::KMeans<>* kmeans,
 			    whiteice::HMM* hmm,
 			    whiteice::dataset<>* eegData,
 			    std::vector< whiteice::dataset<> >* pictureData,
 			    std::vector< whiteice::dataset<> >* keywordData,
-			    whiteice::dataset<>* synthData);
+			    whiteice::dataset<>* synthData,
+			    std::vector<unsigned int>* labelled = nullptr);
 
       ~HMMStateUpdatorThread();
 
       bool start();
-      
+
       bool isRunning();
 
       unsigned int getProcessedElements(){
 	return (processingPicIndex + processingKeyIndex + processingSynthIndex);
       }
 
+      // number of dataset rows relabelled
+      unsigned long long getRelabelledRows() const { return relabelled; }
+
+      // true for datasets (pictures, keywords, synth) that had rows relabelled
+      // (valid after thread has finished)
+      bool wasRelabelled(unsigned int j) const {
+	return (j < changed.size()) ? (changed[j] != 0) : false;
+      }
+
+      // first relabelled row of dataset j (valid after thread has finished)
+      unsigned int getFirstRelabelledRow(unsigned int j) const {
+	return (j < firstRow.size()) ? firstRow[j] : 0;
+      }
+
       bool stop();
-      
+
     private:
 
-      // does binary search of strictly increasing sequences of eeg_index numbers in
-      // eegData and returns EEG DATA INDEX value for given eeg_index value
-      unsigned int find_eegData_index(unsigned int eeg_index);
-      
+      // computes K-Means cluster and HMM state of EEG rows starting from startRow
+      void compute_states(unsigned int startRow);
+
+      // returns HMM state after EEG rows preceding eeg_index value
+      unsigned int find_state(unsigned int eeg_index) const;
+
+      // relabels rows starting from firstRow of dataset, returns false if
+      // there were no rows to relabel
+      bool relabel(whiteice::dataset<>& data, unsigned int firstRow, bool hmmAtEnd);
+
       void updator_loop();
-      
+
       std::mutex thread_mutex;
-      bool thread_running = false;
+      std::atomic<bool> thread_running;
       std::thread* updator_thread = nullptr;
-      
+
       whiteice::KMeans<>* kmeans;
       whiteice::HMM* hmm;
 
@@ -57,11 +91,25 @@ namespace whiteice {
       std::vector< whiteice::dataset<> >* pictureData;
       std::vector< whiteice::dataset<> >* keywordData;
       whiteice::dataset<>* synthData;
+      std::vector<unsigned int>* labelled;
+
+      // per EEG row: index field value and HMM state after the row
+      std::vector<unsigned int> eegIndex;
+      std::vector<unsigned int> eegState;
+      unsigned int firstStateRow = 0;  // first row with computed state
+      unsigned int initialState = 0;   // state before computed rows
+
+      std::vector<char> changed; // datasets with relabelled rows
+      std::vector<unsigned int> firstRow; // first relabelled row of datasets
+
+      std::atomic<unsigned int> processingPicIndex, processingKeyIndex, processingSynthIndex;
+      std::atomic<unsigned long long> relabelled;
+
+      static const unsigned int EEG_CHUNK_SIZE = 1024; // rows per K-Means job
+      static const unsigned int HMM_WARMUP_ROWS = 10;  // EEG rows before new measurements
 
-      unsigned int processingPicIndex = 0, processingKeyIndex = 0, processingSynthIndex = 0;
-      
     };
-    
+
   };
 };
 
@@ -0,0 +1,369 @@
+
+#include "ImageCache.h"
+#include <SDL_image.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    ImageCache::ImageCache(unsigned int budgetMB, unsigned int numThreads)
+    {
+      this->budget = ((unsigned long long)budgetMB)*1024*1024;
+      this->numThreads = numThreads;
+    }
+
+
+    ImageCache::~ImageCache()
+    {
+      {
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	running = false;
+	requests.clear();
+      }
+
+      requests_cond.notify_all();
+
+      for(auto& t : workers)
+	t.join();
+
+      workers.clear();
+
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      free_surfaces();
+    }
+
+
+    void ImageCache::setPictures(const std::vector<std::string>& pictures)
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+
+      free_surfaces();
+
+      this->pictures = pictures;
+      entries.clear();
+      entries.resize(pictures.size());
+    }
+
+
+    void ImageCache::setScreenSize(int width, int height)
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+
+      if(this->width == width && this->height == height)
+	return;
+
+      free_surfaces();
+
+      this->width = width;
+      this->height = height;
+    }
+
+
+    void ImageCache::setBudget(unsigned int budgetMB)
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+
+      budget = ((unsigned long long)budgetMB)*1024*1024;
+      evict();
+    }
+
+
+    unsigned int ImageCache::getBudget() const
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      return (unsigned int)(budget/(1024*1024));
+    }
+
+
+    SDL_Surface* ImageCache::get(unsigned int picture)
+    {
+      std::unique_lock<std::mutex> lock(cache_mutex);
+
+      if(picture >= entries.size())
+	return nullptr;
+
+      pinned = picture;
+
+      if(entries[picture].surface != nullptr){
+	hits++;
+	lru.splice(lru.begin(), lru, entries[picture].lru);
+	return entries[picture].surface;
+      }
+
+      misses++;
+
+      if(entries[picture].failed)
+	return nullptr;
+
+      if(entries[picture].loading){
+	// worker thread is already decoding the picture
+	const unsigned int gen = generation;
+
+	loaded_cond.wait(lock, [&](){
+	    return (generation != gen || entries[picture].loading == false);
+	  });
+
+	if(generation == gen && entries[picture].surface != nullptr){
+	  lru.splice(lru.begin(), lru, entries[picture].lru);
+	  return entries[picture].surface;
+	}
+
+	if(generation == gen && entries[picture].failed)
+	  return nullptr;
+      }
+
+      // decodes picture in the calling thread
+      entries[picture].loading = true;
+
+      const unsigned int gen = generation;
+      const std::string filename = pictures[picture];
+      const int w = width, h = height;
+
+      lock.unlock();
+
+      SDL_Surface* surface = loadScaled(filename, w, h);
+
+      lock.lock();
+
+      if(gen != generation){ // cache was cleared while decoding
+	if(surface) SDL_FreeSurface(surface);
+	return nullptr;
+      }
+
+      store(picture, surface);
+
+      return entries[picture].surface;
+    }
+
+
+    void ImageCache::prefetch(const std::vector<unsigned int>& pictures)
+    {
+      {
+	std::lock_guard<std::mutex> lock(cache_mutex);
+
+	requests.clear(); // old requests are not needed anymore
+
+	for(const auto& p : pictures){
+	  if(p >= entries.size()) continue;
+
+	  if(entries[p].surface != nullptr){
+	    // keeps prefetched pictures in the cache
+	    lru.splice(lru.begin(), lru, entries[p].lru);
+	    continue;
+	  }
+
+	  if(entries[p].loading || entries[p].failed) continue;
+
+	  requests.push_back(p);
+	}
+
+	if(requests.size() == 0)
+	  return;
+
+	if(workers.size() == 0){
+	  running = true;
+
+	  for(unsigned int i=0;i<numThreads;i++)
+	    workers.push_back(std::thread(&ImageCache::worker_loop, this));
+	}
+      }
+
+      requests_cond.notify_all();
+    }
+
+
+    void ImageCache::clear()
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      free_surfaces();
+    }
+
+
+    std::string ImageCache::getStatistics() const
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+
+      char buffer[256];
+      snprintf(buffer, 256,
+	       "image cache hits %llu misses %llu evictions %llu (%.1f/%.1f MB)",
+	       hits, misses, evictions,
+	       used/(1024.0*1024.0), budget/(1024.0*1024.0));
+
+      return std::string(buffer);
+    }
+
+
+    unsigned long long ImageCache::getHits() const
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      return hits;
+    }
+
+
+    unsigned long long ImageCache::getMisses() const
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      return misses;
+    }
+
+
+    unsigned long long ImageCache::getEvictions() const
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      return evictions;
+    }
+
+
+    SDL_Surface* ImageCache::loadScaled(const std::string& filename, int width, int height)
+    {
+      if(width <= 0 || height <= 0)
+	return nullptr;
+
+      SDL_Surface* image = IMG_Load(filename.c_str());
+
+      if(image == nullptr)
+	return nullptr;
+
+      SDL_Surface* scaled = nullptr;
+
+      // scales picture to fill the screen (keeps aspect ratio)
+      double scale = 1.0;
+
+      if((image->w) > (image->h))
+	scale = ((double)width)/((double)image->w);
+      else
+	scale = ((double)height)/((double)image->h);
+
+      scaled = SDL_CreateRGBSurface(0, (int)(image->w*scale), (int)(image->h*scale), 32,
+				    0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+
+      if(scaled != nullptr){
+	if(SDL_BlitScaled(image, NULL, scaled, NULL) != 0){
+	  SDL_FreeSurface(scaled);
+	  scaled = nullptr;
+	}
+      }
+
+      SDL_FreeSurface(image);
+
+      return scaled;
+    }
+
+
+    void ImageCache::store(unsigned int picture, SDL_Surface* surface)
+    {
+      entry& e = entries[picture];
+
+      e.loading = false;
+
+      if(surface == nullptr){
+	e.failed = true;
+	loaded_cond.notify_all();
+	return;
+      }
+
+      e.surface = surface;
+      e.bytes = ((unsigned long long)surface->pitch)*surface->h;
+
+      lru.push_front(picture);
+      e.lru = lru.begin();
+
+      used += e.bytes;
+
+      evict();
+
+      loaded_cond.notify_all();
+    }
+
+
+    void ImageCache::evict()
+    {
+      // removes least recently used surfaces (except the pinned one)
+      auto iter = lru.end();
+
+      while(used > budget && iter != lru.begin()){
+	iter--;
+
+	const unsigned int p = *iter;
+
+	if((int)p == pinned) continue;
+
+	entry& e = entries[p];
+
+	SDL_FreeSurface(e.surface);
+	e.surface = nullptr;
+	used -= e.bytes;
+	e.bytes = 0;
+
+	iter = lru.erase(iter);
+
+	evictions++;
+      }
+    }
+
+
+    void ImageCache::free_surfaces()
+    {
+      for(auto& e : entries){
+	if(e.surface) SDL_FreeSurface(e.surface);
+	e.surface = nullptr;
+	e.bytes = 0;
+	e.loading = false;
+	e.failed = false;
+      }
+
+      lru.clear();
+      requests.clear();
+
+      used = 0;
+      pinned = -1;
+      generation++;
+
+      loaded_cond.notify_all();
+    }
+
+
+    void ImageCache::worker_loop()
+    {
+      std::unique_lock<std::mutex> lock(cache_mutex);
+
+      while(running){
+	requests_cond.wait(lock, [&](){ return (running == false || requests.size() > 0); });
+
+	if(running == false) break;
+
+	const unsigned int picture = requests.front();
+	requests.pop_front();
+
+	if(picture >= entries.size()) continue;
+
+	entry& e = entries[picture];
+
+	if(e.surface != nullptr || e.loading || e.failed)
+	  continue;
+
+	e.loading = true;
+
+	const unsigned int gen = generation;
+	const std::string filename = pictures[picture];
+	const int w = width, h = height;
+
+	lock.unlock();
+
+	SDL_Surface* surface = loadScaled(filename, w, h);
+
+	lock.lock();
+
+	if(gen != generation){ // cache was cleared while decoding
+	  if(surface) SDL_FreeSurface(surface);
+	  continue;
+	}
+
+	store(picture, surface);
+      }
+    }
+
+  };
+};
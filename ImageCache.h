@@ -0,0 +1,113 @@
+/*
+ * ImageCache
+ *
+ * decoded and screen-scaled picture cache used by engine_showScreen().
+ * pictures are decoded and scaled by background worker threads when
+ * prefetch() is called and cached surfaces are evicted in least recently
+ * used order when the memory budget is exceeded.
+ */
+
+#ifndef ImageCache_h
+#define ImageCache_h
+
+#include <SDL.h>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class ImageCache
+    {
+    public:
+
+      ImageCache(unsigned int budgetMB = 256, unsigned int numThreads = 2);
+      ~ImageCache();
+
+      // sets pictures (filenames) and frees all cached surfaces
+      void setPictures(const std::vector<std::string>& pictures);
+
+      // sets size of the screen pictures are scaled to,
+      // frees cached surfaces if the size changes
+      void setScreenSize(int width, int height);
+
+      void setBudget(unsigned int budgetMB);
+      unsigned int getBudget() const;
+
+      // returns scaled picture (decodes it in the calling thread if it is not
+      // cached or being decoded). surface is valid until the next call
+      // to get(), setPictures(), setScreenSize() or clear()
+      SDL_Surface* get(unsigned int picture);
+
+      // queues pictures for background decoding (replaces earlier
+      // prefetch requests that have not been started yet)
+      void prefetch(const std::vector<unsigned int>& pictures);
+
+      // frees all cached surfaces
+      void clear();
+
+      // cache hit/miss/eviction counters as a string
+      std::string getStatistics() const;
+
+      unsigned long long getHits() const;
+      unsigned long long getMisses() const;
+      unsigned long long getEvictions() const;
+
+    private:
+
+      struct entry {
+	SDL_Surface* surface = nullptr;
+	unsigned long long bytes = 0;
+	bool loading = false;
+	bool failed = false;
+	std::list<unsigned int>::iterator lru;
+      };
+
+      // loads and scales picture to the screen size (no locks held)
+      static SDL_Surface* loadScaled(const std::string& filename, int width, int height);
+
+      // stores decoded surface to cache and evicts old surfaces (lock held)
+      void store(unsigned int picture, SDL_Surface* surface);
+
+      void evict();
+
+      void free_surfaces();
+
+      void worker_loop();
+
+      std::vector<std::string> pictures;
+      std::vector<entry> entries;
+      std::list<unsigned int> lru; // most recently used first
+      std::deque<unsigned int> requests;
+
+      int width = 0, height = 0;
+      unsigned int generation = 0; // incremented when cached data becomes invalid
+      int pinned = -1; // latest picture returned by get() is never evicted
+
+      unsigned long long budget;
+      unsigned long long used = 0;
+
+      unsigned long long hits = 0, misses = 0, evictions = 0;
+
+      mutable std::mutex cache_mutex;
+      std::condition_variable requests_cond; // new prefetch requests
+      std::condition_variable loaded_cond;   // picture decoded
+
+      std::vector<std::thread> workers;
+      unsigned int numThreads;
+      bool running = false;
+
+    };
+
+  };
+};
+
+
+#endif
@@ -33,6 +33,8 @@ IsochronicSoundSynthesis::IsochronicSoundSynthesis() {
   oldF = 0.0;
   
   tbase = 0.0;
+  timeSinceReset = 0.0;
+  resetTimer = false;
   
   fadeoutTime = 100.0; // 100ms fade out between parameter changes
   //fadeoutTime = 0.0; // no fadeout
@@ -51,9 +53,8 @@ std::string IsochronicSoundSynthesis::getSynthesizerName()
 
 bool IsochronicSoundSynthesis::reset()
 {
-  // resets sound generation (timer)
-  tbase = 0.0;
-  timeSinceReset = tbase;
+  // resets sound generation (timer) in audio thread
+  resetTimer = true;
   
   return true;
 }
@@ -79,13 +80,9 @@ bool IsochronicSoundSynthesis::setParameters(const std::vector<float>& p_)
     if(pi > 1.0f) pi = 1.0f;
   }
   
-  oldA = A;
-  oldFc = Fc;
-  oldF = F;
-  
   currentp = p; // copies values for getParameters()
   
-  A = p[0];
+  const double A = p[0];
   
   // sound base frquency: [55 Hz, 880 Hz] => note interval: A-1 - A-5
   float f = 220.0;
@@ -100,7 +97,7 @@ bool IsochronicSoundSynthesis::setParameters(const std::vector<float>& p_)
   }
   
   
-  Fc = f;
+  const double Fc = f;
   
   {
     // isochronic modulating freq: F = 1..48 Hz
@@ -108,10 +105,11 @@ bool IsochronicSoundSynthesis::setParameters(const std::vector<float>& p_)
     f = 1.0 + 47.0*p[2];
   }
 
-  F = f;
+  const double F = f;
   
-  resetTime = getMilliseconds();
-  timeSinceReset = tbase;
+  // audio thread picks up new parameters at the next buffer and fades to them
+  std::vector<double> params = { A, Fc, F };
+  publishParameters(params);
   
   return true;
 }
@@ -150,6 +148,29 @@ bool IsochronicSoundSynthesis::synthesize(int16_t* buffer, int samples)
 {
   double hz = (double)snd.freq;
   
+  if(resetTimer){
+    tbase = 0.0;
+    timeSinceReset = tbase;
+    resetTimer = false;
+  }
+  
+  // takes complete parameter block from setParameters() at buffer boundary
+  {
+    const std::vector<double>* params = nullptr;
+    
+    if(acquireParameters(params) && params->size() == 3){
+      oldA = A;
+      oldFc = Fc;
+      oldF = F;
+      
+      A  = (*params)[0];
+      Fc = (*params)[1];
+      F  = (*params)[2];
+      
+      timeSinceReset = tbase; // fade out starts now
+    }
+  }
+  
   //const unsigned int MEANBUFFER_MAX_SIZE = (unsigned int)(0.0010*hz + 1);
   const unsigned int MEANBUFFER_MAX_SIZE = (unsigned int)(0.00200*hz + 1);
 
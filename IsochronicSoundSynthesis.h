@@ -10,6 +10,7 @@
 #include "SDLSoundSynthesis.h"
 #include <vector>
 #include <list>
+#include <atomic>
 
 
 class IsochronicSoundSynthesis: public SDLSoundSynthesis {
@@ -37,13 +38,15 @@ public:
   
   double tbase;
   
+  std::atomic<bool> resetTimer; // set by reset()
+  
+  // parameters used by audio thread (set from setParameters() parameter block)
   double A; // amplitude/volume of carrier
   double Fc; // carrier frequency
   double F; // isochronic frequency
   
   std::vector<float> currentp;
   
-  unsigned long long resetTime = 0ULL;
   double timeSinceReset; // from tbase value (secs)
   double fadeoutTime; // in milliseconds
   
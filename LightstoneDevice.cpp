@@ -30,6 +30,7 @@ LightstoneDevice::LightstoneDevice() {
 	running = true;
 	has_lightstone = false;
 	latest_data_point_added = 0;
+	sampleBuffer.init(this->getNumberOfSignals());
 	worker = new std::thread(lightstone_loop, this);
 }
 
@@ -190,6 +191,8 @@ void LightstoneDevice::lightstone_loop()
 			auto duration1 = std::chrono::system_clock::now().time_since_epoch();
 			latest_data_point_added =
 					std::chrono::duration_cast<std::chrono::milliseconds>(duration1).count();
+
+			sampleBuffer.push(x, latest_data_point_added);
 		}
 
 
@@ -0,0 +1,807 @@
+
+#include "MeasurementJournal.h"
+#include "RunningStatistics.h"
+
+#include <map>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    MeasurementJournal::MeasurementJournal()
+    {
+    }
+
+
+    MeasurementJournal::~MeasurementJournal()
+    {
+      {
+	std::lock_guard<std::mutex> lock(journal_mutex);
+	running = false; // stops compaction after the current dataset
+      }
+
+      wait();
+      close();
+    }
+
+
+    bool MeasurementJournal::open(const std::string& modelDir)
+    {
+      wait();
+
+      std::unique_lock<std::mutex> lock(journal_mutex);
+
+      if(handle){
+	fclose(handle);
+	handle = nullptr;
+      }
+
+      this->modelDir = modelDir;
+      this->journalFile = modelDir + "/measurements.journal";
+
+      records = 0;
+      total = 0;
+      nextSeq = 1;
+
+      // folds journal of the earlier session to datasets before they are loaded
+      seal();
+
+      running = true;
+      compacting = true;
+
+      lock.unlock();
+
+      const bool ok = fold(false);
+
+      lock.lock();
+
+      // segments left (folding failed) are not in the loaded datasets
+      {
+	std::vector<unsigned int> seqs;
+	listSegments(seqs);
+
+	if(seqs.size() > 0 && seqs.back() >= nextSeq)
+	  nextSeq = seqs.back() + 1;
+
+	sessionSeq = nextSeq;
+      }
+
+      compacting = false;
+      compact_cond.notify_all();
+
+      handle = fopen(journalFile.c_str(), "ab");
+
+      if(handle == nullptr){
+	whiteice::logging.error("MeasurementJournal: cannot open journal file for appending");
+	return false;
+      }
+
+      return ok;
+    }
+
+
+    void MeasurementJournal::close()
+    {
+      std::lock_guard<std::mutex> lock(journal_mutex);
+
+      if(handle){
+	fflush(handle);
+#ifdef _WIN32
+	_commit(_fileno(handle));
+#else
+	fsync(fileno(handle));
+#endif
+	fclose(handle);
+	handle = nullptr;
+      }
+    }
+
+
+    void MeasurementJournal::setPCAPreprocess(bool pca)
+    {
+      std::lock_guard<std::mutex> lock(journal_mutex);
+      pcaPreprocess = pca;
+    }
+
+
+    void MeasurementJournal::setStatisticsDrift(float drift)
+    {
+      std::lock_guard<std::mutex> lock(journal_mutex);
+      statisticsDrift = drift;
+    }
+
+
+    bool MeasurementJournal::append(const std::string& name, unsigned int type,
+				    const std::vector<const row*>& clusters)
+    {
+      // builds payload
+      std::vector<unsigned char> buffer;
+
+      auto put32 = [&buffer](unsigned int v){
+	const unsigned char* p = (const unsigned char*)&v;
+	buffer.insert(buffer.end(), p, p + sizeof(v));
+      };
+
+      put32(0); put32(0); put32(0); // header
+
+      put32(type);
+      put32((unsigned int)name.length());
+      buffer.insert(buffer.end(), name.begin(), name.end());
+      put32((unsigned int)clusters.size());
+
+      for(const auto& c : clusters){
+	if(c == nullptr) return false;
+
+	put32((unsigned int)c->size());
+
+	for(const auto& v : *c){
+	  const float f = v.c[0];
+	  const unsigned char* p = (const unsigned char*)&f;
+	  buffer.insert(buffer.end(), p, p + sizeof(f));
+	}
+      }
+
+      const unsigned int bytes = buffer.size() - 3*sizeof(unsigned int);
+      const unsigned int header[3] = { MAGIC, bytes, crc32(buffer.data() + 3*sizeof(unsigned int), bytes) };
+
+      memcpy(buffer.data(), header, sizeof(header));
+
+      std::lock_guard<std::mutex> lock(journal_mutex);
+
+      if(handle == nullptr) return false;
+
+      if(fwrite(buffer.data(), 1, buffer.size(), handle) != buffer.size())
+	return false;
+
+      // record is given to operating system immediately
+      // (sync() and seal() force records to disk)
+      if(fflush(handle) != 0)
+	return false;
+
+      records++;
+      total++;
+
+      return true;
+    }
+
+
+    bool MeasurementJournal::sync()
+    {
+      std::lock_guard<std::mutex> lock(journal_mutex);
+
+      if(handle == nullptr) return false;
+
+      if(fflush(handle) != 0) return false;
+
+#ifdef _WIN32
+      return (_commit(_fileno(handle)) == 0);
+#else
+      return (fsync(fileno(handle)) == 0);
+#endif
+    }
+
+
+    bool MeasurementJournal::compact(bool wait)
+    {
+      this->wait(); // only one compaction at a time
+
+      std::unique_lock<std::mutex> lock(journal_mutex);
+
+      if(modelDir.length() == 0) return false;
+
+      if(seal() == false) return false;
+
+      running = true;
+      compacting = true;
+
+      try{
+	compactor = new std::thread(&MeasurementJournal::compact_loop, this);
+      }
+      catch(std::exception&){
+	compactor = nullptr;
+	compacting = false;
+	return false;
+      }
+
+      lock.unlock();
+
+      if(wait) this->wait();
+
+      return true;
+    }
+
+
+    void MeasurementJournal::wait()
+    {
+      std::unique_lock<std::mutex> lock(journal_mutex);
+
+      compact_cond.wait(lock, [&](){ return (compacting == false); });
+
+      if(compactor){
+	compactor->join(); // thread has finished
+	delete compactor;
+	compactor = nullptr;
+      }
+    }
+
+
+    bool MeasurementJournal::clear()
+    {
+      wait();
+
+      std::lock_guard<std::mutex> lock(journal_mutex);
+
+      // segments sealed in this session are in the saved datasets even if
+      // folding them failed. older segments left by open() (folding failed)
+      // are not in the loaded datasets so they are kept
+      {
+	std::vector<unsigned int> seqs;
+	listSegments(seqs);
+
+	for(const auto& s : seqs){
+	  if(s < sessionSeq) continue;
+
+	  const std::string segment = segmentFilename(s);
+	  remove(segment.c_str());
+	  remove((segment + ".done").c_str());
+	}
+      }
+
+      if(handle){
+	fclose(handle);
+	handle = fopen(journalFile.c_str(), "wb"); // truncates journal
+	records = 0;
+	return (handle != nullptr);
+      }
+      else if(journalFile.length() > 0){
+	remove(journalFile.c_str());
+      }
+
+      return true;
+    }
+
+
+    unsigned long long MeasurementJournal::getNumberOfRecords() const
+    {
+      std::lock_guard<std::mutex> lock(journal_mutex);
+      return total;
+    }
+
+
+    bool MeasurementJournal::seal()
+    {
+      const bool active = (handle != nullptr);
+
+      if(handle){
+	// sealed records must be on disk before datasets are changed
+	fflush(handle);
+#ifdef _WIN32
+	_commit(_fileno(handle));
+#else
+	fsync(fileno(handle));
+#endif
+	fclose(handle);
+	handle = nullptr;
+      }
+
+      FILE* f = fopen(journalFile.c_str(), "rb");
+
+      if(f){
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f);
+	fclose(f);
+
+	if(size > 0){
+	  std::vector<unsigned int> seqs;
+	  listSegments(seqs);
+
+	  // sequence numbers are not reused in a session
+	  unsigned int seq = nextSeq;
+	  if(seqs.size() > 0 && seqs.back() >= seq)
+	    seq = seqs.back() + 1;
+
+	  if(rename(journalFile.c_str(), segmentFilename(seq).c_str()) != 0){
+	    whiteice::logging.error("MeasurementJournal: cannot seal journal file");
+	    if(active) handle = fopen(journalFile.c_str(), "ab");
+	    return false;
+	  }
+
+	  nextSeq = seq + 1;
+	}
+      }
+
+      records = 0;
+
+      if(active){
+	handle = fopen(journalFile.c_str(), "ab");
+	if(handle == nullptr) return false;
+      }
+
+      return true;
+    }
+
+
+    bool MeasurementJournal::fold(bool session)
+    {
+      std::vector<unsigned int> seqs;
+      unsigned int first = 0;
+
+      {
+	std::lock_guard<std::mutex> lock(journal_mutex);
+	listSegments(seqs);
+	if(session) first = sessionSeq;
+      }
+
+      for(const auto& s : seqs){
+	// older segments are folded at the next open(): datasets in memory
+	// don't have their records and would overwrite them when saved
+	if(s < first) continue;
+
+	const std::string segment = segmentFilename(s);
+
+	if(foldSegment(segment) == false)
+	  return false; // keeps segment and continues later
+
+	remove(segment.c_str());
+	remove((segment + ".done").c_str());
+      }
+
+      return true;
+    }
+
+
+    bool MeasurementJournal::foldSegment(const std::string& segment)
+    {
+      std::vector<record> recs;
+
+      if(readRecords(segment, recs) == false)
+	return false;
+
+      // datasets that were already updated from this segment before interruption
+      std::set<std::string> done;
+
+      {
+	FILE* f = fopen((segment + ".done").c_str(), "rt");
+
+	if(f){
+	  char line[1024];
+
+	  while(fgets(line, sizeof(line), f) != NULL){
+	    std::string name(line);
+	    while(name.length() > 0 && (name.back() == '\n' || name.back() == '\r'))
+	      name.pop_back();
+	    if(name.length() > 0) done.insert(name);
+	  }
+
+	  fclose(f);
+	}
+      }
+
+      // groups records by dataset (keeps measurement order)
+      std::vector<std::string> names;
+      std::map< std::string, std::vector<const record*> > datasets;
+
+      for(const auto& r : recs){
+	auto& d = datasets[r.name];
+	if(d.size() == 0) names.push_back(r.name);
+	d.push_back(&r);
+      }
+
+      bool pca = false;
+      float drift = 0.0f;
+      std::string dir;
+
+      {
+	std::lock_guard<std::mutex> lock(journal_mutex);
+	pca = pcaPreprocess;
+	drift = statisticsDrift;
+	dir = modelDir;
+      }
+
+      // completes or rolls back dataset updates interrupted by a crash
+      for(const auto& name : names){
+	for(const char* ext : { ".ds", ".stats" }){
+	  const std::string filename = dir + "/" + name + ext;
+	  const std::string tmpFile = filename + ".tmp";
+
+	  FILE* f = fopen(tmpFile.c_str(), "rb");
+	  if(f == NULL) continue;
+	  fclose(f);
+
+	  if(done.find(name) != done.end()){
+#ifdef _WIN32
+	    remove(filename.c_str());
+#endif
+	    if(rename(tmpFile.c_str(), filename.c_str()) != 0){
+	      whiteice::logging.error("MeasurementJournal: cannot complete folding of dataset " + name);
+	      return false;
+	    }
+	  }
+	  else{
+	    remove(tmpFile.c_str());
+	  }
+	}
+      }
+
+      FILE* donefile = fopen((segment + ".done").c_str(), "at");
+
+      if(donefile == NULL){
+	whiteice::logging.error("MeasurementJournal: cannot write compaction status file");
+	return false;
+      }
+
+      for(const auto& name : names){
+	if(done.find(name) != done.end())
+	  continue;
+
+	{
+	  std::lock_guard<std::mutex> lock(journal_mutex);
+	  if(running == false){
+	    fclose(donefile);
+	    return false;
+	  }
+	}
+
+	const auto& d = datasets[name];
+	const std::string filename = dir + "/" + name + ".ds";
+	const std::string tmpFile = filename + ".tmp";
+	const std::string statsFile = dir + "/" + name + ".stats";
+	const std::string statsTmpFile = statsFile + ".tmp";
+
+	bool written = false;
+
+	if(foldRecords(filename, tmpFile, statsTmpFile, d[0]->type, d, pca, drift, written) == false ||
+	   (written && syncFile(tmpFile) == false))
+	{
+	  remove(tmpFile.c_str());
+	  remove(statsTmpFile.c_str());
+	  fclose(donefile);
+	  return false;
+	}
+
+	// dataset is marked folded before it is replaced (see open())
+	bool marked = (fprintf(donefile, "%s\n", name.c_str()) > 0 && fflush(donefile) == 0);
+#ifdef _WIN32
+	marked = marked && (_commit(_fileno(donefile)) == 0);
+#else
+	marked = marked && (fsync(fileno(donefile)) == 0);
+#endif
+
+	if(!marked){
+	  whiteice::logging.error("MeasurementJournal: cannot write compaction status file");
+	  remove(tmpFile.c_str());
+	  remove(statsTmpFile.c_str());
+	  fclose(donefile);
+	  return false;
+	}
+
+	if(written == false) continue; // bad records, nothing was folded
+
+#ifdef _WIN32
+	remove(filename.c_str());
+#endif
+	if(rename(tmpFile.c_str(), filename.c_str()) != 0){
+	  whiteice::logging.error("MeasurementJournal: cannot replace dataset " + name);
+	  fclose(donefile);
+	  return false; // completed by the next fold
+	}
+
+	// stale statistics are recalculated when the dataset is loaded
+#ifdef _WIN32
+	remove(statsFile.c_str());
+#endif
+	if(rename(statsTmpFile.c_str(), statsFile.c_str()) != 0)
+	  remove(statsTmpFile.c_str());
+      }
+
+      fclose(donefile);
+
+      char buffer[256];
+      snprintf(buffer, 256, "MeasurementJournal: folded %d records to %d datasets",
+	       (int)recs.size(), (int)names.size());
+      whiteice::logging.info(buffer);
+
+      return true;
+    }
+
+
+    bool MeasurementJournal::readRecords(const std::string& filename,
+					 std::vector<record>& records)
+    {
+      records.clear();
+
+      FILE* f = fopen(filename.c_str(), "rb");
+      if(f == NULL) return false;
+
+      std::vector<unsigned char> payload;
+
+      while(true){
+	unsigned int header[3];
+
+	if(fread(header, sizeof(header), 1, f) != 1) break;
+	if(header[0] != MAGIC) break;
+	if(header[1] > 16*1024*1024) break;
+
+	payload.resize(header[1]);
+
+	if(header[1] > 0 && fread(payload.data(), 1, header[1], f) != header[1])
+	  break; // truncated record
+
+	if(crc32(payload.data(), header[1]) != header[2])
+	  break; // partially written or corrupted record
+
+	// parses payload
+	unsigned int pos = 0;
+	bool ok = true;
+
+	auto get32 = [&](unsigned int& v){
+	  if(pos + sizeof(v) > payload.size()){ ok = false; return; }
+	  memcpy(&v, payload.data() + pos, sizeof(v));
+	  pos += sizeof(v);
+	};
+
+	record r;
+	unsigned int len = 0, clusters = 0;
+
+	get32(r.type);
+	get32(len);
+
+	if(!ok || pos + len > payload.size()) break;
+	r.name.assign((const char*)payload.data() + pos, len);
+	pos += len;
+
+	get32(clusters);
+	if(!ok || clusters > 16) break;
+
+	r.clusters.resize(clusters);
+
+	for(auto& c : r.clusters){
+	  unsigned int dim = 0;
+	  get32(dim);
+
+	  if(!ok || pos + dim*sizeof(float) > payload.size()){ ok = false; break; }
+
+	  c.resize(dim);
+	  if(dim > 0) memcpy(c.data(), payload.data() + pos, dim*sizeof(float));
+	  pos += dim*sizeof(float);
+	}
+
+	if(!ok) break;
+
+	records.push_back(r);
+      }
+
+      if(!feof(f)){
+	char buffer[256];
+	snprintf(buffer, 256, "MeasurementJournal: ignoring corrupted data after %d records",
+		 (int)records.size());
+	whiteice::logging.warn(buffer);
+      }
+
+      fclose(f);
+
+      return true;
+    }
+
+
+    bool MeasurementJournal::syncFile(const std::string& filename)
+    {
+      FILE* f = fopen(filename.c_str(), "r+b");
+      if(f == NULL) return false;
+
+#ifdef _WIN32
+      const bool ok = (_commit(_fileno(f)) == 0);
+#else
+      const bool ok = (fsync(fileno(f)) == 0);
+#endif
+
+      fclose(f);
+
+      return ok;
+    }
+
+
+    bool MeasurementJournal::foldRecords(const std::string& filename, const std::string& target,
+					 const std::string& statsTarget, unsigned int type,
+					 const std::vector<const record*>& records,
+					 bool pca, float drift, bool& written)
+    {
+      const unsigned int CLUSTERS = (type == RECORD_EEG) ? 2 : 3;
+      const unsigned int PREPROCESSED = CLUSTERS - 1; // index cluster is not preprocessed
+
+      written = false;
+
+      if(records.size() == 0) return true;
+
+      whiteice::dataset<> data;
+
+      if(data.load(filename) == false || data.getNumberOfClusters() != CLUSTERS){
+	data.clear();
+
+	const record& r = *records[0];
+	if(r.clusters.size() != CLUSTERS) return true; // bad record, nothing to fold
+
+	if(type == RECORD_EEG){
+	  data.createCluster("Pure EEG data", r.clusters[0].size());
+	  data.createCluster("index", r.clusters[1].size());
+	}
+	else{
+	  data.createCluster("input", r.clusters[0].size());
+	  data.createCluster("output", r.clusters[1].size());
+	  data.createCluster("index", r.clusters[2].size());
+	}
+      }
+
+      // running statistics of raw values saved next to the dataset,
+      // recalculated only if they don't match the dataset
+      const bool covariance = pca && (type != RECORD_EEG);
+      std::vector<RunningStatistics> stats;
+
+      if(RunningStatistics::load(filename.substr(0, filename.length()-3) + ".stats", stats) == false)
+	stats.clear();
+
+      bool valid = (stats.size() == PREPROCESSED);
+
+      for(unsigned int c=0;valid && c<PREPROCESSED;c++){
+	valid = (stats[c].dimension() == data.dimension(c) &&
+		 stats[c].size() == data.size(c) &&
+		 stats[c].hasCovariance() == covariance);
+      }
+
+      if(!valid){
+	stats.resize(PREPROCESSED);
+
+	for(unsigned int c=0;c<PREPROCESSED;c++)
+	  if(stats[c].build(data, c, covariance) == false)
+	    stats[c].reset(data.dimension(c), covariance);
+      }
+
+      unsigned int skipped = 0;
+      std::vector< whiteice::math::blas_real<float> > v;
+
+      for(const auto& r : records){
+	bool ok = (r->clusters.size() == CLUSTERS);
+
+	for(unsigned int c=0;ok && c<CLUSTERS;c++)
+	  if(r->clusters[c].size() != data.dimension(c)) ok = false;
+
+	if(!ok){ // EEG device has been changed
+	  skipped++;
+	  continue;
+	}
+
+	for(unsigned int c=0;c<CLUSTERS;c++){
+	  v.resize(r->clusters[c].size());
+	  for(unsigned int i=0;i<v.size();i++)
+	    v[i] = r->clusters[c][i];
+
+	  data.add(c, v); // applies dataset's preprocessings to row
+
+	  if(c < PREPROCESSED)
+	    stats[c].add(r->clusters[c].data());
+	}
+      }
+
+      if(skipped){
+	char buffer[256];
+	snprintf(buffer, 256, "MeasurementJournal: %d records with wrong dimensions skipped", skipped);
+	whiteice::logging.warn(buffer);
+      }
+
+      if(type != RECORD_EEG && data.removeBadData() == false)
+	whiteice::logging.warn("MeasurementJournal: bad data removal failed");
+
+      // new rows were added using dataset's preprocessing parameters which
+      // are recomputed only if statistics have drifted since they were set
+      const auto method = covariance ?
+	whiteice::dataset<>::dnCorrelationRemoval : whiteice::dataset<>::dnMeanVarianceNormalization;
+
+      for(unsigned int c=0;c<PREPROCESSED;c++){
+	if(data.hasPreprocess(c, method) &&
+	   data.hasPreprocess(c, whiteice::dataset<>::dnCorrelationRemoval) == covariance &&
+	   stats[c].drift() < drift)
+	  continue;
+
+	data.convert(c); // removes all preprocessings
+	data.preprocess(c, method);
+	stats[c].checkpoint();
+      }
+
+      if(data.save(target) == false){
+	whiteice::logging.error("MeasurementJournal: saving dataset failed");
+	return false;
+      }
+
+      if(RunningStatistics::save(statsTarget, stats) == false)
+	whiteice::logging.warn("MeasurementJournal: saving statistics failed");
+
+      written = true;
+
+      return true;
+    }
+
+
+    unsigned int MeasurementJournal::crc32(const unsigned char* data, unsigned int bytes)
+    {
+      static unsigned int table[256];
+      static std::once_flag table_flag;
+
+      std::call_once(table_flag, [](){
+	  for(unsigned int i=0;i<256;i++){
+	    unsigned int c = i;
+	    for(unsigned int k=0;k<8;k++)
+	      c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+	    table[i] = c;
+	  }
+	});
+
+      unsigned int crc = 0xFFFFFFFF;
+
+      for(unsigned int i=0;i<bytes;i++)
+	crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+      return (crc ^ 0xFFFFFFFF);
+    }
+
+
+    std::string MeasurementJournal::segmentFilename(unsigned int seq) const
+    {
+      char buffer[32];
+      snprintf(buffer, 32, ".%u", seq);
+      return journalFile + buffer;
+    }
+
+
+    void MeasurementJournal::listSegments(std::vector<unsigned int>& seqs) const
+    {
+      seqs.clear();
+
+      DIR* dp = opendir(modelDir.c_str());
+      if(dp == NULL) return;
+
+      const std::string prefix = "measurements.journal.";
+      struct dirent* ep;
+
+      while((ep = readdir(dp)) != NULL){
+	const std::string name = ep->d_name;
+
+	if(name.compare(0, prefix.length(), prefix) != 0) continue;
+	if(name.length() == prefix.length()) continue;
+
+	bool digits = true;
+	for(unsigned int i=prefix.length();i<name.length();i++)
+	  if(name[i] < '0' || name[i] > '9') digits = false;
+
+	if(digits)
+	  seqs.push_back((unsigned int)atoi(name.c_str() + prefix.length()));
+      }
+
+      closedir(dp);
+
+      std::sort(seqs.begin(), seqs.end());
+    }
+
+
+    void MeasurementJournal::compact_loop()
+    {
+      if(fold(true) == false)
+	whiteice::logging.warn("MeasurementJournal: compaction stopped before all records were folded");
+
+      std::lock_guard<std::mutex> lock(journal_mutex);
+      compacting = false;
+      compact_cond.notify_all();
+    }
+
+  };
+};
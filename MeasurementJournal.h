@@ -0,0 +1,158 @@
+/*
+ * MeasurementJournal
+ *
+ * append-only checksummed binary log of measurements. engine_storeMeasurement()
+ * appends new dataset rows to the journal as they arrive and compact()
+ * folds journaled rows into per-stimulus dataset (.ds) files in a background
+ * thread so that saving the database doesn't need to rewrite all datasets.
+ *
+ * journal file format (binary, host byte order), one record per dataset row:
+ *
+ *  <uint32 magic> <uint32 payload bytes> <uint32 crc32 of payload> <payload>
+ *
+ *  payload: <uint32 type> <uint32 name length> <dataset name>
+ *           <uint32 clusters> (<uint32 dimension> <float values..>)*
+ *
+ * reading stops at the first truncated or corrupted record so a crash loses
+ * at most the latest partially written record.
+ *
+ * folding is idempotent: each dataset is written to a temporary file,
+ * its name is then appended to the segment's .done file (fsynced) and
+ * only after that the temporary file replaces the dataset. after a crash
+ * temporary files of datasets listed in .done are renamed into place and
+ * other temporary files are removed. segments sealed in the current
+ * session are removed by clear() because the saved datasets contain them.
+ *
+ * folded rows are added to the dataset's running statistics (.stats)
+ * and preprocessing is recomputed only when the statistics have drifted.
+ */
+
+#ifndef MeasurementJournal_h
+#define MeasurementJournal_h
+
+#include <dinrhiw.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <stdio.h>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class MeasurementJournal
+    {
+    public:
+
+      // dataset types (clusters of a new dataset)
+      static const unsigned int RECORD_EEG = 0;      // EEG data, index
+      static const unsigned int RECORD_STIMULUS = 1; // input, output, index
+
+      typedef std::vector< whiteice::math::blas_real<float> > row;
+
+      MeasurementJournal();
+      ~MeasurementJournal();
+
+      // folds journals left to modelDir (earlier sessions/crash) into datasets
+      // and opens new journal for appending. datasets are named
+      // modelDir + "/" + name + ".ds"
+      bool open(const std::string& modelDir);
+
+      // writes buffered records and closes journal (doesn't compact)
+      void close();
+
+      // sets preprocessing used when folding rows into datasets
+      void setPCAPreprocess(bool pca);
+
+      // sets statistics drift after which folding recomputes preprocessing
+      void setStatisticsDrift(float drift);
+
+      // appends one row to each cluster of the named dataset
+      bool append(const std::string& name, unsigned int type,
+		  const std::vector<const row*>& clusters);
+
+      // forces appended records to disk
+      bool sync();
+
+      // folds journal into datasets in background thread (or waits if wait is true)
+      bool compact(bool wait);
+
+      // waits until background compaction has finished
+      void wait();
+
+      // removes records of the active journal (datasets already contain them)
+      bool clear();
+
+      unsigned long long getNumberOfRecords() const;
+
+    private:
+
+      struct record {
+	unsigned int type;
+	std::string name;
+	std::vector< std::vector<float> > clusters;
+      };
+
+      // seals active journal file to segment file (lock held)
+      bool seal();
+
+      // folds sealed segment files into datasets (only segments
+      // sealed after open() if session is true)
+      bool fold(bool session);
+
+      bool foldSegment(const std::string& segment);
+
+      // forces written file to disk
+      static bool syncFile(const std::string& filename);
+
+      // reads all valid records from the journal file
+      static bool readRecords(const std::string& filename, std::vector<record>& records);
+
+      // appends records to dataset filename and saves the result to target
+      // and updated statistics to statsTarget (written is false if there
+      // was nothing to fold)
+      static bool foldRecords(const std::string& filename, const std::string& target,
+			      const std::string& statsTarget, unsigned int type,
+			      const std::vector<const record*>& records,
+			      bool pca, float drift, bool& written);
+
+      static unsigned int crc32(const unsigned char* data, unsigned int bytes);
+
+      std::string segmentFilename(unsigned int seq) const;
+
+      // sealed segments of journal in modelDir in sequence order
+      void listSegments(std::vector<unsigned int>& seqs) const;
+
+      void compact_loop();
+
+      std::string modelDir;
+      std::string journalFile;
+      FILE* handle = nullptr;
+      unsigned long long records = 0; // records in active journal file
+      unsigned long long total = 0;   // records appended after open()
+      unsigned int sessionSeq = 1;    // first segment sealed after open()
+      unsigned int nextSeq = 1;       // sequence number of the next sealed segment
+      bool pcaPreprocess = false;
+      float statisticsDrift = 0.05f;
+
+      mutable std::mutex journal_mutex;
+
+      std::thread* compactor = nullptr;
+      bool compacting = false;
+      bool running = false; // false stops compaction between datasets
+      std::condition_variable compact_cond;
+
+      static const unsigned int MAGIC = 0x4c4a5a52; // "RZJL"
+
+    };
+
+  };
+};
+
+
+#endif
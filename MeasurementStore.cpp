@@ -0,0 +1,644 @@
+
+#include "MeasurementStore.h"
+#include "RunningStatistics.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    std::mutex MeasurementStore::file_mutex;
+
+
+    MeasurementStore::MeasurementStore()
+    {
+      memset(&head, 0, sizeof(head));
+    }
+
+
+    MeasurementStore::~MeasurementStore()
+    {
+      close();
+    }
+
+
+    bool MeasurementStore::open(const std::string& modelDir)
+    {
+      std::lock_guard<std::mutex> flock(file_mutex);
+      std::lock_guard<std::mutex> lock(store_mutex);
+
+      unmap();
+
+      storeFile = modelDir + "/measurements.store";
+
+      return map(storeFile);
+    }
+
+
+    void MeasurementStore::close()
+    {
+      std::lock_guard<std::mutex> lock(store_mutex);
+      unmap();
+    }
+
+
+    bool MeasurementStore::update(const std::string& modelDir,
+				  const std::vector<std::string>& names)
+    {
+      std::lock_guard<std::mutex> flock(file_mutex);
+      std::lock_guard<std::mutex> lock(store_mutex);
+
+      // remaps the store: another instance may have updated it
+      unmap();
+      storeFile = modelDir + "/measurements.store";
+      map(storeFile); // store file may not exist yet
+
+      // finds changed and removed datasets
+      std::vector<imported> changes;
+      std::vector<unsigned int> removed; // table entries of removed datasets
+
+      for(const auto& name : names){
+	if(name.length() >= sizeof(entry::name)) continue;
+
+	const std::string dsFile = modelDir + "/" + name + ".ds";
+	long long mtime = 0, size = 0;
+
+	if(fileStat(dsFile, mtime, size) == false){
+	  auto i = index.find(name);
+	  if(i != index.end()) removed.push_back(i->second);
+	  continue;
+	}
+
+	const entry* old = findEntry(name);
+
+	if(old && old->mtime == mtime && old->size == size)
+	  continue; // up to date
+
+	imported d;
+
+	if(importDataset(dsFile, d) == false){
+	  char buffer[256];
+	  snprintf(buffer, 256, "MeasurementStore: cannot import %s", dsFile.c_str());
+	  whiteice::logging.warn(buffer);
+	  continue; // keeps old rows (if any)
+	}
+
+	snprintf(d.e.name, sizeof(d.e.name), "%s", name.c_str());
+	d.e.mtime = mtime;
+	d.e.size = size;
+
+	changes.push_back(d);
+      }
+
+      if(changes.size() == 0 && removed.size() == 0)
+	return true; // store is up to date
+
+      // appends to the store if there is room in entry table and
+      // stale blocks do not take more space than live data
+      bool compact = (mapping == nullptr);
+
+      if(!compact){
+	unsigned int added = 0;
+	unsigned long long live = 0, appended = 0;
+
+	for(const auto& d : changes){
+	  if(index.find(d.e.name) == index.end()) added++;
+	  appended += blockSize(d.e);
+	}
+
+	for(const auto& i : index){
+	  bool replaced = false;
+	  for(const auto& d : changes)
+	    if(i.first == d.e.name) replaced = true;
+	  for(const auto& r : removed)
+	    if(i.second == r) replaced = true;
+
+	  if(!replaced)
+	    live += blockSize(table[i.second]);
+	}
+
+	for(const auto& d : changes)
+	  live += blockSize(d.e);
+
+	const unsigned long long start =
+	  sizeof(header) + ((unsigned long long)head.capacity)*sizeof(entry);
+	const unsigned long long stale = mapping->bytes + appended - start - live;
+
+	compact = (head.count + added > head.capacity || stale > live);
+      }
+
+      const bool ok = compact ? rewrite(changes, removed) : append(changes, removed);
+
+      if(!ok){
+	whiteice::logging.error("MeasurementStore: updating store file FAILED");
+	return false;
+      }
+
+      char buffer[256];
+      snprintf(buffer, 256, "MeasurementStore: %d datasets (%d imported, %d removed%s) %.1f MB",
+	       (int)index.size(), (int)changes.size(), (int)removed.size(),
+	       compact ? ", compacted" : "",
+	       (mapping ? mapping->bytes : 0)/(1024.0*1024.0));
+      whiteice::logging.info(buffer);
+
+      return true;
+    }
+
+
+    bool MeasurementStore::append(std::vector<imported>& changes,
+				  const std::vector<unsigned int>& removed)
+    {
+      header h = head;
+      unsigned long long offset = mapping->bytes;
+
+      FILE* handle = fopen(storeFile.c_str(), "r+b");
+      if(handle == NULL) return false;
+
+      bool ok = (fseek(handle, 0, SEEK_END) == 0);
+
+      // data blocks are written and synced before entries point to them
+      for(unsigned int i=0;ok && i<changes.size();i++){
+	const unsigned long long n = blockSize(changes[i].e);
+
+	changes[i].e.offset = offset;
+	offset += n;
+
+	if(n > 0)
+	  ok = (fwrite(changes[i].block.data(), 1, n, handle) == n);
+      }
+
+      if(ok) ok = (fflush(handle) == 0);
+
+#ifdef _WIN32
+      if(ok) ok = (_commit(_fileno(handle)) == 0);
+#else
+      if(ok) ok = (fsync(fileno(handle)) == 0);
+#endif
+
+      for(unsigned int i=0;ok && i<changes.size();i++){
+	unsigned int slot = h.count;
+
+	auto j = index.find(changes[i].e.name);
+	if(j != index.end()) slot = j->second;
+	else h.count++;
+
+	ok = (fseek(handle, sizeof(header) + slot*sizeof(entry), SEEK_SET) == 0 &&
+	      fwrite(&(changes[i].e), sizeof(entry), 1, handle) == 1);
+      }
+
+      entry empty;
+      memset(&empty, 0, sizeof(empty));
+
+      for(unsigned int i=0;ok && i<removed.size();i++){
+	ok = (fseek(handle, sizeof(header) + removed[i]*sizeof(entry), SEEK_SET) == 0 &&
+	      fwrite(&empty, sizeof(entry), 1, handle) == 1);
+      }
+
+      if(ok) ok = (fseek(handle, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, handle) == 1);
+
+      if(ok) ok = (fflush(handle) == 0);
+
+#ifdef _WIN32
+      if(ok) ok = (_commit(_fileno(handle)) == 0);
+#else
+      if(ok) ok = (fsync(fileno(handle)) == 0);
+#endif
+
+      fclose(handle);
+
+      // old mapping stays alive as long as there are views to it
+      unmap();
+
+      return map(storeFile) && ok;
+    }
+
+
+    bool MeasurementStore::rewrite(std::vector<imported>& changes,
+				   const std::vector<unsigned int>& removed)
+    {
+      // keeps all datasets in the store that are not changed or removed
+      std::vector<imported> datasets;
+      std::vector<const entry*> reused; // entry from the current mapping or nullptr
+
+      for(const auto& i : index){
+	bool replaced = false;
+	for(const auto& d : changes)
+	  if(i.first == d.e.name) replaced = true;
+	for(const auto& r : removed)
+	  if(i.second == r) replaced = true;
+
+	if(replaced) continue;
+
+	const entry* old = findEntry(i.first);
+
+	imported d;
+	d.e = *old;
+	datasets.push_back(d);
+	reused.push_back(old);
+      }
+
+      for(auto& d : changes){
+	datasets.push_back(d);
+	reused.push_back(nullptr);
+      }
+
+      const std::string tmpFile = storeFile + ".tmp";
+
+      FILE* handle = fopen(tmpFile.c_str(), "wb");
+      if(handle == NULL) return false;
+
+      header h;
+      h.magic = MAGIC;
+      h.version = VERSION;
+      h.count = datasets.size();
+      h.capacity = 2*h.count;
+      if(h.capacity < MIN_CAPACITY) h.capacity = MIN_CAPACITY;
+
+      unsigned long long offset = sizeof(header) + ((unsigned long long)h.capacity)*sizeof(entry);
+
+      for(auto& d : datasets){
+	d.e.offset = offset;
+	offset += blockSize(d.e);
+      }
+
+      bool ok = (fwrite(&h, sizeof(h), 1, handle) == 1);
+
+      entry empty;
+      memset(&empty, 0, sizeof(empty));
+
+      for(unsigned int i=0;ok && i<h.capacity;i++){
+	if(i < datasets.size())
+	  ok = (fwrite(&(datasets[i].e), sizeof(entry), 1, handle) == 1);
+	else
+	  ok = (fwrite(&empty, sizeof(entry), 1, handle) == 1);
+      }
+
+      for(unsigned int i=0;ok && i<datasets.size();i++){
+	const unsigned long long n = blockSize(datasets[i].e);
+
+	if(n == 0) continue;
+
+	if(reused[i]) // copies unchanged data directly from the old mapping
+	  ok = (fwrite(mapping->data + reused[i]->offset, 1, n, handle) == n);
+	else
+	  ok = (fwrite(datasets[i].block.data(), 1, n, handle) == n);
+      }
+
+      if(ferror(handle)) ok = false;
+
+      fclose(handle);
+
+      if(!ok){
+	remove(tmpFile.c_str());
+	return false;
+      }
+
+      unmap();
+
+#ifdef _WIN32
+      remove(storeFile.c_str());
+#endif
+
+      if(rename(tmpFile.c_str(), storeFile.c_str()) != 0){
+	remove(tmpFile.c_str());
+	return false;
+      }
+
+      return map(storeFile);
+    }
+
+
+    bool MeasurementStore::find(const std::string& name, view& v) const
+    {
+      std::lock_guard<std::mutex> lock(store_mutex);
+
+      const entry* e = findEntry(name);
+      if(e == nullptr) return false;
+
+      v.clusters = e->clusters;
+      v.rows = e->rows;
+      v.pca = (e->pca != 0);
+      v.owner = mapping;
+
+      const float* p = (const float*)(mapping->data + e->offset);
+
+      for(unsigned int c=0;c<3;c++){
+	if(c < e->clusters){
+	  v.dims[c] = e->dims[c];
+	  v.mean[c] = p; p += e->dims[c];
+	  v.stdev[c] = p; p += e->dims[c];
+	  v.data[c] = p; p += ((unsigned long long)e->rows)*e->dims[c];
+	}
+	else{
+	  v.dims[c] = 0;
+	  v.mean[c] = v.stdev[c] = v.data[c] = nullptr;
+	}
+      }
+
+      return true;
+    }
+
+
+    bool MeasurementStore::exportDataset(const std::string& name, whiteice::dataset<>& data,
+					 const bool preprocess) const
+    {
+      view v;
+
+      if(find(name, v) == false)
+	return false;
+
+      data.clear();
+
+      if(v.clusters == 2){
+	data.createCluster("Pure EEG data", v.dims[0]);
+	data.createCluster("index", v.dims[1]);
+      }
+      else{
+	data.createCluster("input", v.dims[0]);
+	data.createCluster("output", v.dims[1]);
+	data.createCluster("index", v.dims[2]);
+      }
+
+      std::vector< whiteice::math::blas_real<float> > x;
+
+      for(unsigned int c=0;c<v.clusters;c++){
+	x.resize(v.dims[c]);
+
+	for(unsigned int r=0;r<v.rows;r++){
+	  const float* row = v.row(c, r);
+
+	  for(unsigned int i=0;i<v.dims[c];i++)
+	    x[i] = row[i];
+
+	  if(data.add(c, x) == false)
+	    return false;
+	}
+      }
+
+      if(!preprocess)
+	return true;
+
+      // preprocesses data as the engine does (index cluster is not preprocessed)
+      for(unsigned int c=0;c<v.clusters-1;c++){
+	if(v.pca && v.clusters == 3)
+	  data.preprocess(c, whiteice::dataset<>::dnCorrelationRemoval);
+	else
+	  data.preprocess(c, whiteice::dataset<>::dnMeanVarianceNormalization);
+      }
+
+      return true;
+    }
+
+
+    unsigned int MeasurementStore::getNumberOfDatasets() const
+    {
+      std::lock_guard<std::mutex> lock(store_mutex);
+      return index.size();
+    }
+
+
+    unsigned long long MeasurementStore::getBytes() const
+    {
+      std::lock_guard<std::mutex> lock(store_mutex);
+      return mapping ? mapping->bytes : 0;
+    }
+
+
+    bool MeasurementStore::importDataset(const std::string& filename, imported& d)
+    {
+      whiteice::dataset<> data;
+
+      if(data.load(filename) == false)
+	return false;
+
+      const unsigned int clusters = data.getNumberOfClusters();
+
+      if(clusters != 2 && clusters != 3)
+	return false;
+
+      memset(&(d.e), 0, sizeof(entry));
+
+      d.e.clusters = clusters;
+      d.e.pca = data.hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) ? 1 : 0;
+      d.e.rows = data.size(0);
+
+      for(unsigned int c=0;c<clusters;c++){
+	data.convert(c); // removes preprocessings (raw values are stored)
+
+	d.e.dims[c] = data.dimension(c);
+
+	if(data.size(c) < d.e.rows)
+	  d.e.rows = data.size(c);
+      }
+
+      d.block.resize(blockSize(d.e)/sizeof(float));
+
+      float* p = d.block.data();
+
+      for(unsigned int c=0;c<clusters;c++){
+	const unsigned int D = d.e.dims[c];
+	const unsigned int N = d.e.rows;
+
+	float* mean = p;
+	float* stdev = p + D;
+	float* rows = p + 2*D;
+
+	RunningStatistics stats; // single pass mean and variance
+	stats.reset(D, false);
+
+	for(unsigned int r=0;r<N;r++){
+	  const auto& x = data.access(c, r);
+	  float* y = rows + ((unsigned long long)r)*D;
+
+	  for(unsigned int i=0;i<D;i++)
+	    y[i] = x[i].c[0];
+
+	  stats.add(y);
+	}
+
+	// dimensions without variance are not scaled in normalized view
+	for(unsigned int i=0;i<D;i++){
+	  mean[i] = stats.mean(i);
+	  stdev[i] = stats.stdev(i);
+	  if(stdev[i] <= 0.0f) stdev[i] = 1.0f;
+	}
+
+	p += 2*D + ((unsigned long long)N)*D;
+      }
+
+      return true;
+    }
+
+
+    bool MeasurementStore::fileStat(const std::string& filename, long long& mtime, long long& size)
+    {
+      struct stat st;
+
+      if(stat(filename.c_str(), &st) != 0)
+	return false;
+
+      mtime = (long long)st.st_mtime;
+      size = (long long)st.st_size;
+
+      return true;
+    }
+
+
+    unsigned long long MeasurementStore::blockSize(const entry& e)
+    {
+      unsigned long long n = 0;
+
+      for(unsigned int c=0;c<e.clusters && c<3;c++)
+	n += 2*e.dims[c] + ((unsigned long long)e.rows)*e.dims[c];
+
+      return n*sizeof(float);
+    }
+
+
+    MeasurementStore::mapped_file::~mapped_file()
+    {
+      if(data == nullptr) return;
+
+#ifdef _WIN32
+      UnmapViewOfFile((LPCVOID)data);
+      CloseHandle((HANDLE)mapHandle);
+      CloseHandle((HANDLE)fileHandle);
+#else
+      munmap((void*)data, bytes);
+#endif
+    }
+
+
+    bool MeasurementStore::map(const std::string& filename)
+    {
+      index.clear();
+      table.clear();
+      mapping.reset();
+
+      std::shared_ptr<mapped_file> m(new mapped_file);
+
+#ifdef _WIN32
+      // store is appended and replaced while it is mapped
+      HANDLE f = CreateFileA(filename.c_str(), GENERIC_READ,
+			     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+			     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      if(f == INVALID_HANDLE_VALUE) return false;
+
+      LARGE_INTEGER size;
+      if(GetFileSizeEx(f, &size) == 0 || size.QuadPart < (LONGLONG)sizeof(header)){
+	CloseHandle(f);
+	return false;
+      }
+
+      HANDLE mh = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+      if(mh == NULL){
+	CloseHandle(f);
+	return false;
+      }
+
+      void* p = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+      if(p == NULL){
+	CloseHandle(mh);
+	CloseHandle(f);
+	return false;
+      }
+
+      m->fileHandle = f;
+      m->mapHandle = mh;
+      m->data = (const unsigned char*)p;
+      m->bytes = (unsigned long long)size.QuadPart;
+#else
+      const int fd = ::open(filename.c_str(), O_RDONLY);
+      if(fd < 0) return false;
+
+      struct stat st;
+      if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)){
+	::close(fd);
+	return false;
+      }
+
+      void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd); // mapping keeps file open
+
+      if(p == MAP_FAILED) return false;
+
+      m->data = (const unsigned char*)p;
+      m->bytes = (unsigned long long)st.st_size;
+#endif
+
+      // validates header and entry table
+      const header* h = (const header*)m->data;
+
+      bool ok = (h->magic == MAGIC && h->version == VERSION && h->count <= h->capacity &&
+		 sizeof(header) + ((unsigned long long)h->capacity)*sizeof(entry) <= m->bytes);
+
+      const entry* entries = (const entry*)(m->data + sizeof(header));
+
+      if(ok){
+	head = *h;
+	table.assign(entries, entries + h->count);
+      }
+
+      for(unsigned int i=0;ok && i<table.size();i++){
+	const entry& e = table[i];
+
+	if(e.name[0] == '\0') continue; // removed dataset
+
+	if(e.clusters < 2 || e.clusters > 3 ||
+	   memchr(e.name, 0, sizeof(e.name)) == NULL ||
+	   e.offset + blockSize(e) > m->bytes){
+	  ok = false;
+	  break;
+	}
+
+	index[std::string(e.name)] = i;
+      }
+
+      if(!ok){
+	whiteice::logging.warn("MeasurementStore: corrupted store file => ignored");
+	index.clear();
+	table.clear();
+	return false;
+      }
+
+      mapping = m;
+
+      return true;
+    }
+
+
+    void MeasurementStore::unmap()
+    {
+      // views may still hold the mapping
+      index.clear();
+      table.clear();
+      mapping.reset();
+    }
+
+
+    const MeasurementStore::entry* MeasurementStore::findEntry(const std::string& name) const
+    {
+      auto i = index.find(name);
+      if(i == index.end() || mapping == nullptr) return nullptr;
+
+      return &(table[i->second]);
+    }
+
+  };
+};
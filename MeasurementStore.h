@@ -0,0 +1,169 @@
+/*
+ * MeasurementStore
+ *
+ * single memory-mapped columnar file (modelDir/measurements.store) holding
+ * raw (unpreprocessed) rows of all measurement datasets. each cluster of
+ * a dataset is a contiguous float array with per dimension mean and
+ * standard deviation so readers can access data and its normalized view
+ * without loading dataset<> objects.
+ *
+ * the store is a cache of the .ds files: update() imports only datasets
+ * whose .ds file has changed (modification time, size). changed datasets
+ * are appended to the end of the file and only their table entry is
+ * rewritten, the file is compacted when the entry table is full or when
+ * stale blocks take more space than live data.
+ *
+ * views returned by find() keep their mapping alive so they stay valid
+ * even if another thread calls update() while they are used. several
+ * instances can use the same store file: updates are serialized and
+ * each instance keeps a copy of the entry table it has mapped.
+ *
+ * file format (binary, host byte order):
+ *  <header> <entry table[capacity]> <data: per cluster mean[D] stdev[D] rows[N*D]>
+ */
+
+#ifndef MeasurementStore_h
+#define MeasurementStore_h
+
+#include <dinrhiw.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class MeasurementStore
+    {
+    public:
+
+      // zero-copy view to the dataset in the store
+      struct view {
+	unsigned int clusters = 0;
+	unsigned int rows = 0;
+	unsigned int dims[3] = { 0, 0, 0 };
+	const float* data[3] = { nullptr, nullptr, nullptr };  // rows x dims[c] (row-major)
+	const float* mean[3] = { nullptr, nullptr, nullptr };
+	const float* stdev[3] = { nullptr, nullptr, nullptr };
+	bool pca = false; // dataset used PCA preprocessing
+
+	std::shared_ptr<const void> owner; // keeps mapping alive
+
+	const float* row(unsigned int c, unsigned int r) const {
+	  return data[c] + ((unsigned long long)r)*dims[c];
+	}
+      };
+
+      MeasurementStore();
+      ~MeasurementStore();
+
+      MeasurementStore(const MeasurementStore&) = delete;
+      MeasurementStore& operator=(const MeasurementStore&) = delete;
+
+      // maps store file of modelDir (if it exists)
+      bool open(const std::string& modelDir);
+
+      void close();
+
+      // imports new and changed modelDir/<name>.ds files to the store.
+      // datasets not in names are kept, datasets whose .ds file
+      // has been removed are dropped
+      bool update(const std::string& modelDir, const std::vector<std::string>& names);
+
+      // finds dataset from the store, view is valid as long as it exists
+      bool find(const std::string& name, view& v) const;
+
+      // creates dataset<> from stored rows, clusters are mean-variance or
+      // PCA preprocessed if preprocess is true and contain raw values otherwise
+      bool exportDataset(const std::string& name, whiteice::dataset<>& data,
+			 const bool preprocess = true) const;
+
+      unsigned int getNumberOfDatasets() const;
+
+      // size of the mapped file
+      unsigned long long getBytes() const;
+
+    private:
+
+      struct header {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int count;    // used table entries
+	unsigned int capacity; // allocated table entries
+      };
+
+      struct entry {
+	char name[64];
+	long long mtime;
+	long long size;
+	unsigned int clusters;
+	unsigned int rows;
+	unsigned int dims[3];
+	unsigned int pca;
+	unsigned long long offset; // file offset of data block (removed entry: name is empty)
+      };
+
+      // imported dataset before it is written to the store
+      struct imported {
+	entry e;
+	std::vector<float> block;
+      };
+
+      // read-only file mapping, unmapped when the last view releases it
+      struct mapped_file {
+	const unsigned char* data = nullptr;
+	unsigned long long bytes = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mapHandle = nullptr;
+#endif
+	~mapped_file();
+      };
+
+      static bool importDataset(const std::string& filename, imported& d);
+
+      static bool fileStat(const std::string& filename, long long& mtime, long long& size);
+
+      static unsigned long long blockSize(const entry& e);
+
+      // appends changed blocks and rewrites their table entries in place
+      bool append(std::vector<imported>& changes, const std::vector<unsigned int>& removed);
+
+      // writes compacted store to temporary file which replaces the old one
+      bool rewrite(std::vector<imported>& changes, const std::vector<unsigned int>& removed);
+
+      bool map(const std::string& filename);
+      void unmap();
+
+      const entry* findEntry(const std::string& name) const;
+
+      std::string storeFile;
+
+      std::shared_ptr<const mapped_file> mapping;
+
+      // header and entry table of the mapping (other instances rewrite the file)
+      header head;
+      std::vector<entry> table;
+
+      std::map<std::string, unsigned int> index; // dataset name => table entry
+
+      mutable std::mutex store_mutex;
+
+      static std::mutex file_mutex; // serializes store file updates of all instances
+
+      static const unsigned int MAGIC = 0x534d5a52; // "RZMS"
+      static const unsigned int VERSION = 2;
+
+      static const unsigned int MIN_CAPACITY = 64;
+
+    };
+
+  };
+};
+
+
+#endif
@@ -0,0 +1,459 @@
+#include "ModelTrainingScheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    ModelTrainingScheduler::ModelTrainingScheduler()
+    {
+      setLimits(0, 0);
+    }
+
+
+    ModelTrainingScheduler::~ModelTrainingScheduler()
+    {
+      clear();
+    }
+
+
+    void ModelTrainingScheduler::setLimits(unsigned int maxThreads, unsigned long long maxMemory)
+    {
+      if(maxThreads == 0){
+	maxThreads = std::thread::hardware_concurrency();
+	if(maxThreads == 0) maxThreads = 2;
+      }
+
+      if(maxMemory == 0){
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+
+	if(GlobalMemoryStatusEx(&status))
+	  maxMemory = status.ullTotalPhys/2;
+#else
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	const long pagesize = sysconf(_SC_PAGE_SIZE);
+
+	if(pages > 0 && pagesize > 0)
+	  maxMemory = ((unsigned long long)pages)*((unsigned long long)pagesize)/2;
+#endif
+	if(maxMemory == 0) maxMemory = 1ULL << 30; // 1 GB
+      }
+
+      this->maxThreads = maxThreads;
+      this->maxMemory = maxMemory;
+    }
+
+
+    void ModelTrainingScheduler::setOptimization(unsigned int iterations, bool bayesian,
+						 unsigned int samples)
+    {
+      this->iterations = iterations;
+      this->bayesian = bayesian;
+      this->samples = samples;
+    }
+
+
+    bool ModelTrainingScheduler::addJob(const std::string& kind, const std::string& name,
+					const whiteice::nnetwork<>& nn, whiteice::dataset<>& data,
+					const std::string& filename,
+					bool warmStart, unsigned int iterations)
+    {
+      if(data.getNumberOfClusters() < 2 || data.size(0) == 0)
+	return false;
+
+      job* j = new job;
+
+      j->kind = kind;
+      j->name = name;
+      j->filename = filename;
+      j->data = &data;
+      j->nn = new whiteice::nnetwork<>(nn);
+      j->warm = warmStart;
+      j->iterations = (warmStart && iterations > 0) ? iterations : this->iterations;
+
+      // threads are sized to dataset: small datasets don't benefit from many threads
+      j->threads = data.size(0)/ROWS_PER_THREAD;
+      if(j->threads < 1) j->threads = 1;
+      if(j->threads > MAX_JOB_THREADS) j->threads = MAX_JOB_THREADS;
+      if(j->threads > maxThreads) j->threads = maxThreads;
+
+      // per thread network copies and gradients, bayesian samples and minibatches
+      whiteice::math::vertex<> w;
+      j->nn->exportdata(w);
+
+      const unsigned long long params = w.size();
+      const unsigned long long row = data.dimension(0) + data.dimension(1);
+
+      j->memory = sizeof(float)*(params*(4ULL*j->threads + (bayesian ? samples : 0)) +
+				 row*data.size(0));
+
+      jobs.push_back(j);
+
+      return true;
+    }
+
+
+    void ModelTrainingScheduler::skipJob(const std::string& kind, const std::string& name)
+    {
+      job* j = new job;
+
+      j->kind = kind;
+      j->name = name;
+      j->skipped = true;
+      j->state = DONE;
+      j->progress = 1.0f;
+
+      jobs.push_back(j);
+    }
+
+
+    bool ModelTrainingScheduler::update()
+    {
+      bool ok = true;
+      unsigned int running = 0;
+
+      for(auto j : jobs){
+	if(j->state == OPTIMIZING || j->state == SAMPLING){
+	  if(advance(j) == false) ok = false;
+	}
+
+	if(j->state == OPTIMIZING || j->state == SAMPLING)
+	  running++;
+      }
+
+      // starts pending jobs, largest datasets first (shortest total time)
+      std::vector<job*> pending;
+
+      for(auto j : jobs)
+	if(j->state == PENDING) pending.push_back(j);
+
+      std::stable_sort(pending.begin(), pending.end(), [](const job* a, const job* b) {
+	return (a->data->size(0) > b->data->size(0));
+      });
+
+      for(auto j : pending){
+	const unsigned int freeThreads = (usedThreads < maxThreads) ? (maxThreads - usedThreads) : 0;
+
+	if(running > 0 && (freeThreads == 0 || usedMemory + j->memory > maxMemory))
+	  continue; // smaller job may still fit
+
+	// large jobs start with the free threads instead of waiting behind smaller jobs
+	if(running > 0 && j->threads > freeThreads)
+	  j->threads = freeThreads;
+
+	if(start(j)) running++;
+	else ok = false;
+      }
+
+      return ok;
+    }
+
+
+    void ModelTrainingScheduler::clear()
+    {
+      for(auto j : jobs){
+	if(j->state == OPTIMIZING || j->state == SAMPLING)
+	  release(j, FAILED);
+
+	if(j->nn) delete j->nn;
+	delete j;
+      }
+
+      jobs.clear();
+      saved.clear();
+      usedThreads = 0;
+      usedMemory = 0;
+    }
+
+
+    bool ModelTrainingScheduler::finished() const
+    {
+      for(auto j : jobs)
+	if(j->state != DONE && j->state != FAILED)
+	  return false;
+
+      return true;
+    }
+
+
+    unsigned int ModelTrainingScheduler::getFinishedJobs(const std::string& kind) const
+    {
+      unsigned int n = 0;
+
+      for(auto j : jobs)
+	if(j->state == DONE && (kind.length() == 0 || j->kind == kind))
+	  n++;
+
+      return n;
+    }
+
+
+    unsigned int ModelTrainingScheduler::getFailedJobs() const
+    {
+      unsigned int n = 0;
+
+      for(auto j : jobs)
+	if(j->state == FAILED) n++;
+
+      return n;
+    }
+
+
+    unsigned int ModelTrainingScheduler::getSkippedJobs() const
+    {
+      unsigned int n = 0;
+
+      for(auto j : jobs)
+	if(j->skipped) n++;
+
+      return n;
+    }
+
+
+    void ModelTrainingScheduler::takeSavedModels(std::vector<std::string>& filenames)
+    {
+      filenames = saved;
+      saved.clear();
+    }
+
+
+    float ModelTrainingScheduler::getProgress() const
+    {
+      if(jobs.size() == 0) return 1.0f;
+
+      float sum = 0.0f;
+
+      for(auto j : jobs){
+	if(j->state == DONE || j->state == FAILED) sum += 1.0f;
+	else sum += j->progress;
+      }
+
+      return sum/jobs.size();
+    }
+
+
+    std::string ModelTrainingScheduler::getStatus() const
+    {
+      std::vector<const job*> running;
+
+      for(auto j : jobs)
+	if(j->state == OPTIMIZING || j->state == SAMPLING)
+	  running.push_back(j);
+
+      // reports jobs that take longest first
+      std::sort(running.begin(), running.end(), [](const job* a, const job* b) {
+	return (a->progress < b->progress);
+      });
+
+      char buffer[256];
+      snprintf(buffer, 256, "[%d/%d models (%d unchanged), %d running, %d/%d threads]",
+	       getFinishedJobs(), (int)jobs.size(), getSkippedJobs(), (int)running.size(),
+	       usedThreads, maxThreads);
+
+      std::string status = buffer;
+
+      const unsigned int SHOW_JOBS = 4;
+
+      for(unsigned int i=0;i<running.size() && i<SHOW_JOBS;i++){
+	const job* j = running[i];
+
+	snprintf(buffer, 256, " %s %s %.0f%% [ETA %.1f min]",
+		 j->kind.c_str(), j->name.c_str(), 100.0f*j->progress,
+		 j->eta.estimate()/60.0f);
+
+	status += buffer;
+      }
+
+      if(running.size() > SHOW_JOBS)
+	status += " ..";
+
+      return status;
+    }
+
+
+    bool ModelTrainingScheduler::start(job* j)
+    {
+      if(j->warm == false)
+	j->nn->randomize();
+
+      j->optimizer = new whiteice::math::NNGradDescent<>();
+      j->optimizer->setUseMinibatch(true);
+
+      j->state = OPTIMIZING;
+      j->progress = 0.0f;
+      j->eta.start(0.0f, 1.0f);
+
+      usedThreads += j->threads;
+      usedMemory += j->memory;
+
+      if(j->optimizer->startOptimize(*(j->data), *(j->nn), j->threads) == false){
+	char buffer[512];
+	snprintf(buffer, 512, "ModelTrainingScheduler: NNGradDescent::startOptimize() FAILED. %s %s",
+		 j->kind.c_str(), j->name.c_str());
+	whiteice::logging.error(buffer);
+
+	release(j, FAILED);
+	return false;
+      }
+
+      char buffer[512];
+      snprintf(buffer, 512, "resonanz model optimization started: %s %s database size: %d threads: %d%s",
+	       j->kind.c_str(), j->name.c_str(), j->data->size(0), j->threads,
+	       j->warm ? " (warm start)" : "");
+      whiteice::logging.info(buffer);
+
+      return true;
+    }
+
+
+    bool ModelTrainingScheduler::advance(job* j)
+    {
+      if(j->state == OPTIMIZING){
+	whiteice::math::blas_real<float> error = 1000.0f;
+	unsigned int iters = 0;
+
+	j->optimizer->getSolutionStatistics(error, iters);
+
+	float p = (j->iterations > 0) ? iters/((float)j->iterations) : 1.0f;
+	if(p > 1.0f) p = 1.0f;
+
+	j->progress = bayesian ? 0.5f*p : p;
+	j->eta.update(j->progress);
+
+	if(iters < j->iterations)
+	  return true;
+
+	// gets finished solution
+	j->optimizer->stopComputation();
+
+	whiteice::nnetwork<> tmpnn;
+	whiteice::math::vertex<> w;
+
+	j->optimizer->getSolution(tmpnn, error, iters);
+	tmpnn.exportdata(w);
+	j->nn->importdata(w);
+
+	delete j->optimizer;
+	j->optimizer = nullptr;
+
+	{
+	  char buffer[512];
+	  snprintf(buffer, 512, "resonanz model optimization stopped. %s %s iterations: %d error: %f",
+		   j->kind.c_str(), j->name.c_str(), iters, error.c[0]);
+	  whiteice::logging.info(buffer);
+	}
+
+	if(bayesian){
+	  // switches to uncertainty analysis (sampler uses one thread)
+	  const bool adaptive = true;
+
+	  j->sampler = new whiteice::UHMC<>(*(j->nn), *(j->data), adaptive);
+	  j->sampler->setMinibatch(true);
+	  j->sampler->startSampler();
+
+	  usedThreads -= (j->threads - 1);
+	  j->threads = 1;
+	  j->state = SAMPLING;
+
+	  return true;
+	}
+
+	whiteice::bayesian_nnetwork<> model;
+	model.importNetwork(*(j->nn));
+
+	return save(j, model);
+      }
+      else if(j->state == SAMPLING){
+	const unsigned int n = j->sampler->getNumberOfSamples();
+
+	float p = (samples > 0) ? n/((float)samples) : 1.0f;
+	if(p > 1.0f) p = 1.0f;
+
+	j->progress = 0.5f + 0.5f*p;
+	j->eta.update(j->progress);
+
+	if(n < samples)
+	  return true;
+
+	j->sampler->stopSampler();
+
+	{
+	  char buffer[512];
+	  snprintf(buffer, 512, "resonanz bayes model optimization stopped. %s %s samples: %d",
+		   j->kind.c_str(), j->name.c_str(), n);
+	  whiteice::logging.info(buffer);
+	}
+
+	whiteice::bayesian_nnetwork<> model;
+	j->sampler->getNetwork(model);
+
+	return save(j, model);
+      }
+
+      return true;
+    }
+
+
+    bool ModelTrainingScheduler::save(job* j, whiteice::bayesian_nnetwork<>& model)
+    {
+      if(model.save(j->filename) == false){
+	char buffer[512];
+	snprintf(buffer, 512, "saving nn configuration file failed: %s %s",
+		 j->kind.c_str(), j->name.c_str());
+	whiteice::logging.error(buffer);
+
+	release(j, FAILED);
+	return false;
+      }
+
+      saved.push_back(j->filename);
+
+      release(j, DONE);
+      return true;
+    }
+
+
+    void ModelTrainingScheduler::release(job* j, job_state state)
+    {
+      if(j->optimizer){
+	j->optimizer->stopComputation();
+	delete j->optimizer;
+	j->optimizer = nullptr;
+      }
+
+      if(j->sampler){
+	j->sampler->stopSampler();
+	delete j->sampler;
+	j->sampler = nullptr;
+      }
+
+      if(j->state == OPTIMIZING || j->state == SAMPLING){
+	usedThreads -= j->threads;
+	usedMemory -= j->memory;
+      }
+
+      if(j->nn){
+	delete j->nn; // model has been saved
+	j->nn = nullptr;
+      }
+
+      j->state = state;
+      j->progress = 1.0f;
+    }
+
+  };
+};
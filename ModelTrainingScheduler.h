@@ -0,0 +1,128 @@
+/*
+ * ModelTrainingScheduler
+ *
+ * trains prediction models of many stimuli (pictures, keywords, synth)
+ * concurrently. each job optimizes its own copy of the network with
+ * NNGradDescent (and optionally collects bayesian samples with UHMC) and
+ * saves the result. job's optimizer threads are sized to its dataset and
+ * jobs are started (largest first) while total threads and estimated
+ * memory use stay within limits.
+ *
+ * update() is called periodically by the engine thread: it advances and
+ * saves finished jobs and starts pending ones. getStatus() reports running
+ * jobs and their ETAs.
+ *
+ * warm started jobs continue from the given network weights with fewer
+ * iterations and skipped jobs (unchanged models) only count as finished.
+ */
+
+#ifndef ModelTrainingScheduler_h
+#define ModelTrainingScheduler_h
+
+#include <dinrhiw.h>
+
+#include <string>
+#include <vector>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class ModelTrainingScheduler
+    {
+    public:
+
+      ModelTrainingScheduler();
+      ~ModelTrainingScheduler();
+
+      // limits total number of optimizer threads and memory (bytes) used by
+      // running jobs. 0 selects automatically (all cores, half of physical memory)
+      void setLimits(unsigned int maxThreads, unsigned long long maxMemory);
+
+      // gradient descent iterations and bayesian samples of each job
+      void setOptimization(unsigned int iterations, bool bayesian, unsigned int samples);
+
+      // adds job that trains (randomized) copy of nn with data and saves it to
+      // filename. data must not change until job has finished.
+      // kind groups jobs ("picture", "keyword", "synth").
+      // warm start uses nn weights as the initial solution and optimizes
+      // iterations (0 = default) iterations
+      bool addJob(const std::string& kind, const std::string& name,
+		  const whiteice::nnetwork<>& nn, whiteice::dataset<>& data,
+		  const std::string& filename,
+		  bool warmStart = false, unsigned int iterations = 0);
+
+      // adds already finished job of model that doesn't need training
+      void skipJob(const std::string& kind, const std::string& name);
+
+      // advances running jobs and starts pending jobs, returns false if some job failed
+      bool update();
+
+      // stops running jobs and removes all jobs
+      void clear();
+
+      unsigned int getNumJobs() const { return jobs.size(); }
+
+      // true if all jobs have finished (or failed)
+      bool finished() const;
+
+      // number of finished jobs (of kind if not empty)
+      unsigned int getFinishedJobs(const std::string& kind = "") const;
+      unsigned int getFailedJobs() const;
+      unsigned int getSkippedJobs() const;
+
+      // filenames of models saved since the previous call
+      void takeSavedModels(std::vector<std::string>& filenames);
+
+      // fraction of all work done [0,1]
+      float getProgress() const;
+
+      // running jobs with their progress and ETA
+      std::string getStatus() const;
+
+      static const unsigned int ROWS_PER_THREAD = 2000; // dataset rows per optimizer thread
+      static const unsigned int MAX_JOB_THREADS = 8;
+
+    private:
+
+      enum job_state { PENDING, OPTIMIZING, SAMPLING, DONE, FAILED };
+
+      struct job {
+	std::string kind, name, filename;
+	whiteice::dataset<>* data = nullptr;
+	whiteice::nnetwork<>* nn = nullptr;
+
+	whiteice::math::NNGradDescent<>* optimizer = nullptr;
+	whiteice::UHMC<>* sampler = nullptr;
+
+	job_state state = PENDING;
+	bool warm = false, skipped = false;
+	unsigned int iterations = 0;       // gradient descent iterations
+	unsigned int threads = 1;          // threads reserved while running
+	unsigned long long memory = 0;     // estimated bytes while running
+	float progress = 0.0f;
+
+	mutable whiteice::linear_ETA<float> eta;
+      };
+
+      bool start(job* j);
+      bool advance(job* j);
+      bool save(job* j, whiteice::bayesian_nnetwork<>& model);
+      void release(job* j, job_state state);
+
+      std::vector<job*> jobs;
+      std::vector<std::string> saved;
+
+      unsigned int maxThreads = 0, usedThreads = 0;
+      unsigned long long maxMemory = 0, usedMemory = 0;
+
+      unsigned int iterations = 500;
+      bool bayesian = false;
+      unsigned int samples = 250;
+    };
+
+  };
+};
+
+
+#endif
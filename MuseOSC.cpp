@@ -34,6 +34,8 @@ MuseOSC::MuseOSC(const unsigned int portNum) :
   for(auto& v : value) v = 0.0f;
   
   latest_sample_seen_t = 0LL;
+
+  sampleBuffer.init(this->getNumberOfSignals());
   
   try{
     std::unique_lock<std::mutex> lock(connection_mutex);
@@ -241,6 +243,8 @@ void MuseOSC::muse_loop() // worker thread loop
       // gets current time
       auto ms_since_epoch = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
       
+      sampleBuffer.push(v, (long long)ms_since_epoch);
+      
       std::lock_guard<std::mutex> lock(data_mutex);
       value = v;
       latest_sample_seen_t = (long long)ms_since_epoch;
@@ -37,6 +37,8 @@ MuseOSC4::MuseOSC4(const unsigned int portNum) :
   for(auto& v : value) v = 0.0f;
   
   latest_sample_seen_t = 0LL;
+
+  sampleBuffer.init(this->getNumberOfSignals());
   
   try{
     std::unique_lock<std::mutex> lock(connection_mutex);
@@ -342,6 +344,9 @@ void MuseOSC4::muse_loop() // worker thread loop
       else{
 	// gets current time
 	auto ms_since_epoch = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+	sampleBuffer.push(w, (long long)ms_since_epoch);
+	
 	{
 	  std::lock_guard<std::mutex> lock(data_mutex);
 	  value = w;
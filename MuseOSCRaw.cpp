@@ -0,0 +1,492 @@
+/*
+ * MuseOSCRaw.cpp
+ *
+ */
+
+#include "MuseOSCRaw.h"
+#include "spectral_entropy.h"
+#include <math.h>
+#include <cmath>
+#include <unistd.h>
+#include <chrono>
+
+#include "oscpkt.hh"
+#include "udp.hh"
+
+#include <dinrhiw.h>
+
+
+using namespace oscpkt;
+using namespace std::chrono;
+
+namespace whiteice {
+namespace resonanz {
+
+MuseOSCRaw::MuseOSCRaw(const unsigned int portNum,
+		       const double updateHz,
+		       const double samplingHz,
+		       const std::string& captureFile,
+		       const std::string& wisdomFile_) :
+  port(portNum), replayFile(""), replayLoop(false), wisdomFile(wisdomFile_)
+{
+  init(updateHz, samplingHz);
+
+  if(captureFile.length() > 0){
+    capture = fopen(captureFile.c_str(), "wb");
+
+    if(capture == NULL){
+      char buffer[256];
+      snprintf(buffer, 256, "MuseOSCRaw: cannot open capture file %s",
+	       captureFile.c_str());
+      whiteice::logging.error(buffer);
+    }
+  }
+
+  try{
+    running = true;
+    worker_thread = new std::thread(&MuseOSCRaw::muse_loop, this);
+  }
+  catch(std::exception&){
+    running = false;
+    if(capture) fclose(capture);
+    capture = NULL;
+    throw std::runtime_error("MuseOSCRaw: couldn't create worker thread.");
+  }
+}
+
+
+MuseOSCRaw::MuseOSCRaw(const std::string& replayFile_,
+		       const bool loop,
+		       const double updateHz,
+		       const double samplingHz,
+		       const std::string& wisdomFile_) :
+  port(0), replayFile(replayFile_), replayLoop(loop), wisdomFile(wisdomFile_)
+{
+  init(updateHz, samplingHz);
+
+  FILE* handle = fopen(replayFile.c_str(), "rb");
+  if(handle == NULL)
+    throw std::runtime_error("MuseOSCRaw: cannot open replay file.");
+  fclose(handle);
+
+  try{
+    running = true;
+    worker_thread = new std::thread(&MuseOSCRaw::replay_loop, this);
+  }
+  catch(std::exception&){
+    running = false;
+    throw std::runtime_error("MuseOSCRaw: couldn't create worker thread.");
+  }
+}
+
+
+void MuseOSCRaw::init(const double updateHz, const double samplingHz)
+{
+  worker_thread = nullptr;
+  running = false;
+  capture = NULL;
+  captureStart = 0LL;
+
+  value.resize(this->getNumberOfSignals());
+  for(auto& v : value) v = 0.0f;
+
+  latest_sample_seen_t = 0LL;
+
+  sampleBuffer.init(this->getNumberOfSignals());
+
+  // STFT of the latest second of data, new frame updateHz times per second
+  double fs = samplingHz;
+  if(fs < 64.0) fs = 64.0;
+
+  double hz = updateHz;
+  if(hz < 1.0) hz = 1.0;
+  else if(hz > fs) hz = fs;
+
+  const unsigned int windowSize = (unsigned int)round(fs);
+  const unsigned int hop = (unsigned int)round(fs/hz);
+
+  // measured STFT plan is reused from the previous runs if possible
+  if(wisdomFile.length() > 0 && SpectralAnalyzer::loadWisdom(wisdomFile) == false)
+    whiteice::logging.info("MuseOSCRaw: no FFTW wisdom file " + wisdomFile);
+
+  analyzer.setup(fs, CHANNELS, windowSize, hop > 0 ? hop : 1,
+		 SpectralAnalyzer::WINDOW_HANN);
+
+  // headband sends only is_good messages when sensor contact changes,
+  // assumes all channels are good until told otherwise
+  connectionQuality.resize(CHANNELS);
+  for(auto& q : connectionQuality) q = 1;
+
+  // first order high-pass filter (0.5 Hz) removes electrode DC offset (~800 uV)
+  dcAlpha = 1.0 - exp(-2.0*M_PI*0.5/fs);
+  dcLevel.resize(CHANNELS);
+  latest.resize(CHANNELS);
+  for(unsigned int c=0;c<CHANNELS;c++){
+    dcLevel[c] = 0.0;
+    latest[c] = 0.0;
+  }
+
+  hasSamples = false;
+  latestFrame = 0;
+}
+
+
+MuseOSCRaw::~MuseOSCRaw()
+{
+  running = false;
+  if(worker_thread != nullptr){
+    worker_thread->join();
+    delete worker_thread;
+  }
+
+  worker_thread = nullptr;
+
+  if(capture) fclose(capture);
+  capture = NULL;
+
+  if(wisdomFile.length() > 0 && SpectralAnalyzer::saveWisdom(wisdomFile) == false)
+    whiteice::logging.warn("MuseOSCRaw: cannot save FFTW wisdom file " + wisdomFile);
+}
+
+/*
+ * Returns unique DataSource name
+ */
+std::string MuseOSCRaw::getDataSourceName() const
+{
+  if(replayFile.length() > 0)
+    return "Interaxon Muse [4 channels raw EEG replay]";
+  else
+    return "Interaxon Muse [4 channels raw EEG]";
+}
+
+/**
+ * Returns true if connection and data collection to device is currently working.
+ */
+bool MuseOSCRaw::connectionOk() const
+{
+  long long ms_since_epoch = (long long)duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+  std::lock_guard<std::mutex> lock(data_mutex);
+
+  if(latest_sample_seen_t == 0LL)
+    return false; // no data has been received
+
+  if((ms_since_epoch - latest_sample_seen_t) > 2000)
+    return false; // latest sample is more than 2000ms second old => bad connection/data
+  else
+    return true; // sample within 2000ms => good
+}
+
+/**
+ * returns current value
+ */
+bool MuseOSCRaw::data(std::vector<float>& x) const
+{
+  if(this->connectionOk() == false)
+    return false;
+
+  std::lock_guard<std::mutex> lock(data_mutex);
+
+  x = value;
+
+  return true;
+}
+
+bool MuseOSCRaw::getSignalNames(std::vector<std::string>& names) const
+{
+  // same signals as MuseOSC4
+  names.resize(CHANNELS*6+1);
+
+  const char* bands[6] = { "Delta", "Theta", "Alpha", "Beta", "Gamma", "Spectral Entropy" };
+
+  for(unsigned int c=0;c<CHANNELS;c++){
+    for(unsigned int b=0;b<6;b++){
+      char buffer[64];
+      snprintf(buffer, 64, "Muse %d: %s", c+1, bands[b]);
+      names[c*6 + b] = buffer;
+    }
+  }
+
+  names[CHANNELS*6] = "Muse: Total Power";
+
+  return true;
+}
+
+
+unsigned int MuseOSCRaw::getNumberOfSignals() const
+{
+  return (CHANNELS*6+1);
+}
+
+
+void MuseOSCRaw::muse_loop() // worker thread loop
+{
+  // sets MuseOSCRaw internal thread high priority thread
+  // so that no samples are lost
+  {
+    sched_param sch_params;
+    int policy = SCHED_FIFO; // SCHED_RR
+
+    pthread_getschedparam(pthread_self(), &policy, &sch_params);
+
+    policy = SCHED_FIFO;
+    sch_params.sched_priority = sched_get_priority_max(policy);
+
+    if(pthread_setschedparam(pthread_self(),
+			     policy, &sch_params) != 0){
+    }
+
+#ifdef WINOS
+    SetThreadPriority(GetCurrentThread(),
+		      THREAD_PRIORITY_HIGHEST);
+#endif
+  }
+
+  UdpSocket sock;
+
+  while(running){
+    sock.bindTo(port);
+    if(sock.isOk()) break;
+    sock.close();
+    sleep(1);
+  }
+
+  captureStart = (long long)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+
+  while(running){
+
+    if(sock.receiveNextPacket(30)){
+
+      if(capture){
+	const long long t = (long long)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count() - captureStart;
+	const unsigned int bytes = (unsigned int)sock.packetSize();
+
+	if(fwrite(&t, sizeof(t), 1, capture) != 1 ||
+	   fwrite(&bytes, sizeof(bytes), 1, capture) != 1 ||
+	   fwrite(sock.packetData(), 1, bytes, capture) != bytes)
+	{
+	  whiteice::logging.error("MuseOSCRaw: writing capture file FAILED. Stopping capture.");
+	  fclose(capture);
+	  capture = NULL;
+	}
+      }
+
+      processPacket(sock.packetData(), (unsigned int)sock.packetSize());
+    }
+
+    if(sock.isOk() == false){
+      // tries to reconnect the socket to port
+      sock.close();
+      sleep(1);
+      sock.bindTo(port);
+    }
+
+  }
+
+  sock.close();
+
+  if(capture) fflush(capture);
+}
+
+
+void MuseOSCRaw::replay_loop() // worker thread loop
+{
+  std::vector<char> packet;
+
+  while(running){
+    FILE* handle = fopen(replayFile.c_str(), "rb");
+
+    if(handle == NULL){
+      whiteice::logging.error("MuseOSCRaw: cannot open replay file.");
+      break;
+    }
+
+    // packets are replayed with the same timing as they were recorded
+    const auto start = steady_clock::now();
+    unsigned long long packets = 0;
+
+    while(running){
+      long long t = 0;
+      unsigned int bytes = 0;
+
+      if(fread(&t, sizeof(t), 1, handle) != 1) break;
+      if(fread(&bytes, sizeof(bytes), 1, handle) != 1) break;
+      if(bytes > 65536) break; // corrupted file (larger than UDP packet)
+
+      packet.resize(bytes);
+      if(bytes > 0 && fread(packet.data(), 1, bytes, handle) != bytes) break;
+
+      const auto next = start + milliseconds(t);
+
+      // sleeps in short steps so that destructor doesn't need to wait long
+      while(running && steady_clock::now() < next){
+	auto wait = next - steady_clock::now();
+	if(wait > milliseconds(30)) wait = milliseconds(30);
+	std::this_thread::sleep_for(wait);
+      }
+
+      if(running == false) break;
+
+      processPacket(packet.data(), bytes);
+      packets++;
+    }
+
+    fclose(handle);
+
+    {
+      char buffer[256];
+      snprintf(buffer, 256, "MuseOSCRaw: replayed %llu packets from %s",
+	       packets, replayFile.c_str());
+      whiteice::logging.info(buffer);
+    }
+
+    if(replayLoop == false || packets == 0) break;
+  }
+}
+
+
+void MuseOSCRaw::processPacket(const void* data, const unsigned int size)
+{
+  PacketReader pr;
+  pr.init(data, size);
+  Message* msg = NULL;
+
+  std::vector<double> x(CHANNELS);
+
+  while(pr.isOk() && ((msg = pr.popMessage()) != 0)){
+    Message::ArgReader r = msg->match("/muse/eeg");
+
+    if(r.isOk() == true){
+      // 4 or more floats (newer headsets send also aux channels), uses first 4
+      unsigned int c = 0;
+
+      while(r.nbArgRemaining() && c < CHANNELS){
+	float f = 0.0f;
+
+	if(r.isFloat()){
+	  r = r.popFloat(f);
+	}
+	else if(r.isDouble()){
+	  double d = 0.0;
+	  r = r.popDouble(d);
+	  f = (float)d;
+	}
+	else break;
+
+	// dropped samples are sent as NaNs, repeats the previous value
+	if(std::isfinite(f)) latest[c] = f;
+	x[c] = latest[c];
+	c++;
+      }
+
+      if(c == CHANNELS && r.isOk())
+	processSample(x);
+
+      continue;
+    }
+
+    r = msg->match("/muse/elements/is_good");
+
+    if(r.isOk() == true){
+      std::vector<int> quality;
+
+      while(r.nbArgRemaining()){
+	if(r.isInt32()){
+	  int32_t i;
+	  r = r.popInt32(i);
+	  quality.push_back((int)i);
+	}
+	else{
+	  r = r.pop();
+	}
+      }
+
+      for(unsigned int i=0;i<quality.size() && i<CHANNELS;i++)
+	connectionQuality[i] = quality[i];
+    }
+  }
+}
+
+
+void MuseOSCRaw::processSample(const std::vector<double>& x)
+{
+  std::vector<double> y(CHANNELS);
+
+  for(unsigned int c=0;c<CHANNELS;c++){
+    if(hasSamples == false) dcLevel[c] = x[c];
+    dcLevel[c] += dcAlpha*(x[c] - dcLevel[c]);
+    y[c] = x[c] - dcLevel[c];
+  }
+
+  hasSamples = true;
+
+  analyzer.push(y);
+
+  if(analyzer.getFrameNumber() == latestFrame)
+    return; // no new STFT frame
+
+  latestFrame = analyzer.getFrameNumber();
+
+  // Muse headset's absolute band powers: log10 of the sum of power spectral
+  // density (uV^2/Hz) over band frequencies (bels). bad channels are zero
+  const double lo[5] = { 1.0, 4.0, 7.5, 13.0, 30.0 };
+  const double hi[5] = { 4.0, 8.0, 13.0, 30.0, 44.0 };
+
+  std::vector<float> w; // measurement
+  float total = 0.0f;
+
+  std::vector<double> PF;
+  double hz_per_sample = 0.0;
+
+  for(unsigned int c=0;c<CHANNELS;c++){
+    if(analyzer.getPowerSpectrum(c, PF, hz_per_sample) == false)
+      return;
+
+    std::vector<float> P(5, 0.0f); // band powers (bels)
+
+    for(unsigned int i=0;i<5 && connectionQuality[c];i++){
+      double sum = 0.0;
+
+      for(unsigned int k=0;k<PF.size();k++){
+	const double hz = k*hz_per_sample;
+	if(hz >= lo[i] && hz < hi[i]) sum += PF[k];
+      }
+
+      P[i] = (float)log10(sum + 10e-10);
+    }
+
+    // same scaling as MuseOSC4: saturates bels to [0,1] using tanh(t)
+    for(unsigned int i=0;i<5;i++){
+      const float t = (1 + tanh(2*(P[i] - 0.6)))/2.0;
+      w.push_back(t);
+    }
+
+    // spectral entropy of band powers (MuseOSC4 uses bels, not raw powers)
+    w.push_back(spectral_entropy(P));
+
+    // MuseOSC4 sums band powers as if they were decibels
+    for(unsigned int i=0;i<5;i++)
+      total += pow(10.0f, P[i]/10.0f);
+  }
+
+  // total power in decibels (mean of channels) saturated like MuseOSC4
+  total /= (float)CHANNELS;
+  if(total < 10e-10f) total = 10e-10f;
+  total = 10.0f * log10(total);
+
+  w.push_back((1 + tanh(2*(total - 7.0)))/2.0);
+
+  // gets current time
+  auto ms_since_epoch = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+
+  sampleBuffer.push(w, (long long)ms_since_epoch);
+
+  {
+    std::lock_guard<std::mutex> lock(data_mutex);
+    value = w;
+    latest_sample_seen_t = (long long)ms_since_epoch;
+  }
+}
+
+} /* namespace resonanz */
+} /* namespace whiteice */
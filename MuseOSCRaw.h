@@ -0,0 +1,131 @@
+/*
+ * MuseOSCRaw.h
+ *
+ * 4 channel raw EEG Muse OSC data source. Band powers and spectral entropy
+ * are calculated from raw /muse/eeg samples instead of using headset
+ * application's (smoothed and low rate) /muse/elements/ values.
+ *
+ * Received OSC packets can be recorded to a capture file which can be
+ * replayed later without a headset.
+ *
+ * FFTW wisdom is loaded from wisdomFile (if given) before STFT plans are
+ * created and saved back to it when the data source is destroyed.
+ */
+
+#ifndef MUSEOSCRAW_H_
+#define MUSEOSCRAW_H_
+
+#include "DataSource.h"
+#include "spectral_analysis.h"
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <exception>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <stdio.h>
+
+namespace whiteice {
+namespace resonanz {
+
+/**
+ * Receives raw Muse OSC EEG data (/muse/eeg) from given UDP localhost port
+ * or replays recorded capture file. Outputs the same 25 values as MuseOSC4
+ * (4 channels and 6 measurements + total power) so that targets and models
+ * are compatible between the devices: band powers are calculated like
+ * headset's absolute band powers (bels of summed PSD over Muse's band
+ * frequencies) and scaled with the same formulas as in MuseOSC4.
+ *
+ * Raw samples are kept in per-channel ring buffers and STFT of the latest
+ * second of data is calculated updateHz times per second.
+ *
+ * capture file format (binary, host byte order), one record per OSC packet:
+ * <long long msecs since start of capture> <unsigned int bytes> <packet data>
+ */
+class MuseOSCRaw: public DataSource {
+public:
+  // listens UDP port, records received packets to captureFile if it is not empty
+  MuseOSCRaw(const unsigned int port,
+	     const double updateHz = 10.0,
+	     const double samplingHz = 256.0,
+	     const std::string& captureFile = "",
+	     const std::string& wisdomFile = ""); // throw(std::runtime_error)
+
+  // replays capture file in real-time (loops forever if loop is true)
+  MuseOSCRaw(const std::string& replayFile,
+	     const bool loop,
+	     const double updateHz = 10.0,
+	     const double samplingHz = 256.0,
+	     const std::string& wisdomFile = ""); // throw(std::runtime_error)
+
+  virtual ~MuseOSCRaw();
+
+  /*
+   * Returns unique DataSource name
+   */
+  virtual std::string getDataSourceName() const;
+
+  /**
+   * Returns true if connection and data collection
+   * to device is currently working.
+   */
+  virtual bool connectionOk() const;
+
+  /**
+   * returns current value
+   */
+  virtual bool data(std::vector<float>& x) const;
+
+  virtual bool getSignalNames(std::vector<std::string>& names) const;
+
+  virtual unsigned int getNumberOfSignals() const;
+
+ private:
+
+  void init(const double updateHz, const double samplingHz);
+
+  void muse_loop();   // worker thread loop (UDP socket)
+  void replay_loop(); // worker thread loop (capture file)
+
+  // parses OSC packet and processes /muse/eeg and /muse/elements/is_good messages
+  void processPacket(const void* data, const unsigned int size);
+
+  // adds raw multichannel sample to STFT and updates values when there is a new frame
+  void processSample(const std::vector<double>& x);
+
+  static const unsigned int CHANNELS = 4;
+
+  const unsigned int port;
+  const std::string replayFile;
+  const bool replayLoop;
+  const std::string wisdomFile;
+
+  std::thread* worker_thread;
+  std::atomic<bool> running;
+
+  FILE* capture; // records received packets if not null
+  long long captureStart;
+
+  // accessed only from the worker thread
+  SpectralAnalyzer analyzer;
+  std::vector<int> connectionQuality;
+  std::vector<double> dcLevel; // removes DC offset of the raw signal
+  std::vector<double> latest;  // latest valid raw sample
+  double dcAlpha;
+  bool hasSamples;
+  unsigned long long latestFrame;
+
+  mutable std::mutex data_mutex;
+  std::vector<float> value; // currently measured value
+  long long latest_sample_seen_t; // time of the latest measured value
+
+};
+
+} /* namespace resonanz */
+} /* namespace whiteice */
+
+#endif /* MUSEOSCRAW_H_ */
@@ -0,0 +1,249 @@
+
+#include "NNIndex.h"
+#include <algorithm>
+#include <math.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    NNIndex::NNIndex()
+    {
+      D = 0;
+      N = 0;
+      treeSize = 0;
+    }
+
+
+    NNIndex::~NNIndex()
+    {
+    }
+
+
+    bool NNIndex::build(const whiteice::dataset<>& data, unsigned int cluster)
+    {
+      clear();
+
+      if(cluster >= data.getNumberOfClusters())
+	return false;
+
+      D = data.dimension(cluster);
+
+      return update(data, cluster);
+    }
+
+
+    bool NNIndex::update(const whiteice::dataset<>& data, unsigned int cluster)
+    {
+      if(cluster >= data.getNumberOfClusters())
+	return false;
+
+      if(data.dimension(cluster) != D || data.size(cluster) < N){
+	// data was reset or rows were removed: re-index everything
+	clear();
+	D = data.dimension(cluster);
+      }
+
+      const unsigned int NEWSIZE = data.size(cluster);
+
+      if(NEWSIZE == N) return true;
+
+      points.resize(NEWSIZE*D);
+
+      for(unsigned int i=N;i<NEWSIZE;i++){
+	const auto& v = data.access(cluster, i);
+	if(v.size() != D){
+	  clear();
+	  return false;
+	}
+
+	for(unsigned int d=0;d<D;d++)
+	  points[i*D + d] = v[d].c[0];
+      }
+
+      N = NEWSIZE;
+
+      // rebuilds tree when unindexed tail becomes large compared to tree
+      // (amortized O(log N) per inserted row)
+      if(N - treeSize > std::max(4*LEAF_SIZE, treeSize/4))
+	build_tree();
+
+      return true;
+    }
+
+
+    void NNIndex::clear()
+    {
+      points.clear();
+      order.clear();
+      nodes.clear();
+
+      D = 0;
+      N = 0;
+      treeSize = 0;
+    }
+
+
+    bool NNIndex::search(const whiteice::math::vertex<>& x, unsigned int k,
+			 std::vector<unsigned int>& rows,
+			 std::vector<float>& distances) const
+    {
+      rows.clear();
+      distances.clear();
+
+      if(x.size() != D || k == 0) return false;
+
+      std::vector<float> q(D);
+      for(unsigned int d=0;d<D;d++)
+	q[d] = x[d].c[0];
+
+      // max-heap of (squared distance, row) of the current k best rows
+      std::vector< std::pair<float, unsigned int> > heap;
+      heap.reserve(k+1);
+
+      if(nodes.size() > 0)
+	search_node(0, q.data(), k, heap);
+
+      for(unsigned int i=treeSize;i<N;i++)
+	check_row(i, q.data(), k, heap);
+
+      std::sort_heap(heap.begin(), heap.end());
+
+      rows.resize(heap.size());
+      distances.resize(heap.size());
+
+      for(unsigned int i=0;i<heap.size();i++){
+	distances[i] = sqrtf(heap[i].first);
+	rows[i] = heap[i].second;
+      }
+
+      return true;
+    }
+
+
+    void NNIndex::build_tree()
+    {
+      order.resize(N);
+      for(unsigned int i=0;i<N;i++)
+	order[i] = i;
+
+      nodes.clear();
+      nodes.reserve(2*(N/LEAF_SIZE + 1));
+
+      treeSize = N;
+
+      if(N > 0) build_node(0, N);
+    }
+
+
+    unsigned int NNIndex::build_node(unsigned int begin, unsigned int end)
+    {
+      const unsigned int n = nodes.size();
+      nodes.push_back(kdnode());
+
+      nodes[n].dim = -1;
+      nodes[n].split = 0.0f;
+      nodes[n].left = 0;
+      nodes[n].right = 0;
+      nodes[n].begin = begin;
+      nodes[n].end = end;
+
+      if(end - begin <= LEAF_SIZE)
+	return n;
+
+      // splits along dimension with the largest spread
+      int bestdim = -1;
+      float bestspread = 0.0f;
+
+      for(unsigned int d=0;d<D;d++){
+	float minv = points[order[begin]*D + d];
+	float maxv = minv;
+
+	for(unsigned int i=begin+1;i<end;i++){
+	  const float v = points[order[i]*D + d];
+	  if(v < minv) minv = v;
+	  else if(v > maxv) maxv = v;
+	}
+
+	if(maxv - minv > bestspread){
+	  bestspread = maxv - minv;
+	  bestdim = d;
+	}
+      }
+
+      if(bestdim < 0) // all points are identical
+	return n;
+
+      const unsigned int mid = begin + (end - begin)/2;
+      const unsigned int dim = bestdim;
+
+      std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+		       [&](unsigned int a, unsigned int b){
+			 return (points[a*D + dim] < points[b*D + dim]);
+		       });
+
+      const float split = points[order[mid]*D + dim];
+
+      const unsigned int left  = build_node(begin, mid);
+      const unsigned int right = build_node(mid, end);
+
+      nodes[n].dim = bestdim;
+      nodes[n].split = split;
+      nodes[n].left = left;
+      nodes[n].right = right;
+
+      return n;
+    }
+
+
+    void NNIndex::search_node(unsigned int n, const float* q, unsigned int k,
+			      std::vector< std::pair<float, unsigned int> >& heap) const
+    {
+      const kdnode& node = nodes[n];
+
+      if(node.dim < 0){
+	for(unsigned int i=node.begin;i<node.end;i++)
+	  check_row(order[i], q, k, heap);
+
+	return;
+      }
+
+      const float diff = q[node.dim] - node.split;
+
+      const unsigned int nearer = (diff < 0.0f) ? node.left  : node.right;
+      const unsigned int further = (diff < 0.0f) ? node.right : node.left;
+
+      search_node(nearer, q, k, heap);
+
+      if(heap.size() < k || diff*diff < heap.front().first)
+	search_node(further, q, k, heap);
+    }
+
+
+    void NNIndex::check_row(unsigned int row, const float* q, unsigned int k,
+			    std::vector< std::pair<float, unsigned int> >& heap) const
+    {
+      const float* p = &(points[row*D]);
+      const float worst = (heap.size() < k) ? INFINITY : heap.front().first;
+
+      float dist = 0.0f;
+      for(unsigned int d=0;d<D && dist < worst;d++){
+	const float t = q[d] - p[d];
+	dist += t*t;
+      }
+
+      if(dist >= worst) return;
+
+      if(heap.size() >= k){
+	std::pop_heap(heap.begin(), heap.end());
+	heap.pop_back();
+      }
+
+      heap.push_back(std::make_pair(dist, row));
+      std::push_heap(heap.begin(), heap.end());
+    }
+
+  };
+};
@@ -0,0 +1,84 @@
+/*
+ * NNIndex
+ *
+ * KD-tree index over input cluster rows of dataset<> for fast
+ * k-nearest neighbour queries (used by engine_estimateNN()).
+ *
+ * Rows added to dataset after build() are indexed with update() and kept
+ * in a small linearly scanned tail until the tree is rebuilt. Index stores
+ * copies of preprocessed rows so it must be rebuilt with build() when the
+ * preprocessing of the dataset changes (row count stays the same).
+ */
+
+#ifndef NNIndex_h
+#define NNIndex_h
+
+#include <dinrhiw.h>
+#include <vector>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class NNIndex
+    {
+    public:
+
+      NNIndex();
+      ~NNIndex();
+
+      // (re)builds index from all rows of the given cluster
+      bool build(const whiteice::dataset<>& data, unsigned int cluster = 0);
+
+      // indexes rows added to data after the latest build()/update(),
+      // rebuilds the whole index if data has shrunk or dimensions changed
+      bool update(const whiteice::dataset<>& data, unsigned int cluster = 0);
+
+      void clear();
+
+      // number of indexed rows
+      unsigned int size() const { return N; }
+
+      unsigned int dimension() const { return D; }
+
+      // finds k nearest rows (euclidean distance) to x,
+      // results are sorted in increasing distance order
+      bool search(const whiteice::math::vertex<>& x, unsigned int k,
+		  std::vector<unsigned int>& rows,
+		  std::vector<float>& distances) const;
+
+    private:
+
+      struct kdnode {
+	int dim; // split dimension, -1 means leaf node
+	float split;
+	unsigned int left, right; // child nodes
+	unsigned int begin, end;  // rows order[begin..end-1] in leaf node
+      };
+
+      unsigned int build_node(unsigned int begin, unsigned int end);
+
+      void build_tree();
+
+      void search_node(unsigned int n, const float* q, unsigned int k,
+		       std::vector< std::pair<float, unsigned int> >& heap) const;
+
+      void check_row(unsigned int row, const float* q, unsigned int k,
+		     std::vector< std::pair<float, unsigned int> >& heap) const;
+
+      std::vector<float> points;       // N x D row-major copy of indexed data
+      std::vector<unsigned int> order; // row numbers in tree order
+      std::vector<kdnode> nodes;
+
+      unsigned int D = 0, N = 0;
+      unsigned int treeSize = 0; // rows [treeSize,N) are not in tree yet
+
+      static constexpr unsigned int LEAF_SIZE = 16;
+
+    };
+
+  };
+};
+
+
+#endif
@@ -28,6 +28,8 @@ namespace whiteice
 
       latestMeasurementTime = 0LL;
 
+      sampleBuffer.init(this->getNumberOfSignals());
+
       try{
 	polling = true;
 	worker_thread = new std::thread(&NeuroskyEEG::polling_thread, this);
@@ -175,6 +177,8 @@ namespace whiteice
 
 	    if(hasMeditation)
 	      latestMeasurement[1] = meditation;
+
+	    sampleBuffer.push(latestMeasurement, ms_since_epoch);
 	  }
 	}
 
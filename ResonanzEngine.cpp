@@ -13,10 +13,13 @@
 #include <limits>
 #include <map>
 #include <set>
+#include <atomic>
+#include <algorithm>
 
 #include <cmath>
 #include <math.h>
 #include <dirent.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <time.h>
 #include <libgen.h>
@@ -49,6 +52,7 @@
 
 #include "MuseOSC.h"
 #include "MuseOSC4.h"
+#include "MuseOSCRaw.h"
 
 #include "FMSoundSynthesis.h"
 
@@ -58,6 +62,7 @@
 #include "SDLAVCodec.h"
 
 #include "pictureFeatureVector.h"
+#include "stimulus_scoring.h"
 
 #include "hermitecurve.h"
 
@@ -72,7 +77,8 @@ namespace whiteice {
 namespace resonanz {
 
   // FIXME: numDeviceChannels is NOT USED BY CODE AND SHOULD BE REMOVED FROM PARAMETERS
-ResonanzEngine::ResonanzEngine(const unsigned int numDeviceChannels) 
+ResonanzEngine::ResonanzEngine(const unsigned int numDeviceChannels, const bool headless) :
+  headless(headless)
 {        
   logging.info("ResonanzEngine ctor starting");
   
@@ -160,6 +166,13 @@ ResonanzEngine::ResonanzEngine(const unsigned int numDeviceChannels)
   thread_initialized = false;
   keypressed = false;
   
+  if(headless){
+    // virtual clock must run before the engine thread reads time
+    headlessClockStart = (long long)std::chrono::duration_cast<std::chrono::milliseconds>
+      (std::chrono::system_clock::now().time_since_epoch()).count();
+    scheduler.setVirtualClock(true);
+  }
+  
   // starts updater thread thread
   workerThread = new std::thread(&ResonanzEngine::engine_loop, this);
   workerThread->detach();
@@ -208,6 +221,12 @@ ResonanzEngine::~ResonanzEngine()
     hmmUpdator = nullptr;
   }
 
+  if(brainTrainer){
+    brainTrainer->stopTrain();
+    delete brainTrainer;
+    brainTrainer = nullptr;
+  }
+
   if(kmeans && hmmUpdator == nullptr){
     delete kmeans;
     kmeans = nullptr;
@@ -234,6 +253,7 @@ ResonanzEngine::~ResonanzEngine()
   }
 
   if(video){
+    if(synth) synth->setCapture(nullptr);
     delete video;
     video = nullptr;
   }
@@ -261,6 +281,14 @@ ResonanzEngine::~ResonanzEngine()
 std::string ResonanzEngine::getEngineStatus() throw()
 {
   std::lock_guard<std::mutex> lock(status_mutex);
+  
+  // reports timing jitter of engine tasks when engine is running
+  if(thread_initialized && thread_is_running){
+    const std::string stats = scheduler.getStatistics();
+    if(stats.length() > 0)
+      return (engineState + " [" + stats + ", " + imageCache.getStatistics() + "]");
+  }
+  
   return engineState;
 }
 
@@ -596,6 +624,30 @@ bool ResonanzEngine::setEEGDeviceType(int deviceNumber)
 #endif
       
     }
+    else if(deviceNumber == ResonanzEngine::RE_EEG_IA_MUSE_RAW_DEVICE){
+      if(eeg != nullptr) delete eeg;
+      eeg = nullptr;
+
+      if(museReplayFile.length() > 0) // replays recorded OSC packets (loops)
+	eeg = new MuseOSCRaw(museReplayFile, true, museUpdateHz, 256.0, museWisdomFile);
+      else
+	eeg = new MuseOSCRaw(musePort, museUpdateHz, 256.0, museCaptureFile, museWisdomFile); // 4545
+
+      int counter = 0;
+
+      while(counter < 10){
+	millisleep(2000); // gives engine time connect MuseOSCRaw object to UDP stream..
+	if(eeg->connectionOk()) break;
+	counter++;
+
+	if(museReplayFile.length() > 0)
+	  printf("Waiting Muse raw EEG replay (%s)..\n", museReplayFile.c_str());
+	else
+	  printf("Waiting connection to Muse OSC UDP server (localhost:%d)..\n", musePort);
+	fflush(stdout);
+      }
+
+    }
 #ifdef LIGHTSTONE
     else if(deviceNumber == ResonanzEngine::RE_WD_LIGHTSTONE){
       if(eeg != nullptr) delete eeg;
@@ -908,6 +960,32 @@ bool ResonanzEngine::setParameter(const std::string& parameter, const std::strin
     }
     else return false;
   }
+  else if(parameter == "tick-ms"){
+    // engine tick length: how often stimulus can change (50-1000ms)
+    const int ms = atoi(value.c_str());
+    if(ms < 50 || ms > 1000) return false;
+    
+    // engine thread changes tick length at the start of its next tick
+    requestedTickMS = (unsigned int)ms;
+    
+    return true;
+  }
+  else if(parameter == "image-cache-mb"){
+    // memory budget of scaled pictures cache
+    const int mb = atoi(value.c_str());
+    if(mb < 16) return false;
+    
+    imageCache.setBudget((unsigned int)mb);
+    return true;
+  }
+  else if(parameter == "nn-neighbours"){
+    // number of nearest data points used by data-rbf model (0 = all data)
+    const int k = atoi(value.c_str());
+    if(k < 0) return false;
+    
+    nnNeighbours = (unsigned int)k;
+    return true;
+  }
   else if(parameter == "optimize-synth-only"){
     if(value == "true"){
       optimizeSynthOnly = true;
@@ -957,10 +1035,48 @@ bool ResonanzEngine::setParameter(const std::string& parameter, const std::strin
       randomPrograms = false;
     }
   }
+  else if(parameter == "headless"){
+    // headless mode is fixed when the engine is constructed
+    if(value == "true") return headless;
+    else if(value == "false") return !headless;
+    else return false;
+  }
+  else if(parameter == "headless-size"){
+    // offscreen resolution WIDTHxHEIGHT (video frames must have even size)
+    int w = 0, h = 0;
+    if(sscanf(value.c_str(), "%dx%d", &w, &h) != 2) return false;
+    if(w < 16 || h < 16 || w > 8192 || h > 8192 || (w % 2) || (h % 2)) return false;
+    
+    HEADLESS_WIDTH = w;
+    HEADLESS_HEIGHT = h;
+    
+    return true;
+  }
+  else if(parameter == "headless-length"){
+    const int secs = atoi(value.c_str());
+    if(secs < 0) return false;
+    
+    headlessLength = (unsigned int)secs;
+    return true;
+  }
   else if(parameter == "muse-port"){
     musePort = (unsigned int)atoi(value.c_str());
     std::cout << "MUSE OSC PORT IS NOW: " << musePort << std::endl;
   }
+  else if(parameter == "muse-update-hz"){
+    const double hz = atof(value.c_str());
+    if(hz < 1.0 || hz > 64.0) return false;
+    museUpdateHz = hz;
+  }
+  else if(parameter == "muse-replay-file"){
+    museReplayFile = value;
+  }
+  else if(parameter == "muse-capture-file"){
+    museCaptureFile = value;
+  }
+  else if(parameter == "fftw-wisdom-file"){
+    museWisdomFile = value;
+  }
   else{
     return false;
   }
@@ -987,15 +1103,12 @@ void ResonanzEngine::engine_loop()
   }
 #endif
   
-  long long tickStartTime = 0;
-  {
-    auto t1 = std::chrono::system_clock::now().time_since_epoch();
-    auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
-    
-    tickStartTime = t1ms;
-  }
+  // periodic tasks of the engine: engine tick (commands, stimulus selection
+  // and screen updates) and HMM brain state update (EEG sampling)
+  scheduler.clear();
+  const unsigned int tickTask = scheduler.addTask("tick", TICK_MS);
+  const unsigned int hmmTask  = scheduler.addTask("hmm", MEASUREMODE_DELAY_MS);
   
-  long long lastTickProcessed = -1;
   tick = 0;
   
   long long eegLastTickConnectionOk = tick;
@@ -1026,7 +1139,6 @@ void ResonanzEngine::engine_loop()
 
   std::vector<float> distanceTarget; // distance of program to target value
 
-  long long lastHMMStateUpdateMS = 0; // last time HMM model has been updated
   HMMstate = 0;
   
   std::vector<float> eegCurrent;
@@ -1065,58 +1177,43 @@ void ResonanzEngine::engine_loop()
   
   while(thread_is_running){
 
-    bool tick_delay_sleep = false;
+    // tick length changed with setParameter("tick-ms")
+    {
+      const unsigned int ms = requestedTickMS.exchange(0);
+      
+      if(ms > 0 && ms != TICK_MS){
+	TICK_MS = ms;
+	SHOWTIME_TICKS = (long long)(0.5 / (TICK_MS/1000.0));
+	scheduler.setPeriod(tickTask, TICK_MS);
+      }
+    }
     
-    // sleeps until there is a new engine tick
-    while(lastTickProcessed >= tick){
-      auto t1 = std::chrono::system_clock::now().time_since_epoch();
-      auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+    // sleeps until the next task deadline and runs periodic tasks until there is a new engine tick
+    bool tickDue = false;
+    const long long prevTick = tick;
+    
+    while(tickDue == false && thread_is_running){
+      const unsigned int task = scheduler.waitNext();
       
-      auto currentTick = (t1ms - tickStartTime)/TICK_MS;
-
-      // UPDATE HMM STATE
-      {
-	const auto timeSinceLastUpdateMS = ((long long)t1ms) - lastHMMStateUpdateMS;
-	
-	if(timeSinceLastUpdateMS >= MEASUREMODE_DELAY_MS){
-	  // update HMM state here
-	  std::lock_guard<std::mutex> lock(hmm_mutex); // NOT REALLY NEEDED FOR NOW
-
-	  if(hmm != NULL && kmeans != NULL && eeg != NULL){
-	  
-	    math::vertex<> data;
-	  
-	    if(eeg->data(eegCurrent)){
-	      data.resize(eegCurrent.size());
-
-	      for(unsigned int i=0;i<data.size();i++)
-		data[i] = eegCurrent[i];
-	      
-	      unsigned int dataCluster = kmeans->getClusterIndex(data);
-	      unsigned int nextState = 0;
-	      if(HMMstate >= HMM_NUM_CLUSTERS){
-		HMMstate = hmm->sampleInitialHiddenState();
-	      }
-	      hmm->next_state(HMMstate, nextState, dataCluster);
-	      HMMstate = nextState;
-	    }
-	    
-	    lastHMMStateUpdateMS = (long long)t1ms;
+      if(task == hmmTask){
+	// UPDATE HMM STATE (forward filter has its own copy of K-Means/HMM: no hmm_mutex)
+	if(hmmFilter.hasModel() && eeg != NULL){
+	  if(eeg->data(eegCurrent)){
+	    if(hmmFilter.update(eegCurrent))
+	      HMMstate = hmmFilter.getState();
 	  }
 	}
-	
-      }
-      
-      if(tick < currentTick){
-	tick = currentTick;
       }
-      else{
-	tick_delay_sleep = true;
-	engine_sleep(TICK_MS/20);
+      else if(task == tickTask){
+	tick = scheduler.getTaskTick(tickTask);
+	tickDue = true;
       }
     }
     
-    lastTickProcessed = tick;
+    if(thread_is_running == false) break;
+    
+    // engine is in sync if no engine ticks were skipped
+    const bool tick_delay_sleep = (tick - prevTick <= 1);
 		
 		
     ResonanzCommand prevCommand = currentCommand;
@@ -1152,11 +1249,11 @@ void ResonanzEngine::engine_loop()
 
 	// stops encoding if needed
 	if(video != nullptr){
-	  auto t1 = std::chrono::system_clock::now().time_since_epoch();
-	  auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+	  auto t1ms = engine_clockMS();
 	  
 	  logging.info("stopping theora video encoding.");
 	  
+	  if(synth) synth->setCapture(nullptr);
 	  video->stopEncoding((unsigned long long)(t1ms - programStarted));
 	  delete video;
 	  video = nullptr;
@@ -1173,7 +1270,7 @@ void ResonanzEngine::engine_loop()
 	}
 	
 	engine_setStatus("resonanz-engine: saving database..");
-	if(engine_saveDatabase(prevCommand.modelDir) == false){
+	if(engine_syncDatabase(prevCommand.modelDir) == false){
 	  logging.error("saving database failed");
 	}
 	else{
@@ -1194,10 +1291,17 @@ void ResonanzEngine::engine_loop()
 	  hmmUpdator = nullptr;
 	}
 	
+	if(brainTrainer != nullptr){
+	  brainTrainer->stopTrain();
+	  delete brainTrainer;
+	  brainTrainer = nullptr;
+	}
+	
 	if(hmm != nullptr && hmmUpdator == nullptr){
 	  hmm->stopTrain();
 	  delete hmm;
 	  hmm = nullptr;
+	  hmmFilter.clearModel();
 	}
 
 	if(kmeans != nullptr && hmmUpdator == nullptr){
@@ -1206,17 +1310,7 @@ void ResonanzEngine::engine_loop()
 	  kmeans = nullptr;
 	}
 	
-	if(optimizer != nullptr){
-	  optimizer->stopComputation();
-	  delete optimizer;
-	  optimizer = nullptr;
-	}
-	
-	if(bayes_optimizer != nullptr){
-	  bayes_optimizer->stopSampler();
-	  delete bayes_optimizer;
-	  bayes_optimizer = nullptr;
-	}
+	trainingScheduler.clear();
 
 	// also saves database because preprocessing parameters may have changed
 	if(engine_saveDatabase(prevCommand.modelDir) == false){
@@ -1243,11 +1337,18 @@ void ResonanzEngine::engine_loop()
 	  delete hmmUpdator;
 	  hmmUpdator = nullptr;
 	}
+	
+	if(brainTrainer != nullptr){
+	  brainTrainer->stopTrain();
+	  delete brainTrainer;
+	  brainTrainer = nullptr;
+	}
 
 	if(hmm != nullptr){
 	  hmm->stopTrain(); // to be sure
 	  delete hmm;
 	  hmm = nullptr;
+	  hmmFilter.clearModel();
 	}
 
 	if(kmeans != nullptr){
@@ -1272,11 +1373,11 @@ void ResonanzEngine::engine_loop()
 	
 	// stops encoding if needed
 	if(video != nullptr){
-	  auto t1 = std::chrono::system_clock::now().time_since_epoch();
-	  auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+	  auto t1ms = engine_clockMS();
 	  
 	  logging.info("stopping theora video encoding.");
 	  
+	  if(synth) synth->setCapture(nullptr);
 	  video->stopEncoding((unsigned long long)(t1ms - programStarted));
 	  delete video;
 	  video = nullptr;
@@ -1303,7 +1404,15 @@ void ResonanzEngine::engine_loop()
       
       
       // checks if we want to have open graphics window and opens one if needed
-      if(currentCommand.showScreen == true && prevCommand.showScreen == false){
+      if(headless){
+	// renders into offscreen surface instead of window
+	if(window != nullptr) SDL_DestroyWindow(window);
+	window = nullptr;
+	
+	if(currentCommand.showScreen && engine_openOffscreen(fontname) == false)
+	  logging.error("resonanz-engine: creating offscreen surface failed");
+      }
+      else if(currentCommand.showScreen == true && prevCommand.showScreen == false){
 	if(window != nullptr) SDL_DestroyWindow(window);
 	
 	SDL_DisplayMode mode;
@@ -1434,7 +1543,8 @@ void ResonanzEngine::engine_loop()
 	
 	bool loadData = (currentCommand.command != ResonanzCommand::CMD_DO_OPTIMIZE);
 	
-	if(engine_loadMedia(currentCommand.pictureDir, currentCommand.keywordsFile, loadData) == false){
+	if(engine_loadMedia(currentCommand.pictureDir, currentCommand.keywordsFile,
+			    currentCommand.modelDir, loadData) == false){
 	  logging.error("loading media files failed");
 	}
 	else{
@@ -1465,6 +1575,7 @@ void ResonanzEngine::engine_loop()
 	currentPictureModel = 0;
 	currentKeywordModel = 0;
 	soundModelCalculated = false;
+	trainingScheduler.clear();
 	
 	if(this->use_bayesian_nnetwork)
 	  logging.info("model optimization uses BAYESIAN UNCERTAINTY estimation through sampling");
@@ -1585,8 +1696,7 @@ void ResonanzEngine::engine_loop()
 	  
 	  // starts measuring time for the execution of the program
 	  
-	  auto t0 = std::chrono::system_clock::now().time_since_epoch();
-	  auto t0ms = std::chrono::duration_cast<std::chrono::milliseconds>(t0).count();
+	  auto t0ms = engine_clockMS();
 	  programStarted = t0ms;
 	  lastProgramSecond = -1;
 	  
@@ -1649,7 +1759,12 @@ void ResonanzEngine::engine_loop()
 	engine_setStatus("resonanz-engine: starting sound synthesis..");
 	
 	if(currentCommand.audioFile.length() <= 0){
-	  if(synth){
+	  if(synth && headless){
+	    // sound is synthesized with engine ticks (no audio device)
+	    if(synth->playOffline() == false)
+	      logging.error("starting offline sound synthesis failed");
+	  }
+	  else if(synth){
 	    if(synth->play() == false){
 	      logging.error("starting sound synthesis failed");
 	    }
@@ -1668,12 +1783,29 @@ void ResonanzEngine::engine_loop()
 	  // starts video encoder
 	  //video = new SDLTheora(0.50f); // 50% quality
 	  video = new SDLAVCodec(0.50f); // 50% quality
+	  video->setMemoryBudget(VIDEO_MEMORY_BUDGET);
+	  
+	  // headless engine waits for the encoder: every frame is written
+	  video->setOverflowPolicy(headless ? SDLAVCodec::OVERFLOW_BLOCK : VIDEO_OVERFLOW_POLICY);
+	  
+	  // synthesized sound is saved as the audio track of the video
+	  // (offline synthesis can run far ahead of the encoder)
+	  const unsigned int audioBlocks = AudioCapture::DEFAULT_BLOCKS*(headless ? 16 : 1);
+	  
+	  const bool audio = (synth != nullptr && synth->getSampleRate() > 0 &&
+			      currentCommand.audioFile.length() <= 0 &&
+			      videoAudio.init(synth->getSampleRate(), synth->getChannels(),
+					      synth->getBufferSamples(), audioBlocks));
+	  
+	  if(audio) video->setAudioSource(&videoAudio);
 	  
 	  if(video->startEncoding("neurostim.mp4",
 				  SCREEN_WIDTH, SCREEN_HEIGHT) == false) // "neurostim.ogv"
 	    logging.error("starting theora video encoder failed");
-	  else
+	  else{
 	    logging.info("started theora video encoding");
+	    if(audio) synth->setCapture(&videoAudio);
+	  }
 	}
 	else{
 	  // do not save video
@@ -1683,8 +1815,7 @@ void ResonanzEngine::engine_loop()
 
       
       if(currentCommand.command == ResonanzCommand::CMD_DO_RANDOM){
-	auto t0 = std::chrono::system_clock::now().time_since_epoch();
-	auto t0ms = std::chrono::duration_cast<std::chrono::milliseconds>(t0).count();
+	auto t0ms = engine_clockMS();
 	programStarted = t0ms;
 	lastProgramSecond = -1;
 	
@@ -1694,6 +1825,12 @@ void ResonanzEngine::engine_loop()
 	}
       }
       
+      // offline synthesized sound is timestamped with the engine (virtual) clock
+      if(headless && video != nullptr && programStarted > 0){
+	video->setAudioClock(programStarted);
+	offlineSamples = 0;
+      }
+      
     }
     
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1707,10 +1844,21 @@ void ResonanzEngine::engine_loop()
       engine_updateScreen(); // always updates window if it exists
     }
     else if(currentCommand.command == ResonanzCommand::CMD_DO_RANDOM){
-      engine_setStatus("resonanz-engine: showing random examples..");
+      if(video)
+	engine_setStatus("resonanz-engine: showing random examples.. [" + video->getStatus() + "]");
+      else
+	engine_setStatus("resonanz-engine: showing random examples..");
       
       engine_stopHibernation();
       
+      // headless random stimulation has fixed length
+      if(headless && headlessLength > 0 && programStarted > 0 &&
+	 engine_clockMS() - programStarted >= 1000LL*headlessLength){
+	logging.info("headless random stimulation has stopped [length]");
+	cmdStopCommand();
+	continue;
+      }
+      
       if(pictures.size() > 0){
 	if(keywords.size() > 0){
 	  auto& key = currentKey;
@@ -1819,12 +1967,23 @@ void ResonanzEngine::engine_loop()
 	}
 	
 	eeg->data(eegBefore);
+
+	long long stimulusStart = (long long)std::chrono::duration_cast<std::chrono::milliseconds>
+	  (std::chrono::system_clock::now().time_since_epoch()).count();
+	
+	const unsigned long long synthGeneration =
+	  (synth) ? synth->getParametersGeneration() : 0;
 	
 	engine_showScreen(keywords[key], pic, synthCurrent);
 	engine_updateScreen(); // always updates window if it exists
 	engine_sleep(MEASUREMODE_DELAY_MS);
 	
+	// measures response after sound if it became audible after picture
+	engine_synthOnset(synthGeneration, stimulusStart);
+	
 	eeg->data(eegAfter);
+
+	engine_averageResponse(stimulusStart, eegBefore, eegAfter);
 	
 	engine_pollEvents();
 	
@@ -1862,12 +2021,23 @@ void ResonanzEngine::engine_loop()
 	}
 	
 	eeg->data(eegBefore);
+
+	long long stimulusStart = (long long)std::chrono::duration_cast<std::chrono::milliseconds>
+	  (std::chrono::system_clock::now().time_since_epoch()).count();
+	
+	const unsigned long long synthGeneration =
+	  (synth) ? synth->getParametersGeneration() : 0;
 	
 	engine_showScreen(" ", pic, synthCurrent);
 	engine_updateScreen(); // always updates window if it exists
 	engine_sleep(MEASUREMODE_DELAY_MS);
 	
+	// measures response after sound if it became audible after picture
+	engine_synthOnset(synthGeneration, stimulusStart);
+	
 	eeg->data(eegAfter);
+
+	engine_averageResponse(stimulusStart, eegBefore, eegAfter);
 	
 	engine_pollEvents();
 	
@@ -1882,8 +2052,10 @@ void ResonanzEngine::engine_loop()
       }
     }
     else if(currentCommand.command == ResonanzCommand::CMD_DO_OPTIMIZE){
-      const float percentage =
-	(currentHMMModel + currentPictureModel + currentKeywordModel + (soundModelCalculated == true))/((float)(pictureData.size()+keywordData.size()+2));
+      // HMM phase (2 steps) and all prediction models trained concurrently
+      const float models = (float)(pictureData.size() + keywordData.size() + 1);
+      const float trained = (trainingScheduler.getNumJobs() > 0) ? models*trainingScheduler.getProgress() : 0.0f;
+      const float percentage = (currentHMMModel + trained)/(models + 2.0f);
       
       optimizeETA.update(percentage);
       
@@ -1895,7 +2067,11 @@ void ResonanzEngine::engine_loop()
 	snprintf(buffer, 160, "resonanz-engine: optimizing prediction model (%.2f%%) [ETA %.1f min]..",
 		 100.0f*percentage, eta);
 	
-	engine_setStatus(buffer);
+	// per model progress and ETA of running training jobs
+	if(trainingScheduler.getNumJobs() > 0)
+	  engine_setStatus(std::string(buffer) + " " + trainingScheduler.getStatus());
+	else
+	  engine_setStatus(buffer);
       }
       
       engine_stopHibernation();
@@ -1926,13 +2102,16 @@ void ResonanzEngine::engine_loop()
 	distanceTarget.clear();
 	
 	logging.info(buffer);
-	engine_setStatus(buffer);
+	
+	if(video)
+	  engine_setStatus(std::string(buffer) + " [" + video->getStatus() + "]");
+	else
+	  engine_setStatus(buffer);
       }
       
       engine_stopHibernation();
       
-      auto t1 = std::chrono::system_clock::now().time_since_epoch();
-      auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+      auto t1ms = engine_clockMS();
       
       long long currentSecond = (long long)
 	(programHz*(t1ms - programStarted)/1000.0f); // gets current second for the program value
@@ -1944,8 +2123,7 @@ void ResonanzEngine::engine_loop()
 	  currentSecond = 0;
 	  lastProgramSecond = -1;
 	  
-	  auto t1 = std::chrono::system_clock::now().time_since_epoch();
-	  auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+	  auto t1ms = engine_clockMS();
 	  
 	  programStarted = (long long)t1ms;
 	}
@@ -2055,11 +2233,11 @@ void ResonanzEngine::engine_loop()
 	logging.info("Executing the given program has stopped [program stop time].");
 	
 	if(video){
-	  auto t1 = std::chrono::system_clock::now().time_since_epoch();
-	  auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+	  auto t1ms = engine_clockMS();
 	  
 	  logging.info("stopping theora video encoding.");
 	  
+	  if(synth) synth->setCapture(nullptr);
 	  video->stopEncoding((unsigned long long)(t1ms - programStarted));
 	  delete video;
 	  video = nullptr;
@@ -2198,6 +2376,11 @@ void ResonanzEngine::engine_loop()
   if(window != nullptr)
     SDL_DestroyWindow(window);
   
+  if(offscreen != nullptr){
+    SDL_FreeSurface(offscreen);
+    offscreen = nullptr;
+  }
+  
   {
     std::lock_guard<std::mutex> lock(eeg_mutex);
     if(eeg) delete eeg;
@@ -2225,6 +2408,14 @@ void ResonanzEngine::engine_loop()
     delete hmmUpdator;
     hmmUpdator = nullptr;
   }
+  
+  if(brainTrainer != nullptr){
+    brainTrainer->stopTrain();
+    delete brainTrainer;
+    brainTrainer = nullptr;
+  }
+  
+  trainingScheduler.clear();
 
   if(kmeans != nullptr){
     delete kmeans;
@@ -2236,6 +2427,8 @@ void ResonanzEngine::engine_loop()
     hmm = nullptr;
   }
   
+  hmmFilter.clearModel();
+  
   if(bnn != nullptr){
     delete bnn;
     bnn = nullptr;
@@ -2255,6 +2448,8 @@ bool ResonanzEngine::engine_loadModels(const std::string& modelDir)
   try{
     if(hmmUpdator != nullptr) return  false; // already computing HMM/K-Means models.
     
+    registry.open(modelDir); // no-op if engine_loadDatabase() opened it
+    
     std::string filename = calculateHashName("KMeans" + eeg->getDataSourceName()) + ".kmeans";
     filename = modelDir + "/" + filename;
 
@@ -2295,11 +2490,16 @@ bool ResonanzEngine::engine_loadModels(const std::string& modelDir)
       kmeans = newkmeans;
       hmm = newhmm;
       
-      // updates HMM state (choses first randomly according to HMM PI parameter)
+      // HMM state filtering starts from HMM PI parameter
+      if(hmmFilter.setModel(*kmeans, *hmm) == false)
+	logging.warn("HMM state filter: K-Means and HMM models mismatch");
       
-      HMMstate = hmm->sample(hmm->getPI());
+      HMMstate = hmmFilter.getState();
     }
     
+    if(engine_loadHMMGeneration(modelDir, hmmGeneration) == false)
+      hmmGeneration = "";
+    
   }
   catch(std::exception& e){
     logging.error("");
@@ -2330,6 +2530,13 @@ bool ResonanzEngine::engine_loadModels(const std::string& modelDir)
       continue;
     }
     
+    // picture features are inputs of picture models: models saved without
+    // them are not used and are retrained from scratch by optimization
+    if(pictureModels[i].inputSize() != eeg->getNumberOfSignals() + HMM_NUM_CLUSTERS + PICFEATURES_SIZE){
+      logging.warn("Picture model has old input size (needs optimization): " + filename);
+      continue;
+    }
+    
     
     // pictureModels[i].downsample(100); // keeps only 100 random models
     
@@ -2498,116 +2705,15 @@ bool ResonanzEngine::engine_executeProgram(const std::vector<float>& eegCurrent,
     }
   }
   
-  std::vector< std::pair<float, int> > results(keywordData.size());
-  std::vector< float > model_error_ratio(keywordData.size());
+  std::vector< std::pair<float, int> > results;
+  std::vector< float > model_error_ratio;
   
   logging.info("engine_executeProgram() calculate keywords");
 
-#pragma omp parallel for schedule(dynamic)	
-  for(unsigned int index=0;index<keywordData.size();index++){
-    
-    math::vertex<> x(eegCurrent.size() + HMM_NUM_CLUSTERS);
-    
-    for(unsigned int i=0;i<eegCurrent.size();i++)
-      x[i] = eegCurrent[i];
-    for(unsigned int i=eegCurrent.size();i<x.size();i++){
-      if(i-eegCurrent.size() == HMMstate) x[i] = 1.0f;
-      else x[i] = 0.0f;
-    }
-    
-    auto original = x;
-    
-    if(keywordData[index].preprocess(0, x) == false){
-      logging.warn("skipping bad keyword prediction model");
-      continue;
-    }
-    
-    math::vertex<> m;
-    math::matrix<> cov;
-
-    unsigned int SAMPLES = MODEL_SAMPLES;
-    
-    if(dataRBFmodel){
-      engine_estimateNN(x, keywordData[index], m , cov);
-      SAMPLES = 1;
-    }
-    else{
-      whiteice::bayesian_nnetwork<>& model = keywordModels[index];
-      
-      if(model.inputSize() != (eegCurrent.size()+HMM_NUM_CLUSTERS) ||
-	 model.outputSize() != eegTarget.size())
-      {
-	logging.warn("skipping bad keyword prediction model");
-	continue; // bad model/data => ignore
-      }
-
-
-      if(model.getNumberOfSamples() < SAMPLES)
-	SAMPLES = model.getNumberOfSamples();
-
-	 
-      if(model.calculate(x, m, cov, 1, SAMPLES) == false){
-	logging.warn("skipping bad keyword prediction model");
-	continue;
-      }
-    }
-    
-    
-    if(keywordData[index].invpreprocess(1, m, cov) == false){
-      logging.warn("skipping bad keyword prediction model");
-      continue;
-    }
-
-    m *= timestep; // corrects delta to given timelength
-    cov *= timestep*timestep;
-
-    // converts cov to cov of mean
-    cov /= whiteice::math::blas_real<float>((float)SAMPLES);
-    
-    // now we have prediction x to the response to the given keyword
-    // calculates error (weighted distance to the target state)
-
-    //auto predicted_value = original + m;
-    auto predicted_value = m;
-    for(unsigned int i=0;i<m.size();i++)
-      predicted_value[i] += original[i];
-    
-    // no out of range values (clips to [0,1] interval)
-    for(unsigned int i=0;i<predicted_value.size();i++){
-      if(predicted_value[i] < 0.0f) predicted_value[i] = 0.0f;
-      else if(predicted_value[i] > 1.0f) predicted_value[i] = 1.0f;
-    }
-    
-    auto delta = target - predicted_value;
-#if 1
-    auto stdev = m;
-    
-    for(unsigned int i=0;i<stdev.size();i++){
-      stdev[i] = math::sqrt(math::abs(cov(i,i)));
-    }
-    
-    // calculates average stdev/delta ratio
-    auto ratio = stdev.norm()/m.norm();
-    model_error_ratio[index] = ratio.c[0];
-    
-    for(unsigned int i=0;i<delta.size();i++){
-      delta[i] = math::abs(delta[i]) + 0.50f*stdev[i]; // FIXME: was 1 (handles uncertainty in weights)
-      delta[i] /= math::sqrt(targetVariance[i]);
-    }
-#else
-    for(unsigned int i=0;i<delta.size();i++)
-      delta[i] /= math::sqrt(targetVariance[i]);
-#endif
-    
-    auto error = delta.norm();
-    
-    std::pair<float, int> p;
-    p.first = error.c[0];
-    p.second = index;
-    
-    results[index] = p;
-    
-    // engine_pollEvents(); // polls for incoming events in case there are lots of models
+  if(engine_scoreStimuli(eegCurrent, eegTarget, eegTargetVariance, timestep_,
+			 false, results, model_error_ratio) == false)
+  {
+    logging.warn("engine_executeProgram(): scoring keywords failed");
   }
   
 	
@@ -2640,167 +2746,13 @@ bool ResonanzEngine::engine_executeProgram(const std::vector<float>& eegCurrent,
   engine_pollEvents();
   
   
-  results.resize(pictureData.size());
-  model_error_ratio.resize(pictureData.size());
-  
   logging.info("engine_executeProgram(): calculate pictures");
 
-  // presets values..
-  {
-    for(unsigned int index=0;index<pictureData.size();index++){
-    
-      std::pair<float, int> p;
-      p.first = 1e6f; // very large error as the default value [=> ignotes this picture]
-      p.second = index;
-    
-      results[index] = p;
-
-      model_error_ratio[index] = 1.0f; // dummy value [no clue what to set]
-    }
-  }
-
-
-  
-  std::set<unsigned int> picIndexes;
-
+  // scores all pictures [batched scoring is fast enough for realtime requirements]
+  if(engine_scoreStimuli(eegCurrent, eegTarget, eegTargetVariance, timestep_,
+			 true, results, model_error_ratio) == false)
   {
-    // only selects picture from set of was: 50, 100 randomly chosen pictures from all pictures [to keep in sync/realtime requirements]
-    for(unsigned int i=0;i<pictureData.size();i++){
-      picIndexes.insert(i);
-    }
-
-    while(picIndexes.size() > PIC_DATASET_SIZE){
-      // keeps removing random elements until dataset size is PIC_DATASET_SIZE
-      unsigned int remove = rng.rand() % picIndexes.size();
-      auto iter = picIndexes.begin();
-
-      while(remove > 0){
-	iter++;
-	remove--;
-      }
-
-      picIndexes.erase(iter); // removes remove:th element from the set
-    }
-  }
-  
-
-#pragma omp parallel for schedule(dynamic)	
-  for(unsigned int picindex=0;picindex<picIndexes.size();picindex++){
-
-    auto piciter = picIndexes.begin();
-    for(unsigned int p=0;p<picindex;p++)
-      piciter++;
-    
-    const unsigned int index = (*piciter); // select (all) pictures from PicIndexes set
-    
-    math::vertex<> x(eegCurrent.size() + HMM_NUM_CLUSTERS + PICFEATURES_SIZE);
-    
-    for(unsigned int i=0;i<eegCurrent.size();i++){
-      x[i] = eegCurrent[i];
-    }
-    
-    for(unsigned int i=eegCurrent.size();i<(eegCurrent.size()+HMM_NUM_CLUSTERS);i++){
-      if(i-eegCurrent.size() == HMMstate) x[i] = 1.0f;
-      else x[i] = 0.0f;
-    }
-
-    for(unsigned int i=eegCurrent.size()+HMM_NUM_CLUSTERS, index=0;i<x.size();i++,index++){
-      x[i] = imageFeatures[picindex][index];
-    }
-    
-    auto original = x;
-    
-    if(pictureData[index].preprocess(0, x) == false){
-      logging.warn("skipping bad picture prediction model (1)");
-      continue;
-    }
-    
-    math::vertex<> m;
-    math::matrix<> cov;
-
-    unsigned int SAMPLES = MODEL_SAMPLES;
-    
-    if(dataRBFmodel){
-      engine_estimateNN(x, pictureData[index], m , cov);
-      SAMPLES = 1;
-    }
-    else{
-      whiteice::bayesian_nnetwork<>& model = pictureModels[index];
-      
-      if(model.inputSize() != (eegCurrent.size()+HMM_NUM_CLUSTERS) ||
-	 model.outputSize() != eegTarget.size()){
-	
-	logging.warn("skipping bad picture prediction model (2)");
-	continue; // bad model/data => ignore
-      }
-
-      if(model.getNumberOfSamples() < SAMPLES)
-	SAMPLES = model.getNumberOfSamples();
-      
-      if(model.calculate(x, m, cov, 1, SAMPLES) == false){
-	logging.warn("skipping bad picture prediction model (3)");
-	continue;
-      }
-      
-    }
-    
-    if(pictureData[index].invpreprocess(1, m, cov) == false){
-      logging.warn("skipping bad picture prediction model (4)");
-      continue;
-    }
-    
-    m *= timestep; // corrects delta to given timelength
-    cov *= timestep*timestep;
-
-    // converts cov to cov of mean
-    cov /= whiteice::math::blas_real<float>((float)SAMPLES);
-    
-    // now we have prediction x to the response to the given picture
-    // calculates error (weighted distance to the target state)
-    
-    //auto predicted_value = original + m;
-    auto predicted_value = m;
-    for(unsigned int i=0;i<m.size();i++)
-      predicted_value[i] += original[i];
-    
-    // no out of range values (clips to [0,1] interval)
-    for(unsigned int i=0;i<predicted_value.size();i++){
-      if(predicted_value[i] < 0.0f) predicted_value[i] = 0.0f;
-      else if(predicted_value[i] > 1.0f) predicted_value[i] = 1.0f;
-    }
-    
-    auto delta = target - predicted_value;
-#if 1
-    auto stdev = m;
-    
-    for(unsigned int i=0;i<stdev.size();i++){
-      stdev[i] = math::sqrt(math::abs(cov(i,i)));
-    }
-    
-    // calculates average stdev/delta ratio
-    auto ratio = stdev.norm()/m.norm();
-    model_error_ratio[index] = ratio.c[0];
-
-
-    for(unsigned int i=0;i<delta.size();i++){
-      delta[i] = math::abs(delta[i]) + 0.50f*stdev[i]; // FIXME: was 1 (handles uncertainty)
-      delta[i] /= math::sqrt(targetVariance[i]);
-    }
-#else
-    
-    for(unsigned int i=0;i<delta.size();i++)
-      delta[i] /= math::sqrt(targetVariance[i]);
-#endif
-    
-    auto error = delta.norm();
-    
-    std::pair<float, int> p;
-    p.first = error.c[0];
-    p.second = index;
-    
-    results[index] = p;
-		
-    // engine_pollEvents(); // polls for incoming events in case there are lots of models
+    logging.warn("engine_executeProgram(): scoring pictures failed");
   }
   
   
@@ -2828,6 +2780,16 @@ bool ResonanzEngine::engine_executeProgram(const std::vector<float>& eegCurrent,
     bestPicture.erase(i); // removes the largest element
   }
   
+  // decodes and scales top candidate pictures in background threads
+  // so that the picture is already in cache when it is shown
+  {
+    std::vector<unsigned int> candidates;
+    for(auto& p : bestPicture)
+      candidates.push_back(p.second);
+    
+    imageCache.prefetch(candidates);
+  }
+  
   engine_pollEvents(); // polls for incoming events in case there are lots of models
 
   
@@ -2866,8 +2828,14 @@ bool ResonanzEngine::engine_executeProgram(const std::vector<float>& eegCurrent,
       input[2*synthBefore.size() + i] = eegCurrent[i];
     }
 
-    // sets HMM state variable to input
-    input[2*synthBefore.size()+eegCurrent.size()+HMMstate] = 1.0f;
+    // sets HMM state variables to input
+    {
+      std::vector<float> stateInput;
+      engine_hmmStateInput(stateInput);
+      
+      for(unsigned int i=0;i<HMM_NUM_CLUSTERS;i++)
+	input[2*synthBefore.size()+eegCurrent.size()+i] = stateInput[i];
+    }
     
     math::vertex<> original(eegCurrent.size());
     
@@ -3132,7 +3100,175 @@ bool ResonanzEngine::engine_executeProgram(const std::vector<float>& eegCurrent,
 }
 
 
-// executes program blindly based on Monte Carlo sampling and prediction models
+// HMM state input of prediction models (see HMM_SOFT_STATE)
+void ResonanzEngine::engine_hmmStateInput(std::vector<float>& x) const
+{
+  x.resize(HMM_NUM_CLUSTERS);
+  
+  if(HMM_SOFT_STATE && hmmFilter.getUpdates() > 0){
+    std::vector<float> p;
+    
+    if(hmmFilter.getPosterior(p) && p.size() == HMM_NUM_CLUSTERS){
+      x = p;
+      return;
+    }
+  }
+  
+  // one-hot encoding of MAP state (measurements are stored with MAP state)
+  for(unsigned int i=0;i<HMM_NUM_CLUSTERS;i++)
+    x[i] = (i == HMMstate) ? 1.0f : 0.0f;
+}
+
+
+// scores all keywords or pictures in a batch: predicted responses are packed into
+// structure-of-arrays matrices and errors are calculated with a vectorized kernel
+bool ResonanzEngine::engine_scoreStimuli(const std::vector<float>& eegCurrent,
+					 const std::vector<float>& eegTarget,
+					 const std::vector<float>& eegTargetVariance,
+					 float timestep, bool pictureStimulus,
+					 std::vector< std::pair<float, int> >& results,
+					 std::vector<float>& model_error_ratio)
+{
+  // how many bayesian neural networks use to calculate mean and cov.
+  const unsigned int MODEL_SAMPLES = 11;
+  
+  std::vector< whiteice::dataset<> >& data = pictureStimulus ? pictureData : keywordData;
+  std::vector< NNIndex >& dataIndex = pictureStimulus ? pictureIndex : keywordIndex;
+  std::vector< whiteice::bayesian_nnetwork<> >& models = pictureStimulus ? pictureModels : keywordModels;
+  
+  const unsigned int N = data.size();
+  const unsigned int D = eegTarget.size();
+  const unsigned int FEATURES = pictureStimulus ? PICFEATURES_SIZE : 0;
+  const unsigned int INPUTSIZE = eegCurrent.size() + HMM_NUM_CLUSTERS + FEATURES;
+  
+  results.resize(N);
+  model_error_ratio.resize(N);
+  
+  // presets values [very large error => ignores stimulus]
+  for(unsigned int n=0;n<N;n++){
+    results[n].first = 1e6f;
+    results[n].second = n;
+    model_error_ratio[n] = 1.0f; // dummy value [no clue what to set]
+  }
+  
+  if(eegCurrent.size() != D || eegTargetVariance.size() != D)
+    return false;
+  
+  if(N == 0) return true;
+  
+  std::vector<float> stateInput;
+  engine_hmmStateInput(stateInput);
+  
+  // batchMean[d*N + n] and batchVar[d*N + n] are predicted change
+  // of signal d and its variance after showing stimulus n
+  // (member buffers keep their capacity between calls)
+  std::vector<float>& batchMean = scoreMean;
+  std::vector<float>& batchVar = scoreVar;
+  std::vector<char>& valid = scoreValid;
+  
+  batchMean.assign(D*N, 0.0f);
+  batchVar.assign(D*N, 0.0f);
+  valid.assign(N, 0);
+  
+#pragma omp parallel
+  {
+    // per thread buffers reused between stimuli
+    math::vertex<> x;
+    math::vertex<> m;
+    math::matrix<> cov;
+    
+#pragma omp for schedule(dynamic)
+    for(unsigned int n=0;n<N;n++){
+      
+      if(pictureStimulus){
+	if(n >= imageFeatures.size() || imageFeatures[n].size() != FEATURES)
+	  continue;
+      }
+      
+      x.resize(INPUTSIZE);
+      
+      for(unsigned int i=0;i<eegCurrent.size();i++)
+	x[i] = eegCurrent[i];
+      
+      for(unsigned int i=0;i<HMM_NUM_CLUSTERS;i++)
+	x[eegCurrent.size() + i] = stateInput[i];
+      
+      for(unsigned int i=0;i<FEATURES;i++)
+	x[eegCurrent.size() + HMM_NUM_CLUSTERS + i] = imageFeatures[n][i];
+      
+      if(data[n].preprocess(0, x) == false){
+	logging.warn("skipping bad stimulus prediction model (1)");
+	continue;
+      }
+      
+      unsigned int SAMPLES = MODEL_SAMPLES;
+      
+      if(dataRBFmodel){
+	engine_estimateNN(x, data[n], m, cov,
+			  (n < dataIndex.size()) ? &(dataIndex[n]) : nullptr);
+	SAMPLES = 1;
+      }
+      else{
+	if(n >= models.size()) continue;
+	
+	whiteice::bayesian_nnetwork<>& model = models[n];
+	
+	if(model.inputSize() != INPUTSIZE || model.outputSize() != D){
+	  logging.warn("skipping bad stimulus prediction model (2)");
+	  continue; // bad model/data => ignore
+	}
+	
+	if(model.getNumberOfSamples() < SAMPLES)
+	  SAMPLES = model.getNumberOfSamples();
+	
+	if(SAMPLES == 0 || model.calculate(x, m, cov, 1, SAMPLES) == false){
+	  logging.warn("skipping bad stimulus prediction model (3)");
+	  continue;
+	}
+      }
+      
+      if(data[n].invpreprocess(1, m, cov) == false || m.size() != D){
+	logging.warn("skipping bad stimulus prediction model (4)");
+	continue;
+      }
+      
+      // corrects delta to given timelength and converts cov to cov of mean
+      const float mscale = timestep;
+      const float vscale = timestep*timestep/SAMPLES;
+      
+      for(unsigned int d=0;d<D;d++){
+	batchMean[d*N + n] = mscale*m[d].c[0];
+	batchVar[d*N + n]  = vscale*cov(d,d).c[0];
+      }
+      
+      valid[n] = 1;
+    }
+  }
+  
+  // calculates errors (weighted distance to the target state) of all stimuli
+  std::vector<float>& error = scoreError;
+  std::vector<float>& ratio = scoreRatio;
+  
+  error.resize(N);
+  ratio.resize(N);
+  scoreNorm.resize(N);
+  
+  stimulus_error_batch(batchMean.data(), batchVar.data(), N, D,
+		       eegCurrent.data(), eegTarget.data(), eegTargetVariance.data(),
+		       error.data(), ratio.data(), scoreNorm.data());
+  
+  for(unsigned int n=0;n<N;n++){
+    if(valid[n]){
+      results[n].first = error[n];
+      model_error_ratio[n] = ratio[n];
+    }
+  }
+  
+  return true;
+}
+
+
+// executes program blindly based on Monte Carlo sampling and prediction models
 // [only works for low dimensional target signals and well-trained models]
 //
 // FIXME: don't support randomPrograms flag which instead selects model randomly
@@ -3472,91 +3608,155 @@ bool ResonanzEngine::engine_optimizeModels(unsigned int& currentHMMModel,
   if(currentHMMModel <= 1){
     // calculates K-Means and HMM models and saves them to disk
 
-    if(kmeans == nullptr){
-      kmeans = new whiteice::KMeans<>();
-      std::vector<whiteice::math::vertex<> > eegTS; // eeg time-series
-
-      if(eegData.getData(0,eegTS) == false){
-	logging.error("Loading EEG data from datastructure failed");
-	return false;
+    const std::string kmeansFile = currentCommand.modelDir + "/" +
+      calculateHashName("KMeans" + eeg->getDataSourceName()) + ".kmeans";
+    const std::string hmmFile = currentCommand.modelDir + "/" +
+      calculateHashName("HMM" + eeg->getDataSourceName()) + ".hmm";
+    
+    if(currentHMMModel == 0 && brainTrainer == nullptr){
+      // models trained with the same EEG rows are kept so that HMM states
+      // (and labels of measurements) keep their meaning
+      hmmTrainingGeneration = engine_eegGeneration();
+      
+      std::string trainedGeneration;
+      
+      if(hmmTrainingGeneration.length() > 0 &&
+	 engine_loadHMMGeneration(currentCommand.modelDir, trainedGeneration) &&
+	 trainedGeneration == hmmTrainingGeneration)
+      {
+	auto newkmeans = new whiteice::KMeans<>();
+	auto newhmm = new whiteice::HMM();
+	
+	if(newkmeans->load(kmeansFile) && newhmm->loadArbitrary(hmmFile) &&
+	   newhmm->getNumVisibleStates() == newkmeans->size() &&
+	   newhmm->getNumHiddenStates() == HMM_NUM_CLUSTERS)
+	{
+	  {
+	    std::lock_guard<std::mutex> lock(hmm_mutex);
+	    
+	    if(kmeans) delete kmeans;
+	    if(hmm) delete hmm;
+	    
+	    kmeans = newkmeans;
+	    hmm = newhmm;
+	    
+	    hmmFilter.setModel(*kmeans, *hmm);
+	    HMMstate = hmmFilter.getState();
+	  }
+	  
+	  hmmGeneration = hmmTrainingGeneration;
+	  
+	  logging.info("resonanz K-Means/HMM models are up to date (EEG data hasn't changed)");
+	  
+	  currentHMMModel++;
+	  return true;
+	}
+	
+	delete newkmeans;
+	delete newhmm;
       }
-
-      printf("KMeans: EEG input data size: %d\n", (int)eegTS.size()); // REMOVE ME
       
-      if(kmeans->startTrain(KMEANS_NUM_CLUSTERS, eegTS) == false){
-	logging.error("Starting K-Means optimization FAILED.");
+      // warm starts from models of the previous optimization (if they exist)
+      whiteice::KMeans<> warmKMeans;
+      whiteice::HMM warmHMM;
+      
+      const bool warmK = warmKMeans.load(kmeansFile);
+      const bool warmH = warmK && warmHMM.loadArbitrary(hmmFile);
+      
+      brainTrainer = new BrainStateTrainer();
+      
+      if(brainTrainer->startTrain(eegData, KMEANS_NUM_CLUSTERS, HMM_NUM_CLUSTERS,
+				  warmK ? &warmKMeans : nullptr,
+				  warmH ? &warmHMM : nullptr) == false)
+      {
+	delete brainTrainer;
+	brainTrainer = nullptr;
+	logging.error("Starting K-Means/HMM optimization FAILED.");
 	return false;
       }
+      
+      char buffer[256];
+      snprintf(buffer, 256, "resonanz K-Means/HMM optimization started (%d EEG rows, %s)",
+	       (int)eegData.size(0), (warmK ? (warmH ? "warm start" : "K-Means warm start") : "cold start"));
+      logging.info(buffer);
     }
-    else if(kmeans->isRunning() == true){
-      // do nothing while optimizer runs
-
+    else if(currentHMMModel == 0 && brainTrainer->isRunning()){
+      // does nothing during optimization
+      
       char buffer[512];
-      snprintf(buffer, 512, "resonanz K-Means optimization running. error: %f",
-	       kmeans->getSolutionError());
+      snprintf(buffer, 512, "resonanz K-Means/HMM optimization running. %s",
+	       brainTrainer->getStatus().c_str());
       logging.info(buffer);
     }
-    else if(kmeans->isRunning() == false && hmm == nullptr){
-      // computation has stopped
-
-      // saves optimization results to a file
-      std::string filename = calculateHashName("KMeans" + eeg->getDataSourceName()) + ".kmeans";
-      filename = currentCommand.modelDir + "/" + filename;
-
-      if(kmeans->save(filename) == false){
-	logging.error("Saving K-Means solution FAILED.");
+    else if(currentHMMModel == 0){
+      // computation has stopped: saves optimization results to files
+      
+      auto newkmeans = new whiteice::KMeans<>();
+      auto newhmm = new whiteice::HMM(KMEANS_NUM_CLUSTERS, HMM_NUM_CLUSTERS);
+      
+      const bool ok = brainTrainer->getModels(*newkmeans, *newhmm);
+      
+      {
+	char buffer[512];
+	snprintf(buffer, 512, "resonanz K-Means/HMM optimization stopped. %s",
+		 brainTrainer->getStatus().c_str());
+	logging.info(buffer);
+      }
+      
+      delete brainTrainer;
+      brainTrainer = nullptr;
+      
+      if(ok == false){
+	delete newkmeans;
+	delete newhmm;
+	logging.error("K-Means/HMM optimization FAILED.");
 	return false;
       }
-      else logging.info("Saving K-Means solution OK.");
-
-      // starts HMM optimizer
-      hmm = new HMM(KMEANS_NUM_CLUSTERS, HMM_NUM_CLUSTERS);
-
-      std::vector<unsigned int> observations;
+      
       {
-	// converts data to observation variables
+	std::lock_guard<std::mutex> lock(hmm_mutex);
 	
-	for(unsigned int i=0;i<eegData.size(0);i++){
-	  unsigned int c = kmeans->getClusterIndex(eegData.access(0, i));
-	  observations.push_back(c);
-	}
+	if(kmeans) delete kmeans;
+	if(hmm) delete hmm;
+	
+	kmeans = newkmeans;
+	hmm = newhmm;
+	
+	hmmFilter.setModel(*kmeans, *hmm);
+	HMMstate = hmmFilter.getState();
       }
       
-      if(hmm->startTrain(observations) == false){
-	logging.error("Starting HMM optimization FAILED.");
+      if(kmeans->save(kmeansFile) == false){
+	logging.error("Saving K-Means solution FAILED.");
 	return false;
       }
+      else logging.info("Saving K-Means solution OK.");
       
-    }
-    else if(hmm->isRunning()){
-      // does nothing during optimization
-
-      char buffer[512];
-      snprintf(buffer, 512, "resonanz HMM optimization running. log(prob): %f",
-	       hmm->getSolutionGoodness());
-      logging.info(buffer);
-    }
-    else if(hmm->isRunning() == false && currentHMMModel == 0){
-      hmm->stopTrain();
-
-      std::string filename = calculateHashName("HMM" + eeg->getDataSourceName()) + ".hmm";
-      filename = currentCommand.modelDir + "/" + filename;
-
-      if(hmm->saveArbitrary(filename) == false){
+      if(hmm->saveArbitrary(hmmFile) == false){
 	logging.error("Saving HMM solution FAILED.");
 	return false;
       }
       else logging.info("Saving HMM solution OK.");
-
+      
+      hmmGeneration = hmmTrainingGeneration;
+      
+      if(engine_saveHMMGeneration(currentCommand.modelDir, hmmGeneration) == false)
+	logging.warn("Saving K-Means/HMM training generation FAILED.");
+      
       currentHMMModel++;
     }
     else if(hmmUpdator == nullptr && currentHMMModel == 1){
       
+      // rows labelled earlier with models of the same training generation are not relabelled
+      if(engine_loadHMMLabels(currentCommand.modelDir) == false)
+	logging.info("HMM labels of data are recalculated");
+      
       hmmUpdator = new HMMStateUpdatorThread(kmeans, hmm,
 					     &eegData,
 					     &pictureData,
 					     &keywordData,
-					     &synthData);
+					     &synthData,
+					     &hmmLabelled);
       
       hmmUpdator->start();
     }
@@ -3572,671 +3772,154 @@ bool ResonanzEngine::engine_optimizeModels(unsigned int& currentHMMModel,
 
       hmmUpdator->stop();
 
-      delete hmmUpdator;
-      hmmUpdator = nullptr;
-
-      currentHMMModel++;
-    }
-    
-  }
-  
-  else if(soundModelCalculated == false){
-	  
-    // first model to be optimized (no need to store the previous result)
-    if(optimizer == nullptr && bayes_optimizer == nullptr){
-      whiteice::math::vertex<> w;
-      
-      nnsynth->randomize();
-      nnsynth->exportdata(w);
-      
       {
-	char buffer[512];
-	snprintf(buffer, 512, "resonanz model optimization started: synth model. database size: %d %d",
-		 synthData.size(0), synthData.size(1));
-	fprintf(stdout, "%s\n", buffer);
+	char buffer[128];
+	snprintf(buffer, 128, "resonanz HMM relabelled %llu measurements",
+		 hmmUpdator->getRelabelledRows());
 	logging.info(buffer);
       }
 
+      // HMM state fields of relabelled input data have changed: reindex data and
+      // recalculate statistics of fully relabelled datasets (preprocessing
+      // parameters are unchanged so the checkpoint is kept)
+      const unsigned int P = pictureData.size();
+      const unsigned int K = keywordData.size();
       
-      //optimizer = new whiteice::pLBFGS_nnetwork<>(*nnsynth, synthData, false, false);
-      //optimizer->minimize(NUM_OPTIMIZER_THREADS);
-      
-      optimizer = new whiteice::math::NNGradDescent<>();
-      optimizer->setUseMinibatch(true);
-      if(optimizer->startOptimize(synthData, *nnsynth, 
-				  NUM_OPTIMIZER_THREADS) == false){
-	logging.error("nnsynth NNGradDescent::startOptimize() FAILED.");
-      }
-      
-    }
-    else if(optimizer != nullptr && use_bayesian_nnetwork){ // pre-optimizer is active
-      
-      whiteice::math::blas_real<float> error = 1000.0f;
-      whiteice::math::vertex<> w;
-      whiteice::nnetwork<> tmpnn;
-      unsigned int iterations = 0;
-      
-      //optimizer->getSolution(w, error, iterations);
-      optimizer->getSolution(tmpnn, error, iterations);
-      
-      if(iterations >= NUM_OPTIMIZER_ITERATIONS){
-	// gets finished solution
-	
-	logging.info("DEBUG: ABOUT TO STOP COMPUTATION");
-	
-	optimizer->stopComputation();
-	//optimizer->getSolution(w, error, iterations);
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz model NNGradDescent<> optimization stopped. synth model. iterations: %d error: %f",
-		   iterations, error.c[0]);
-	  logging.info(buffer);
-	}
+#pragma omp parallel for schedule(dynamic) num_threads(engine_databaseThreads())
+      for(unsigned int j=0;j<P+K+1;j++){
+	if(hmmUpdator->wasRelabelled(j) == false) continue;
 	
-	nnsynth->importdata(w);
+	whiteice::dataset<>& data = (j < P) ? pictureData[j] : ((j < P+K) ? keywordData[j-P] : synthData);
+	std::vector<RunningStatistics>& stats = (j < P) ? pictureStats[j] : ((j < P+K) ? keywordStats[j-P] : synthStats);
 	
-	// switches to uncertainty analysis
-	const bool adaptive = true;
+	if(j < P && j < pictureIndex.size())
+	  pictureIndex[j].build(pictureData[j], 0);
+	else if(j >= P && j < P+K && j-P < keywordIndex.size())
+	  keywordIndex[j-P].build(keywordData[j-P], 0);
 	
-	logging.info("DEBUG: STARTING HMC SAMPLER");
-	
-	bayes_optimizer = new whiteice::UHMC<>(*nnsynth, synthData, adaptive);
-	bayes_optimizer->setMinibatch(true);
-	bayes_optimizer->startSampler();
-	
-	delete optimizer;
-	optimizer = nullptr;
-      }
-      else{
-	{
-	  whiteice::nnetwork<> tmpnn;
-	  math::vertex< math::blas_real<float> > w;
-	  math::blas_real<float> error;
-	  unsigned int iterations = 0;
-	  
-	  //optimizer->getSolution(w, error, iterations);
-	  optimizer->getSolution(tmpnn, error, iterations);
-	  tmpnn.exportdata(w);
+	if(stats.size() > 0 && hmmUpdator->getFirstRelabelledRow(j) == 0){
+	  RunningStatistics s;
 	  
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz NNGradDescent<> model optimization running. synth model. number of iterations: %d/%d. error: %f",
-		   iterations, NUM_OPTIMIZER_ITERATIONS, error.c[0]);
-	  logging.info(buffer);
+	  if(s.build(data, 0, pcaPreprocess)){
+	    s.setCheckpoint(stats[0]);
+	    stats[0] = s;
+	  }
 	}
       }
       
+      delete hmmUpdator;
+      hmmUpdator = nullptr;
+
+      currentHMMModel++;
     }
-    else if(bayes_optimizer != nullptr){
-      if(bayes_optimizer->getNumberOfSamples() >= BAYES_NUM_SAMPLES){ // time to stop computation [got uncertainly information]
-	
-	bayes_optimizer->stopSampler();
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz bayes synth model optimization stopped. iterations: %d",
-		   bayes_optimizer->getNumberOfSamples());
-	  logging.info(buffer);
-	}
-	
-	// saves optimization results to a file
-	std::string dbFilename = currentCommand.modelDir + "/" +
-	  calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".model";
-	
-	bayes_optimizer->getNetwork(*bnn);
-	
-	if(bnn->save(dbFilename) == false)
-	  logging.error("saving bayesian nn configuration file failed");
-	
-	delete bayes_optimizer;
-	bayes_optimizer = nullptr;
-	
-	soundModelCalculated = true;
-      }
-      else{
-	unsigned int samples = bayes_optimizer->getNumberOfSamples();
+    
+  }
+  
+  else if(trainingScheduler.getNumJobs() == 0){
+    // trains synth, picture and keyword models concurrently
+    trainingScheduler.setLimits(MAX_TRAINING_THREADS, 0);
+    trainingScheduler.setOptimization(NUM_OPTIMIZER_ITERATIONS, use_bayesian_nnetwork, BAYES_NUM_SAMPLES);
+    
+    // models whose data hasn't changed since the previous optimization are not retrained
+    if(engine_loadModelVersions(currentCommand.modelDir) == false)
+      logging.info("resonanz model optimization: no model versions, all models are trained");
+    
+    trainingVersions.clear();
+    
+    if(synth != NULL && soundModelCalculated == false){
+      const std::string modelName =
+	calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName());
+      
+      if(engine_addTrainingJob("synth", synth->getSynthesizerName(), *nnsynth, synthData, modelName) == false)
+	logging.warn("resonanz model optimization: no synth model data");
+    }
+    
+    if(optimizeSynthOnly == false){
+      for(unsigned int i=0;i<pictureData.size() && i<pictures.size();i++){
+	const std::string modelName = calculateHashName(pictures[i] + eeg->getDataSourceName());
 	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz bayes model optimization running. synth model. number of samples: %d/%d",
-		   bayes_optimizer->getNumberOfSamples(), BAYES_NUM_SAMPLES);
-	  logging.info(buffer);
-	}
+	const size_t slash = pictures[i].find_last_of("/\\");
+	const std::string name = (slash == std::string::npos) ? pictures[i] : pictures[i].substr(slash+1);
 	
+	if(engine_addTrainingJob("picture", name, *nn, pictureData[i], modelName) == false)
+	  logging.warn("resonanz model optimization: no picture model data");
       }
-    }
-    else if(optimizer != nullptr){
-      whiteice::math::blas_real<float> error = 1000.0f;
-      whiteice::nnetwork<> tmpnn;
-      whiteice::math::vertex<> w;
-      unsigned int iterations = 0;
       
-      //optimizer->getSolution(w, error, iterations);
-      optimizer->getSolution(tmpnn, error, iterations);
-      tmpnn.exportdata(w);
-      
-      if(iterations >= NUM_OPTIMIZER_ITERATIONS){
-	// gets finished solution
-	
-	optimizer->stopComputation();
-	//optimizer->getSolution(w, error, iterations);
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
+      for(unsigned int i=0;i<keywordData.size() && i<keywords.size();i++){
+	const std::string modelName = calculateHashName(keywords[i] + eeg->getDataSourceName());
 	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz model optimization stopped. synth model. iterations: %d error: %f",
-		   iterations, error.c[0]);
-	  logging.info(buffer);
-	}
-	
-	// saves optimization results to a file
-	std::string modelFilename = currentCommand.modelDir + "/" + 
-	  calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".model";
-	
-	nnsynth->importdata(w);
-	
-	bnn->importNetwork(*nnsynth);
-	
-	if(bnn->save(modelFilename) == false)
-	  logging.error("saving nn configuration file failed");
-	
-	delete optimizer;
-	optimizer = nullptr;
-	
-	soundModelCalculated = true;
-      }
-      else{
-	{
-	  whiteice::nnetwork<> tmpnn;
-	  math::vertex< math::blas_real<float> > w;
-	  math::blas_real<float> error;
-	  unsigned int iterations = 0;
-	  
-	  //optimizer->getSolution(w, error, iterations);
-	  optimizer->getSolution(tmpnn, error, iterations);
-	  tmpnn.exportdata(w);
-	  
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz NNGradDescent<> model optimization running. synth model. number of iterations: %d/%d. error: %f",
-		   iterations, NUM_OPTIMIZER_ITERATIONS, error.c[0]);
-	  
-	  logging.info(buffer);
-	}
+	if(engine_addTrainingJob("keyword", keywords[i], *nnkey, keywordData[i], modelName) == false)
+	  logging.warn("resonanz model optimization: no keyword model data");
       }
     }
     
+    if(trainingScheduler.getNumJobs() == 0){
+      cmdStopCommand(); // nothing to optimize
+      return true;
+    }
+    
+    char buffer[256];
+    snprintf(buffer, 256, "resonanz model optimization started: %d models (%d unchanged)",
+	     trainingScheduler.getNumJobs(), trainingScheduler.getSkippedJobs());
+    logging.info(buffer);
     
+    trainingScheduler.update(); // starts jobs
   }
-  else if(currentPictureModel < pictureData.size() && optimizeSynthOnly == false){
+  else if(trainingScheduler.finished() == false){
+    if(trainingScheduler.update() == false)
+      logging.warn("resonanz model optimization: training of a model failed");
     
-    // first model to be optimized (no need to store the previous result)
-    if(optimizer == nullptr && bayes_optimizer == nullptr){
-      whiteice::math::vertex<> w;
-      
-      nn->randomize();
-      nn->exportdata(w);
-      
-      //optimizer = new whiteice::pLBFGS_nnetwork<>(*nn, pictureData[currentPictureModel], false, false);
-      //optimizer->minimize(NUM_OPTIMIZER_THREADS);
-      
-      optimizer = new whiteice::math::NNGradDescent<>();
-      optimizer->setUseMinibatch(true);
-      if(optimizer->startOptimize(pictureData[currentPictureModel], *nn,
-				  NUM_OPTIMIZER_THREADS) == false){
-	logging.error("nn NNGradDescent::startOptimize() FAILED.");
-      }
+    // records data versions of saved models immediately so that
+    // stopped optimization doesn't retrain them
+    {
+      std::vector<std::string> saved;
+      trainingScheduler.takeSavedModels(saved);
       
-      {
-	char buffer[512];
-	snprintf(buffer, 512, "resonanz model optimization started: picture %d database size: %d",
-		 currentPictureModel, pictureData[currentPictureModel].size(0));
-	fprintf(stdout, "%s\n", buffer);
-	logging.info(buffer);
+      for(const auto& filename : saved){
+	auto v = trainingVersions.find(filename);
+	if(v == trainingVersions.end()) continue;
+	
+	modelVersions[v->second.first] = v->second.second;
+	trainingVersions.erase(v);
       }
       
+      if(saved.size() > 0 && engine_saveModelVersions(currentCommand.modelDir) == false)
+	logging.warn("resonanz model optimization: saving model versions FAILED");
     }
-    else if(optimizer != nullptr && use_bayesian_nnetwork){ // pre-optimizer is active
-      
-      whiteice::math::blas_real<float> error = 1000.0f;
-      whiteice::nnetwork<> tmpnn;
-      whiteice::math::vertex<> w;
-      unsigned int iterations = 0;
-      
-      //optimizer->getSolution(w, error, iterations);
-      optimizer->getSolution(tmpnn, error, iterations);
-      tmpnn.exportdata(w);
+    
+    currentPictureModel = trainingScheduler.getFinishedJobs("picture");
+    currentKeywordModel = trainingScheduler.getFinishedJobs("keyword");
+    if(trainingScheduler.getFinishedJobs("synth") > 0) soundModelCalculated = true;
+    
+    logging.info("resonanz model optimization running " + trainingScheduler.getStatus());
+  }
+  else{ // both synth, picture and keyword models has been computed or
+    // optimizeSynthOnly == true and only synth model has been computed => stop
+    {
+      std::vector<std::string> saved;
+      trainingScheduler.takeSavedModels(saved);
       
-      if(iterations >= NUM_OPTIMIZER_ITERATIONS){
-	// gets finished solution
-	
-	optimizer->stopComputation();
-	//optimizer->getSolution(w, error, iterations);
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz model NNGradDescent<> optimization stopped. picture model. iterations: %d error: %f",
-		   iterations, error.c[0]);
-	  logging.info(buffer);
-	}
-	
-	nn->importdata(w);
-	
-	// switches to uncertainty analysis
-	const bool adaptive = true;
-	
-	bayes_optimizer = new whiteice::UHMC<>(*nn, pictureData[currentPictureModel], adaptive);
-	bayes_optimizer->setMinibatch(true);
-	bayes_optimizer->startSampler();
+      for(const auto& filename : saved){
+	auto v = trainingVersions.find(filename);
+	if(v == trainingVersions.end()) continue;
 	
-	delete optimizer;
-	optimizer = nullptr;
+	modelVersions[v->second.first] = v->second.second;
       }
-      else{
-	{
-	  char buffer[512];
-	  unsigned int iterations;
-	  whiteice::math::blas_real<float> error;
-	  optimizer->getSolutionStatistics(error, iterations);
-	  
-	  //snprintf(buffer, 512, "resonanz L-BFGS model optimization running. picture model. number of iterations: %d/%d",
-	  //   optimizer->getIterations(), NUM_OPTIMIZER_ITERATIONS);
-	  snprintf(buffer, 512, "resonanz NNGradDescent<> model optimization running. picture model. number of iterations: %d/%d",
-		   iterations, NUM_OPTIMIZER_ITERATIONS);
-	  logging.info(buffer);
-	}
-      }
-      
-    }
-    else if(bayes_optimizer != nullptr){
-      if(bayes_optimizer->getNumberOfSamples() >= BAYES_NUM_SAMPLES){ // time to stop computation [got uncertainly information]
-	
-	bayes_optimizer->stopSampler();
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz bayes model optimization stopped. picture: %d iterations: %d",
-		   currentPictureModel, bayes_optimizer->getNumberOfSamples());
-	  logging.info(buffer);
-	}
-	
-	// saves optimization results to a file
-	std::string dbFilename = currentCommand.modelDir + "/" +
-	  calculateHashName(pictures[currentPictureModel] + eeg->getDataSourceName()) + ".model";
-	
-	bayes_optimizer->getNetwork(*bnn);
-	
-	if(bnn->save(dbFilename) == false)
-	  logging.error("saving bayesian nn configuration file failed");
-	
-	delete bayes_optimizer;
-	bayes_optimizer = nullptr;
-	
-	// starts new computation
-	currentPictureModel++;
-	if(currentPictureModel < pictures.size()){
-	  {
-	    char buffer[512];
-	    snprintf(buffer, 512, "resonanz bayes model optimization started: picture %d database size: %d",
-		     currentPictureModel, pictureData[currentPictureModel].size(0));
-	    fprintf(stdout, "%s\n", buffer);
-	    logging.info(buffer);
-	  }
-	  
-	  // actives pre-optimizer
-	  whiteice::math::vertex<> w;
-	  
-	  nn->randomize();
-	  nn->exportdata(w);
-	  
-	  //optimizer = new whiteice::pLBFGS_nnetwork<>(*nn, pictureData[currentPictureModel], false, false);
-	  //optimizer->minimize(NUM_OPTIMIZER_THREADS);
-	  
-	  optimizer = new whiteice::math::NNGradDescent<>();
-	  optimizer->setUseMinibatch(true);
-	  if(optimizer->startOptimize(pictureData[currentPictureModel], *nn,
-				      NUM_OPTIMIZER_THREADS) == false){
-	    logging.error("nn NNGradDescent::startOptimize() FAILED.");
-	  }
-	  
-	}
-      }
-      else{
-	unsigned int samples = bayes_optimizer->getNumberOfSamples();
-	
-	if((samples % 100) == 0){
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz bayes model optimization running. picture: %d number of samples: %d/%d",
-		   currentPictureModel, bayes_optimizer->getNumberOfSamples(), BAYES_NUM_SAMPLES);
-	  logging.info(buffer);
-	}
-	
-      }
-    }
-    else if(optimizer != nullptr){
-      whiteice::math::blas_real<float> error = 1000.0f;
-      whiteice::nnetwork<> tmpnn;
-      whiteice::math::vertex<> w;
-      unsigned int iterations = 0;
       
-      //optimizer->getSolution(w, error, iterations);
-      optimizer->getSolution(tmpnn, error, iterations);
-      tmpnn.exportdata(w);
+      trainingVersions.clear();
       
-      if(iterations >= NUM_OPTIMIZER_ITERATIONS){
-	// gets finished solution
-	
-	optimizer->stopComputation();
-	//optimizer->getSolution(w, error, iterations);
-	
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz model optimization stopped. picture: %d iterations: %d error: %f",
-		   currentPictureModel, iterations, error.c[0]);
-	  fprintf(stdout, "%s\n", buffer);
-	  logging.info(buffer);
-	}
-	
-	// saves optimization results to a file
-	std::string dbFilename = currentCommand.modelDir + "/" +
-	  calculateHashName(pictures[currentPictureModel] + eeg->getDataSourceName()) + ".model";
-	nn->importdata(w);
-	
-	bnn->importNetwork(*nn);
-	
-	if(bnn->save(dbFilename) == false)
-	  logging.error("saving nn configuration file failed");
-	
-	delete optimizer;
-	optimizer = nullptr;
-	
-	// starts new computation
-	currentPictureModel++;
-	if(currentPictureModel < pictures.size()){
-	  nn->randomize();
-	  nn->exportdata(w);
-	  
-	  {
-	    char buffer[512];
-	    snprintf(buffer, 512, "resonanz model optimization started: picture %d database size: %d",
-		     currentPictureModel, pictureData[currentPictureModel].size(0));
-	    logging.info(buffer);
-	  }
-	  
-	  //optimizer = new whiteice::pLBFGS_nnetwork<>(*nn, pictureData[currentPictureModel], false, false);
-	  //optimizer->minimize(NUM_OPTIMIZER_THREADS);
-	  
-	  optimizer = new whiteice::math::NNGradDescent<>();
-	  optimizer->setUseMinibatch(true);
-	  if(optimizer->startOptimize(pictureData[currentPictureModel], *nn,
-				      NUM_OPTIMIZER_THREADS) == false){
-	    logging.error("nn NNGradDescent::startOptimize() FAILED.");
-	  }
-	}
-      }
-    }
-    else{
-      {
-	math::vertex< math::blas_real<float> > w;
-	whiteice::nnetwork<> tmpnn;
-	math::blas_real<float> error;
-	unsigned int iterations = 0;
-	
-	//optimizer->getSolution(w, error, iterations);
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
-	
-	char buffer[512];
-	snprintf(buffer, 512, "resonanz L-BFGS model optimization running. picture model %d/%d. number of iterations: %d/%d. error: %f",
-		 currentPictureModel, (int)pictures.size(), 
-		 iterations, NUM_OPTIMIZER_ITERATIONS, error.c[0]);
-	fprintf(stdout, "%s\n", buffer);
-	logging.info(buffer);
-      }
+      if(saved.size() > 0 && engine_saveModelVersions(currentCommand.modelDir) == false)
+	logging.warn("resonanz model optimization: saving model versions FAILED");
     }
     
-  }
-  else if(currentKeywordModel < keywords.size() && optimizeSynthOnly == false){
-    
-    if(optimizer == nullptr && bayes_optimizer == nullptr){
-      // first model to be optimized (no need to store the previous result)
-      
-      whiteice::math::vertex<> w;
-      
-      nnkey->randomize();
-      nnkey->exportdata(w);
-      
-      //optimizer = new whiteice::pLBFGS_nnetwork<>(*nn, keywordData[currentKeywordModel], false, false);
-      //optimizer->minimize(NUM_OPTIMIZER_THREADS);
-      
-      optimizer = new whiteice::math::NNGradDescent<>();
-      optimizer->setUseMinibatch(true);
-      if(optimizer->startOptimize(keywordData[currentKeywordModel], *nnkey,
-				  NUM_OPTIMIZER_THREADS) == false){
-	logging.error("nnkey NNGradDescent::startOptimize() FAILED.");
-      }
-      
-      {
-	char buffer[512];
-	snprintf(buffer, 512, "resonanz model optimization started: keyword %d database size: %d",
-		 currentKeywordModel, keywordData[currentKeywordModel].size(0));
-	fprintf(stdout, "%s\n", buffer);
-	logging.info(buffer);
-      }
-      
-    }
-    else if(optimizer != nullptr && use_bayesian_nnetwork){ // pre-optimizer is active
-      
-      whiteice::math::blas_real<float> error = 1000.0f;
-      whiteice::nnetwork<> tmpnn;
-      whiteice::math::vertex<> w;
-      unsigned int iterations = 0;
-      
-      //optimizer->getSolution(w, error, iterations);
-      optimizer->getSolution(tmpnn, error, iterations);
-      tmpnn.exportdata(w);
-      
-      if(iterations >= NUM_OPTIMIZER_ITERATIONS){
-	// gets finished solution
-	
-	optimizer->stopComputation();
-	
-	//optimizer->getSolution(w, error, iterations);
-	
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz model NNGradDescent<> optimization stopped. keyword model. iterations: %d error: %f",
-		   iterations, error.c[0]);
-	  logging.info(buffer);
-	}
-	
-	nnkey->importdata(w);
-	
-	// switches to bayesian optimizer
-	const bool adaptive = true;
-	
-	bayes_optimizer = new whiteice::UHMC<>(*nnkey, keywordData[currentKeywordModel], adaptive);
-	bayes_optimizer->setMinibatch(true);
-	bayes_optimizer->startSampler();
-	
-	delete optimizer;
-	optimizer = nullptr;
-      }
-      else{
-	{
-	  char buffer[512];
-	  unsigned int iterations;
-	  whiteice::math::blas_real<float> error;
-	  optimizer->getSolutionStatistics(error, iterations);
-	  
-	  //snprintf(buffer, 512, "resonanz L-BFGS model optimization running. keyword model. number of iterations: %d/%d",
-	  //	   optimizer->getIterations(), NUM_OPTIMIZER_ITERATIONS);
-	  snprintf(buffer, 512, "resonanz NNGradDescent<> model optimization running. keyword model. number of iterations: %d/%d",
-		   iterations, NUM_OPTIMIZER_ITERATIONS);
-	  logging.info(buffer);
-	}
-      }
-      
-    }
-    else if(bayes_optimizer != nullptr){
-      if(bayes_optimizer->getNumberOfSamples() >= BAYES_NUM_SAMPLES){ // time to stop computation
-	
-	bayes_optimizer->stopSampler();
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz bayes model optimization stopped. keyword: %d iterations: %d",
-		   currentKeywordModel, bayes_optimizer->getNumberOfSamples());
-	  logging.info(buffer);
-	}
-	
-	// saves optimization results to a file
-	std::string dbFilename = currentCommand.modelDir + "/" +
-	  calculateHashName(keywords[currentKeywordModel] + eeg->getDataSourceName()) + ".model";
-	
-	bayes_optimizer->getNetwork(*bnn);
-	
-	if(bnn->save(dbFilename) == false)
-	  logging.error("saving bayesian nn configuration file failed");
-	
-	delete bayes_optimizer;
-	bayes_optimizer = nullptr;
-	
-	// starts new computation
-	currentKeywordModel++;
-	if(currentKeywordModel < keywords.size()){
-	  {
-	    char buffer[512];
-	    snprintf(buffer, 512, "resonanz bayes model optimization started: keyword %d database size: %d",
-		     currentKeywordModel, keywordData[currentKeywordModel].size(0));
-	    fprintf(stdout, "%s\n", buffer);
-	    logging.info(buffer);
-	  }
-	  
-	  whiteice::math::vertex<> w;
-	  nnkey->randomize();
-	  nnkey->exportdata(w);
-	  
-	  //optimizer = new whiteice::pLBFGS_nnetwork<>(*nn, keywordData[currentKeywordModel], false, false);
-	  //optimizer->minimize(NUM_OPTIMIZER_THREADS);
-	  
-	  optimizer = new whiteice::math::NNGradDescent<>();
-	  optimizer->setUseMinibatch(true);
-	  if(optimizer->startOptimize(keywordData[currentKeywordModel], *nnkey, 
-				      NUM_OPTIMIZER_THREADS)){
-	    logging.error("nnkey NNGradDescent::startOptimize() FAILED.");
-	  }
-	}
-      }
-      else{
-	unsigned int samples = bayes_optimizer->getNumberOfSamples();
-	
-	if((samples % 100) == 0){
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz bayes model optimization running. keyword: %d number of samples: %d/%d",
-		   currentKeywordModel, bayes_optimizer->getNumberOfSamples(), BAYES_NUM_SAMPLES);
-	  logging.info(buffer);
-	}
-	
-      }
-    }
-    else if(optimizer != nullptr){
-      whiteice::math::blas_real<float> error = 1000.0f;
-      whiteice::nnetwork<> tmpnn;
-      whiteice::math::vertex<> w;
-      unsigned int iterations = 0;
-      
-      //optimizer->getSolution(w, error, iterations);
-      optimizer->getSolution(tmpnn, error, iterations);
-      tmpnn.exportdata(w);
-      
-      if(iterations >= NUM_OPTIMIZER_ITERATIONS){
-	// gets finished solution
-	
-	optimizer->stopComputation();
-	
-	//optimizer->getSolution(w, error, iterations);
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
-	
-	
-	{
-	  char buffer[512];
-	  snprintf(buffer, 512, "resonanz model optimization stopped. keyword: %d iterations: %d error: %f",
-		   currentKeywordModel, iterations, error.c[0]);
-	  fprintf(stdout, "%s\n", buffer);
-	  logging.info(buffer);
-	}
-	
-	// saves optimization results to a file
-	std::string dbFilename = currentCommand.modelDir + "/" +
-	  calculateHashName(keywords[currentKeywordModel] + eeg->getDataSourceName()) + ".model";
-	nnkey->importdata(w);
-	
-	bnn->importNetwork(*nnkey);
-	
-	if(bnn->save(dbFilename) == false)
-	  logging.error("saving nn configuration file failed");
-	
-	delete optimizer;
-	optimizer = nullptr;
-	
-	// starts new computation
-	currentKeywordModel++;
-	if(currentKeywordModel < keywords.size()){
-	  nnkey->randomize();
-	  nnkey->exportdata(w);
-	  
-	  {
-	    char buffer[512];
-	    snprintf(buffer, 512, "resonanz model optimization started: keyword %d database size: %d",
-		     currentKeywordModel, keywordData[currentKeywordModel].size(0));
-	    logging.info(buffer);
-	  }
-	  
-	  //optimizer = new whiteice::pLBFGS_nnetwork<>(*nn, keywordData[currentKeywordModel], false, false);
-	  //optimizer->minimize(NUM_OPTIMIZER_THREADS);
-	  
-	  optimizer = new whiteice::math::NNGradDescent<>();
-	  optimizer->setUseMinibatch(true);
-	  if(optimizer->startOptimize(keywordData[currentKeywordModel], *nnkey, 
-				      NUM_OPTIMIZER_THREADS) == false){
-	    logging.error("nnkey NNGradDescent::startOptimize() FAILED.");
-	  }
-	}
-      }
-    }
-    else{
-      {
-	math::vertex< math::blas_real<float> > w;
-	whiteice::nnetwork<> tmpnn;
-	math::blas_real<float> error;
-	unsigned int iterations = 0;
-	
-	//optimizer->getSolution(w, error, iterations);
-	optimizer->getSolution(tmpnn, error, iterations);
-	tmpnn.exportdata(w);
-	
-	char buffer[512];
-	snprintf(buffer, 512, "resonanz NNGradDescent<> model optimization running. keyword model %d/%d. number of iterations: %d/%d. error: %f",
-		 currentKeywordModel, (int)keywords.size(), 
-		 iterations, NUM_OPTIMIZER_ITERATIONS, error.c[0]);
-	logging.info(buffer);
-      }
+    if(trainingScheduler.getFailedJobs() > 0){
+      char buffer[256];
+      snprintf(buffer, 256, "resonanz model optimization: %d models FAILED",
+	       trainingScheduler.getFailedJobs());
+      logging.error(buffer);
     }
-  }
-  else{ // both synth, picture and keyword models has been computed or
-    // optimizeSynthOnly == true and only synth model has been computed => stop
+    
+    trainingScheduler.clear();
     cmdStopCommand();
   }
   
@@ -4249,12 +3932,13 @@ bool ResonanzEngine::engine_optimizeModels(unsigned int& currentHMMModel,
 bool ResonanzEngine::engine_estimateNN(const whiteice::math::vertex<>& x,
 				       const whiteice::dataset<>& data,
 				       whiteice::math::vertex<>& m,
-				       whiteice::math::matrix<>& cov)
+				       whiteice::math::matrix<>& cov,
+				       const NNIndex* index)
 {
   bool bad_data = false;
   
   if(data.size(0) <= 0) bad_data = true;
-  if(data.getNumberOfClusters() != 2) bad_data = true;
+  if(data.getNumberOfClusters() < 2) bad_data = true;
   if(bad_data == false){
     if(data.size(0) != data.size(1))
       bad_data = true;
@@ -4277,18 +3961,51 @@ bool ResonanzEngine::engine_estimateNN(const whiteice::math::vertex<>& x,
   const float epsilon    = 0.01f;
   math::blas_real<float> sumweights = 0.0f;
 
+  // uses only k nearest rows (the most heavily weighted ones) if index is up to date
+  std::vector<unsigned int> rows;
+  std::vector<float> distances;
   
-  for(unsigned int i=0;i<data.size(0);i++){
-    auto delta = x - data.access(0, i);
-    
-    auto w = math::blas_real<float>(1.0f / (epsilon + delta.norm().c[0]));
-	  
-    auto v = data.access(1, i);
-    
-    m += w*v;
-    cov += w*v.outerproduct();
+  if(nnNeighbours > 0 && nnNeighbours < data.size(0) && index != nullptr &&
+     index->size() == data.size(0))
+  {
+    if(index->search(x, nnNeighbours, rows, distances) == false){
+      rows.clear();
+      distances.clear();
+    }
+  }
+
+  if(rows.size() > 0){
     
-    sumweights += w;
+    for(unsigned int j=0;j<rows.size();j++){
+      auto w = math::blas_real<float>(1.0f / (epsilon + distances[j]));
+      
+      const auto& v = data.access(1, rows[j]);
+      
+      m += w*v;
+      
+      // adds w*v*v^t to covariance matrix
+      for(unsigned int a=0;a<YMAX;a++){
+	const auto wva = w*v[a];
+	for(unsigned int b=0;b<YMAX;b++)
+	  cov(a,b) += wva*v[b];
+      }
+      
+      sumweights += w;
+    }
+  }
+  else{
+    for(unsigned int i=0;i<data.size(0);i++){
+      auto delta = x - data.access(0, i);
+      
+      auto w = math::blas_real<float>(1.0f / (epsilon + delta.norm().c[0]));
+      
+      auto v = data.access(1, i);
+      
+      m += w*v;
+      cov += w*v.outerproduct();
+      
+      sumweights += w;
+    }
   }
   
   m /= sumweights;
@@ -4342,7 +4059,8 @@ bool ResonanzEngine::engine_checkIncomingCommand()
 }
 
 
-bool ResonanzEngine::engine_loadMedia(const std::string& picdir, const std::string& keyfile, bool loadData)
+bool ResonanzEngine::engine_loadMedia(const std::string& picdir, const std::string& keyfile,
+				      const std::string& modelDir, bool loadData)
 {
   std::vector<std::string> tempKeywords;
   
@@ -4363,17 +4081,11 @@ bool ResonanzEngine::engine_loadMedia(const std::string& picdir, const std::stri
   pictures = tempPictures;
   keywords = tempKeywords;
   
-  for(unsigned int i=0;i<images.size();i++){
-    if(images[i] != nullptr)
-      SDL_FreeSurface(images[i]);
-    images[i] = nullptr;
-  }
-
-  images.clear();
+  imageCache.setPictures(std::vector<std::string>());
   imageFeatures.clear();
   
   if(loadData){
-    images.resize(pictures.size());
+    imageCache.setPictures(pictures);
     imageFeatures.resize(pictures.size());
     
     std::vector<float> synthParams;
@@ -4384,46 +4096,68 @@ bool ResonanzEngine::engine_loadMedia(const std::string& picdir, const std::stri
     }
     
     
-    for(unsigned int i=0;i<images.size();i++){
-      images[i] = nullptr;
+    // pictures are loaded lazily by engine_showScreen(), here we only calculate
+    // picture feature vectors in parallel (or get them from the feature cache)
+    PicFeatureVectorCache featureCache
+      (modelDir.length() > 0 ? (modelDir + "/pictures.features") : "");
 
+    featureCache.load();
+    
+    std::vector< std::vector<float> > features(pictures.size());
+
+    const unsigned int CHUNK_SIZE = 64;
+
+    for(unsigned int i=0;i<pictures.size();i+=CHUNK_SIZE){
       {
 	char buffer[80];
 	
 	snprintf(buffer, 80,
 		 "resonanz-engine: loading media files (%.1f%%)..",
-		 100.0f*(((float)i)/((float)images.size())));
+		 100.0f*(((float)i)/((float)pictures.size())));
 	engine_setStatus(buffer);
       }
       
-      engine_showScreen("Loading..", i, synthParams); // loads picture if it is not loaded yet.
+      engine_showScreen("Loading..", pictures.size(), synthParams);
+      
+      featureCache.calculate(pictures, i, CHUNK_SIZE, features);
 
-      // calculates feature vector from picture
-      {
-	std::vector<float> features;
+      for(unsigned int k=i;k<pictures.size() && k<i+CHUNK_SIZE;k++){
 	whiteice::math::vertex<> f;
 	
 	f.resize(PICFEATURES_SIZE);
 	f.zero();
 
-	calculatePicFeatureVector(images[i], features);
+	if(features[k].size() == 0){
+	  char buffer[256];
+	  snprintf(buffer, 256, "calculating picture features FAILED: %s",
+		   pictures[k].c_str());
+	  logging.warn(buffer);
+	}
 
-	for(unsigned int j=0;j<features.size() && j< f.size();j++)
-	  f[j] = features[j];
+	for(unsigned int j=0;j<features[k].size() && j< f.size();j++)
+	  f[j] = features[k][j];
 
-	imageFeatures[i] = f;
+	imageFeatures[k] = f;
       }
       
       engine_pollEvents();
       engine_updateScreen();
     }
+
+    if(featureCache.save() == false && modelDir.length() > 0){
+      logging.warn("saving picture feature cache FAILED.");
+    }
+
+    {
+      char buffer[80];
+      snprintf(buffer, 80, "picture features: %d cached, %d calculated",
+	       (int)featureCache.getCacheHits(), (int)featureCache.getCacheMisses());
+      logging.info(buffer);
+    }
     
     engine_pollEvents();
     engine_updateScreen();
   }
-  else{
-    images.clear();
-  }
   
   return true;
 }
@@ -4434,9 +4168,76 @@ bool ResonanzEngine::engine_loadDatabase(const std::string& modelDir)
   std::lock_guard<std::mutex> lock(database_mutex);
 
   latestModelDir = modelDir;
+
+  // moved pictures keep dataset names of their earlier locations
+  registry.open(modelDir);
+  
+  {
+    const std::string sourceName = eeg->getDataSourceName();
+    std::set<std::string> active;
+    
+    for(const auto& p : pictures)
+      active.insert(p + sourceName);
+    
+    for(const auto& p : pictures){
+      const std::string key = p + sourceName;
+      
+      if(registry.contains(key)) continue;
+      
+      char filename[2048];
+      snprintf(filename, 2048, "%s", p.c_str());
+      
+      if(registry.relocate(key, std::string(basename(filename)) + sourceName, active))
+	logging.info("picture moved, keeps its measurements: " + p);
+    }
+  }
+
+  // folds measurements journaled by earlier (crashed) sessions into
+  // dataset files before loading them and starts a new journal
+  journal.setPCAPreprocess(pcaPreprocess);
+  journal.setStatisticsDrift(STATISTICS_DRIFT);
+  
+  if(journal.open(modelDir) == false){
+    logging.warn("engine_loadDatabase(): measurement journal cannot be folded/opened");
+    journalFailed = true;
+  }
+  else{
+    journalFailed = false;
+  }
+  
+  // names of journaled datasets (registry is not searched for every measurement)
+  {
+    const std::string sourceName = eeg->getDataSourceName();
+    
+    keywordDatasets.resize(keywords.size());
+    pictureDatasets.resize(pictures.size());
+    
+    for(unsigned int i=0;i<keywords.size();i++)
+      keywordDatasets[i] = calculateHashName(keywords[i] + sourceName);
+    
+    for(unsigned int i=0;i<pictures.size();i++)
+      pictureDatasets[i] = calculateHashName(pictures[i] + sourceName);
+    
+    eegDataset = calculateHashName("eegData" + sourceName);
+    synthDataset = synth ? calculateHashName(sourceName + synth->getSynthesizerName()) : "";
+  }
+  
+  // unchanged datasets are read from the measurement store, only
+  // datasets whose .ds file has changed are parsed and imported
+  {
+    std::vector<std::string> names(keywordDatasets);
+    names.insert(names.end(), pictureDatasets.begin(), pictureDatasets.end());
+    names.push_back(eegDataset);
+    if(synth) names.push_back(synthDataset);
+    
+    if(store.update(modelDir, names) == false)
+      logging.warn("engine_loadDatabase(): updating measurement store failed");
+  }
   
   keywordData.resize(keywords.size());
   pictureData.resize(pictures.size());
+  keywordStats.resize(keywords.size());
+  pictureStats.resize(pictures.size());
   
   std::string name1 = "input";
   std::string name2 = "output";
@@ -4457,8 +4258,9 @@ bool ResonanzEngine::engine_loadDatabase(const std::string& modelDir)
   {
     std::string dbFilename = modelDir + "/" + calculateHashName("eegData" + eeg->getDataSourceName()) + ".ds";
     std::string eegName = "Pure EEG data";
+    bool raw = false;
 
-    if(eegData.load(dbFilename) == false){
+    if(engine_readDataset(dbFilename, eegData, raw) == false){
       logging.info("Couldn't load EEG data => creating empty database");
       eegData.clear();
       eegData.createCluster(eegName, eeg->getNumberOfSignals());
@@ -4490,170 +4292,74 @@ bool ResonanzEngine::engine_loadDatabase(const std::string& modelDir)
 	eegData.preprocess(0, whiteice::dataset<>::dnMeanVarianceNormalization);
       }
     }
+    
+    engine_loadStatistics(dbFilename, eegData, 1, eegStats, false, raw);
   }
     
   
-  // loads databases into memory or initializes new ones
-  for(unsigned int i=0;i<keywords.size();i++){
-    std::string dbFilename = modelDir + "/" + calculateHashName(keywords[i] + eeg->getDataSourceName()) + ".ds";
-    
-    keywordData[i].clear();
+  // loads keyword and picture datasets concurrently (files are independent)
+  keywordIndex.resize(keywordData.size());
+  pictureIndex.resize(pictureData.size());
+  
+  {
+    const unsigned int numSignals = eeg->getNumberOfSignals();
+    const std::string sourceName = eeg->getDataSourceName();
+    const unsigned int N = keywords.size() + pictures.size();
+    std::atomic<unsigned int> done(0);
     
-    if(keywordData[i].load(dbFilename) == false){
-      logging.info("Couldn't load keyword data => creating empty database");
-      
-      keywordData[i].createCluster(name1, eeg->getNumberOfSignals() + HMM_NUM_CLUSTERS);
-      keywordData[i].createCluster(name2, eeg->getNumberOfSignals());
-      keywordData[i].createCluster("index", 1);
-    }
-    else{
-      if(keywordData[i].getNumberOfClusters() != 3){
-	logging.error("Keyword data wrong number of clusters or data corruption => reset database");
+#pragma omp parallel for schedule(dynamic) num_threads(engine_databaseThreads())
+    for(unsigned int j=0;j<N;j++){
+      if(j < keywords.size()){
+	const unsigned int i = j;
+	std::string dbFilename = modelDir + "/" + calculateHashName(keywords[i] + sourceName) + ".ds";
+	
+	engine_loadStimulusDataset(dbFilename, "keyword",
+				   numSignals + HMM_NUM_CLUSTERS, numSignals,
+				   keywordData[i], keywordStats[i]);
+	
+	// nearest neighbour index of preprocessed keyword inputs
+	if(keywordIndex[i].build(keywordData[i], 0) == false)
+	  logging.warn("keywordData: building nearest neighbour index failed");
+      }
+      else{
+	const unsigned int i = j - keywords.size();
+	std::string dbFilename = modelDir + "/" + calculateHashName(pictures[i] + sourceName) + ".ds";
 	
-	keywordData[i].clear();
-	keywordData[i].createCluster(name1, eeg->getNumberOfSignals() + HMM_NUM_CLUSTERS);
-	keywordData[i].createCluster(name2, eeg->getNumberOfSignals());
-	keywordData[i].createCluster("index", 1);
+	engine_loadStimulusDataset(dbFilename, "picture",
+				   numSignals + HMM_NUM_CLUSTERS + PICFEATURES_SIZE, numSignals,
+				   pictureData[i], pictureStats[i]);
+	
+	if(pictureIndex[i].build(pictureData[i], 0) == false)
+	  logging.warn("pictureData: building nearest neighbour index failed");
       }
+      
+      engine_databaseProgress("loading", ++done, N);
     }
     
+    for(unsigned int i=0;i<keywordData.size();i++)
+      keyword_num_samples += keywordData[i].size(0);
     
-    const unsigned int datasize = keywordData[i].size(0);
-    
-    if(keywordData[i].removeBadData() == false)
-      logging.warn("keywordData: bad data removal failed");
+    for(unsigned int i=0;i<pictureData.size();i++)
+      picture_num_samples += pictureData[i].size(0);
+  }
+  
+  logging.info("keywords and picture measurement database loaded");
+  
+  if(registry.save() == false)
+    logging.warn("engine_loadDatabase(): saving stimulus registry failed");
+  
+  // loads synth parameters data into memory
+  if(synth){
+    std::string dbFilename = modelDir + "/" + calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
     
-    if(datasize != keywordData[i].size(0)){
-      char buffer[80];
-      snprintf(buffer, 80, "Keyword %d: bad data removal reduced data: %d => %d\n",
-	       i, datasize, keywordData[i].size(0));
-      logging.warn(buffer);
-    }
+    synthData.clear();
+    bool raw = false;
     
-    keyword_num_samples += keywordData[i].size(0);
-    
-    {
-      if(pcaPreprocess){
-	if(keywordData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing keyword measurements [input]");
-	  keywordData[i].preprocess(0, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	if(keywordData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing keyword measurements [output]");
-	  keywordData[i].preprocess(1, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	// keywordData[i].convert(1);
-      }
-      else{
-	if(keywordData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA processing of keyword measurements [input]");
-	  keywordData[i].convert(0); // removes all preprocessings from input
-	}
-	if(keywordData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA processing of keyword measurements [output]");
-	  keywordData[i].convert(1); // removes all preprocessings from output
-	}
-	
-	keywordData[i].preprocess(0, whiteice::dataset<>::dnMeanVarianceNormalization);
-	keywordData[i].preprocess(1, whiteice::dataset<>::dnMeanVarianceNormalization);
-	
-	// keywordData[i].convert(1);
-      }
-      
-      // keywordData[i].convert(1); // removes all preprocessings from output
-    }
-    
-  }
-  
-  logging.info("keywords measurement database loaded");
-	
-  
-  
-  for(unsigned int i=0;i<pictures.size();i++){
-    std::string dbFilename = modelDir + "/" + calculateHashName(pictures[i] + eeg->getDataSourceName()) + ".ds";
-    
-    pictureData[i].clear();
-    
-    if(pictureData[i].load(dbFilename) == false){
-      logging.info("Couldn't load picture data => creating empty database");
-      
-      pictureData[i].createCluster(name1, eeg->getNumberOfSignals() + HMM_NUM_CLUSTERS + PICFEATURES_SIZE);
-      pictureData[i].createCluster(name2, eeg->getNumberOfSignals());
-      pictureData[i].createCluster("index", 1);
-      
-    }
-    else{
-      if(pictureData[i].getNumberOfClusters() != 3){
-	logging.error("Picture data wrong number of clusters or data corruption => reset database");
-	
-	pictureData[i].clear();
-	pictureData[i].createCluster(name1, eeg->getNumberOfSignals() + HMM_NUM_CLUSTERS + PICFEATURES_SIZE);
-	pictureData[i].createCluster(name2, eeg->getNumberOfSignals());
-	pictureData[i].createCluster("index", 1);
-      }
-    }
-    
-    const unsigned int datasize = pictureData[i].size(0);
-    
-    if(pictureData[i].removeBadData() == false)
-      logging.warn("pictureData: bad data removal failed");
-    
-    if(datasize != pictureData[i].size(0)){
-      char buffer[80];
-      snprintf(buffer, 80, "Picture %d: bad data removal reduced data: %d => %d\n",
-	       i, datasize, pictureData[i].size(0));
-      logging.warn(buffer);
-    }
-    
-    picture_num_samples += pictureData[i].size(0);
-    
-    
-    {
-      if(pcaPreprocess){
-	if(pictureData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing picture measurements [input]");
-	  pictureData[i].preprocess(0, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	
-	if(pictureData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing picture measurements [output]");
-	  pictureData[i].preprocess(1, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	
-	// pictureData[i].convert(1);
-      }
-      else{
-	if(pictureData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA processing of picture measurements [input]");
-	  pictureData[i].convert(0); // removes all preprocessings from input
-	}
-	if(pictureData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA processing of picture measurements [output]");
-	  pictureData[i].convert(1); // removes all preprocessings from output
-	}
-	
-	pictureData[i].preprocess(0, whiteice::dataset<>::dnMeanVarianceNormalization);
-	pictureData[i].preprocess(1, whiteice::dataset<>::dnMeanVarianceNormalization);
-	
-	// pictureData[i].convert(1);
-      }
-      
-      // pictureData[i].convert(1); // removes all preprocessings from output
-    }
-  }
-  
-  logging.info("picture measurement database loaded");
-  
-  // loads synth parameters data into memory
-  if(synth){
-    std::string dbFilename = modelDir + "/" + calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
-    
-    synthData.clear();
-    
-    if(synthData.load(dbFilename) == false){
+    if(engine_readDataset(dbFilename, synthData, raw) == false){
       synthData.createCluster(name1, eeg->getNumberOfSignals() + 2*synth->getNumberOfParameters() + HMM_NUM_CLUSTERS);
       synthData.createCluster(name2, eeg->getNumberOfSignals());
       synthData.createCluster("index", 1);
+      engine_loadStatistics(dbFilename, synthData, 2, synthStats, pcaPreprocess);
       logging.info("Couldn't load synth data => creating empty database");
       return false;
     }
@@ -4664,6 +4370,7 @@ bool ResonanzEngine::engine_loadDatabase(const std::string& modelDir)
 	synthData.createCluster(name1, eeg->getNumberOfSignals() + 2*synth->getNumberOfParameters() + HMM_NUM_CLUSTERS);
 	synthData.createCluster(name2, eeg->getNumberOfSignals());
 	synthData.createCluster("index", 1);
+	engine_loadStatistics(dbFilename, synthData, 2, synthStats, pcaPreprocess);
 	return false;
       }
     }
@@ -4713,6 +4420,8 @@ bool ResonanzEngine::engine_loadDatabase(const std::string& modelDir)
       }
     }
     
+    engine_loadStatistics(dbFilename, synthData, 2, synthStats, pcaPreprocess, raw);
+    
     logging.info("synth measurement database loaded");
   }
   
@@ -4742,6 +4451,83 @@ bool ResonanzEngine::engine_loadDatabase(const std::string& modelDir)
 }
 
 
+// replaces single before and after EEG values with averages of all device samples:
+// before = mean of [t0 - DELAY/2, t0] and after = mean of [t0 + DELAY/2, t0 + DELAY]
+// so that time between before and after values is still MEASUREMODE_DELAY_MS.
+// keeps single values if device doesn't buffer samples
+bool ResonanzEngine::engine_averageResponse(long long stimulusStart,
+					    std::vector<float>& eegBefore,
+					    std::vector<float>& eegAfter)
+{
+  if(eeg == nullptr) return false;
+  
+  const long long halfDelay = MEASUREMODE_DELAY_MS/2;
+  
+  std::vector< std::vector<float> > x;
+  std::vector<long long> times;
+  
+  bool averaged = false;
+  
+  for(unsigned int w=0;w<2;w++){
+    const long long t0 = (w == 0) ? (stimulusStart - halfDelay) : (stimulusStart + halfDelay);
+    const long long t1 = (w == 0) ? stimulusStart : (stimulusStart + MEASUREMODE_DELAY_MS);
+    std::vector<float>& value = (w == 0) ? eegBefore : eegAfter;
+    
+    if(eeg->dataWindow(t0, t1, x, times) == false) return false;
+    if(x.size() == 0) continue;
+    
+    std::vector<float> mean(x[0].size(), 0.0f);
+    
+    for(const auto& s : x){
+      if(s.size() != mean.size()) return false;
+      for(unsigned int i=0;i<mean.size();i++)
+	mean[i] += s[i];
+    }
+    
+    for(auto& m : mean)
+      m /= ((float)x.size());
+    
+    value = mean;
+    averaged = true;
+  }
+  
+  return averaged;
+}
+
+
+bool ResonanzEngine::engine_synthOnset(unsigned long long generation,
+				       long long& stimulusStart)
+{
+  if(synth == nullptr) return false;
+  
+  const unsigned long long current = synth->getParametersGeneration();
+  
+  if(current <= generation)
+    return false; // sound parameters were not changed
+  
+  unsigned long long applied = 0;
+  long long appliedTime = 0;
+  
+  if(synth->getParametersAppliedTime(applied, appliedTime) == false)
+    return false;
+  
+  if(applied < current)
+    return false; // audio thread has not picked up parameters (paused?)
+  
+  if(appliedTime > stimulusStart){
+    long long delay = appliedTime - stimulusStart;
+    if(delay > MEASUREMODE_DELAY_MS) delay = MEASUREMODE_DELAY_MS;
+    
+    // waits so that the whole response window after onset is measured
+    engine_sleep((int)delay);
+    
+    stimulusStart = appliedTime;
+  }
+  
+  return true;
+}
+
+
 bool ResonanzEngine::engine_storeMeasurement(unsigned int pic, unsigned int key, 
 					     const std::vector<float>& eegBefore, 
 					     const std::vector<float>& eegAfter,
@@ -4851,6 +4637,18 @@ bool ResonanzEngine::engine_storeMeasurement(unsigned int pic, unsigned int key,
       logging.error("Adding new keyword data FAILED");
       return false;
     }
+
+    if(key < keywordIndex.size())
+      keywordIndex[key].update(keywordData[key], 0);
+
+    if(key < keywordStats.size() && keywordStats[key].size() == 2){
+      keywordStats[key][0].add(t1);
+      keywordStats[key][1].add(t2);
+    }
+
+    if(key >= keywordDatasets.size() ||
+       journal.append(keywordDatasets[key], MeasurementJournal::RECORD_STIMULUS, { &t1, &t2, &t4 }) == false)
+      journalFailed = true;
   }
   
   if(pic < pictureData.size()){
@@ -4866,6 +4664,18 @@ bool ResonanzEngine::engine_storeMeasurement(unsigned int pic, unsigned int key,
       logging.error("Adding new picture data FAILED");
       return false;
     }
+
+    if(pic < pictureIndex.size())
+      pictureIndex[pic].update(pictureData[pic], 0);
+
+    if(pic < pictureStats.size() && pictureStats[pic].size() == 2){
+      pictureStats[pic][0].add(t5);
+      pictureStats[pic][1].add(t2);
+    }
+
+    if(pic >= pictureDatasets.size() ||
+       journal.append(pictureDatasets[pic], MeasurementJournal::RECORD_STIMULUS, { &t5, &t2, &t4 }) == false)
+      journalFailed = true;
   }
 
   if(eegData.add(0, t3) == false || eegData.add(1, t4) == false){
@@ -4873,6 +4683,12 @@ bool ResonanzEngine::engine_storeMeasurement(unsigned int pic, unsigned int key,
     return false;
   }
 
+  if(eegStats.size() == 1)
+    eegStats[0].add(t3);
+
+  if(journal.append(eegDataset, MeasurementJournal::RECORD_EEG, { &t3, &t4 }) == false)
+    journalFailed = true;
+
   // FIXME: don't handle HMM brain states at all
   if(synth){
     std::vector< whiteice::math::blas_real<float> > input, output;
@@ -4934,6 +4750,15 @@ bool ResonanzEngine::engine_storeMeasurement(unsigned int pic, unsigned int key,
       logging.error("Adding new synth data FAILED");
       return false;
     }
+
+    if(synthStats.size() == 2){
+      synthStats[0].add(input);
+      synthStats[1].add(output);
+    }
+
+    if(synthDataset.length() == 0 ||
+       journal.append(synthDataset, MeasurementJournal::RECORD_STIMULUS, { &input, &output, &t4 }) == false)
+      journalFailed = true;
   }
   
   return true;
@@ -4944,6 +4769,9 @@ bool ResonanzEngine::engine_saveDatabase(const std::string& modelDir)
 {
   std::lock_guard<std::mutex> lock(database_mutex);
 
+  // dataset files must not be folded while they are rewritten
+  journal.wait();
+  
   
   // saves eegData to files
   {
@@ -4951,9 +4779,10 @@ bool ResonanzEngine::engine_saveDatabase(const std::string& modelDir)
 
     if(eegData.getNumberOfClusters() != 2) return false;
 
-    eegData.convert(0);
+    // EEG data is renormalized only if its statistics have changed
+    engine_validateStatistics(eegData, 1, eegStats, false);
 
-    if(eegData.preprocess(0, whiteice::dataset<>::dnMeanVarianceNormalization) == false)
+    if(engine_refreshPreprocess(eegData, 0, eegStats[0], false) == false)
       return false;
     
     if(eegData.save(dbFilename) == false){
@@ -4962,196 +4791,759 @@ bool ResonanzEngine::engine_saveDatabase(const std::string& modelDir)
     }
   }
   
-  // saves databases from memory
-  for(unsigned int i=0;i<keywordData.size();i++){
-    std::string dbFilename = modelDir + "/" + calculateHashName(keywords[i] + eeg->getDataSourceName()) + ".ds";
-    
-    if(keywordData[i].removeBadData() == false)
-      logging.warn("keywordData: bad data removal failed");
+  // saves keyword and picture datasets concurrently (files are independent)
+  {
+    keywordStats.resize(keywordData.size());
+    pictureStats.resize(pictureData.size());
+    
+    const std::string sourceName = eeg->getDataSourceName();
+    const unsigned int N = keywordData.size() + pictureData.size();
+    std::atomic<unsigned int> done(0);
+    std::atomic<bool> failed(false);
+    
+#pragma omp parallel for schedule(dynamic) num_threads(engine_databaseThreads())
+    for(unsigned int j=0;j<N;j++){
+      bool ok = true;
+      
+      if(j < keywordData.size()){
+	const unsigned int i = j;
+	std::string dbFilename = modelDir + "/" + calculateHashName(keywords[i] + sourceName) + ".ds";
+	
+	ok = engine_saveStimulusDataset(dbFilename, "keyword", keywordData[i], keywordStats[i],
+					i < keywordIndex.size() ? &(keywordIndex[i]) : nullptr);
+      }
+      else{
+	const unsigned int i = j - keywordData.size();
+	std::string dbFilename = modelDir + "/" + calculateHashName(pictures[i] + sourceName) + ".ds";
+	
+	ok = engine_saveStimulusDataset(dbFilename, "picture", pictureData[i], pictureStats[i],
+					i < pictureIndex.size() ? &(pictureIndex[i]) : nullptr);
+      }
+      
+      if(ok == false) failed = true;
+      
+      engine_databaseProgress("saving", ++done, N);
+    }
+    
+    if(failed) return false;
+  }
+  
+  // stores sound synthesis measurements
+  if(synth){
+    std::string dbFilename = modelDir + "/" + calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
+    
+    if(engine_saveStimulusDataset(dbFilename, "synth", synthData, synthStats) == false)
+      return false;
+  }
+  
+  if(engine_saveStatistics(modelDir) == false)
+    logging.warn("engine_saveDatabase(): saving measurement statistics failed");
+  
+  if(registry.save() == false)
+    logging.warn("engine_saveDatabase(): saving stimulus registry failed");
+  
+  if(hmmLabelModel.length() > 0 && engine_saveHMMLabels(modelDir) == false)
+    logging.warn("engine_saveDatabase(): saving HMM labels failed");
+  
+  // saved datasets contain all journaled measurements
+  if(journal.clear() == false)
+    logging.warn("engine_saveDatabase(): clearing measurement journal failed");
+  
+  journalFailed = false;
+  
+  return true;
+}
+
+
+bool ResonanzEngine::engine_syncDatabase(const std::string& modelDir)
+{
+  {
+    std::lock_guard<std::mutex> lock(database_mutex);
+    
+    if(journalFailed == false && journal.sync()){
+      // saving is O(new measurements), datasets are updated in background
+      if(journal.compact(false)){
+	// folding updates statistics files of the datasets
+	char buffer[128];
+	snprintf(buffer, 128, "engine_syncDatabase(): %llu new measurements journaled",
+		 journal.getNumberOfRecords());
+	logging.info(buffer);
+	
+	return true;
+      }
+    }
+  }
+  
+  logging.warn("engine_syncDatabase(): measurement journal failed => saving all datasets");
+  
+  return engine_saveDatabase(modelDir);
+}
+
+
+bool ResonanzEngine::engine_loadStimulusDataset(const std::string& dbFilename, const std::string& kind,
+					       unsigned int inputDimension, unsigned int outputDimension,
+					       whiteice::dataset<>& data,
+					       std::vector<RunningStatistics>& stats)
+{
+  data.clear();
+  bool raw = false;
+  
+  if(engine_readDataset(dbFilename, data, raw) == false){
+    logging.info("Couldn't load " + kind + " data => creating empty database");
+    
+    data.createCluster("input", inputDimension);
+    data.createCluster("output", outputDimension);
+    data.createCluster("index", 1);
+  }
+  else if(data.getNumberOfClusters() != 3){
+    logging.error(kind + " data wrong number of clusters or data corruption => reset database");
+    
+    data.clear();
+    data.createCluster("input", inputDimension);
+    data.createCluster("output", outputDimension);
+    data.createCluster("index", 1);
+  }
+  
+  const unsigned int datasize = data.size(0);
+  
+  if(data.removeBadData() == false)
+    logging.warn(kind + " data: bad data removal failed");
+  
+  if(datasize != data.size(0)){
+    char buffer[256];
+    snprintf(buffer, 256, "%s data: bad data removal reduced data: %d => %d",
+	     dbFilename.c_str(), datasize, data.size(0));
+    logging.warn(buffer);
+  }
+  
+  for(unsigned int c=0;c<2;c++){
+    const char* cluster = (c == 0) ? " measurements [input]" : " measurements [output]";
+    
+    if(pcaPreprocess){
+      if(data.hasPreprocess(c, whiteice::dataset<>::dnCorrelationRemoval) == false){
+	logging.info("PCA preprocessing " + kind + cluster);
+	data.preprocess(c, whiteice::dataset<>::dnCorrelationRemoval);
+      }
+    }
+    else{
+      if(data.hasPreprocess(c, whiteice::dataset<>::dnCorrelationRemoval) == true){
+	logging.info("Removing PCA processing of " + kind + cluster);
+	data.convert(c); // removes all preprocessings
+      }
+      
+      data.preprocess(c, whiteice::dataset<>::dnMeanVarianceNormalization);
+    }
+  }
+  
+  engine_loadStatistics(dbFilename, data, 2, stats, pcaPreprocess, raw);
+  
+  return true;
+}
+
+
+bool ResonanzEngine::engine_readDataset(const std::string& dbFilename,
+					whiteice::dataset<>& data, bool& raw) const
+{
+  std::string name = dbFilename.substr(dbFilename.find_last_of("/\\") + 1);
+  
+  if(name.length() > 3 && name.compare(name.length()-3, 3, ".ds") == 0)
+    name.resize(name.length()-3);
+  
+  raw = store.exportDataset(name, data, false);
+  
+  if(raw) return true;
+  
+  data.clear();
+  
+  return data.load(dbFilename);
+}
+
+
+bool ResonanzEngine::engine_saveStimulusDataset(const std::string& dbFilename, const std::string& kind,
+					       whiteice::dataset<>& data,
+					       std::vector<RunningStatistics>& stats,
+					       NNIndex* index)
+{
+  if(data.removeBadData() == false)
+    logging.warn(kind + " data: bad data removal failed");
+  
+  // recomputes preprocessing only if statistics of measurements have
+  // drifted since the dataset was preprocessed
+  engine_validateStatistics(data, 2, stats, pcaPreprocess);
+  
+  bool renormalized = false;
+  
+  for(unsigned int c=0;c<2;c++){
+    if(engine_refreshPreprocess(data, c, stats[c], pcaPreprocess,
+				c == 0 ? &renormalized : nullptr) == false)
+      logging.warn(kind + " data: preprocessing failed");
+  }
+  
+  // indexed input rows are stale if they were renormalized or removed
+  if(index && (renormalized || index->size() != data.size(0))){
+    if(index->build(data, 0) == false)
+      logging.warn(kind + " data: building nearest neighbour index failed");
+  }
+  
+  if(data.save(dbFilename) == false){
+    logging.error("Saving " + kind + " data failed");
+    return false;
+  }
+  
+  return true;
+}
+
+
+unsigned int ResonanzEngine::engine_databaseThreads() const
+{
+  // dataset I/O is memory and disk bound so only few threads are used
+  const unsigned int cores = std::max(std::thread::hardware_concurrency(), 1U);
+  
+  return std::min(cores, MAX_DATABASE_THREADS);
+}
+
+
+void ResonanzEngine::engine_databaseProgress(const char* action, unsigned int done, unsigned int total)
+{
+  // reports about every 5% of datasets
+  const unsigned int step = total/20 + 1;
+  
+  if((done % step) != 0 && done != total)
+    return;
+  
+  char buffer[128];
+  snprintf(buffer, 128, "resonanz-engine: %s database (%d/%d datasets)..",
+	   action, done, total);
+  engine_setStatus(buffer);
+}
+
+
+std::string ResonanzEngine::engine_hmmModelIdentity() const
+{
+  if(kmeans == nullptr || hmm == nullptr)
+    return ""; // no model
+  
+  // FNV-1a hash of quantized K-Means centroids and HMM parameters so that
+  // retraining that converges to the same models keeps the labels valid
+  unsigned long long hash = 14695981039346656037ULL;
+  
+  auto add = [&hash](double value) {
+    const long long q = llround(value*1000.0);
+    
+    for(unsigned int b=0;b<8;b++){
+      hash ^= (((unsigned long long)q) >> (8*b)) & 0xFF;
+      hash *= 1099511628211ULL;
+    }
+  };
+  
+  add(kmeans->size());
+  
+  for(unsigned int k=0;k<kmeans->size();k++){
+    add((*kmeans)[k].size());
+    
+    for(unsigned int d=0;d<(*kmeans)[k].size();d++)
+      add((*kmeans)[k][d].c[0]);
+  }
+  
+  const auto& pi = hmm->getPI();
+  const auto& A = hmm->getA();
+  const auto& B = hmm->getB();
+  
+  for(const auto& p : pi) add(p.getDouble());
+  
+  for(const auto& row : A)
+    for(const auto& a : row) add(a.getDouble());
+  
+  for(const auto& row : B)
+    for(const auto& col : row)
+      for(const auto& b : col) add(b.getDouble());
+  
+  char buffer[32];
+  snprintf(buffer, 32, "%016llx", hash);
+  
+  return buffer;
+}
+
+
+std::string ResonanzEngine::engine_eegGeneration() const
+{
+  if(eegData.getNumberOfClusters() < 1 || eegData.size(0) == 0)
+    return ""; // no data
+  
+  // FNV-1a hash of raw EEG rows (rounded like in engine_modelVersion())
+  unsigned long long hash = 14695981039346656037ULL;
+  
+  auto add = [&hash](uint32_t bits) {
+    for(unsigned int b=0;b<4;b++){
+      hash ^= (bits >> (8*b)) & 0xFF;
+      hash *= 1099511628211ULL;
+    }
+  };
+  
+  add(eegData.size(0));
+  add(eegData.dimension(0));
+  
+  for(unsigned int i=0;i<eegData.size(0);i++){
+    auto x = eegData.access(0, i);
+    
+    if(eegData.invpreprocess(0, x) == false)
+      return "";
+    
+    for(unsigned int k=0;k<x.size();k++){
+      const float value = x[k].c[0];
+      uint32_t bits = 0;
+      memcpy(&bits, &value, sizeof(bits));
+      add((bits + 0x80) & 0xFFFFFF00);
+    }
+  }
+  
+  char buffer[32];
+  snprintf(buffer, 32, "%016llx", hash);
+  
+  return buffer;
+}
+
+
+bool ResonanzEngine::engine_loadHMMGeneration(const std::string& modelDir,
+					      std::string& generation) const
+{
+  FILE* handle = fopen((modelDir + "/hmm.generation").c_str(), "rt");
+  if(handle == NULL) return false;
+  
+  char line[64];
+  const bool ok = (fgets(line, 64, handle) != NULL);
+  
+  fclose(handle);
+  
+  if(!ok) return false;
+  
+  generation = line;
+  while(generation.length() > 0 && (generation.back() == '\n' || generation.back() == '\r'))
+    generation.pop_back();
+  
+  return (generation.length() > 0);
+}
+
+
+bool ResonanzEngine::engine_saveHMMGeneration(const std::string& modelDir,
+					      const std::string& generation) const
+{
+  const std::string filename = modelDir + "/hmm.generation";
+  const std::string tmpFile = filename + ".tmp";
+  
+  FILE* handle = fopen(tmpFile.c_str(), "wt");
+  if(handle == NULL) return false;
+  
+  fprintf(handle, "%s\n", generation.c_str());
+  
+  bool ok = (ferror(handle) == 0);
+  
+  fclose(handle);
+  
+  if(ok){
+#ifdef _WIN32
+    remove(filename.c_str());
+#endif
+    ok = (rename(tmpFile.c_str(), filename.c_str()) == 0);
+  }
+  
+  if(!ok) remove(tmpFile.c_str());
+  
+  return ok;
+}
+
+
+void ResonanzEngine::engine_hmmLabelNames(std::vector<std::string>& names) const
+{
+  // same order as datasets of HMMStateUpdatorThread
+  names.clear();
+  
+  for(unsigned int i=0;i<pictureData.size() && i<pictures.size();i++)
+    names.push_back(calculateHashName(pictures[i] + eeg->getDataSourceName()));
+  
+  for(unsigned int i=0;i<keywordData.size() && i<keywords.size();i++)
+    names.push_back(calculateHashName(keywords[i] + eeg->getDataSourceName()));
+  
+  if(synth)
+    names.push_back(calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()));
+  else
+    names.push_back("");
+}
+
+
+bool ResonanzEngine::engine_loadHMMLabels(const std::string& modelDir)
+{
+  std::vector<std::string> names;
+  engine_hmmLabelNames(names);
+  
+  hmmLabelModel = hmmGeneration;
+  hmmLabelled.assign(names.size(), 0);
+  
+  if(hmmLabelModel.length() == 0)
+    return false;
+  
+  FILE* handle = fopen((modelDir + "/hmm.labels").c_str(), "rt");
+  if(handle == NULL) return false;
+  
+  std::map<std::string, unsigned int> rows;
+  bool sameModel = false;
+  char line[1024];
+  
+  while(fgets(line, 1024, handle) != NULL){
+    char* tab = strchr(line, '\t');
+    if(tab == NULL) continue;
+    
+    *tab = '\0';
+    std::string value = tab + 1;
+    while(value.length() > 0 && (value.back() == '\n' || value.back() == '\r'))
+      value.pop_back();
+    
+    if(strcmp(line, "model") == 0)
+      sameModel = (value == hmmLabelModel);
+    else
+      rows[line] = (unsigned int)atol(value.c_str());
+  }
+  
+  fclose(handle);
+  
+  if(sameModel == false)
+    return false; // labels were calculated using other K-Means/HMM training
+  
+  for(unsigned int j=0;j<names.size();j++){
+    auto r = rows.find(names[j]);
+    if(r != rows.end()) hmmLabelled[j] = r->second;
+  }
+  
+  return true;
+}
+
+
+bool ResonanzEngine::engine_saveHMMLabels(const std::string& modelDir)
+{
+  std::vector<std::string> names;
+  engine_hmmLabelNames(names);
+  
+  if(names.size() != hmmLabelled.size())
+    return false;
+  
+  const std::string filename = modelDir + "/hmm.labels";
+  const std::string tmpFile = filename + ".tmp";
+  
+  FILE* handle = fopen(tmpFile.c_str(), "wt");
+  if(handle == NULL) return false;
+  
+  fprintf(handle, "model\t%s\n", hmmLabelModel.c_str());
+  
+  for(unsigned int j=0;j<names.size();j++)
+    if(names[j].length() > 0)
+      fprintf(handle, "%s\t%d\n", names[j].c_str(), hmmLabelled[j]);
+  
+  bool ok = (ferror(handle) == 0);
+  
+  fclose(handle);
+  
+  if(ok){
+#ifdef _WIN32
+    remove(filename.c_str());
+#endif
+    ok = (rename(tmpFile.c_str(), filename.c_str()) == 0);
+  }
+  
+  if(!ok) remove(tmpFile.c_str());
+  
+  return ok;
+}
+
+
+bool ResonanzEngine::engine_modelVersion(const whiteice::dataset<>& data,
+					 const whiteice::nnetwork<>& net,
+					 unsigned int hmmColumn,
+					 model_version& version) const
+{
+  whiteice::math::vertex<> w;
+  
+  if(net.exportdata(w) == false)
+    return false;
+  
+  version.rows = data.size(0);
+  version.parameters = w.size();
+  version.bayesian = use_bayesian_nnetwork;
+  
+  // FNV-1a hash of raw input and output rows: renormalization doesn't change
+  // the version. values are rounded to 15 bit mantissa so that inverse
+  // preprocessing round-off is ignored. HMM state columns are hashed as
+  // K-Means/HMM models which give them their meaning, PCA flag selects
+  // the input space of the model
+  unsigned long long hash = 14695981039346656037ULL;
+  
+  const std::string hmmIdentity = engine_hmmModelIdentity() + (pcaPreprocess ? "+pca" : "");
+  
+  for(const char ch : hmmIdentity){
+    hash ^= (unsigned char)ch;
+    hash *= 1099511628211ULL;
+  }
+  
+  for(unsigned int c=0;c<data.getNumberOfClusters() && c<2;c++){
+    for(unsigned int i=0;i<data.size(c);i++){
+      auto x = data.access(c, i);
+      
+      if(data.invpreprocess(c, x) == false)
+	return false;
+      
+      for(unsigned int k=0;k<x.size();k++){
+	if(c == 0 && k >= hmmColumn && k < hmmColumn + HMM_NUM_CLUSTERS)
+	  continue; // HMM state
+	
+	const float value = x[k].c[0];
+	uint32_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	bits = (bits + 0x80) & 0xFFFFFF00;
+	
+	for(unsigned int b=0;b<4;b++){
+	  hash ^= (bits >> (8*b)) & 0xFF;
+	  hash *= 1099511628211ULL;
+	}
+      }
+    }
+  }
+  
+  version.hash = hash;
+  
+  return true;
+}
+
+
+bool ResonanzEngine::engine_loadModelVersions(const std::string& modelDir)
+{
+  modelVersions.clear();
+  
+  FILE* handle = fopen((modelDir + "/models.versions").c_str(), "rt");
+  if(handle == NULL) return false;
+  
+  char line[1024];
+  
+  while(fgets(line, 1024, handle) != NULL){
+    char name[512];
+    unsigned int rows = 0, parameters = 0, bayesian = 0;
+    unsigned long long hash = 0;
+    
+    if(sscanf(line, "%511s %u %llx %u %u", name, &rows, &hash, &parameters, &bayesian) != 5)
+      continue;
+    
+    model_version& v = modelVersions[name];
+    v.rows = rows;
+    v.hash = hash;
+    v.parameters = parameters;
+    v.bayesian = (bayesian != 0);
+  }
+  
+  fclose(handle);
+  
+  return true;
+}
+
+
+bool ResonanzEngine::engine_saveModelVersions(const std::string& modelDir) const
+{
+  const std::string filename = modelDir + "/models.versions";
+  const std::string tmpFile = filename + ".tmp";
+  
+  FILE* handle = fopen(tmpFile.c_str(), "wt");
+  if(handle == NULL) return false;
+  
+  for(const auto& v : modelVersions)
+    fprintf(handle, "%s\t%u\t%016llx\t%u\t%d\n", v.first.c_str(),
+	    v.second.rows, v.second.hash, v.second.parameters, v.second.bayesian ? 1 : 0);
+  
+  bool ok = (ferror(handle) == 0);
+  
+  fclose(handle);
+  
+  if(ok){
+#ifdef _WIN32
+    remove(filename.c_str());
+#endif
+    ok = (rename(tmpFile.c_str(), filename.c_str()) == 0);
+  }
+  
+  if(!ok) remove(tmpFile.c_str());
+  
+  return ok;
+}
+
+
+bool ResonanzEngine::engine_addTrainingJob(const std::string& kind, const std::string& name,
+					   const whiteice::nnetwork<>& net, whiteice::dataset<>& data,
+					   const std::string& modelName)
+{
+  const std::string modelFilename = currentCommand.modelDir + "/" + modelName + ".model";
+  
+  model_version version;
+  
+  if(data.getNumberOfClusters() < 2 || data.size(0) == 0)
+    return false;
+  
+  // HMM state is at the end of synth inputs and after EEG values otherwise
+  const unsigned int hmmColumn = (kind == "synth") ?
+    (data.dimension(0) - HMM_NUM_CLUSTERS) : eeg->getNumberOfSignals();
+  
+  if(engine_modelVersion(data, net, hmmColumn, version) == false)
+    return false;
+  
+  struct stat st;
+  auto old = modelVersions.find(modelName);
+  
+  // models with different architecture (e.g. picture models without picture
+  // feature inputs) have different parameter count and are trained from scratch
+  if(old != modelVersions.end() && stat(modelFilename.c_str(), &st) == 0 &&
+     old->second.parameters == version.parameters &&
+     old->second.bayesian == version.bayesian)
+  {
+    const model_version& prev = old->second;
     
+    if(prev.rows == version.rows && prev.hash == version.hash){
+      trainingScheduler.skipJob(kind, name); // data hasn't changed
+      return true;
+    }
     
+    if(version.rows >= prev.rows && prev.rows > 0 &&
+       (version.rows - prev.rows) <= WARM_START_NEW_ROWS*prev.rows)
     {
-      if(pcaPreprocess){
-	if(keywordData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing keyword measurements data [input]");
-	  keywordData[i].preprocess(0, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	if(keywordData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing keyword measurements data [output]");
-	  keywordData[i].preprocess(1, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	
-	// keywordData[i].convert(1); // removes preprocessigns from output
-      }
-      else{
-	if(keywordData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA preprocessing from keyword measurements data [input]");
-	  keywordData[i].convert(0); // removes all preprocessings from input
-	}
+      // continues from the saved model: iterations are proportional to new data
+      whiteice::bayesian_nnetwork<> model;
+      whiteice::nnetwork<> tmpnn;
+      whiteice::nnetwork<> warmnn(net);
+      std::vector< whiteice::math::vertex<> > weights;
+      
+      if(model.load(modelFilename) && model.exportSamples(tmpnn, weights) &&
+	 weights.size() > 0 && warmnn.importdata(weights.back()))
+      {
+	const float fraction = (version.rows - prev.rows)/(WARM_START_NEW_ROWS*prev.rows);
 	
-	if(keywordData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA preprocessing from keyword measurements data [output]");
-	  keywordData[i].convert(1); // removes all preprocessings from input
-	}
-
-	keywordData[i].convert(0);
-	keywordData[i].convert(1);
+	unsigned int iterations = (unsigned int)(fraction*NUM_OPTIMIZER_ITERATIONS);
+	if(iterations < WARM_START_MIN_ITERATIONS) iterations = WARM_START_MIN_ITERATIONS;
+	if(iterations > NUM_OPTIMIZER_ITERATIONS) iterations = NUM_OPTIMIZER_ITERATIONS;
 	
-	keywordData[i].preprocess(0, whiteice::dataset<>::dnMeanVarianceNormalization);
-	keywordData[i].preprocess(1, whiteice::dataset<>::dnMeanVarianceNormalization);
+	if(trainingScheduler.addJob(kind, name, warmnn, data, modelFilename, true, iterations) == false)
+	  return false;
 	
-	// keywordData[i].convert(1); // removes preprocessigns from output
+	trainingVersions[modelFilename] = std::make_pair(modelName, version);
+	return true;
       }
       
-      // keywordData[i].convert(1); // removes all preprocessings from output
-    }
-    
-    if(keywordData[i].save(dbFilename) == false){
-      logging.error("Saving keyword data failed");
-      return false;
+      logging.warn("resonanz model optimization: cannot warm start from model: " + modelFilename);
     }
   }
   
+  if(trainingScheduler.addJob(kind, name, net, data, modelFilename) == false)
+    return false;
   
-  for(unsigned int i=0;i<pictureData.size();i++){
-    std::string dbFilename = modelDir + "/" + calculateHashName(pictures[i] + eeg->getDataSourceName()) + ".ds";
-    
-    if(pictureData[i].removeBadData() == false)
-      logging.warn("pictureData: bad data removal failed");
-    
-    
-    {
-      if(pcaPreprocess){
-	if(pictureData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing picture measurements data [input]");
-	  pictureData[i].preprocess(0, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	if(pictureData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing picture measurements data [output]");
-	  pictureData[i].preprocess(1, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	// pictureData[i].convert(1); // removes preprocessigns from output
-      }
-      else{
-	if(pictureData[i].hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA preprocessing from picture measurements data [input]");
-	  pictureData[i].convert(0); // removes all preprocessings from input
-	}
-	if(pictureData[i].hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA preprocessing from picture measurements data [output]");
-	  pictureData[i].convert(1); // removes all preprocessings from input
-	}
+  trainingVersions[modelFilename] = std::make_pair(modelName, version);
+  
+  return true;
+}
 
-	pictureData[i].convert(0);
-	pictureData[i].convert(1);
-	
-	pictureData[i].preprocess(0, whiteice::dataset<>::dnMeanVarianceNormalization);
-	pictureData[i].preprocess(1, whiteice::dataset<>::dnMeanVarianceNormalization);
-	
-	// pictureData[i].convert(1);
-      }
-      
-      // pictureData[i].convert(1); // removes all preprocessings from output
-    }
-    
-    if(pictureData[i].save(dbFilename) == false){
-      logging.error("Saving picture data failed");
-      return false;
-    }
+
+bool ResonanzEngine::engine_refreshPreprocess(whiteice::dataset<>& data, unsigned int cluster,
+					     RunningStatistics& stats, bool pca,
+					     bool* renormalized)
+{
+  const auto method = pca ?
+    whiteice::dataset<>::dnCorrelationRemoval : whiteice::dataset<>::dnMeanVarianceNormalization;
+  
+  if(data.hasPreprocess(cluster, method) &&
+     data.hasPreprocess(cluster, whiteice::dataset<>::dnCorrelationRemoval) == pca &&
+     stats.drift() < STATISTICS_DRIFT)
+    return true; // preprocessing parameters are still valid
+  
+  data.convert(cluster); // removes all preprocessings
+  
+  if(renormalized) *renormalized = true;
+  
+  if(data.preprocess(cluster, method) == false)
+    return false;
+  
+  stats.checkpoint();
+  
+  return true;
+}
+
+
+void ResonanzEngine::engine_validateStatistics(const whiteice::dataset<>& data, unsigned int clusters,
+					       std::vector<RunningStatistics>& stats, bool covariance)
+{
+  bool valid = (stats.size() == clusters && data.getNumberOfClusters() >= clusters);
+  
+  for(unsigned int c=0;valid && c<clusters;c++){
+    valid = (stats[c].dimension() == data.dimension(c) &&
+	     stats[c].size() == data.size(c) &&
+	     stats[c].hasCovariance() == covariance);
   }
   
-  // stores sound synthesis measurements
-  if(synth){
-    std::string dbFilename = modelDir + "/" + calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
-    
-    if(synthData.removeBadData() == false)
-      logging.warn("synthData: bad data removal failed");
-    
-    {
-      if(pcaPreprocess){
-	if(synthData.hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing sound measurements [input]");
-	  synthData.preprocess(0, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	
-	if(synthData.hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == false){
-	  logging.info("PCA preprocessing sound measurements [output]");
-	  synthData.preprocess(1, whiteice::dataset<>::dnCorrelationRemoval);
-	}
-	
-	// synthData.convert(1);
-      }
-      else{
-	if(synthData.hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA processing of sound measurements [input]");
-	  synthData.convert(0); // removes all preprocessings from input
-	}
-	if(synthData.hasPreprocess(1, whiteice::dataset<>::dnCorrelationRemoval) == true){
-	  logging.info("Removing PCA processing of sound measurements [output]");
-	  synthData.convert(1); // removes all preprocessings from input
-	}
-	
-	synthData.preprocess(0, whiteice::dataset<>::dnMeanVarianceNormalization);
-	synthData.preprocess(1, whiteice::dataset<>::dnMeanVarianceNormalization);
-	
-	// synthData.convert(1);
-      }
-    }
-    
-    if(synthData.save(dbFilename) == false){
-      logging.info("Saving synth data failed");
-      return false;
+  if(valid) return;
+  
+  // recalculates statistics from data (dataset is renormalized at next save)
+  stats.resize(clusters);
+  
+  for(unsigned int c=0;c<clusters;c++){
+    if(c >= data.getNumberOfClusters() || stats[c].build(data, c, covariance) == false){
+      logging.warn("engine_validateStatistics(): calculating measurement statistics failed");
+      stats[c].reset(c < data.getNumberOfClusters() ? data.dimension(c) : 0, covariance);
     }
   }
+}
+
+
+void ResonanzEngine::engine_loadStatistics(const std::string& dbFilename, const whiteice::dataset<>& data,
+					   unsigned int clusters, std::vector<RunningStatistics>& stats,
+					   bool covariance, bool renormalized)
+{
+  const std::string filename = dbFilename.substr(0, dbFilename.length()-3) + ".stats";
   
+  if(RunningStatistics::load(filename, stats) == false)
+    stats.clear();
   
-  return true;
+  engine_validateStatistics(data, clusters, stats, covariance);
+  
+  // raw rows from the measurement store were preprocessed at load
+  if(renormalized)
+    for(auto& s : stats) s.checkpoint();
+}
+
+
+bool ResonanzEngine::engine_saveStatistics(const std::string& modelDir)
+{
+  auto save = [&](const std::string& name, const std::vector<RunningStatistics>& stats) {
+    return RunningStatistics::save(modelDir + "/" + name + ".stats", stats);
+  };
+  
+  bool ok = save(calculateHashName("eegData" + eeg->getDataSourceName()), eegStats);
+  
+  for(unsigned int i=0;i<keywordStats.size() && i<keywords.size();i++)
+    ok = save(calculateHashName(keywords[i] + eeg->getDataSourceName()), keywordStats[i]) && ok;
+  
+  for(unsigned int i=0;i<pictureStats.size() && i<pictures.size();i++)
+    ok = save(calculateHashName(pictures[i] + eeg->getDataSourceName()), pictureStats[i]) && ok;
+  
+  if(synth)
+    ok = save(calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()),
+	      synthStats) && ok;
+  
+  return ok;
 }
 
 
 std::string ResonanzEngine::calculateHashName(const std::string& filename) const
 {
-  try{
-    unsigned int N = strlen(filename.c_str()) + 1;
-    unsigned char* data = (unsigned char*)malloc(sizeof(unsigned char)*N);
-    unsigned char* hash160 = (unsigned char*)malloc(sizeof(unsigned char)*20);
-    
-    whiteice::crypto::SHA sha(160);
-    
-    memcpy(data, filename.c_str(), N);
-    
-    if(sha.hash(&data, N, hash160)){
-      std::string result = "";
-      for(unsigned int i=0;i<20;i++){
-	char buffer[10];
-	snprintf(buffer, 10, "%.2x", hash160[i]);
-	result += buffer;
-      }
-      
-      if(data) free(data);
-      if(hash160) free(hash160);
-      
-      // printf("%s => %s\n", filename.c_str(), result.c_str());
-      
-      return result; // returns hex hash of the name
-    }
-    else{
-      if(data) free(data);
-      if(hash160) free(hash160);
-      
-      return "";
-    }
-  }
-  catch(std::exception& e){
-    return "";
-  }
+  // names are memoized (and moved pictures keep their names) by the registry
+  return registry.id(filename);
 }
 
 
 bool ResonanzEngine::engine_showScreen(const std::string& message, unsigned int picture,
 				       const std::vector<float>& synthParams)
 {
-  SDL_Surface* surface = SDL_GetWindowSurface(window);
+  SDL_Surface* surface = headless ? offscreen : SDL_GetWindowSurface(window);
   if(surface == nullptr)
     return false;
   
@@ -5160,6 +5552,7 @@ bool ResonanzEngine::engine_showScreen(const std::string& message, unsigned int
   
   int bgcolor = 0;
   int elementsDisplayed = 0;
+  const SDL_Surface* image = nullptr; // shown picture
   
   {
     char buffer[256];
@@ -5169,72 +5562,19 @@ bool ResonanzEngine::engine_showScreen(const std::string& message, unsigned int
   }
   
   if(picture < pictures.size()){ // shows a picture
-    if(images[picture] == NULL){
-      SDL_Surface* image = IMG_Load(pictures[picture].c_str());
-      
-      if(image == NULL){
-	char buffer[120];
-	snprintf(buffer, 120, "showscreen: loading image FAILED (%s): %s",
-		 SDL_GetError(), pictures[picture].c_str());
-	logging.warn(buffer);
-      }
-      
-      SDL_Rect imageRect;
-      SDL_Surface* scaled = 0;
-      
-      
-      if(image != 0){
-	if((image->w) > (image->h)){
-	  double wscale = ((double)SCREEN_WIDTH)/((double)image->w);
-	  // scaled = zoomSurface(image, wscale, wscale, SMOOTHING_ON);
-	  
-	  scaled = SDL_CreateRGBSurface(0, (int)(image->w*wscale), (int)(image->h*wscale), 32,
-					0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-	  
-	  if(SDL_BlitScaled(image, NULL, scaled, NULL) != 0)
-	    return false;
-	  
-	}
-	else{
-	  double hscale = ((double)SCREEN_HEIGHT)/((double)image->h);
-	  // scaled = zoomSurface(image, hscale, hscale, SMOOTHING_ON);
-	  
-	  scaled = SDL_CreateRGBSurface(0, (int)(image->w*hscale), (int)(image->h*hscale), 32,
-					0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-	  
-	  if(SDL_BlitScaled(image, NULL, scaled, NULL) != 0)
-	    return false;
-	}
-	
-	images[picture] = scaled;
-      }
-      
-      if(scaled != NULL){
-	SDL_Color averageColor;
-	measureColor(scaled, averageColor);
-	
-	bgcolor = (int)(averageColor.r + averageColor.g + averageColor.b)/3;
-	
-	imageRect.w = scaled->w;
-	imageRect.h = scaled->h;
-	imageRect.x = (SCREEN_WIDTH - scaled->w)/2;
-	imageRect.y = (SCREEN_HEIGHT - scaled->h)/2;
-	
-	if(SDL_BlitSurface(images[picture], NULL, surface, &imageRect) != 0)
-	  return false;
-	
-	elementsDisplayed++;
-      }
-      
-      if(image)
-	SDL_FreeSurface(image);
+    // scaled pictures are usually prefetched by background threads
+    imageCache.setScreenSize(SCREEN_WIDTH, SCREEN_HEIGHT);
+    
+    SDL_Surface* scaled = imageCache.get(picture);
+    
+    if(scaled == NULL){
+      char buffer[120];
+      snprintf(buffer, 120, "showscreen: loading image FAILED (%s): %s",
+	       SDL_GetError(), pictures[picture].c_str());
+      logging.warn(buffer);
     }
     else{
       SDL_Rect imageRect;
-      SDL_Surface* scaled = 0;
-      
-      scaled = images[picture];
-      
       SDL_Color averageColor;
       
       measureColor(scaled, averageColor);
@@ -5246,9 +5586,10 @@ bool ResonanzEngine::engine_showScreen(const std::string& message, unsigned int
       imageRect.x = (SCREEN_WIDTH - scaled->w)/2;
       imageRect.y = (SCREEN_HEIGHT - scaled->h)/2;
       
-      if(SDL_BlitSurface(images[picture], NULL, surface, &imageRect) != 0)
+      if(SDL_BlitSurface(scaled, NULL, surface, &imageRect) != 0)
 	return false;
       
+      image = scaled;
       elementsDisplayed++;
     }
   }
@@ -5416,16 +5757,29 @@ bool ResonanzEngine::engine_showScreen(const std::string& message, unsigned int
   // video encoding (if activated)
   {
     if(video != NULL && programStarted > 0){
-      auto t1 = std::chrono::system_clock::now().time_since_epoch();
-      auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+      auto t1ms = engine_clockMS();
       
       logging.info("adding frame to theora encoding queue");
       
+      // screen is redrawn every tick but its contents depend only on
+      // the message and the picture: unchanged screens are not converted
+      const bool changed =
+	(message != videoFrameMessage || picture != videoFramePicture ||
+	 image != videoFrameImage ||
+	 SCREEN_WIDTH != videoFrameWidth || SCREEN_HEIGHT != videoFrameHeight);
+      
       if(video->insertFrame((unsigned long long)(t1ms - programStarted),
-			    surface) == false){
+			    surface, changed) == false){
 	
 	logging.error("inserting frame FAILED");
       }
+      else{ // rejected frames are inserted again
+	videoFrameMessage = message;
+	videoFramePicture = picture;
+	videoFrameImage = image;
+	videoFrameWidth = SCREEN_WIDTH;
+	videoFrameHeight = SCREEN_HEIGHT;
+      }
     }
   }
   
@@ -5437,11 +5791,13 @@ bool ResonanzEngine::engine_showScreen(const std::string& message, unsigned int
   
   if(synth)
   {
+    // sound until now uses the previous parameters
+    if(headless) engine_renderOfflineSound();
+    
     // changes synth parameters only as fast sound synthesis can generate
     // meaningful sounds (sound has time to evolve)
     
-    auto t1 = std::chrono::system_clock::now().time_since_epoch();
-    auto t1ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1).count();
+    auto t1ms = engine_clockMS();
     unsigned long long now = (unsigned long long)t1ms;
     
     if(now - synthParametersChangedTime >= MEASUREMODE_DELAY_MS){
@@ -5499,10 +5855,78 @@ void ResonanzEngine::engine_updateScreen()
 }
 
 
+long long ResonanzEngine::engine_clockMS() const
+{
+  if(headless)
+    return headlessClockStart + scheduler.getVirtualMS();
+  
+  auto t = std::chrono::system_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(t).count();
+}
+
+
+bool ResonanzEngine::engine_openOffscreen(const std::string& fontname)
+{
+  SCREEN_WIDTH = HEADLESS_WIDTH;
+  SCREEN_HEIGHT = HEADLESS_HEIGHT;
+  
+  if(offscreen == nullptr || offscreen->w != SCREEN_WIDTH || offscreen->h != SCREEN_HEIGHT){
+    if(offscreen) SDL_FreeSurface(offscreen);
+    
+    // 32-bit RGB frames are converted to video without copying
+    offscreen = SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32,
+				     0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+    if(offscreen == nullptr) return false;
+  }
+  
+  if(font) TTF_CloseFont(font);
+  double fontSize = 100.0*sqrt(((float)(SCREEN_WIDTH*SCREEN_HEIGHT))/(640.0*480.0));
+  unsigned int fs = (unsigned int)fontSize;
+  if(fs <= 0) fs = 10;
+  
+  font = 0;
+  font = TTF_OpenFont(fontname.c_str(), fs);
+  
+  SDL_FillRect(offscreen, NULL, SDL_MapRGB(offscreen->format, 0, 0, 0));
+  
+  return true;
+}
+
+
+void ResonanzEngine::engine_renderOfflineSound()
+{
+  if(synth == nullptr || programStarted <= 0 || synth->getSampleRate() == 0)
+    return;
+  
+  // sample exact: sound of msecs [programStarted, now) has been synthesized
+  const unsigned long long rate = synth->getSampleRate();
+  const long long msecs = engine_clockMS() - programStarted;
+  
+  if(msecs <= 0) return;
+  
+  const unsigned long long samples = (((unsigned long long)msecs)*rate)/1000;
+  
+  if(samples <= offlineSamples) return;
+  
+  const long long timeMS = programStarted + (long long)((offlineSamples*1000)/rate);
+  
+  if(synth->renderOffline((unsigned int)(samples - offlineSamples), timeMS) == false)
+    logging.warn("offline sound synthesis failed");
+  
+  offlineSamples = samples;
+}
+
+
 // initializes SDL libraries to be used (graphics, font, music)
 bool ResonanzEngine::engine_SDL_init(const std::string& fontname)
 {
   logging.info("Starting SDL init (0)..");
+  
+  if(headless){
+    // no display or audio device is needed
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+  }
         
   SDL_Init(0);
   
@@ -5703,6 +6127,8 @@ bool ResonanzEngine::engine_SDL_deinit()
     font = NULL;
   }
   
+  imageCache.clear();
+  
   IMG_Quit();
   
   if(audioEnabled)
@@ -5890,6 +6316,9 @@ bool ResonanzEngine::loadPictures(const std::string directory, std::vector<std::
 
 std::string ResonanzEngine::analyzeModel(const std::string& modelDir) const
 {
+  // waits until journaled measurements have been folded into dataset files
+  journal.wait();
+  
   // we go through database directory and load all *.ds files
   std::vector<std::string> databaseFiles;
   
@@ -5923,19 +6352,35 @@ std::string ResonanzEngine::analyzeModel(const std::string& modelDir) const
   // std::lock_guard<std::mutex> lock(database_mutex);
   // (we do read only operations so these are relatively safe) => no mutex
   
+  // imports changed .ds files to memory-mapped measurement store
+  // (own instance: the engine thread may be loading the database from its store)
+  MeasurementStore measurements;
+  
+  {
+    std::vector<std::string> names;
+    
+    for(auto filename : databaseFiles)
+      names.push_back(filename.substr(0, filename.length()-3));
+    
+    if(measurements.update(modelDir, names) == false)
+      logging.warn("analyzeModel(): updating measurement store failed");
+  }
+  
   for(auto filename : databaseFiles){
     // calculate statistics
-    whiteice::dataset<> ds;
-    std::string fullname = modelDir + "/" + filename;
-    if(ds.load(fullname) == false){
+    const std::string name = filename.substr(0, filename.length()-3);
+    MeasurementStore::view v;
+    
+    if(measurements.find(name, v) == false){
       failed++;
       continue; // couldn't load this dataset
     }
     
-    if(ds.size(0) < minDSSamples) minDSSamples = ds.size(0);
-    avgDSSamples += ds.size(0);
+    if(v.rows < minDSSamples) minDSSamples = v.rows;
+    avgDSSamples += v.rows;
     N++;
     
+    std::string fullname = modelDir + "/" + filename;
     std::string modelFilename = fullname.substr(0, fullname.length()-3) + ".model";
     
     // check if there is a model file and load it into memory and TODO: calculate average error
@@ -5944,7 +6389,13 @@ std::string ResonanzEngine::analyzeModel(const std::string& modelDir) const
     if(nnet.load(modelFilename)){
       models++;
       
-      if(ds.getNumberOfClusters() < 2)
+      if(v.clusters < 2)
+	continue;
+      
+      // model error is calculated using preprocessed data
+      whiteice::dataset<> ds;
+      
+      if(measurements.exportDataset(name, ds) == false)
 	continue;
       
       if(ds.size(0) != ds.size(1))
@@ -6013,6 +6464,13 @@ std::string ResonanzEngine::analyzeModel2(const std::string& pictureDir,
 					  const std::string& keywordsFile, 
 					  const std::string& modelDir) const
 {
+  // waits until journaled measurements have been folded into dataset files
+  journal.wait();
+  
+  // dataset names of modelDir (read-only, engine thread owns the registry)
+  StimulusRegistry manifest;
+  manifest.open(modelDir);
+  
   // 1. loads picture and keywords filename information into local memory
   std::vector<std::string> pictureFiles;
   std::vector<std::string> keywords;
@@ -6027,8 +6485,8 @@ std::string ResonanzEngine::analyzeModel2(const std::string& pictureDir,
   
   // loads databases into memory
   for(unsigned int i=0;i<keywords.size();i++){
-    std::string dbFilename = modelDir + "/" + calculateHashName(keywords[i] + eeg->getDataSourceName()) + ".ds";
-    std::string modelFilename = modelDir + "/" + calculateHashName(keywords[i] + eeg->getDataSourceName()) + ".model";
+    std::string dbFilename = modelDir + "/" + manifest.lookup(keywords[i] + eeg->getDataSourceName()) + ".ds";
+    std::string modelFilename = modelDir + "/" + manifest.lookup(keywords[i] + eeg->getDataSourceName()) + ".model";
     
     whiteice::dataset<> data;
     whiteice::bayesian_nnetwork<> bnn;
@@ -6075,9 +6533,9 @@ std::string ResonanzEngine::analyzeModel2(const std::string& pictureDir,
   
   for(unsigned int i=0;i<pictureFiles.size();i++){
     std::string dbFilename = 
-      modelDir + "/" + calculateHashName(pictureFiles[i] + eeg->getDataSourceName()) + ".ds";
+      modelDir + "/" + manifest.lookup(pictureFiles[i] + eeg->getDataSourceName()) + ".ds";
     std::string modelFilename = 
-      modelDir + "/" + calculateHashName(pictureFiles[i] + eeg->getDataSourceName()) + ".model";
+      modelDir + "/" + manifest.lookup(pictureFiles[i] + eeg->getDataSourceName()) + ".model";
     
     whiteice::dataset<> data;
     whiteice::bayesian_nnetwork<> bnn;
@@ -6126,9 +6584,9 @@ std::string ResonanzEngine::analyzeModel2(const std::string& pictureDir,
   
   if(synth){
     std::string dbFilename = modelDir + "/" + 
-      calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
+      manifest.lookup(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
     std::string modelFilename = modelDir + "/" + 
-      calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".model";
+      manifest.lookup(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".model";
     
     whiteice::dataset<> data;
     whiteice::bayesian_nnetwork<> bnn;    
@@ -6206,6 +6664,13 @@ bool ResonanzEngine::getMeasuredProgram(std::vector< std::vector<float> >& progr
 // calculates delta statistics from the measurements [with currently selected EEG]
 std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const std::string& keywordsFile, const std::string& modelDir) const
 {
+  // waits until journaled measurements have been folded into dataset files
+  journal.wait();
+  
+  // dataset names of modelDir (read-only, engine thread owns the registry)
+  StimulusRegistry manifest;
+  manifest.open(modelDir);
+  
   // 1. loads picture and keywords files into local memory
   std::vector<std::string> pictureFiles;
   std::vector<std::string> keywords;
@@ -6228,29 +6693,55 @@ std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const
   unsigned int input_dimension = 0;
   unsigned int output_dimension = 0;
   
-  // 2. loads dataset files (.ds) one by one if possible and calculates mean delta
-  whiteice::dataset<> data;
+  // 2. reads datasets from memory-mapped measurement store (imports changed .ds files)
+  //    and calculates mean delta of normalized (mean-variance preprocessed) outputs
+  //    (own instance: the engine thread may be loading the database from its store)
+  MeasurementStore measurements;
   
-  // loads databases into memory or initializes new ones
-  for(unsigned int i=0;i<keywords.size();i++){
-    std::string dbFilename = modelDir + "/" + calculateHashName(keywords[i] + eeg->getDataSourceName()) + ".ds";
+  {
+    std::vector<std::string> names;
     
-    data.clear();
+    for(unsigned int i=0;i<keywords.size();i++)
+      names.push_back(manifest.lookup(keywords[i] + eeg->getDataSourceName()));
+    for(unsigned int i=0;i<pictureFiles.size();i++)
+      names.push_back(manifest.lookup(pictureFiles[i] + eeg->getDataSourceName()));
+    if(synth)
+      names.push_back(manifest.lookup(eeg->getDataSourceName() + synth->getSynthesizerName()));
     
-    if(data.load(dbFilename) == true){
-      if(data.getNumberOfClusters() >= 2){
+    if(measurements.update(modelDir, names) == false)
+      logging.warn("deltaStatistics(): updating measurement store failed");
+  }
+  
+  // norm of normalized output row
+  auto output_norm = [](const MeasurementStore::view& v, unsigned int j) -> float {
+    const float* y = v.row(1, j);
+    float n = 0.0f;
+    for(unsigned int k=0;k<v.dims[1];k++){
+      const float e = (y[k] - v.mean[1][k])/v.stdev[1][k];
+      n += e*e;
+    }
+    return sqrtf(n);
+  };
+  
+  MeasurementStore::view data;
+  
+  for(unsigned int i=0;i<keywords.size();i++){
+    const std::string name = manifest.lookup(keywords[i] + eeg->getDataSourceName());
+    
+    if(measurements.find(name, data) == true){
+      if(data.clusters >= 2){
 	float delta = 0.0f;
 	float delta2 = 0.0f;
 	
-	for(unsigned int j=0;j<data.size(0);j++){
-	  auto d = data.access(1, j);
-	  delta += d.norm().c[0] / data.size(0);
-	  delta2 += d.norm().c[0]*d.norm().c[0] / data.size(0);
+	for(unsigned int j=0;j<data.rows;j++){
+	  const float d = output_norm(data, j);
+	  delta += d / data.rows;
+	  delta2 += d*d / data.rows;
 	}
 	
-	if(data.size(0) > 0){
-	  input_dimension  = data.access(0, 0).size();
-	  output_dimension = data.access(1, 0).size();
+	if(data.rows > 0){
+	  input_dimension  = data.dims[0];
+	  output_dimension = data.dims[1];
 	}
 	
 	std::pair<float, std::string> p;
@@ -6258,7 +6749,7 @@ std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const
 	
 	char buffer[128];
 	snprintf(buffer, 128, "%s (N = %d)", 
-		 keywords[i].c_str(), data.size(0));
+		 keywords[i].c_str(), data.rows);
 	std::string msg = buffer;
 	
 	p.second = msg;
@@ -6268,7 +6759,7 @@ std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const
 	var_delta_keywords  += delta2 - delta*delta;
 	num_keywords++;
 	
-	if(data.hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval))
+	if(data.pca)
 	  pca_preprocess++;
       }
     }
@@ -6278,24 +6769,22 @@ std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const
   var_delta_keywords  /= num_keywords;
   
   for(unsigned int i=0;i<pictureFiles.size();i++){
-    std::string dbFilename = modelDir + "/" + calculateHashName(pictureFiles[i] + eeg->getDataSourceName()) + ".ds";
-    
-    data.clear();
+    const std::string name = manifest.lookup(pictureFiles[i] + eeg->getDataSourceName());
     
-    if(data.load(dbFilename) == true){
-      if(data.getNumberOfClusters() >= 2){
+    if(measurements.find(name, data) == true){
+      if(data.clusters >= 2){
 	float delta = 0.0f;
 	float delta2 = 0.0f; 
 	
-	for(unsigned int j=0;j<data.size(0);j++){
-	  auto d = data.access(1, j);
-	  delta += d.norm().c[0] / data.size(0);
-	  delta2 += d.norm().c[0]*d.norm().c[0] / data.size(0);
+	for(unsigned int j=0;j<data.rows;j++){
+	  const float d = output_norm(data, j);
+	  delta += d / data.rows;
+	  delta2 += d*d / data.rows;
 	}
 	
-	if(data.size(0) > 0){
-	  input_dimension  = data.access(0, 0).size();
-	  output_dimension = data.access(1, 0).size();
+	if(data.rows > 0){
+	  input_dimension  = data.dims[0];
+	  output_dimension = data.dims[1];
 	}
 	
 	std::pair<float, std::string> p;
@@ -6303,7 +6792,7 @@ std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const
 	
 	char buffer[128];
 	snprintf(buffer, 128, "%s (N = %d)", 
-		 pictureFiles[i].c_str(), data.size(0));
+		 pictureFiles[i].c_str(), data.rows);
 	std::string msg = buffer;
 	
 	p.second = msg;
@@ -6313,7 +6802,7 @@ std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const
 	var_delta_pictures  += delta2 - delta*delta;
 	num_pictures++;
 	
-	if(data.hasPreprocess(0, whiteice::dataset<>::dnCorrelationRemoval))
+	if(data.pca)
 	  pca_preprocess++;
       }
     }
@@ -6325,24 +6814,21 @@ std::string ResonanzEngine::deltaStatistics(const std::string& pictureDir, const
   unsigned int synth_N = 0;
   
   if(synth){
-    std::string dbFilename = modelDir + "/" + 
-      calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
-    
-    data.clear();
+    const std::string name = manifest.lookup(eeg->getDataSourceName() + synth->getSynthesizerName());
     
-    if(data.load(dbFilename) == true){
+    if(measurements.find(name, data) == true){
 
-      synth_N = data.size(1);
+      synth_N = data.rows;
       
-      if(data.getNumberOfClusters() >= 2){
+      if(data.clusters >= 2){
 	
 	float delta = 0.0f;
 	float delta2 = 0.0f;
 	
-	for(unsigned int j=0;j<data.size(1);j++){
-	  auto d = data.access(1, j);
-	  delta += d.norm().c[0] / ((float)data.size(1));
-	  delta2 += d.norm().c[0]*d.norm().c[0] / ((float)data.size(1));
+	for(unsigned int j=0;j<data.rows;j++){
+	  const float d = output_norm(data, j);
+	  delta += d / ((float)data.rows);
+	  delta2 += d*d / ((float)data.rows);
 	}
 	
 	mean_delta_synth += delta;
@@ -6423,6 +6909,13 @@ bool ResonanzEngine::exportDataAscii(const std::string& pictureDir,
 				     const std::string& keywordsFile, 
 				     const std::string& modelDir) const
 {
+  // waits until journaled measurements have been folded into dataset files
+  journal.wait();
+  
+  // dataset names of modelDir (read-only, engine thread owns the registry)
+  StimulusRegistry manifest;
+  manifest.open(modelDir);
+  
   // 1. loads picture and keywords files into local memory
   std::vector<std::string> pictureFiles;
   std::vector<std::string> keywords;
@@ -6438,7 +6931,7 @@ bool ResonanzEngine::exportDataAscii(const std::string& pictureDir,
   {
     
     std::string dbFilename = modelDir + "/" + 
-      calculateHashName("eegData" + eeg->getDataSourceName()) + ".ds";
+      manifest.lookup("eegData" + eeg->getDataSourceName()) + ".ds";
     std::string txtFilename = modelDir + "/EEGDATA_" + eeg->getDataSourceName() + ".txt";
     
     data.clear();
@@ -6454,7 +6947,7 @@ bool ResonanzEngine::exportDataAscii(const std::string& pictureDir,
   // loads databases into memory or initializes new ones
   for(unsigned int i=0;i<keywords.size();i++){
     std::string dbFilename = modelDir + "/" + 
-      calculateHashName(keywords[i] + eeg->getDataSourceName()) + ".ds";
+      manifest.lookup(keywords[i] + eeg->getDataSourceName()) + ".ds";
     std::string txtFilename = modelDir + "/" + "KEYWORD_" + 
       keywords[i] + "_" + eeg->getDataSourceName() + ".txt";
     
@@ -6469,7 +6962,7 @@ bool ResonanzEngine::exportDataAscii(const std::string& pictureDir,
   
   for(unsigned int i=0;i<pictureFiles.size();i++){
     std::string dbFilename = modelDir + "/" + 
-      calculateHashName(pictureFiles[i] + eeg->getDataSourceName()) + ".ds";
+      manifest.lookup(pictureFiles[i] + eeg->getDataSourceName()) + ".ds";
     
     char filename[2048];
     snprintf(filename, 2048, "%s", pictureFiles[i].c_str());
@@ -6489,7 +6982,7 @@ bool ResonanzEngine::exportDataAscii(const std::string& pictureDir,
   
   if(synth){
     std::string dbFilename = modelDir + "/" + 
-      calculateHashName(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
+      manifest.lookup(eeg->getDataSourceName() + synth->getSynthesizerName()) + ".ds";
     
     std::string sname = synth->getSynthesizerName();
     
@@ -6538,6 +7031,10 @@ bool ResonanzEngine::deleteModelData(const std::string& modelDir)
       if(strlen(filename) > 3)
 	if(strcmp(&(filename[strlen(filename)-3]),".ds") == 0)
 	  databaseFiles.push_back(filename);
+      
+      if(strlen(filename) > 6)
+	if(strcmp(&(filename[strlen(filename)-6]),".stats") == 0)
+	  databaseFiles.push_back(filename);
     }
     closedir (dir);
   }
@@ -6610,6 +7107,27 @@ bool ResonanzEngine::deleteModelData(const std::string& modelDir)
      keywordModels.size() > 0 || pictureModels.size() > 0)
     return false; // do not delete anything if there models/data is loaded into memory
   
+  // stops appending to measurement journal which is deleted with datasets
+  journal.wait();
+  journal.close();
+  store.close();
+  registry.clear();
+  
+  {
+    if ((dir = opendir (modelDir.c_str())) != NULL) {
+      while ((ent = readdir (dir)) != NULL) {
+	if(strncmp(ent->d_name, "measurements.journal", 20) == 0 ||
+	   strncmp(ent->d_name, "measurements.store", 18) == 0 ||
+	   strncmp(ent->d_name, "stimulus.manifest", 17) == 0 ||
+	   strcmp(ent->d_name, "hmm.labels") == 0 ||
+	   strcmp(ent->d_name, "hmm.generation") == 0 ||
+	   strcmp(ent->d_name, "models.versions") == 0)
+	  databaseFiles.push_back(ent->d_name);
+      }
+      closedir (dir);
+    }
+  }
+  
   for(auto filename : databaseFiles){
     auto f = modelDir + "/" + filename;
     remove(f.c_str());
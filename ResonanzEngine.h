@@ -11,7 +11,9 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <vector>
+#include <map>
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +43,16 @@
 #include "SDLAVCodec.h"
 
 #include "HMMStateUpdator.h"
+#include "HMMStateFilter.h"
+#include "BrainStateTrainer.h"
+#include "ModelTrainingScheduler.h"
+#include "NNIndex.h"
+#include "EngineScheduler.h"
+#include "ImageCache.h"
+#include "MeasurementJournal.h"
+#include "MeasurementStore.h"
+#include "RunningStatistics.h"
+#include "StimulusRegistry.h"
 
 
 namespace whiteice {
@@ -87,7 +99,9 @@ public:
 class ResonanzEngine 
 {
 public:
-	ResonanzEngine(const unsigned int numDeviceChannels = 7);
+	// headless engine renders offscreen and runs with virtual clock, it must
+	// be selected before the engine thread initializes SDL
+	ResonanzEngine(const unsigned int numDeviceChannels = 7, const bool headless = false);
 	virtual ~ResonanzEngine();
 
 	// what resonanz is doing right now [especially interesting if we are optimizing model]
@@ -172,6 +186,7 @@ public:
 	static const int RE_EEG_IA_MUSE_DEVICE = 3;
 	static const int RE_WD_LIGHTSTONE = 4;
         static const int RE_EEG_IA_MUSE_4CH_DEVICE = 5;
+        static const int RE_EEG_IA_MUSE_RAW_DEVICE = 6; // raw EEG (4 channels)
   
 
 	bool setEEGDeviceType(int deviceNumber);
@@ -217,7 +232,8 @@ private:
 
 	bool measureColor(SDL_Surface* image, SDL_Color& averageColor);
 
-	bool engine_loadMedia(const std::string& picdir, const std::string& keyfile, bool loadData);
+	bool engine_loadMedia(const std::string& picdir, const std::string& keyfile,
+			      const std::string& modelDir, bool loadData);
 	bool engine_showScreen(const std::string& message, 
 			       unsigned int picture,
 			       const std::vector<float>& synthparams);
@@ -229,6 +245,15 @@ private:
 
 	void engine_updateScreen();
 
+	// engine time (msecs since epoch): system clock or virtual clock in headless mode
+	long long engine_clockMS() const;
+
+	// headless mode: creates offscreen surface (and font) instead of a window
+	bool engine_openOffscreen(const std::string& fontname);
+
+	// headless mode: synthesizes sound until the current (virtual) time
+	void engine_renderOfflineSound();
+
 	SDL_Window* window = nullptr;
 	int SCREEN_WIDTH, SCREEN_HEIGHT;
 	TTF_Font* font = nullptr;
@@ -236,19 +261,34 @@ private:
 	Mix_Music* music = nullptr;
 	bool fullscreen = false; // set to use fullscreen mode otherwise window
 
+	// headless mode renders into offscreen surface and runs engine ticks with
+	// virtual clock as fast as possible (batch video generation) [constructor]
+	const bool headless;
+	SDL_Surface* offscreen = nullptr;
+	std::atomic<int> HEADLESS_WIDTH{1280}, HEADLESS_HEIGHT{720}; // [setParameter("headless-size")]
+	std::atomic<unsigned int> headlessLength{0}; // length (secs) of headless random stimulation (0 = until stopped)
+	long long headlessClockStart = 0; // system clock when virtual clock was started
+	unsigned long long offlineSamples = 0; // sound synthesized since program start
+
 	bool keypressed = false;
 	std::mutex keypress_mutex;
 
 	long long tick = 0; // current engine tick (one tick is TICK_MS long)
 
+	// schedules engine tick and HMM update tasks using monotonic clock
+	EngineScheduler scheduler;
+
 	// set to 100ms (set tick back to 1000ms = 1 sec)
-	static const unsigned int TICK_MS = 250;             // how fast engine runs: engine measures ticks and executes (one) command only when tick changes (was: 100)
+	unsigned int TICK_MS = 250;             // how fast engine runs: engine measures ticks and executes (one) command only when tick changes (was: 100) [setParameter("tick-ms")]
+	std::atomic<unsigned int> requestedTickMS{0}; // new TICK_MS given to engine thread (0 = no change)
 	static const unsigned int MEASUREMODE_DELAY_MS = 500; // how long each screen is shown when measuring response (was: 200)
 
 	// media resource
 	std::vector<std::string> keywords;
 	std::vector<std::string> pictures;
-	std::vector<SDL_Surface*> images;
+
+	// decoded and scaled pictures (LRU cache with background prefetching) [setParameter("image-cache-mb")]
+	ImageCache imageCache;
 
         const unsigned int PICFEATURES_SIZE = 20; // 5*(3+1)
         std::vector< whiteice::math::vertex<> > imageFeatures; // feature vectors of images
@@ -267,6 +307,15 @@ private:
 
 
 	bool engine_loadDatabase(const std::string& modelDir);
+	// averages buffered EEG samples around stimulus to before and after values
+	bool engine_averageResponse(long long stimulusStart,
+				    std::vector<float>& eegBefore,
+				    std::vector<float>& eegAfter);
+	
+	// moves stimulus start to the time when new synth parameters
+	// (published after generation) became audible
+	bool engine_synthOnset(unsigned long long generation, long long& stimulusStart);
+	
 	bool engine_storeMeasurement(unsigned int pic, unsigned int key, 
 				     const std::vector<float>& eegBefore, 
 				     const std::vector<float>& eegAfter,
@@ -274,7 +323,104 @@ private:
 				     const std::vector<float>& synthAfter);
 	
 	bool engine_saveDatabase(const std::string& modelDir);
+	
+	// saves measurements stored after engine_loadDatabase() by folding
+	// measurement journal into datasets in background thread
+	bool engine_syncDatabase(const std::string& modelDir);
+	
+	// loads, cleans and preprocesses keyword/picture dataset (thread-safe for different datasets)
+	bool engine_loadStimulusDataset(const std::string& dbFilename, const std::string& kind,
+					unsigned int inputDimension, unsigned int outputDimension,
+					whiteice::dataset<>& data,
+					std::vector<RunningStatistics>& stats);
+	
+	// reads raw dataset rows from measurement store (raw = true) or
+	// loads .ds file if the dataset is not in the store. raw rows are
+	// preprocessed again by the caller: dataset<> cannot take stored
+	// normalization parameters, so loading is still linear in row count
+	bool engine_readDataset(const std::string& dbFilename,
+				whiteice::dataset<>& data, bool& raw) const;
+	
+	// cleans, renormalizes (if needed) and saves stimulus dataset,
+	// rebuilds nearest neighbour index of input data if it was changed
+	bool engine_saveStimulusDataset(const std::string& dbFilename, const std::string& kind,
+					whiteice::dataset<>& data,
+					std::vector<RunningStatistics>& stats,
+					NNIndex* index = nullptr);
+	
+	// number of threads loading/saving datasets concurrently
+	unsigned int engine_databaseThreads() const;
+	
+	// reports dataset load/save progress using engine_setStatus()
+	void engine_databaseProgress(const char* action, unsigned int done, unsigned int total);
+	
+	// recomputes preprocessing of dataset cluster only if its statistics
+	// have drifted since the last preprocessing (sets renormalized)
+	bool engine_refreshPreprocess(whiteice::dataset<>& data, unsigned int cluster,
+				      RunningStatistics& stats, bool pca,
+				      bool* renormalized = nullptr);
+	
+	// recalculates statistics if they don't match dataset
+	void engine_validateStatistics(const whiteice::dataset<>& data, unsigned int clusters,
+				       std::vector<RunningStatistics>& stats, bool covariance);
+	
+	// loads statistics saved next to dataset file (dbFilename),
+	// renormalized: dataset was preprocessed again at load
+	void engine_loadStatistics(const std::string& dbFilename, const whiteice::dataset<>& data,
+				   unsigned int clusters, std::vector<RunningStatistics>& stats,
+				   bool covariance, bool renormalized = false);
+	
+	// saves statistics of all datasets to modelDir
+	bool engine_saveStatistics(const std::string& modelDir);
+	
+	// identifies content of current K-Means and HMM models, "" if there are none
+	std::string engine_hmmModelIdentity() const;
+	
+	// identifies raw EEG rows K-Means and HMM models are trained with
+	std::string engine_eegGeneration() const;
+	
+	// training generation of saved K-Means/HMM models (modelDir/hmm.generation)
+	bool engine_loadHMMGeneration(const std::string& modelDir, std::string& generation) const;
+	bool engine_saveHMMGeneration(const std::string& modelDir, const std::string& generation) const;
+	
+	// dataset names in HMMStateUpdatorThread order (pictures, keywords, synth)
+	void engine_hmmLabelNames(std::vector<std::string>& names) const;
+	
+	// loads number of rows labelled with the current K-Means/HMM training generation
+	// (modelDir/hmm.labels), returns false if labels are not valid
+	bool engine_loadHMMLabels(const std::string& modelDir);
+	bool engine_saveHMMLabels(const std::string& modelDir);
+	
+	// dataset version (rows and content hash) and network a model was trained with
+	struct model_version {
+	  unsigned int rows = 0;
+	  unsigned long long hash = 0;
+	  unsigned int parameters = 0;
+	  bool bayesian = false;
+	};
+	
+	// hashes raw input/output rows without HMM state columns of input
+	// (starting from hmmColumn) which are relabelled at every optimization
+	bool engine_modelVersion(const whiteice::dataset<>& data, const whiteice::nnetwork<>& net,
+				 unsigned int hmmColumn, model_version& version) const;
+	
+	// loads/saves versions of trained models (modelDir/models.versions)
+	bool engine_loadModelVersions(const std::string& modelDir);
+	bool engine_saveModelVersions(const std::string& modelDir) const;
+	
+	// adds training job of dataset's model: unchanged models are skipped and
+	// models with few new rows are warm started from the saved model
+	bool engine_addTrainingJob(const std::string& kind, const std::string& name,
+				   const whiteice::nnetwork<>& net, whiteice::dataset<>& data,
+				   const std::string& modelName);
+	
+	// dataset name of the stimulus in the loaded model (engine thread, registers new
+	// stimuli), analysis functions use read-only StimulusRegistry of their modelDir
 	std::string calculateHashName(const std::string& filename) const;
+	
+	// stimulus key => dataset name registry of the model directory
+	// (mutable: names are memoized by const methods too)
+	mutable StimulusRegistry registry;
         
         
         std::string latestModelDir;
@@ -285,8 +431,41 @@ private:
 	std::vector< whiteice::dataset<> > keywordData;
 	std::vector< whiteice::dataset<> > pictureData;
 	whiteice::dataset<>                synthData; // sound synthesis data
+
+	// engine_scoreStimuli() buffers (structure-of-arrays), reused between ticks
+	std::vector<float> scoreMean, scoreVar, scoreError, scoreRatio, scoreNorm;
+	std::vector<char> scoreValid;
+
+	// KD-tree indexes of keywordData and pictureData input clusters for engine_estimateNN()
+	std::vector< NNIndex > keywordIndex;
+	std::vector< NNIndex > pictureIndex;
 	
         mutable std::mutex database_mutex;  // mutex to synchronize I/O access to dataset files
+	
+	// append-only log of stored measurements, folded into dataset files
+	// in background (mutable: readers of dataset files wait for compaction)
+	mutable MeasurementJournal journal;
+
+	// dataset names of journal records (set by engine_loadDatabase())
+	std::vector<std::string> keywordDatasets, pictureDatasets;
+	std::string eegDataset, synthDataset;
+	bool journalFailed = false; // falls back to full database save
+	
+	// memory-mapped copy of dataset files, database is loaded from it
+	// (engine thread only: API thread functions use their own instances)
+	MeasurementStore store;
+	
+	// running statistics of raw input/output clusters of datasets
+	// (dataset preprocessing is recomputed only when they drift)
+	std::vector<RunningStatistics> eegStats;
+	std::vector< std::vector<RunningStatistics> > keywordStats;
+	std::vector< std::vector<RunningStatistics> > pictureStats;
+	std::vector<RunningStatistics> synthStats;
+	
+	const float STATISTICS_DRIFT = 0.05f; // [stdevs] (correlation for PCA)
+	
+	const unsigned int MAX_DATABASE_THREADS = 8; // concurrent dataset file loads/saves
+	
 	bool pcaPreprocess = false; // should measured data be preprocessed using PCA (no pca preprocessing as the default!)
 
 
@@ -295,6 +474,10 @@ private:
 	int eegDeviceType = RE_EEG_NO_DEVICE;
 
         unsigned int musePort = 4545; // parameters when creating MuseOSC device/class for localhost
+        double museUpdateHz = 10.0;   // band power update rate of raw EEG Muse device
+        std::string museReplayFile;   // raw EEG Muse device replays capture file if set
+        std::string museCaptureFile;  // raw EEG Muse device records OSC packets if set
+        std::string museWisdomFile;   // raw EEG Muse device keeps FFTW wisdom in this file if set
 	
         bool engine_optimizeModels(unsigned int& currentHMMModel,
 				   unsigned int& currentPictureModel, 
@@ -304,17 +487,33 @@ private:
         mutable std::mutex hmm_mutex; // synchronized manipulation of HMM params
         whiteice::KMeans<>* kmeans = nullptr;
         whiteice::HMM* hmm = nullptr;
-        unsigned int HMMstate = 0; // current HMM state
+        unsigned int HMMstate = 0; // current HMM state (MAP state of hmmFilter)
+	HMMStateFilter hmmFilter; // streaming posterior of HMM state
+	// prediction inputs use state posterior instead of one-hot MAP state. off by default:
+	// models are trained with one-hot states stored in datasets so soft inputs differ
+	// from the training distribution
+	const bool HMM_SOFT_STATE = false;
         HMMStateUpdatorThread* hmmUpdator = nullptr;
+	BrainStateTrainer* brainTrainer = nullptr; // K-Means/HMM training of optimize command
+	std::vector<unsigned int> hmmLabelled; // HMM labelled rows of datasets
+	std::string hmmLabelModel; // K-Means/HMM training generation used to label rows
+	std::string hmmGeneration; // training generation of current K-Means/HMM ("" if unknown)
+	std::string hmmTrainingGeneration; // EEG rows of running K-Means/HMM training
   
         const unsigned int KMEANS_NUM_CLUSTERS = 15;
         const unsigned int HMM_NUM_CLUSTERS = 20; // number of HMM hidden brain states
 	
-	// whiteice::pLBFGS_nnetwork<>* optimizer = nullptr;
-	whiteice::math::NNGradDescent<>* optimizer = nullptr;
+	ModelTrainingScheduler trainingScheduler; // trains prediction models concurrently
 	
-	const unsigned int NUM_OPTIMIZER_THREADS = 2;
+	const unsigned int MAX_TRAINING_THREADS = 0; // optimizer threads of all models (0 = all cores)
 	const unsigned int NUM_OPTIMIZER_ITERATIONS = 500; // was: 150, 1000
+	
+	std::map<std::string, model_version> modelVersions; // model name => trained version
+	std::map<std::string, std::pair<std::string, model_version> > trainingVersions; // model file => (name, version) being trained
+	
+	const float WARM_START_NEW_ROWS = 0.25f; // models with at most 25% new rows are warm started
+	const unsigned int WARM_START_MIN_ITERATIONS = 50;
+	
 	bool optimizeSynthOnly = false;
 
   	whiteice::nnetwork<>* nn = nullptr;
@@ -322,7 +521,6 @@ private:
 	whiteice::nnetwork<>* nnsynth = nullptr; // synth data neural network
         
 	whiteice::bayesian_nnetwork<>* bnn = nullptr;
-	whiteice::UHMC<>* bayes_optimizer = nullptr;
 
 	const int NEURALNETWORK_COMPLEXITY = 4; // values above 10 seem to make sense (was: 25, 10) [was: 10]
         const int NEURALNETWORK_DEPTH = 3; // how many layers neural network have (was: 3, 6, *10*) [was: 1, 2, 5] (only (2*x+1) odd values work correctly now!)
@@ -334,6 +532,19 @@ private:
 	bool engine_executeProgram(const std::vector<float>& eegCurrent,
 			const std::vector<float>& eegTarget, const std::vector<float>& eegTargetVariance, float timedelta);
 
+	// HMM state input of prediction models: posterior (HMM_SOFT_STATE) or one-hot MAP state
+	void engine_hmmStateInput(std::vector<float>& x) const;
+
+	// calculates prediction errors of all keywords or pictures (pictureStimulus):
+	// predictions are calculated per stimulus (own model and preprocessing)
+	// and their errors in a batch
+	bool engine_scoreStimuli(const std::vector<float>& eegCurrent,
+				 const std::vector<float>& eegTarget,
+				 const std::vector<float>& eegTargetVariance,
+				 float timestep, bool pictureStimulus,
+				 std::vector< std::pair<float, int> >& results,
+				 std::vector<float>& model_error_ratio);
+
 	// executes program blindly based on Monte Carlo sampling and prediction models
 	bool engine_executeProgramMonteCarlo(const std::vector<float>& eegTarget,
 			const std::vector<float>& eegTargetVariance, float timedelta);
@@ -350,14 +561,17 @@ private:
 	// number of parameters to test with synthModel before selecting the optimium one 
 	const unsigned int SYNTH_NUM_GENERATED_PARAMS = 200; // (was 400, 100, 2000) reduced to 50 because of slowness(?)
 
-        // number of pictures to test per iteration for stimulus response before selecting the optimum one
-        const unsigned int PIC_DATASET_SIZE = 100;
   	
 	unsigned long long synthParametersChangedTime = 0ULL;
 
-	// estimate output value N(m,cov) for x given dataset data uses nearest neighbourhood estimation
+	// estimate output value N(m,cov) for x given dataset data uses nearest neighbourhood estimation,
+	// uses only nnNeighbours nearest rows when index of data is given (and up to date)
 	bool engine_estimateNN(const whiteice::math::vertex<>& x, const whiteice::dataset<>& data,
-			whiteice::math::vertex<>& m, whiteice::math::matrix<>& cov);
+			whiteice::math::vertex<>& m, whiteice::math::matrix<>& cov,
+			const NNIndex* index = nullptr);
+
+	// number of nearest neighbours used by engine_estimateNN() (0 = use all data rows)
+	unsigned int nnNeighbours = 64;
 
 	// for calculating program performance: RMS statistic
 	float programRMS = 0.0f;
@@ -370,6 +584,15 @@ private:
 	long long programStarted; // 0 = program has not been started
         //SDLTheora* video = nullptr; // used to encode program into video
         SDLAVCodec* video = nullptr; // used to encode program into video
+	const unsigned long long VIDEO_MEMORY_BUDGET = 512ULL*1024ULL*1024ULL; // raw frames queued for encoder
+	const SDLAVCodec::overflow_policy VIDEO_OVERFLOW_POLICY = SDLAVCodec::OVERFLOW_LOWER_FPS;
+	AudioCapture videoAudio; // synthesized sound muxed into video
+	
+	// contents of the latest video frame (unchanged screens are not encoded again)
+	std::string videoFrameMessage;
+	unsigned int videoFramePicture = 0;
+	const SDL_Surface* videoFrameImage = nullptr;
+	int videoFrameWidth = 0, videoFrameHeight = 0;
 
 
 	std::mutex measure_program_mutex;
@@ -0,0 +1,338 @@
+#include "RunningStatistics.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <utility>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    RunningStatistics::RunningStatistics()
+    {
+    }
+
+
+    void RunningStatistics::reset(unsigned int dim, bool covariance)
+    {
+      D = dim;
+      N = 0;
+      useCovariance = covariance;
+
+      m.resize(D);
+      M2.resize(D);
+      for(unsigned int i=0;i<D;i++){
+	m[i] = 0.0;
+	M2[i] = 0.0;
+      }
+
+      if(useCovariance) C.resize((D*(D-1))/2);
+      else C.clear();
+
+      for(auto& c : C) c = 0.0;
+
+      N0 = 0;
+      m0.clear();
+      s0.clear();
+      r0.clear();
+    }
+
+
+    bool RunningStatistics::build(const whiteice::dataset<>& data, unsigned int cluster,
+				  bool covariance)
+    {
+      if(cluster >= data.getNumberOfClusters())
+	return false;
+
+      reset(data.dimension(cluster), covariance);
+
+      std::vector<float> x(D);
+
+      for(unsigned int r=0;r<data.size(cluster);r++){
+	auto v = data.access(cluster, r);
+
+	if(data.invpreprocess(cluster, v) == false)
+	  return false;
+
+	for(unsigned int i=0;i<D;i++)
+	  x[i] = v[i].c[0];
+
+	add(x.data());
+      }
+
+      return true;
+    }
+
+
+    bool RunningStatistics::add(const std::vector< whiteice::math::blas_real<float> >& x)
+    {
+      if(x.size() != D) return false;
+
+      v.resize(D);
+
+      for(unsigned int i=0;i<D;i++)
+	v[i] = x[i].c[0];
+
+      return add(v.data());
+    }
+
+
+    bool RunningStatistics::add(const float* x)
+    {
+      N++;
+
+      // delta before and after mean update (Welford)
+      d1.resize(D);
+      d2.resize(D);
+
+      for(unsigned int i=0;i<D;i++){
+	d1[i] = x[i] - m[i];
+	m[i] += d1[i]/N;
+	d2[i] = x[i] - m[i];
+	M2[i] += d1[i]*d2[i];
+      }
+
+      if(useCovariance){
+	for(unsigned int i=0;i<D;i++)
+	  for(unsigned int j=i+1;j<D;j++)
+	    C[index(i,j)] += d1[i]*d2[j];
+      }
+
+      return true;
+    }
+
+
+    float RunningStatistics::mean(unsigned int i) const
+    {
+      if(i >= D) return 0.0f;
+      return (float)m[i];
+    }
+
+
+    float RunningStatistics::variance(unsigned int i) const
+    {
+      if(i >= D || N < 2) return 0.0f;
+      return (float)(M2[i]/(N-1));
+    }
+
+
+    float RunningStatistics::stdev(unsigned int i) const
+    {
+      return sqrtf(variance(i));
+    }
+
+
+    float RunningStatistics::covariance(unsigned int i, unsigned int j) const
+    {
+      if(i >= D || j >= D || N < 2) return 0.0f;
+      if(i == j) return variance(i);
+      if(useCovariance == false) return 0.0f;
+
+      if(i > j) std::swap(i, j);
+
+      return (float)(C[index(i,j)]/(N-1));
+    }
+
+
+    bool RunningStatistics::normalize(const std::vector< whiteice::math::blas_real<float> >& x,
+				      std::vector< whiteice::math::blas_real<float> >& y) const
+    {
+      if(x.size() != D) return false;
+
+      y.resize(D);
+
+      for(unsigned int i=0;i<D;i++){
+	float s = stdev(i);
+	if(s <= 0.0f) s = 1.0f; // dimensions without variance are not scaled
+
+	y[i] = (x[i].c[0] - (float)m[i])/s;
+      }
+
+      return true;
+    }
+
+
+    void RunningStatistics::checkpoint()
+    {
+      N0 = N;
+      m0 = m;
+
+      s0.resize(D);
+      for(unsigned int i=0;i<D;i++)
+	s0[i] = stdev(i);
+
+      if(useCovariance){
+	r0.resize(C.size());
+
+	for(unsigned int i=0;i<D;i++)
+	  for(unsigned int j=i+1;j<D;j++)
+	    r0[index(i,j)] = correlation(i, j);
+      }
+      else r0.clear();
+    }
+
+
+    void RunningStatistics::setCheckpoint(const RunningStatistics& s)
+    {
+      N0 = s.N0;
+      m0 = s.m0;
+      s0 = s.s0;
+      r0 = s.r0;
+    }
+
+
+    float RunningStatistics::drift() const
+    {
+      if(N0 == 0 || m0.size() != D || s0.size() != D)
+	return 1e30f; // no checkpoint
+
+      if(N == N0)
+	return 0.0f;
+
+      double d = 0.0;
+
+      for(unsigned int i=0;i<D;i++){
+	const double s = (s0[i] > 1e-6) ? s0[i] : 1e-6;
+
+	const double dm = fabs(m[i] - m0[i])/s;
+	const double ds = fabs(stdev(i) - s0[i])/s;
+
+	if(dm > d) d = dm;
+	if(ds > d) d = ds;
+      }
+
+      if(useCovariance && r0.size() == C.size()){
+	for(unsigned int i=0;i<D;i++){
+	  for(unsigned int j=i+1;j<D;j++){
+	    const double dr = fabs(correlation(i, j) - r0[index(i,j)]);
+	    if(dr > d) d = dr;
+	  }
+	}
+      }
+
+      return (float)d;
+    }
+
+
+    double RunningStatistics::correlation(unsigned int i, unsigned int j) const
+    {
+      const double s = sqrt(M2[i]*M2[j]);
+      if(s <= 0.0) return 0.0;
+
+      return C[index(i,j)]/s;
+    }
+
+
+    unsigned int RunningStatistics::index(unsigned int i, unsigned int j) const
+    {
+      // row i of packed strict upper triangle starts after rows 0..i-1
+      return i*D - (i*(i+1))/2 + (j - i - 1);
+    }
+
+
+    bool RunningStatistics::save(const std::string& filename,
+				 const std::vector<RunningStatistics>& stats)
+    {
+      FILE* handle = fopen(filename.c_str(), "wb");
+      if(handle == NULL) return false;
+
+      bool ok = true;
+
+      auto writeu = [&](unsigned long long v) {
+	if(ok) ok = (fwrite(&v, sizeof(v), 1, handle) == 1);
+      };
+
+      auto writev = [&](const std::vector<double>& v) {
+	writeu(v.size());
+	if(ok && v.size() > 0) ok = (fwrite(v.data(), sizeof(double), v.size(), handle) == v.size());
+      };
+
+      writeu(MAGIC);
+      writeu(stats.size());
+
+      for(const auto& s : stats){
+	writeu(s.D);
+	writeu(s.N);
+	writeu(s.useCovariance ? 1 : 0);
+	writev(s.m);
+	writev(s.M2);
+	writev(s.C);
+	writeu(s.N0);
+	writev(s.m0);
+	writev(s.s0);
+	writev(s.r0);
+      }
+
+      if(ferror(handle)) ok = false;
+
+      fclose(handle);
+
+      if(!ok) remove(filename.c_str());
+
+      return ok;
+    }
+
+
+    bool RunningStatistics::load(const std::string& filename,
+				 std::vector<RunningStatistics>& stats)
+    {
+      FILE* handle = fopen(filename.c_str(), "rb");
+      if(handle == NULL) return false;
+
+      bool ok = true;
+
+      auto readu = [&]() -> unsigned long long {
+	unsigned long long v = 0;
+	if(ok) ok = (fread(&v, sizeof(v), 1, handle) == 1);
+	return v;
+      };
+
+      auto readv = [&](std::vector<double>& v) {
+	const unsigned long long n = readu();
+	if(!ok || n > (1ULL<<26)){ ok = false; return; }
+	v.resize(n);
+	if(n > 0) ok = (fread(v.data(), sizeof(double), n, handle) == n);
+      };
+
+      if(readu() != MAGIC) ok = false;
+
+      const unsigned long long count = readu();
+      if(count > 16) ok = false;
+
+      std::vector<RunningStatistics> s;
+
+      for(unsigned int k=0;ok && k<count;k++){
+	RunningStatistics r;
+
+	r.D = readu();
+	r.N = readu();
+	r.useCovariance = (readu() != 0);
+	readv(r.m);
+	readv(r.M2);
+	readv(r.C);
+	r.N0 = readu();
+	readv(r.m0);
+	readv(r.s0);
+	readv(r.r0);
+
+	if(ok){
+	  if(r.m.size() != r.D || r.M2.size() != r.D ||
+	     r.C.size() != (r.useCovariance ? (r.D*(r.D-1))/2 : 0))
+	    ok = false;
+	}
+
+	s.push_back(r);
+      }
+
+      fclose(handle);
+
+      if(ok) stats = s;
+
+      return ok;
+    }
+
+  };
+};
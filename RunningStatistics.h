@@ -0,0 +1,99 @@
+/*
+ * RunningStatistics
+ *
+ * incremental (Welford) mean, variance and optional covariance of
+ * raw (unpreprocessed) dataset cluster values. engine_storeMeasurement()
+ * updates statistics in O(D) (O(D^2) with covariance) per new row and
+ * engine_saveDatabase() recomputes dataset preprocessing only when
+ * statistics have drifted away from the checkpoint taken when the
+ * dataset was last preprocessed.
+ *
+ * statistics are saved next to datasets (modelDir/<name>.stats).
+ */
+
+#ifndef RunningStatistics_h
+#define RunningStatistics_h
+
+#include <dinrhiw.h>
+
+#include <string>
+#include <vector>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class RunningStatistics
+    {
+    public:
+
+      RunningStatistics();
+
+      // clears statistics of dim dimensional data
+      void reset(unsigned int dim, bool covariance);
+
+      // recalculates statistics from raw values of dataset cluster
+      // (single pass, preprocessing is removed row by row)
+      bool build(const whiteice::dataset<>& data, unsigned int cluster, bool covariance);
+
+      bool add(const std::vector< whiteice::math::blas_real<float> >& x);
+      bool add(const float* x);
+
+      unsigned int dimension() const { return D; }
+      unsigned long long size() const { return N; }
+      bool hasCovariance() const { return useCovariance; }
+
+      float mean(unsigned int i) const;
+      float variance(unsigned int i) const;
+      float stdev(unsigned int i) const;
+      float covariance(unsigned int i, unsigned int j) const;
+
+      // normalized view of raw data: (x - mean)/stdev
+      bool normalize(const std::vector< whiteice::math::blas_real<float> >& x,
+		     std::vector< whiteice::math::blas_real<float> >& y) const;
+
+      // marks current statistics as the ones used by dataset preprocessing
+      void checkpoint();
+
+      // copies checkpoint of s (statistics recalculated for the same preprocessing)
+      void setCheckpoint(const RunningStatistics& s);
+
+      // largest change of mean, stdev (in checkpoint stdev units) and
+      // correlation since checkpoint(), very large if there is no checkpoint
+      float drift() const;
+
+      // saves/loads statistics of dataset clusters
+      static bool save(const std::string& filename, const std::vector<RunningStatistics>& stats);
+      static bool load(const std::string& filename, std::vector<RunningStatistics>& stats);
+
+    private:
+
+      // correlation coefficient of current statistics (i < j)
+      double correlation(unsigned int i, unsigned int j) const;
+
+      unsigned int index(unsigned int i, unsigned int j) const; // packed i < j
+
+      unsigned int D = 0;
+      unsigned long long N = 0;
+      bool useCovariance = false;
+
+      std::vector<double> m;  // mean
+      std::vector<double> M2; // sum of squared deviations
+      std::vector<double> C;  // sum of co-deviations (i < j, packed)
+
+      // work buffers of add()
+      std::vector<float> v;
+      std::vector<double> d1, d2;
+
+      // checkpoint
+      unsigned long long N0 = 0;
+      std::vector<double> m0, s0, r0; // mean, stdev, correlation (packed)
+
+      static const unsigned int MAGIC = 0x53525a52; // "RZRS"
+    };
+
+  };
+};
+
+
+#endif
@@ -6,6 +6,7 @@
  */
 
 #include "SDLAVCodec.h"
+#include "yuv_conversion.h"
 #include <string.h>
 
 #include <ogg/ogg.h>
@@ -35,8 +36,8 @@ extern "C"
 namespace whiteice {
 namespace resonanz {
 
-SDLAVCodec::SDLAVCodec(float q) :
-  FPS(100), MSECS_PER_FRAME(1000/100) // currently saves at 25 frames per second, now 100, now 30, now 60
+SDLAVCodec::SDLAVCodec(float q, bool vfr) :
+  variableFrameRate(vfr), FPS(100), MSECS_PER_FRAME(1000/100) // currently saves at 25 frames per second, now 100, now 30, now 60
 {
   if(q >= 0.0f && q <= 1.0f)
     quality = q;
@@ -47,20 +48,37 @@ SDLAVCodec::SDLAVCodec(float q) :
   encoder_thread = nullptr;
   error_flag = false;
   
+  frameInterval = 1;
+  maxQueueDepth = 0;
+  framesInserted = 0;
+  framesUnchanged = 0;
+  framesEncoded = 0;
+  framesDropped = 0;
+  latencySum = 0;
+  latencyMax = 0;
+  
+  audioStartMS = -1;
+  audioEndMsecs = -1;
+  audioSamplesEncoded = 0;
+  audioSamplesLost = 0;
+  
   //av_register_all();
 }
 
   
 SDLAVCodec::~SDLAVCodec()
 {
-  std::lock_guard<std::mutex> lock1(incoming_mutex);
+  void* p = nullptr;
   
-  for(auto& i : incoming){
-    av_frame_free(&(i->frame));
-    delete i;
-  }
+  while(incoming.pop(p))
+    release_frame((SDLAVCodec::videoframe*)p);
   
-  incoming.clear();
+  free_frames();
+  
+  if(scratch){
+    SDL_FreeSurface(scratch);
+    scratch = nullptr;
+  }
   
   std::lock_guard<std::mutex> lock2(start_lock);
   
@@ -81,6 +99,75 @@ SDLAVCodec::~SDLAVCodec()
     pkt = NULL;
   }
   
+  free_audio();
+}
+
+
+void SDLAVCodec::setMemoryBudget(unsigned long long bytes)
+{
+  memoryBudget = bytes;
+}
+
+
+void SDLAVCodec::setOverflowPolicy(overflow_policy policy)
+{
+  overflowPolicy = policy;
+}
+
+
+void SDLAVCodec::setAudioSource(AudioCapture* capture)
+{
+  std::lock_guard<std::mutex> lock(start_lock);
+  
+  if(running == false)
+    audioCapture = capture;
+}
+
+
+void SDLAVCodec::setAudioClock(long long startMS)
+{
+  audioStartMS = startMS;
+}
+
+
+void SDLAVCodec::getStatistics(SDLAVCodec::statistics& s) const
+{
+  s.queueDepth = incoming.size();
+  s.queueCapacity = incoming.capacity();
+  s.maxQueueDepth = maxQueueDepth;
+  s.inserted = framesInserted;
+  s.unchanged = framesUnchanged;
+  s.encoded = framesEncoded;
+  s.dropped = framesDropped;
+  s.meanLatency = (s.encoded > 0) ? (latencySum/1000.0)/s.encoded : 0.0;
+  s.maxLatency = latencyMax/1000.0;
+  s.fps = ((float)FPS)/frameInterval;
+  
+  const unsigned int rate = audioCapture ? audioCapture->getSampleRate() : 0;
+  
+  s.audioSeconds = (rate > 0) ? audioSamplesEncoded/((double)rate) : 0.0;
+  s.audioLost = audioSamplesLost;
+}
+
+
+std::string SDLAVCodec::getStatus() const
+{
+  SDLAVCodec::statistics s;
+  getStatistics(s);
+  
+  char buffer[256];
+  snprintf(buffer, 256, "video: queue %d/%d (max %d) frames: %llu encoded %llu unchanged %llu dropped, latency %.1f ms (max %.1f ms), %.0f fps",
+	   s.queueDepth, s.queueCapacity, s.maxQueueDepth,
+	   s.encoded, s.unchanged, s.dropped, s.meanLatency, s.maxLatency, s.fps);
+  
+  std::string status = buffer;
+  
+  if(audioCapture){
+    snprintf(buffer, 256, ", audio: %.1f s (%llu samples lost)", s.audioSeconds, s.audioLost);
+    status += buffer;
+  }
+  
+  return status;
 }
 
 
@@ -208,6 +295,19 @@ bool SDLAVCodec::startEncoding(const std::string& filename,
   fmt_ctx->video_codec_id = codec->id;
   fmt_ctx->bit_rate = frameWidth * frameHeight * FPS * 2;
   
+  // audio stream must be added before the header is written
+  audioStartMS = -1;
+  audioEndMsecs = -1;
+  audioStarted = false;
+  audioPending.clear();
+  audioSamplesEncoded = 0;
+  audioSamplesLost = 0;
+  
+  if(audioCapture != nullptr && setup_audio() == false){
+    logging.warn("sdl-theora: opening audio encoder failed, video has no audio");
+    free_audio();
+  }
+  
 
   // printf("VIDEO FORMAT:\n");
   av_dump_format(fmt_ctx, 0, filename.c_str(), 1);
@@ -241,6 +341,52 @@ bool SDLAVCodec::startEncoding(const std::string& filename,
   pkt = av_packet_alloc();
   if (!pkt) return false;
   
+  // queue capacity: frames within memory budget except frames held by
+  // caller (conversion) and encoder (current and previous frame)
+  {
+    const unsigned long long frameBytes =
+      ((unsigned long long)frameWidth)*((unsigned long long)frameHeight)*3/2 + 1;
+    
+    unsigned long long frames = memoryBudget/frameBytes;
+    if(frames < 4) frames = 4;
+    if(frames > MAX_QUEUE_LENGTH + 3) frames = MAX_QUEUE_LENGTH + 3;
+    
+    maxFrames = (unsigned int)frames;
+    
+    if(incoming.init(maxFrames - 3) == false)
+      return false;
+    
+    frameInterval = 1;
+    intervalChanged = 0;
+    changePending = false;
+    maxQueueDepth = 0;
+    framesInserted = 0;
+    framesUnchanged = 0;
+    framesEncoded = 0;
+    framesDropped = 0;
+    latencySum = 0;
+    latencyMax = 0;
+    
+    char buffer[128];
+    snprintf(buffer, 128, "sdl-theora: frame queue capacity %d frames (%.1f MB)",
+	     incoming.capacity(), (maxFrames*frameBytes)/(1024.0*1024.0));
+    logging.info(buffer);
+  }
+  
+  // preallocates frames so that capturing doesn't allocate memory
+  {
+    std::vector<SDLAVCodec::videoframe*> frames;
+    
+    for(unsigned int i=0;i<FRAME_POOL_PREALLOCATED && i<maxFrames;i++){
+      auto f = acquire_frame();
+      if(f == nullptr) return false;
+      frames.push_back(f);
+    }
+    
+    for(auto f : frames)
+      release_frame(f);
+  }
+  
   
   try{
     latest_frame_encoded = -1;
@@ -262,16 +408,59 @@ bool SDLAVCodec::startEncoding(const std::string& filename,
 
 // inserts SDL_Surface picture frame into video at msecs
 // onwards since the start of the encoding (msecs = 0 is the first frame)
-bool SDLAVCodec::insertFrame(unsigned long long msecs, SDL_Surface* surface)
+bool SDLAVCodec::insertFrame(unsigned long long msecs, SDL_Surface* surface, bool changed)
 {
   // very quick skipping of frames [without conversion] when picture for the current frame has been already inserted
   const unsigned long long frame = msecs/MSECS_PER_FRAME;
   if((signed)frame <= latest_frame_encoded)
     return false;
   
+  // a changed picture skipped at lowered frame rate is still pending:
+  // the current (same) surface is encoded at the next allowed frame
+  if(changePending) changed = true;
+  
+  // unchanged picture: previous frame is shown longer (VFR) or
+  // repeated by the encoder loop
+  if(changed == false && latest_frame_encoded >= 0){
+    framesUnchanged++;
+    return true;
+  }
+  
+  if(overflowPolicy == OVERFLOW_LOWER_FPS && latest_frame_encoded >= 0){
+    // halves frame rate while encoder cannot keep up and restores it when queue drains
+    const unsigned int depth = incoming.size();
+    const unsigned int capacity = incoming.capacity();
+    
+    if((signed)frame < latest_frame_encoded + frameInterval){
+      framesDropped++;
+      changePending = true; // changed picture is not lost
+      return true; // not an error: frame is skipped at lowered frame rate
+    }
+    
+    // adjusts frame rate at most once per second so that queue has time to react
+    if((signed)frame >= intervalChanged + FPS){
+      if(4*depth > 3*capacity && frameInterval < FPS){
+	frameInterval = 2*frameInterval;
+	intervalChanged = frame;
+      }
+      else if(4*depth < capacity && frameInterval > 1){
+	frameInterval = frameInterval/2;
+	intervalChanged = frame;
+      }
+    }
+  }
+  
   if(running){
+    // capture timestamps are mapped to video time using clock of the first frame
+    if(audioStartMS < 0){
+      const long long now = (long long)std::chrono::duration_cast<std::chrono::milliseconds>
+	(std::chrono::system_clock::now().time_since_epoch()).count();
+      audioStartMS = now - (long long)msecs;
+    }
+    
     if(__insert_frame(msecs, surface, false)){
       latest_frame_encoded = frame;
+      changePending = false;
       return true;
     }
 		else{
@@ -288,6 +477,8 @@ bool SDLAVCodec::stopEncoding(unsigned long long msecs,
 			      SDL_Surface* surface)
 {
   if(running){
+    audioEndMsecs = (long long)msecs; // audio captured while encoder drains is not written
+    
     if(__insert_frame(msecs, surface, true) == false){
       logging.fatal("sdl-theora: inserting LAST frame failed");
       return false;
@@ -329,15 +520,25 @@ bool SDLAVCodec::stopEncoding(unsigned long long msecs,
 
   av_write_trailer(fmt_ctx);
   
+  logging.info("sdl-theora: encoding stopped. " + getStatus());
+  
   avcodec_free_context(&av_ctx);
   av_frame_free(&frame);
   av_packet_free(&pkt);
   av_free(stream);
+  free_audio();
 
   av_ctx = NULL;
   frame = NULL;
   pkt = NULL;
   
+  free_frames();
+  
+  if(scratch){
+    SDL_FreeSurface(scratch);
+    scratch = nullptr;
+  }
+  
   running = false; // it is safe to do because we have start lock?
   
   return true; // everything went correctly
@@ -346,155 +547,212 @@ bool SDLAVCodec::stopEncoding(unsigned long long msecs,
 
 bool SDLAVCodec::__insert_frame(unsigned long long msecs, SDL_Surface* surface, bool last)
 {
-  // converts SDL into YUV format [each plane separatedly and have full width and height]
+  // converts SDL surface directly into a pooled YUV420 frame
   // before sending it to the encoder thread
   
-  SDL_Surface* frame = SDL_CreateRGBSurface(0, frameWidth, frameHeight, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+  SDLAVCodec::videoframe* f = acquire_frame(last); // always processes special LAST frames
   
-  if(frame == NULL){
-    logging.error("sdl-theora::__insert_frame failed [1]");
-    return false;
+  while(f == nullptr){
+    if(make_room(last) == false){
+      framesDropped++;
+      logging.error("sdl-theora::__insert_frame failed [1]");
+      return false;
+    }
+    
+    f = acquire_frame(last);
   }
   
-  if(surface != NULL){
-    SDL_BlitSurface(surface, NULL, frame, NULL);
+  f->msecs = msecs;
+  
+  const long long f_frame = (f->msecs / MSECS_PER_FRAME);
+  f->frame->pts = f_frame;
+  
+  if(convert_frame(surface, f->frame) == false){
+    logging.error("sdl-theora::__insert_frame failed [2]");
+    
+    if(last == false){
+      release_frame(f);
+      return false;
+    }
   }
-  else{ // just fills the frame with black
-    SDL_FillRect(frame, NULL, SDL_MapRGB(frame->format, 0, 0, 0));
+  
+  f->last = last; // IMPORTANT!
+  f->queued = std::chrono::duration_cast<std::chrono::microseconds>
+    (std::chrono::steady_clock::now().time_since_epoch()).count();
+  
+  if(running == false && f->last != true){
+    logging.error("sdl-theora::__insert_frame failed [3]");
+    
+    release_frame(f);
+    return false;
   }
   
-  // assumes yuv pixels format is full plane for each component:
-  // Y plane (one byte per pixel), U plane (one byte per pixel), V plane (one byte per pixel)
+  // always processes special LAST frames (waits for the encoder)
+  while(incoming.push(f) == false){
+    if(make_room(last) == false){
+      framesDropped++;
+      logging.error("sdl-theora::__insert_frame failed [3]");
+      
+      release_frame(f);
+      return false;
+    }
+  }
   
-  SDLAVCodec::videoframe* f = new SDLAVCodec::videoframe;
+  framesInserted++;
   
-  f->msecs = msecs;
+  const unsigned int depth = incoming.size();
+  if(depth > maxQueueDepth) maxQueueDepth = depth;
   
-  f->frame = av_frame_alloc();
+  return true;
+}
+
+
+bool SDLAVCodec::make_room(bool last)
+{
+  if(running == false)
+    return false; // encoder has stopped
+  
+  if(overflowPolicy == OVERFLOW_BLOCK || last){
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return true;
+  }
+  else if(overflowPolicy == OVERFLOW_DROP_OLDEST){
+    void* p = nullptr;
+    
+    if(incoming.pop(p)){
+      release_frame((SDLAVCodec::videoframe*)p);
+      framesDropped++;
+    }
+    
+    return true; // frame was dropped or encoder took it
+  }
   
-  f->frame->format = av_ctx->pix_fmt;
-  f->frame->width = frameWidth;
-  f->frame->height = frameHeight;
+  return false; // OVERFLOW_LOWER_FPS: drops the new frame
+}
 
-  const long long f_frame = (f->msecs / MSECS_PER_FRAME);
-  f->frame->pts = f_frame;
 
-  if(av_frame_get_buffer(f->frame, 0) != 0){
+bool SDLAVCodec::convert_frame(SDL_Surface* surface, AVFrame* yuv)
+{
+  // encoder may still reference the previous contents of a recycled frame
+  if(av_frame_make_writable(yuv) != 0){
     error_flag = true;
-    printf("ERROR\n");
+    return false;
   }
   
-  if(av_frame_make_writable(f->frame) != 0){
-    error_flag = true;
-    printf("ERROR\n");
+  if(surface == NULL){ // just fills the frame with black
+    for(int y=0;y<frameHeight;y++)
+      memset(yuv->data[0] + y*yuv->linesize[0], 16, frameWidth);
+    
+    for(int y=0;y<(frameHeight+1)/2;y++){
+      memset(yuv->data[1] + y*yuv->linesize[1], 128, (frameWidth+1)/2);
+      memset(yuv->data[2] + y*yuv->linesize[2], 128, (frameWidth+1)/2);
+    }
+    
+    return true;
   }
-
-  /*
-  printf("FRAMEDATA: %llx %llx %llx %llx PTS: %ld\n",
-	 (unsigned long long)(f->frame),
-	 (unsigned long long)(f->frame->data[0]),
-	 (unsigned long long)(f->frame->linesize[0]),
-	 (unsigned long long)(f),
-	 f->frame->pts);
-  */
   
+  // 32-bit RGB surfaces of frame size are converted without copying
+  SDL_Surface* source = surface;
   
-  // perfect opportunity for parallelization: pixel conversions are independet from each other
-#pragma omp parallel for
-  for(int y=0; y<f->frame->height; y++) {
-    for(int x=0; x<f->frame->width; x++) {
-      
-      const unsigned int index = x + frameWidth*y;
-      unsigned int* source = (unsigned int*)(frame->pixels);
-      
-      const unsigned int r = (source[index] & 0x00FF0000)>>16;
-      const unsigned int g = (source[index] & 0x0000FF00)>> 8;
-      const unsigned int b = (source[index] & 0x000000FF)>> 0;
-      
-      auto Y  =  (0.257*r) + (0.504*g) + (0.098*b) + 16.0;
-      auto Cr =  (0.439*r) - (0.368*g) - (0.071*b) + 128.0;
-      auto Cb = -(0.148*r) - (0.291*g) + (0.439*b) + 128.0;
-      
-      if(Y < 0.0) Y = 0.0;
-      else if(Y > 255.0) Y = 255.0;
-      
-      if(Cr < 0.0) Cr = 0.0;
-      else if(Cr > 255.0) Cr = 255.0;
-      
-      if(Cb < 0.0) Cb = 0.0;
-      else if(Cb > 255.0) Cb = 255.0;
-      
-      f->frame->data[0][y * f->frame->linesize[0] + x] =
-	(unsigned char)round(Y);  // Y
-      //f->frame->data[1][y * f->frame->linesize[1] + x] =
-      //(unsigned char)round(Cb);  // Cb
-      //f->frame->data[2][y * f->frame->linesize[2] + x] =
-      //(unsigned char)round(Cr);  // Cr
+  if(surface->w != frameWidth || surface->h != frameHeight ||
+     (surface->format->format != SDL_PIXELFORMAT_RGB888 &&
+      surface->format->format != SDL_PIXELFORMAT_ARGB8888))
+  {
+    if(scratch == nullptr){
+      scratch = SDL_CreateRGBSurface(0, frameWidth, frameHeight, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+      if(scratch == nullptr) return false;
     }
+    
+    SDL_FillRect(scratch, NULL, SDL_MapRGB(scratch->format, 0, 0, 0));
+    SDL_BlitSurface(surface, NULL, scratch, NULL);
+    
+    source = scratch;
   }
+  
+  if(SDL_MUSTLOCK(source)){
+    if(SDL_LockSurface(source) != 0)
+      return false;
+  }
+  
+  rgb32_to_i420((const uint32_t*)(source->pixels), source->pitch/4,
+		frameWidth, frameHeight,
+		yuv->data[0], yuv->linesize[0],
+		yuv->data[1], yuv->linesize[1],
+		yuv->data[2], yuv->linesize[2]);
+  
+  if(SDL_MUSTLOCK(source))
+    SDL_UnlockSurface(source);
+  
+  return true;
+}
 
 
-#pragma omp parallel for
-  for(int y=0; y<f->frame->height; y++) {
-    for(int x=0; x<f->frame->width; x++) {
-      
-      const unsigned int index = x + frameWidth*y;
-      unsigned int* source = (unsigned int*)(frame->pixels);
-      
-      const unsigned int r = (source[index] & 0x00FF0000)>>16;
-      const unsigned int g = (source[index] & 0x0000FF00)>> 8;
-      const unsigned int b = (source[index] & 0x000000FF)>> 0;
-      
-      auto Y  =  (0.257*r) + (0.504*g) + (0.098*b) + 16.0;
-      auto Cr =  (0.439*r) - (0.368*g) - (0.071*b) + 128.0;
-      auto Cb = -(0.148*r) - (0.291*g) + (0.439*b) + 128.0;
-      
-      if(Y < 0.0) Y = 0.0;
-      else if(Y > 255.0) Y = 255.0;
-      
-      if(Cr < 0.0) Cr = 0.0;
-      else if(Cr > 255.0) Cr = 255.0;
-      
-      if(Cb < 0.0) Cb = 0.0;
-      else if(Cb > 255.0) Cb = 255.0;
-      
-      //f->frame->data[0][y * f->frame->linesize[0] + x] =
-      //(unsigned char)round(Y);  // Y
-
-      int xx = x/2;
-      int yy = y/2;
-      
-      f->frame->data[1][yy * f->frame->linesize[1] + xx] =
-	(unsigned char)round(Cb);  // Cb
-      f->frame->data[2][yy * f->frame->linesize[2] + xx] =
-	(unsigned char)round(Cr);  // Cr
+SDLAVCodec::videoframe* SDLAVCodec::acquire_frame(bool force)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    
+    if(framePool.size() > 0){
+      auto f = framePool.back();
+      framePool.pop_back();
+      return f;
     }
+    
+    if(framesAllocated >= maxFrames && force == false)
+      return nullptr; // encoder is too slow: drops frame
+    
+    framesAllocated++;
   }
   
+  SDLAVCodec::videoframe* f = new SDLAVCodec::videoframe;
   
-  f->last = last; // IMPORTANT!
+  f->msecs = 0;
+  f->last = false;
+  f->frame = av_frame_alloc();
   
-  {
-    std::lock_guard<std::mutex> lock1(start_lock);
-    std::lock_guard<std::mutex> lock2(incoming_mutex);
+  if(f->frame != nullptr){
+    f->frame->format = av_ctx->pix_fmt;
+    f->frame->width = frameWidth;
+    f->frame->height = frameHeight;
+  }
+  
+  if(f->frame == nullptr || av_frame_get_buffer(f->frame, 0) != 0){
+    error_flag = true;
+    logging.error("sdl-theora: allocating video frame failed");
     
-    // always processes special LAST frames
-    if((running == false || incoming.size() >= MAX_QUEUE_LENGTH) && f->last != true){
-      logging.error("sdl-theora::__insert_frame failed [3]");
+    av_frame_free(&(f->frame));
+    delete f;
+    
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    framesAllocated--;
+    
+    return nullptr;
+  }
+  
+  return f;
+}
 
-      av_frame_free(&(f->frame));
-      delete f;
 
-      SDL_FreeSurface(frame);
-      return false;
-    }
-    else
-      incoming.push_back(f);
-  }
+void SDLAVCodec::release_frame(SDLAVCodec::videoframe* f)
+{
+  if(f == nullptr) return;
   
-  SDL_FreeSurface(frame);
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  framePool.push_back(f);
+}
+
+
+void SDLAVCodec::free_frames()
+{
+  std::lock_guard<std::mutex> lock(pool_mutex);
   
-  return true;
+  for(auto f : framePool){
+    av_frame_free(&(f->frame));
+    delete f;
+  }
+  
+  framePool.clear();
+  framesAllocated = 0;
 }
 
 
@@ -517,23 +775,17 @@ void SDLAVCodec::encoder_loop()
   
   while(1)
   {
+    // audio is encoded as it is captured
+    if(encode_audio() == false)
+      logging.error("sdl-theora: encoding audio failed");
+    
     {
-      incoming_mutex.lock();
-
-      {
-	char buffer[80];
-	snprintf(buffer, 80, "sdl-theora: incoming frame buffer size: %d", (int)incoming.size());
-	logging.info(buffer);
-      }
+      void* p = nullptr;
       
-      if(incoming.size() > 0){ // has incoming picture data
-	f = incoming.front();
-	incoming.pop_front();
-	incoming_mutex.unlock();
+      if(incoming.pop(p)){ // has incoming picture data
+	f = (SDLAVCodec::videoframe*)p;
       }
       else{
-	incoming_mutex.unlock();
-	
 	// sleep here ~10ms [time between frames 1ms]
 	std::this_thread::sleep_for(std::chrono::milliseconds(MSECS_PER_FRAME/10));
 	
@@ -548,7 +800,7 @@ void SDLAVCodec::encoder_loop()
     // last_frame_generated .. f_frame
     // fills them with latest_frame_generated (prev)
     
-    if(latest_frame_generated < 0 && f_frame >= 0){
+    if(variableFrameRate == false && latest_frame_generated < 0 && f_frame >= 0){
       // writes f frame
       latest_frame_generated = 0;
       
@@ -569,7 +821,7 @@ void SDLAVCodec::encoder_loop()
 
       latest_frame_generated = f_frame;
     }
-    else if((latest_frame_generated+1) < f_frame){
+    else if(variableFrameRate == false && (latest_frame_generated+1) < f_frame){
       // writes prev frames
       
       logging.info("sdl-theora: writing prev-frames");
@@ -591,12 +843,20 @@ void SDLAVCodec::encoder_loop()
     }
     
     // writes f-frame once (f_frame) if it is a new frame for this msec
-    // OR if it is a last frame [stream close frame]
+    // OR if it is a last frame [stream close frame]. with variable frame rate
+    // the frame is shown until pts of the next frame (video starts from the first frame)
     if(latest_frame_generated < f_frame || f->last)
     {
       logging.info("sdl-theora: writing current frame");
-
-      f->frame->pts = f_frame;
+      
+      long long pts = f_frame;
+      
+      if(variableFrameRate && latest_frame_generated < 0)
+	pts = 0;
+      else if(pts <= latest_frame_generated)
+	pts = latest_frame_generated + 1; // last frame: pts must increase
+      
+      f->frame->pts = pts;
       
       if(encode_frame(f->frame, f->last) == false)
 	logging.error("sdl-theora: encoding frame failed");
@@ -609,17 +869,33 @@ void SDLAVCodec::encoder_loop()
     }
     
     latest_frame_generated = f_frame;
+    
+    {
+      const long long now = std::chrono::duration_cast<std::chrono::microseconds>
+	(std::chrono::steady_clock::now().time_since_epoch()).count();
+      const long long latency = now - f->queued;
+      
+      framesEncoded++;
+      latencySum += latency;
+      if(latency > latencyMax) latencyMax = latency;
+    }
 
     if(prev != nullptr){
-
-      av_frame_free(&(prev->frame));
-      delete prev;
+      release_frame(prev);
       prev = nullptr;
     }
     
     prev = f;
     
     if(f->last == true){
+      // drains frames still buffered by the encoder (B-frames)
+      if(encode_frame(nullptr, true) == false)
+	logging.error("sdl-theora: flushing encoder failed");
+      
+      // audio captured until the last frame
+      if(encode_audio((long long)f->msecs, true) == false)
+	logging.error("sdl-theora: flushing audio encoder failed");
+      
       logging.info("sdl-theora: special last frame seen => exit");
       break;
     }
@@ -633,21 +909,17 @@ void SDLAVCodec::encoder_loop()
   
   // all frames has been written
   if(prev != nullptr){
-    av_frame_free(&(prev->frame));
-    delete prev;
+    release_frame(prev);
     prev = nullptr;
   }
   
   logging.info("sdl-theora: encoder thread shutdown: incoming buffer clear");
   
   {
-    std::lock_guard<std::mutex> lock1(incoming_mutex);
-    for(auto i : incoming){
-      av_frame_free(&(i->frame));
-      delete i;
-    }
+    void* p = nullptr;
     
-    incoming.clear();
+    while(incoming.pop(p))
+      release_frame((SDLAVCodec::videoframe*)p);
   }
   
   {
@@ -658,19 +930,235 @@ void SDLAVCodec::encoder_loop()
 }
 
 
+bool SDLAVCodec::setup_audio()
+{
+  audioCodec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+  if(audioCodec == nullptr) return false;
+  
+  audio_ctx = avcodec_alloc_context3(audioCodec);
+  if(audio_ctx == nullptr) return false;
+  
+  const int channels = audioCapture->getChannels();
+  
+  audio_ctx->sample_fmt = AV_SAMPLE_FMT_FLTP; // native AAC encoder uses planar floats
+  audio_ctx->sample_rate = audioCapture->getSampleRate();
+  audio_ctx->bit_rate = 64000*channels;
+  audio_ctx->time_base = (AVRational){1, audio_ctx->sample_rate};
+  
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100)
+  av_channel_layout_default(&audio_ctx->ch_layout, channels);
+#else
+  audio_ctx->channels = channels;
+  audio_ctx->channel_layout = av_get_default_channel_layout(channels);
+#endif
+  
+  if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+    audio_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  
+  int ret = avcodec_open2(audio_ctx, audioCodec, NULL);
+  if (ret < 0) {
+    fprintf(stderr, "Could not open audio codec: %s\n", av_err2str2(ret));
+    return false;
+  }
+  
+  audioFrameSize = audio_ctx->frame_size;
+  if(audioFrameSize == 0) audioFrameSize = 1024; // encoder accepts any frame size
+  
+  audioFrame = av_frame_alloc();
+  if(audioFrame == nullptr) return false;
+  
+  audioFrame->format = audio_ctx->sample_fmt;
+  audioFrame->sample_rate = audio_ctx->sample_rate;
+  audioFrame->nb_samples = audioFrameSize;
+  
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100)
+  if(av_channel_layout_copy(&audioFrame->ch_layout, &audio_ctx->ch_layout) < 0)
+    return false;
+#else
+  audioFrame->channels = audio_ctx->channels;
+  audioFrame->channel_layout = audio_ctx->channel_layout;
+#endif
+  
+  if(av_frame_get_buffer(audioFrame, 0) != 0)
+    return false;
+  
+  audioStream = avformat_new_stream(fmt_ctx, NULL);
+  if(audioStream == nullptr) return false;
+  
+  ret = avcodec_parameters_from_context(audioStream->codecpar, audio_ctx);
+  if(ret < 0) return false;
+  
+  audioStream->time_base = audio_ctx->time_base;
+  audioStream->id = fmt_ctx->nb_streams - 1;
+  
+  fmt_ctx->audio_codec_id = audioCodec->id;
+  
+  char buffer[128];
+  snprintf(buffer, 128, "sdl-theora: audio stream %d Hz, %d channel(s), %d samples per frame",
+	   audio_ctx->sample_rate, channels, audioFrameSize);
+  logging.info(buffer);
+  
+  return true;
+}
+
+
+void SDLAVCodec::free_audio()
+{
+  if(audio_ctx) avcodec_free_context(&audio_ctx);
+  if(audioFrame) av_frame_free(&audioFrame);
+  
+  audio_ctx = nullptr;
+  audioFrame = nullptr;
+  audioStream = nullptr; // owned by format context
+  
+  audioPending.clear();
+  audioStarted = false;
+}
+
+
+bool SDLAVCodec::encode_audio(long long endMsecs, bool flush)
+{
+  if(audio_ctx == nullptr || audioCapture == nullptr)
+    return true;
+  
+  const long long startMS = audioStartMS;
+  const long long rate = audio_ctx->sample_rate;
+  const unsigned int channels = audioCapture->getChannels();
+  const long long resync = (AUDIO_RESYNC_MSECS*rate)/1000;
+  const long long maxGap = (AUDIO_MAX_GAP_MSECS*rate)/1000;
+  
+  AudioCapture::block* b = nullptr;
+  
+  while(audioCapture->pop(b)){
+    if(startMS < 0){ // video hasn't started yet
+      audioCapture->release(b);
+      continue;
+    }
+    
+    const long long pts = ((b->timeMS - startMS)*rate)/1000;
+    const int16_t* samples = b->samples.data();
+    long long length = b->length;
+    
+    if(audioStarted == false){
+      audioPts = pts;
+      audioStarted = true;
+    }
+    else{
+      if(b->lost > 0){ // capture was full
+	audioPending.insert(audioPending.end(), b->lost*channels, 0);
+	audioSamplesLost += b->lost;
+      }
+      
+      // audio is kept continuous over callback timing jitter: only larger
+      // differences are gaps (paused synthesis) or overlaps
+      const long long next = audioPts + (long long)(audioPending.size()/channels);
+      const long long diff = pts - next;
+      
+      if(diff > resync && diff < maxGap){
+	audioPending.insert(audioPending.end(), diff*channels, 0);
+	audioSamplesLost += diff;
+      }
+      else if(diff < -resync){
+	const long long skip = (-diff < length) ? -diff : length;
+	samples += skip*channels;
+	length -= skip;
+      }
+    }
+    
+    audioPending.insert(audioPending.end(), samples, samples + length*channels);
+    audioCapture->release(b);
+  }
+  
+  if(audioStarted == false)
+    return true;
+  
+  long long pending = audioPending.size()/channels;
+  long long pos = 0;
+  
+  // audio before the first video frame is not written
+  if(audioPts < 0){
+    pos = (-audioPts < pending) ? -audioPts : pending;
+    audioPts += pos;
+  }
+  
+  if(flush){ // pads the last frame with silence
+    const long long partial = (pending - pos) % audioFrameSize;
+    
+    if(partial > 0){
+      audioPending.insert(audioPending.end(), (audioFrameSize - partial)*channels, 0);
+      pending += audioFrameSize - partial;
+    }
+  }
+  
+  if(endMsecs < 0) endMsecs = audioEndMsecs;
+  
+  const long long endPts = (endMsecs >= 0) ? (endMsecs*rate)/1000 : -1;
+  bool ok = true;
+  
+  while(pending - pos >= audioFrameSize){
+    if(endPts >= 0 && audioPts >= endPts){ // after the last video frame
+      audioPts += pending - pos;
+      pos = pending;
+      break;
+    }
+    
+    if(av_frame_make_writable(audioFrame) != 0){
+      ok = false;
+      break;
+    }
+    
+    const int16_t* s = &(audioPending[pos*channels]);
+    
+    for(unsigned int c=0;c<channels;c++){
+      float* plane = (float*)(audioFrame->data[c]);
+      
+      for(unsigned int i=0;i<audioFrameSize;i++)
+	plane[i] = s[i*channels + c]*(1.0f/32768.0f);
+    }
+    
+    audioFrame->pts = audioPts;
+    
+    if(avcodec_send_frame(audio_ctx, audioFrame) < 0 ||
+       write_packets(audio_ctx, audioStream) == false)
+      ok = false;
+    
+    audioPts += audioFrameSize;
+    pos += audioFrameSize;
+    audioSamplesEncoded += audioFrameSize;
+  }
+  
+  audioPending.erase(audioPending.begin(), audioPending.begin() + pos*channels);
+  
+  if(flush){ // drains frames buffered by the encoder
+    if(avcodec_send_frame(audio_ctx, nullptr) < 0 ||
+       write_packets(audio_ctx, audioStream) == false)
+      ok = false;
+  }
+  
+  return ok;
+}
+
+
 bool SDLAVCodec::encode_frame(AVFrame* buffer,
 			      bool last)
 {
+  // nullptr buffer flushes encoder
   if(avcodec_send_frame(av_ctx, buffer) < 0)
     return false;
   
+  return write_packets(av_ctx, stream);
+}
+
+
+bool SDLAVCodec::write_packets(AVCodecContext* ctx, AVStream* st)
+{
   AVPacket packet;
   av_init_packet(&packet);
   
   int ret = 0;
   
   while(ret >= 0) {
-    ret = avcodec_receive_packet(av_ctx, &packet);
+    ret = avcodec_receive_packet(ctx, &packet);
     if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
       return true;  // nothing to write
     }
@@ -680,9 +1168,9 @@ bool SDLAVCodec::encode_frame(AVFrame* buffer,
     // av_packet_rescale_ts(&packet, av_ctx->time_base, av_ctx->time_base);
 
 
-    // packet.stream_index = stream->id;
-    packet.pts = buffer->pts;
-    packet.dts = buffer->pts;
+    // encoder's timestamps: frames may be reordered (B-frames) and
+    // variable frame rate has gaps between pts values
+    packet.stream_index = st->index;
 
 #if 0
     printf("STREAMS:\n");
@@ -694,13 +1182,14 @@ bool SDLAVCodec::encode_frame(AVFrame* buffer,
 
 #if 1
     av_packet_rescale_ts(&packet,
-			 av_ctx->time_base, // your theoric timebase
+			 ctx->time_base, // your theoric timebase
 			 fmt_ctx->streams[packet.stream_index]->time_base); // the actual timebase
 #endif
     
     
     //fwrite(packet.data, 1, packet.size, handle);
-    av_write_frame(fmt_ctx, &packet);
+    // audio and video packets are interleaved by the muxer
+    av_interleaved_write_frame(fmt_ctx, &packet);
     
     av_packet_unref(&packet);
   }
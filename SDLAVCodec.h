@@ -21,13 +21,17 @@ extern "C" {
   
 };
 
-#include <list>
+#include <vector>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 #include <dinrhiw.h>
 
+#include "FrameQueue.h"
+#include "AudioCapture.h"
+
 
 namespace whiteice {
   namespace resonanz {
@@ -39,7 +43,10 @@ namespace whiteice {
      */
     class SDLAVCodec {
     public:
-      SDLAVCodec(float q = 0.8f); // encoding quality between 0 and 1
+      // encoding quality between 0 and 1. variable frame rate video writes each
+      // distinct frame once (shown until the next frame), otherwise frames are
+      // repeated at FPS
+      SDLAVCodec(float q = 0.8f, bool vfr = true);
       virtual ~SDLAVCodec();
       
       // setups encoding structure
@@ -47,29 +54,68 @@ namespace whiteice {
 
       bool setupEncoder(); // helper function..
       
+      // captured (synthesized) sound is encoded as AAC audio stream of the video.
+      // set before startEncoding() [nullptr: no audio]. capture timestamps are
+      // mapped to video time with the clock of the first insertFrame() call
+      void setAudioSource(AudioCapture* capture);
+      
+      // capture time (msecs since epoch) of video msecs = 0 when capture is not
+      // timestamped with system clock. call after startEncoding() before frames
+      void setAudioClock(long long startMS);
+      
       // inserts SDL_Surface picture frame into video at msecs
       // onwards since the start of the encoding (msecs = 0 is the first frame)
-      // [nullptr means black empty frame]
+      // [nullptr means black empty frame]. frames that haven't changed
+      // (changed = false) are not converted: previous frame is shown longer.
+      // a changed frame skipped at lowered frame rate (OVERFLOW_LOWER_FPS)
+      // is encoded from the surface of the next call even if it is unchanged
       bool insertFrame(unsigned long long msecs,
-		       SDL_Surface* surface = nullptr);
+		       SDL_Surface* surface = nullptr,
+		       bool changed = true);
       
       // stops encoding with a final frame [nullptr means black empty frame]
       bool stopEncoding(unsigned long long msecs,
 			SDL_Surface* surface = nullptr);
 
       bool busy() const {
-	std::lock_guard<std::mutex> lock1(incoming_mutex);
-	bool r = (bool)(((this->incoming).size()) > 0);
-	
-	return r;
+	return (incoming.size() > 0);
       }
       
       // error was detected during encoding: restart encoding to try again
       bool error() const { return error_flag; }
       
+      // what to do when frame queue (memory budget) is full
+      enum overflow_policy {
+	OVERFLOW_BLOCK,        // waits for the encoder (slows down caller)
+	OVERFLOW_DROP_OLDEST,  // drops the oldest queued frame
+	OVERFLOW_LOWER_FPS     // halves frame rate while queue is over 3/4 full, drops new frames
+      };
+      
+      // memory (bytes) of queued raw frames and overflow policy, set before startEncoding()
+      void setMemoryBudget(unsigned long long bytes);
+      void setOverflowPolicy(overflow_policy policy);
+      
+      struct statistics {
+	unsigned int queueDepth, queueCapacity, maxQueueDepth;
+	unsigned long long inserted;  // frames queued for encoding
+	unsigned long long unchanged; // frames not inserted because screen hadn't changed
+	unsigned long long encoded;
+	unsigned long long dropped;   // overflow drops and frames skipped at lowered frame rate
+	double meanLatency, maxLatency; // msecs from insertion to encoded frame
+	float fps; // current frame rate (lowered by OVERFLOW_LOWER_FPS)
+	double audioSeconds; // encoded audio
+	unsigned long long audioLost; // samples lost by capture (replaced by silence)
+      };
+      
+      void getStatistics(SDLAVCodec::statistics& s) const;
+      std::string getStatus() const; // statistics as a string
+      
     private:
       bool __insert_frame(unsigned long long msecs, SDL_Surface* surface, bool last);
       
+      // converts surface (nullptr is black frame) to YUV420 frame
+      bool convert_frame(SDL_Surface* surface, AVFrame* yuv);
+      
       struct videoframe {
 	AVFrame* frame;
 	
@@ -78,20 +124,53 @@ namespace whiteice {
 	
 	// last frame in video: instructs encoder loop to shutdown after this one
 	bool last;
+	
+	// steady clock usecs when frame was inserted (latency statistics)
+	long long queued;
       };
       
       float quality;
       
+      const bool variableFrameRate;
+      
       const long long FPS; // video frames per second
       const long long MSECS_PER_FRAME;
       long long latest_frame_encoded;
       
-      mutable std::mutex incoming_mutex;
-      
       SDLAVCodec::videoframe* prev;
       
-      const unsigned int MAX_QUEUE_LENGTH = 10000*FPS; // maximum of 1 minute (60 seconds) of frames..
-      std::list<SDLAVCodec::videoframe*> incoming; // incoming frames for the encoder (loop)
+      // incoming frames for the encoder (loop), capacity is set by memory budget
+      FrameQueue incoming;
+      
+      unsigned long long memoryBudget = 512ULL*1024ULL*1024ULL; // 512 MB
+      overflow_policy overflowPolicy = OVERFLOW_LOWER_FPS;
+      const unsigned int MAX_QUEUE_LENGTH = 60*FPS; // maximum of 1 minute (60 seconds) of frames..
+      
+      // handles full queue/frame pool according to overflow policy,
+      // returns false if the new frame must be dropped
+      bool make_room(bool last);
+      
+      // preallocated frames are recycled after encoding: the pool grows up to
+      // maxFrames frames when the encoder falls behind (last frame is always allocated)
+      SDLAVCodec::videoframe* acquire_frame(bool force = false);
+      void release_frame(SDLAVCodec::videoframe* f);
+      void free_frames();
+      
+      std::mutex pool_mutex;
+      std::vector<SDLAVCodec::videoframe*> framePool; // free frames
+      unsigned int framesAllocated = 0;
+      unsigned int maxFrames = 0; // queue capacity + frames held by caller and encoder
+      const unsigned int FRAME_POOL_PREALLOCATED = 8;
+      
+      // statistics
+      std::atomic<unsigned int> frameInterval; // frame slots per inserted frame (lowered fps)
+      long long intervalChanged = 0; // frame slot of the latest frame rate change
+      bool changePending = false; // changed frame was skipped at lowered frame rate
+      std::atomic<unsigned int> maxQueueDepth;
+      std::atomic<unsigned long long> framesInserted, framesUnchanged, framesEncoded, framesDropped;
+      std::atomic<long long> latencySum, latencyMax; // usecs
+      
+      SDL_Surface* scratch = nullptr; // conversion surface of other pixel formats and sizes
       
       bool running;
       bool error_flag;
@@ -103,6 +182,37 @@ namespace whiteice {
       // encodes single video frame
       bool encode_frame(AVFrame* buffer, bool last=false);
       
+      // writes encoded packets of stream to file
+      bool write_packets(AVCodecContext* ctx, AVStream* st);
+      
+      // audio stream: opened by startEncoding() if there is audio source
+      bool setup_audio();
+      void free_audio();
+      
+      // encodes captured audio (full frames) before video time endMsecs
+      // (-1: no limit). flush pads the last frame and drains the encoder
+      bool encode_audio(long long endMsecs = -1, bool flush = false);
+      
+      AudioCapture* audioCapture = nullptr;
+      std::atomic<long long> audioStartMS; // capture time of video msecs = 0
+      std::atomic<long long> audioEndMsecs; // video time of the last frame (set by stopEncoding())
+      
+      const AVCodec* audioCodec = nullptr;
+      AVCodecContext* audio_ctx = nullptr;
+      AVStream* audioStream = nullptr;
+      AVFrame* audioFrame = nullptr;
+      unsigned int audioFrameSize = 0;
+      
+      std::vector<int16_t> audioPending; // captured samples not yet encoded (interleaved)
+      long long audioPts = 0;            // pts (samples) of the first pending sample
+      bool audioStarted = false;
+      std::atomic<unsigned long long> audioSamplesEncoded, audioSamplesLost;
+      
+      // larger differences between capture timestamps and audio stream are
+      // gaps (filled with silence) or overlaps (dropped)
+      const long long AUDIO_RESYNC_MSECS = 100;
+      const long long AUDIO_MAX_GAP_MSECS = 60*1000;
+      
       int frameHeight, frameWidth; // divisable by 16..
 
       std::mutex start_lock;
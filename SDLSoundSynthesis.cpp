@@ -13,6 +13,7 @@
 
 #include <pthread.h>
 #include <sched.h>
+#include <chrono>
 
 SDLSoundSynthesis::SDLSoundSynthesis()
 {
@@ -29,6 +30,14 @@ SDLSoundSynthesis::SDLSoundSynthesis()
   
   dev = 0;
   
+  for(unsigned int i=0;i<3;i++)
+    slotGeneration[i] = 0;
+  
+  middleSlot = 2;
+  appliedSequence = 0;
+  appliedGeneration = 0;
+  appliedTimeMS = 0;
+  capture = nullptr;
 }
 
 SDLSoundSynthesis::~SDLSoundSynthesis() {
@@ -42,6 +51,8 @@ SDLSoundSynthesis::~SDLSoundSynthesis() {
 
 bool SDLSoundSynthesis::play()
 {
+  offlineTimeMS = -1;
+  
   if(dev == 0){
     dev = SDL_OpenAudioDevice(NULL, 0, &desired, &snd,
 			      SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
@@ -95,6 +106,130 @@ bool SDLSoundSynthesis::pause()
   return true;
 }
 
+unsigned long long SDLSoundSynthesis::getParametersGeneration() const
+{
+  std::lock_guard<std::mutex> lock(publish_mutex);
+  return publishedGeneration;
+}
+
+
+bool SDLSoundSynthesis::getParametersAppliedTime(unsigned long long& generation,
+						 long long& timeMS) const
+{
+  // retries if audio thread updated the pair while it was read
+  unsigned int before, after;
+  
+  do{
+    before = appliedSequence.load(std::memory_order_acquire);
+    
+    generation = appliedGeneration.load(std::memory_order_relaxed);
+    timeMS = appliedTimeMS.load(std::memory_order_relaxed);
+    
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = appliedSequence.load(std::memory_order_relaxed);
+  }
+  while((before & 1) || before != after);
+  
+  return (generation > 0);
+}
+
+
+unsigned long long SDLSoundSynthesis::publishParameters(const std::vector<double>& params)
+{
+  std::lock_guard<std::mutex> lock(publish_mutex);
+  
+  // writes to private slot (allocates only if parameter block size changes)
+  paramSlots[writeSlot] = params;
+  slotGeneration[writeSlot] = ++publishedGeneration;
+  
+  // swaps written slot to the middle and takes old middle slot for writing
+  writeSlot = middleSlot.exchange(writeSlot | SLOT_DIRTY,
+				  std::memory_order_acq_rel) & 3;
+  
+  return publishedGeneration;
+}
+
+
+bool SDLSoundSynthesis::acquireParameters(const std::vector<double>*& params)
+{
+  if((middleSlot.load(std::memory_order_acquire) & SLOT_DIRTY) == 0)
+    return false; // no new parameters
+  
+  readSlot = middleSlot.exchange(readSlot, std::memory_order_acq_rel) & 3;
+  
+  params = &(paramSlots[readSlot]);
+  
+  const unsigned int sequence = appliedSequence.load(std::memory_order_relaxed);
+  
+  appliedSequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  
+  appliedTimeMS.store(audibleTimeMS(), std::memory_order_relaxed);
+  appliedGeneration.store(slotGeneration[readSlot], std::memory_order_relaxed);
+  
+  appliedSequence.store(sequence + 2, std::memory_order_release);
+  
+  return true;
+}
+
+
+long long SDLSoundSynthesis::audibleTimeMS() const
+{
+  if(offlineTimeMS >= 0)
+    return offlineTimeMS;
+  
+  // buffer becomes audible after the buffer currently playing
+  const long long now = (long long)std::chrono::duration_cast<std::chrono::milliseconds>
+    (std::chrono::system_clock::now().time_since_epoch()).count();
+  
+  const long long latency = (snd.freq > 0) ? (1000LL*snd.samples)/snd.freq : 0;
+  
+  return (now + latency);
+}
+
+
+bool SDLSoundSynthesis::playOffline()
+{
+  if(dev != 0) return false; // audio device is playing
+  
+  snd = desired;
+  offlineTimeMS = 0;
+  
+  return true;
+}
+
+
+bool SDLSoundSynthesis::renderOffline(unsigned int samples, long long timeMS)
+{
+  if(dev != 0 || offlineTimeMS < 0 || snd.channels == 0)
+    return false;
+  
+  offlineTimeMS = timeMS;
+  offlineBuffer.resize(samples*snd.channels);
+  
+  if(synthesize(offlineBuffer.data(), samples*snd.channels) == false)
+    return false;
+  
+  whiteice::resonanz::AudioCapture* capture = this->capture.load(std::memory_order_acquire);
+  
+  if(capture != nullptr)
+    capture->write(offlineBuffer.data(), samples, timeMS);
+  
+  return true;
+}
+
+
+void SDLSoundSynthesis::setCapture(whiteice::resonanz::AudioCapture* capture)
+{
+  // audio callback doesn't run while device is locked
+  if(dev != 0) SDL_LockAudioDevice(dev);
+  
+  this->capture = capture;
+  
+  if(dev != 0) SDL_UnlockAudioDevice(dev);
+}
+
+
 static bool __sdl__soundsynth_setpriority = false;
 
 void __sdl_soundsynthesis_mixaudio(void* unused, 
@@ -129,6 +264,13 @@ void __sdl_soundsynthesis_mixaudio(void* unused,
   
   if(s == NULL) return;
   
+  const long long timeMS = s->audibleTimeMS();
+  
   s->synthesize((int16_t*)stream, len/2);
+  
+  whiteice::resonanz::AudioCapture* capture = s->capture.load(std::memory_order_acquire);
+  
+  if(capture != nullptr && s->snd.channels > 0)
+    capture->write((int16_t*)stream, len/(2*s->snd.channels), timeMS);
 }
 
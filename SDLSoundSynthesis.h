@@ -10,10 +10,13 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
+#include <mutex>
 #include <stdint.h>
 #include <SDL.h>
 
 #include "SoundSynthesis.h"
+#include "AudioCapture.h"
 
 class SDLSoundSynthesis : public SoundSynthesis
 {
@@ -31,15 +34,77 @@ public:
   // return current signal power of synthesized sound in DECIBELs
   virtual double getSynthPower() = 0; 
   
+  // sequence number of the latest parameters given to setParameters()
+  unsigned long long getParametersGeneration() const;
+  
+  // returns sequence number of the latest parameters picked up by audio thread
+  // and estimated time (milliseconds since epoch) when they became audible
+  bool getParametersAppliedTime(unsigned long long& generation,
+				long long& timeMS) const;
+  
+  // tees synthesized samples to capture (nullptr stops capturing).
+  // returns after audio thread has stopped using the previous capture
+  void setCapture(whiteice::resonanz::AudioCapture* capture);
+  
+  // opened audio device format (valid after play())
+  unsigned int getSampleRate() const { return snd.freq; }
+  unsigned int getChannels() const { return snd.channels; }
+  unsigned int getBufferSamples() const { return snd.samples; }
+  
+  // headless mode: sound is synthesized by renderOffline() calls instead of
+  // the audio device (uses the requested audio format)
+  bool playOffline();
+  
+  // synthesizes samples audible at timeMS (msecs since epoch) into capture
+  bool renderOffline(unsigned int samples, long long timeMS);
+  
  protected:  
   SDL_AudioSpec snd;
   
   virtual bool synthesize(int16_t* buffer, int samples) = 0;
   
+  // lock-free (triple buffered) handoff of parameter blocks from
+  // setParameters() to the audio thread. audio thread always gets complete
+  // parameter block at buffer boundary, never a partially written one
+  
+  // called by setParameters(), returns sequence number of the parameters
+  unsigned long long publishParameters(const std::vector<double>& params);
+  
+  // called by synthesize() at the start of buffer, returns false if there
+  // are no new parameters. params is valid until the next call
+  bool acquireParameters(const std::vector<double>*& params);
+  
  private:
   SDL_AudioDeviceID dev;
   SDL_AudioSpec desired;
   
+  static const unsigned int SLOT_DIRTY = 4; // middle slot has new parameters
+  
+  std::vector<double> paramSlots[3];
+  unsigned long long slotGeneration[3];
+  
+  unsigned int writeSlot = 0; // owned by setParameters() thread
+  unsigned int readSlot = 1;  // owned by audio thread
+  std::atomic<unsigned int> middleSlot;
+  
+  mutable std::mutex publish_mutex; // serializes writers (never taken by audio thread)
+  
+  unsigned long long publishedGeneration = 0;
+  
+  // applied generation and its time are written by audio thread as a pair,
+  // odd appliedSequence means the pair is being written (sequence lock)
+  std::atomic<unsigned int> appliedSequence;
+  std::atomic<unsigned long long> appliedGeneration;
+  std::atomic<long long> appliedTimeMS;
+  
+  std::atomic<whiteice::resonanz::AudioCapture*> capture;
+  
+  // estimated time (milliseconds since epoch) when buffer being synthesized becomes audible
+  long long audibleTimeMS() const;
+  
+  long long offlineTimeMS = -1; // time of offline buffer (-1: audio device is used)
+  std::vector<int16_t> offlineBuffer;
+  
   friend void __sdl_soundsynthesis_mixaudio(void* unused, Uint8* stream, int len);
   
 };
@@ -0,0 +1,121 @@
+
+#include "SampleRingBuffer.h"
+#include <algorithm>
+
+
+SampleRingBuffer::SampleRingBuffer()
+{
+  D = 0;
+  CAPACITY = 0;
+  head = 0;
+  
+  seq = nullptr;
+  timestamp = nullptr;
+  values = nullptr;
+}
+
+
+SampleRingBuffer::~SampleRingBuffer()
+{
+  if(seq) delete[] seq;
+  if(timestamp) delete[] timestamp;
+  if(values) delete[] values;
+}
+
+
+bool SampleRingBuffer::init(unsigned int dimension, unsigned int capacity)
+{
+  if(dimension == 0 || capacity == 0) return false;
+  if(initialized()) return false; // buffer cannot be reallocated while in use
+  
+  seq = new std::atomic<unsigned long long>[capacity];
+  timestamp = new std::atomic<long long>[capacity];
+  values = new std::atomic<float>[capacity*dimension];
+  
+  for(unsigned int i=0;i<capacity;i++){
+    seq[i].store(0ULL, std::memory_order_relaxed);
+    timestamp[i].store(0LL, std::memory_order_relaxed);
+  }
+  
+  for(unsigned int i=0;i<capacity*dimension;i++)
+    values[i].store(0.0f, std::memory_order_relaxed);
+  
+  head.store(0ULL, std::memory_order_relaxed);
+  
+  CAPACITY = capacity;
+  D = dimension;
+  
+  std::atomic_thread_fence(std::memory_order_release);
+  
+  return true;
+}
+
+
+bool SampleRingBuffer::push(const std::vector<float>& x, long long t)
+{
+  if(initialized() == false || x.size() != D) return false;
+  
+  const unsigned long long n = head.load(std::memory_order_relaxed);
+  const unsigned int slot = (unsigned int)(n % CAPACITY);
+  
+  // marks slot as being written
+  seq[slot].store(2*n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  
+  timestamp[slot].store(t, std::memory_order_relaxed);
+  
+  for(unsigned int i=0;i<D;i++)
+    values[slot*D + i].store(x[i], std::memory_order_relaxed);
+  
+  seq[slot].store(2*n + 2, std::memory_order_release);
+  head.store(n + 1, std::memory_order_release);
+  
+  return true;
+}
+
+
+unsigned int SampleRingBuffer::window(long long t0, long long t1,
+				      std::vector< std::vector<float> >& x,
+				      std::vector<long long>& times) const
+{
+  x.clear();
+  times.clear();
+  
+  if(initialized() == false || t1 < t0) return 0;
+  
+  const unsigned long long h = head.load(std::memory_order_acquire);
+  const unsigned long long first = (h > CAPACITY) ? (h - CAPACITY) : 0ULL;
+  
+  std::vector<float> v(D);
+  
+  // walks backwards from the latest sample until samples are older than t0
+  for(unsigned long long n = h; n > first; n--){
+    const unsigned long long k = n - 1;
+    const unsigned int slot = (unsigned int)(k % CAPACITY);
+    
+    const unsigned long long s1 = seq[slot].load(std::memory_order_acquire);
+    if(s1 != 2*k + 2) break; // producer has already overwritten older samples
+    
+    const long long t = timestamp[slot].load(std::memory_order_relaxed);
+    
+    for(unsigned int i=0;i<D;i++)
+      v[i] = values[slot*D + i].load(std::memory_order_relaxed);
+    
+    std::atomic_thread_fence(std::memory_order_acquire);
+    
+    const unsigned long long s2 = seq[slot].load(std::memory_order_relaxed);
+    if(s2 != s1) break; // sample was overwritten while reading it
+    
+    if(t < t0) break;
+    
+    if(t <= t1){
+      x.push_back(v);
+      times.push_back(t);
+    }
+  }
+  
+  std::reverse(x.begin(), x.end());
+  std::reverse(times.begin(), times.end());
+  
+  return x.size();
+}
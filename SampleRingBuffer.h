@@ -0,0 +1,54 @@
+/*
+ * SampleRingBuffer
+ *
+ * timestamped single producer/multiple consumer lock-free ring buffer
+ * of fixed dimensional samples. device worker thread pushes samples and
+ * any number of readers can query samples measured in given time window.
+ * readers never block producer: samples overwritten while being read
+ * are dropped from the results.
+ */
+
+#ifndef SampleRingBuffer_h
+#define SampleRingBuffer_h
+
+#include <vector>
+#include <atomic>
+
+
+class SampleRingBuffer
+{
+public:
+
+  SampleRingBuffer();
+  ~SampleRingBuffer();
+
+  // allocates buffer, must be called before producer thread starts
+  bool init(unsigned int dimension, unsigned int capacity = 4096);
+
+  bool initialized() const { return (D > 0 && CAPACITY > 0); }
+
+  unsigned int dimension() const { return D; }
+
+  // adds new sample measured at time t [msecs] (single producer only)
+  bool push(const std::vector<float>& x, long long t);
+
+  // returns samples with time t0 <= t <= t1 in measurement order
+  unsigned int window(long long t0, long long t1,
+		      std::vector< std::vector<float> >& x,
+		      std::vector<long long>& times) const;
+
+private:
+
+  unsigned int D, CAPACITY;
+
+  std::atomic<unsigned long long> head; // number of samples pushed so far
+
+  // slot sequence numbers: 2n+1 while sample n is being written, 2n+2 after write
+  std::atomic<unsigned long long>* seq;
+  std::atomic<long long>* timestamp;
+  std::atomic<float>* values; // CAPACITY x D
+  
+};
+
+
+#endif
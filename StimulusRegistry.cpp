@@ -0,0 +1,251 @@
+#include "StimulusRegistry.h"
+
+#include <dinrhiw.h>
+
+#include <vector>
+#include <exception>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    StimulusRegistry::StimulusRegistry()
+    {
+    }
+
+
+    StimulusRegistry::~StimulusRegistry()
+    {
+      save();
+    }
+
+
+    bool StimulusRegistry::open(const std::string& modelDir)
+    {
+      {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	if(this->modelDir == modelDir && manifestFile.length() > 0)
+	  return true;
+      }
+
+      save(); // manifest of the previous model directory
+
+      std::lock_guard<std::mutex> lock(registry_mutex);
+
+      this->modelDir = modelDir;
+      manifestFile = modelDir + "/stimulus.manifest";
+      ids.clear(); // relocations are model directory specific
+      modified = false;
+
+      FILE* handle = fopen(manifestFile.c_str(), "rt");
+      if(handle == NULL) return true; // new model directory
+
+      std::vector<char> line(64*1024);
+
+      while(fgets(line.data(), line.size(), handle) != NULL){
+	char* tab = strchr(line.data(), '\t');
+	if(tab == NULL || line[0] == '#') continue;
+
+	*tab = '\0';
+	std::string id = line.data();
+	std::string key = tab + 1;
+
+	while(key.length() > 0 && (key.back() == '\n' || key.back() == '\r'))
+	  key.pop_back();
+
+	if(id.length() == 40 && key.length() > 0)
+	  ids[key] = id;
+      }
+
+      fclose(handle);
+
+      char buffer[256];
+      snprintf(buffer, 256, "StimulusRegistry: %d stimuli in manifest", (int)ids.size());
+      whiteice::logging.info(buffer);
+
+      return true;
+    }
+
+
+    bool StimulusRegistry::save()
+    {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+
+      if(modified == false || manifestFile.length() == 0)
+	return true;
+
+      const std::string tmpFile = manifestFile + ".tmp";
+
+      FILE* handle = fopen(tmpFile.c_str(), "wt");
+      if(handle == NULL) return false;
+
+      bool ok = (fprintf(handle, "# resonanz stimulus registry: <id> <stimulus key>\n") > 0);
+
+      for(const auto& i : ids){
+	if(!ok) break;
+	ok = (fprintf(handle, "%s\t%s\n", i.second.c_str(), i.first.c_str()) > 0);
+      }
+
+      if(ferror(handle)) ok = false;
+
+      fclose(handle);
+
+      if(ok){
+#ifdef _WIN32
+	remove(manifestFile.c_str());
+#endif
+	ok = (rename(tmpFile.c_str(), manifestFile.c_str()) == 0);
+      }
+
+      if(!ok){
+	remove(tmpFile.c_str());
+	whiteice::logging.warn("StimulusRegistry: saving manifest failed");
+	return false;
+      }
+
+      modified = false;
+
+      return true;
+    }
+
+
+    void StimulusRegistry::clear()
+    {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+
+      modelDir = "";
+      manifestFile = "";
+      ids.clear();
+      modified = false;
+    }
+
+
+    std::string StimulusRegistry::id(const std::string& key)
+    {
+      {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+
+	auto i = ids.find(key);
+	if(i != ids.end()) return i->second;
+      }
+
+      // hashes outside of lock so that parallel dataset loads don't wait
+      const std::string name = hashName(key);
+      if(name.length() == 0) return name;
+
+      std::lock_guard<std::mutex> lock(registry_mutex);
+
+      auto r = ids.emplace(key, name);
+      if(r.second) modified = true;
+
+      return r.first->second;
+    }
+
+
+    std::string StimulusRegistry::lookup(const std::string& key) const
+    {
+      {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+
+	auto i = ids.find(key);
+	if(i != ids.end()) return i->second;
+      }
+
+      return hashName(key); // new keys are registered with their hash
+    }
+
+
+    bool StimulusRegistry::contains(const std::string& key) const
+    {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+      return (ids.find(key) != ids.end());
+    }
+
+
+    bool StimulusRegistry::relocate(const std::string& key, const std::string& suffix,
+				    const std::set<std::string>& active)
+    {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+
+      if(ids.find(key) != ids.end())
+	return false;
+
+      const std::string ending = "/" + suffix;
+      auto found = ids.end();
+
+      for(auto i = ids.begin();i != ids.end();i++){
+	const std::string& k = i->first;
+
+	if(k.length() > ending.length() && active.find(k) == active.end() &&
+	   k.compare(k.length() - ending.length(), ending.length(), ending) == 0)
+	{
+	  if(found != ids.end()) return false; // ambiguous
+	  found = i;
+	}
+      }
+
+      if(found == ids.end())
+	return false;
+
+      const std::string id = found->second;
+
+      ids.erase(found);
+      ids[key] = id;
+      modified = true;
+
+      return true;
+    }
+
+
+    unsigned int StimulusRegistry::size() const
+    {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+      return ids.size();
+    }
+
+
+    std::string StimulusRegistry::hashName(const std::string& key)
+    {
+      static const char hex[] = "0123456789abcdef";
+
+      try{
+	const unsigned int N = strlen(key.c_str()) + 1;
+
+	// SHA::hash() may reallocate the data buffer
+	unsigned char* data = (unsigned char*)malloc(sizeof(unsigned char)*N);
+	unsigned char hash160[20];
+
+	if(data == NULL) return "";
+
+	memcpy(data, key.c_str(), N);
+
+	whiteice::crypto::SHA sha(160);
+
+	const bool ok = sha.hash(&data, N, hash160);
+
+	if(data) free(data);
+
+	if(!ok) return "";
+
+	std::string result(40, '0');
+
+	for(unsigned int i=0;i<20;i++){
+	  result[2*i+0] = hex[hash160[i] >> 4];
+	  result[2*i+1] = hex[hash160[i] & 0x0f];
+	}
+
+	return result; // hex hash of the name
+      }
+      catch(std::exception& e){
+	return "";
+      }
+    }
+
+  };
+};
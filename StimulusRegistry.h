@@ -0,0 +1,76 @@
+/*
+ * StimulusRegistry
+ *
+ * maps stimulus keys (stimulus name + EEG data source name) to stable
+ * dataset IDs. IDs are SHA-1 hex hashes of the key when the stimulus is
+ * first seen and are memoized so names are not rehashed on every
+ * load/save/analyze. the registry is kept in modelDir/stimulus.manifest
+ * so moved pictures can keep the ID (and dataset) of their old path.
+ *
+ * manifest format (text): one "<id>\t<key>" line per stimulus
+ */
+
+#ifndef StimulusRegistry_h
+#define StimulusRegistry_h
+
+#include <string>
+#include <unordered_map>
+#include <set>
+#include <mutex>
+
+
+namespace whiteice {
+  namespace resonanz {
+
+    class StimulusRegistry
+    {
+    public:
+
+      StimulusRegistry();
+      ~StimulusRegistry();
+
+      // loads manifest of modelDir (saves earlier modified registry first),
+      // does nothing if registry of modelDir is already open
+      bool open(const std::string& modelDir);
+
+      // writes manifest if new stimuli have been registered
+      bool save();
+
+      // forgets registry without saving it (model data has been deleted)
+      void clear();
+
+      // returns ID of the key (registers new key)
+      std::string id(const std::string& key);
+
+      // returns ID of the key without registering it (read-only users)
+      std::string lookup(const std::string& key) const;
+
+      bool contains(const std::string& key) const;
+
+      // moves registered key ending to "/" + suffix to key
+      // (picture has moved to a new directory), keys in active
+      // are not moved. fails if there are no or many candidate keys
+      bool relocate(const std::string& key, const std::string& suffix,
+		    const std::set<std::string>& active);
+
+      unsigned int size() const;
+
+      // SHA-1 hex hash of key (including terminating '\0')
+      static std::string hashName(const std::string& key);
+
+    private:
+
+      std::string modelDir;
+      std::string manifestFile;
+
+      std::unordered_map<std::string, std::string> ids; // key => ID
+      bool modified = false;
+
+      mutable std::mutex registry_mutex;
+    };
+
+  };
+};
+
+
+#endif
@@ -1139,6 +1139,14 @@ bool TranquilityEngine::setParameter(const std::string& parameter, const std::st
     }
     else return false;
   }
+  else if(parameter == "nn-neighbours"){
+    // number of nearest data points used by data-rbf model (0 = all data)
+    const int k = atoi(value.c_str());
+    if(k < 0) return false;
+    
+    nnNeighbours = (unsigned int)k;
+    return true;
+  }
   else if(parameter == "optimize-synth-only"){
     if(value == "true"){
       optimizeSynthOnly = true;
@@ -2889,7 +2897,8 @@ bool TranquilityEngine::engine_executeProgram(const std::vector<float>& eegCurre
     unsigned int SAMPLES = MODEL_SAMPLES;
     
     if(dataRBFmodel){
-      engine_estimateNN(x, keywordData[index], m , cov);
+      engine_estimateNN(x, keywordData[index], m , cov,
+			(index < keywordIndex.size()) ? &(keywordIndex[index]) : nullptr);
       SAMPLES = 1;
     }
     else{
@@ -3082,7 +3091,8 @@ bool TranquilityEngine::engine_executeProgram(const std::vector<float>& eegCurre
     unsigned int SAMPLES = MODEL_SAMPLES;
     
     if(dataRBFmodel){
-      engine_estimateNN(x, pictureData[index], m , cov);
+      engine_estimateNN(x, pictureData[index], m , cov,
+			(index < pictureIndex.size()) ? &(pictureIndex[index]) : nullptr);
       SAMPLES = 1;
     }
     else{
@@ -3811,6 +3821,13 @@ bool TranquilityEngine::engine_optimizeModels(unsigned int& currentHMMModel,
       delete hmmUpdator;
       hmmUpdator = nullptr;
 
+      // HMM state fields of input data has changed: reindex data
+      for(unsigned int i=0;i<keywordData.size() && i<keywordIndex.size();i++)
+	keywordIndex[i].build(keywordData[i], 0);
+      
+      for(unsigned int i=0;i<pictureData.size() && i<pictureIndex.size();i++)
+	pictureIndex[i].build(pictureData[i], 0);
+
       currentHMMModel++;
     }
     
@@ -4674,12 +4691,13 @@ bool TranquilityEngine::engine_optimizeModels(unsigned int& currentHMMModel,
 bool TranquilityEngine::engine_estimateNN(const whiteice::math::vertex<>& x,
 					  const whiteice::dataset<>& data,
 					  whiteice::math::vertex<>& m,
-					  whiteice::math::matrix<>& cov)
+					  whiteice::math::matrix<>& cov,
+					  const NNIndex* index)
 {
   bool bad_data = false;
   
   if(data.size(0) <= 0) bad_data = true;
-  if(data.getNumberOfClusters() != 2) bad_data = true;
+  if(data.getNumberOfClusters() < 2) bad_data = true;
   if(bad_data == false){
     if(data.size(0) != data.size(1))
       bad_data = true;
@@ -4702,18 +4720,51 @@ bool TranquilityEngine::engine_estimateNN(const whiteice::math::vertex<>& x,
   const float epsilon    = 0.01f;
   math::blas_real<float> sumweights = 0.0f;
 
+  // uses only k nearest rows (the most heavily weighted ones) if index is up to date
+  std::vector<unsigned int> rows;
+  std::vector<float> distances;
   
-  for(unsigned int i=0;i<data.size(0);i++){
-    auto delta = x - data.access(0, i);
-    
-    auto w = math::blas_real<float>(1.0f / (epsilon + delta.norm().c[0]));
-	  
-    auto v = data.access(1, i);
-    
-    m += w*v;
-    cov += w*v.outerproduct();
+  if(nnNeighbours > 0 && nnNeighbours < data.size(0) && index != nullptr &&
+     index->size() == data.size(0))
+  {
+    if(index->search(x, nnNeighbours, rows, distances) == false){
+      rows.clear();
+      distances.clear();
+    }
+  }
+
+  if(rows.size() > 0){
     
-    sumweights += w;
+    for(unsigned int j=0;j<rows.size();j++){
+      auto w = math::blas_real<float>(1.0f / (epsilon + distances[j]));
+      
+      const auto& v = data.access(1, rows[j]);
+      
+      m += w*v;
+      
+      // adds w*v*v^t to covariance matrix
+      for(unsigned int a=0;a<YMAX;a++){
+	const auto wva = w*v[a];
+	for(unsigned int b=0;b<YMAX;b++)
+	  cov(a,b) += wva*v[b];
+      }
+      
+      sumweights += w;
+    }
+  }
+  else{
+    for(unsigned int i=0;i<data.size(0);i++){
+      auto delta = x - data.access(0, i);
+      
+      auto w = math::blas_real<float>(1.0f / (epsilon + delta.norm().c[0]));
+      
+      auto v = data.access(1, i);
+      
+      m += w*v;
+      cov += w*v.outerproduct();
+      
+      sumweights += w;
+    }
   }
   
   m /= sumweights;
@@ -5001,6 +5052,14 @@ bool TranquilityEngine::engine_loadDatabase(const std::string& modelDir)
     
   }
   
+  // builds nearest neighbour indexes of preprocessed keyword inputs
+  keywordIndex.resize(keywordData.size());
+  
+  for(unsigned int i=0;i<keywordData.size();i++){
+    if(keywordIndex[i].build(keywordData[i], 0) == false)
+      logging.warn("keywordData: building nearest neighbour index failed");
+  }
+  
   logging.info("keywords measurement database loaded");
 	
   
@@ -5078,6 +5137,13 @@ bool TranquilityEngine::engine_loadDatabase(const std::string& modelDir)
     }
   }
   
+  pictureIndex.resize(pictureData.size());
+  
+  for(unsigned int i=0;i<pictureData.size();i++){
+    if(pictureIndex[i].build(pictureData[i], 0) == false)
+      logging.warn("pictureData: building nearest neighbour index failed");
+  }
+  
   logging.info("picture measurement database loaded");
   
   // loads synth parameters data into memory
@@ -5363,6 +5429,9 @@ bool TranquilityEngine::engine_storeMeasurement(unsigned int pic, unsigned int k
       logging.error("Adding new keyword data FAILED");
       return false;
     }
+
+    if(key < keywordIndex.size())
+      keywordIndex[key].update(keywordData[key], 0);
   }
   
   if(pic < pictureData.size()){
@@ -5378,6 +5447,9 @@ bool TranquilityEngine::engine_storeMeasurement(unsigned int pic, unsigned int k
       logging.error("Adding new picture data FAILED");
       return false;
     }
+
+    if(pic < pictureIndex.size())
+      pictureIndex[pic].update(pictureData[pic], 0);
   }
 
   if(eegData.add(0, t3) == false || eegData.add(1, t4) == false){
@@ -5582,6 +5654,10 @@ bool TranquilityEngine::engine_saveDatabase(const std::string& modelDir)
       // keywordData[i].convert(1); // removes all preprocessings from output
     }
     
+    // input data was renormalized: reindex data
+    if(i < keywordIndex.size())
+      keywordIndex[i].build(keywordData[i], 0);
+    
     if(keywordData[i].save(dbFilename) == false){
       logging.error("Saving keyword data failed");
       return false;
@@ -5630,6 +5706,10 @@ bool TranquilityEngine::engine_saveDatabase(const std::string& modelDir)
       // pictureData[i].convert(1); // removes all preprocessings from output
     }
     
+    // input data was renormalized: reindex data
+    if(i < pictureIndex.size())
+      pictureIndex[i].build(pictureData[i], 0);
+    
     if(pictureData[i].save(dbFilename) == false){
       logging.error("Saving picture data failed");
       return false;
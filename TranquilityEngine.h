@@ -43,6 +43,7 @@
 #include "SDLAVCodec.h"
 
 #include "HMMStateUpdator.h"
+#include "NNIndex.h"
 
 
 using namespace whiteice::resonanz;
@@ -296,6 +297,10 @@ private:
   std::vector< whiteice::dataset<> > pictureData;
   whiteice::dataset<>                synthData; // sound synthesis data
   whiteice::dataset<>                picsynthData; // pic synthesis data 
+
+  // KD-tree indexes of keywordData and pictureData input clusters for engine_estimateNN()
+  std::vector< NNIndex > keywordIndex;
+  std::vector< NNIndex > pictureIndex;
   
   mutable std::mutex database_mutex;  // mutex to synchronize I/O access to dataset files
   bool pcaPreprocess = false; // should measured data be preprocessed using PCA (no pca preprocessing as the default!)
@@ -366,9 +371,14 @@ private:
   unsigned long long synthParametersChangedTime = 0ULL;
   unsigned long long picsynthParametersChangedTime = 0ULL;
   
-  // estimate output value N(m,cov) for x given dataset data uses nearest neighbourhood estimation
+  // estimate output value N(m,cov) for x given dataset data uses nearest neighbourhood estimation,
+  // uses only nnNeighbours nearest rows when index of data is given (and up to date)
   bool engine_estimateNN(const whiteice::math::vertex<>& x, const whiteice::dataset<>& data,
-			 whiteice::math::vertex<>& m, whiteice::math::matrix<>& cov);
+			 whiteice::math::vertex<>& m, whiteice::math::matrix<>& cov,
+			 const NNIndex* index = nullptr);
+
+  // number of nearest neighbours used by engine_estimateNN() (0 = use all data rows)
+  unsigned int nnNeighbours = 64;
   
   // for calculating program performance: RMS statistic
   float programRMS = 0.0f;
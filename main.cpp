@@ -51,15 +51,19 @@ void print_usage()
   printf("--program-file=  sets NMC program file\n");
   printf("--music-file=    sets music (MP3) file for playback\n");
   printf("--target=        sets measurement program targets (comma separated numbers)\n");
-  printf("--device=        sets measurement device: muse* (osc.udp://localhost:4545), muse4ch, random\n");
+  printf("--device=        sets measurement device: muse* (osc.udp://localhost:4545), muse4ch, museraw, random\n");
   printf("--method=        sets optimization method: rbf, lbfgs, bayes*\n");
   printf("--pca            preprocess input data with pca if possible\n");
   printf("--loop           loops program forever\n");
   printf("--program-len=   measured program length in seconds/ticks\n");
   printf("--fullscreen     fullscreen mode instead of windowed mode\n");
   printf("--savevideo      save video to neurostim.ogv file\n");
+  printf("--headless       render video offscreen with virtual clock (--savevideo, simulated EEG)\n");
   printf("--optimize-synth only optimize synth model when optimizing\n");
   printf("--muse-port=     sets muse osc server port (localhost:<port-number>)\n");
+  printf("--muse-hz=       sets museraw band power update rate (default 10 Hz)\n");
+  printf("--muse-capture=  records museraw OSC packets to file\n");
+  printf("--muse-replay=   replays museraw OSC capture file instead of using headset\n");
   printf("-v               verbose mode\n");
   printf("\n");
   printf("This is alpha version. Report bugs to Tomas Ukkonen <nop@iki.fi>\n");
@@ -101,6 +105,7 @@ int main(int argc, char** argv)
 	bool loop = false;
 	bool optimizeSynthOnly = false;
 	bool randomPrograms = false;
+	bool headless = false;
 	bool verbose = false;
 
 	unsigned int programLength = 5*60; // 5 minutes default
@@ -109,6 +114,7 @@ int main(int argc, char** argv)
 	std::vector<float> targets;
 	
 	std::string museServerPort = "4545";
+	std::string museUpdateHz, museCaptureFile, museReplayFile;
 	
 	cmd.pictureDir = "pics";
 	cmd.keywordsFile = "keywords.txt";
@@ -196,6 +202,18 @@ int main(int argc, char** argv)
 	        char* p = &(argv[i][12]);
 		if(strlen(p) > 0) museServerPort = p;
 	    }
+	    else if(strncmp(argv[i], "--muse-hz=", 10) == 0){
+	        char* p = &(argv[i][10]);
+		if(strlen(p) > 0) museUpdateHz = p;
+	    }
+	    else if(strncmp(argv[i], "--muse-capture=", 15) == 0){
+	        char* p = &(argv[i][15]);
+		if(strlen(p) > 0) museCaptureFile = p;
+	    }
+	    else if(strncmp(argv[i], "--muse-replay=", 14) == 0){
+	        char* p = &(argv[i][14]);
+		if(strlen(p) > 0) museReplayFile = p;
+	    }
 	    else if(strcmp(argv[i], "--optimize-synth") == 0){
 	      optimizeSynthOnly = true;
 	    }
@@ -208,6 +226,9 @@ int main(int argc, char** argv)
 	    else if(strcmp(argv[i],"--savevideo") == 0){
  	        cmd.saveVideo = true;
 	    } 
+	    else if(strcmp(argv[i],"--headless") == 0){
+	        headless = true;
+	    }
 	    else if(strcmp(argv[i],"--pca") == 0){
 	        usepca = true;
 	    }
@@ -228,8 +249,24 @@ int main(int argc, char** argv)
 		return -1;
 	}
 
+	// virtual clock runs faster than real EEG input: headless mode is only
+	// for random stimulation or for programs driven by the random device
+	if(headless && cmd.command != cmd.CMD_DO_RANDOM &&
+	   (cmd.command != cmd.CMD_DO_EXECUTE || device != "random")){
+		print_usage();
+		printf("ERROR: --headless only works with --random or with --program --device=random\n");
+		return -1;
+	}
+
+	// headless mode only generates video
+	if(headless && cmd.saveVideo == false){
+		print_usage();
+		printf("ERROR: --headless requires --savevideo\n");
+		return -1;
+	}
+
 	unsigned int numChannels = 7;
-	if(device == "muse4ch"){
+	if(device == "muse4ch" || device == "museraw"){
 	  // converts target to all channels
 	  if(targets.size() == 7){
 	    
@@ -253,9 +290,22 @@ int main(int argc, char** argv)
 	std::cout << "ResonanzEngine NUMCHANNELS: " << numChannels << std::endl;
 
 	// starts resonanz engine
-	whiteice::resonanz::ResonanzEngine engine(numChannels);
+	whiteice::resonanz::ResonanzEngine engine(numChannels, headless);
+
+	if(headless){
+	  // batch video generation: random stimulation lasts program length (secs)
+	  if(cmd.command == cmd.CMD_DO_RANDOM){
+	    char buffer[32];
+	    snprintf(buffer, 32, "%u", programLength);
+	    engine.setParameter("headless-length", buffer);
+	  }
+	}
 
 	engine.setParameter("muse-port", museServerPort);
+	if(museUpdateHz.length() > 0) engine.setParameter("muse-update-hz", museUpdateHz);
+	if(museCaptureFile.length() > 0) engine.setParameter("muse-capture-file", museCaptureFile);
+	if(museReplayFile.length() > 0) engine.setParameter("muse-replay-file", museReplayFile);
+	engine.setParameter("fftw-wisdom-file", cmd.modelDir + "/fftw.wisdom");
 
 	
 	
@@ -283,6 +333,15 @@ int main(int argc, char** argv)
 		exit(-1);
 	      }
 	    }
+	    else if(device == "museraw"){
+	      // raw EEG from UDP traffic at localhost:4545 or from capture file
+	      if(engine.setEEGDeviceType(whiteice::resonanz::ResonanzEngine::RE_EEG_IA_MUSE_RAW_DEVICE))
+		printf("Hardware: Interaxon Muse EEG [4 channels raw EEG]\n");
+	      else{
+		printf("Cannot connect to Interaxon Muse EEG device\n");
+		exit(-1);
+	      }
+	    }
 	    else if(device == "insight"){
 	      if(engine.setEEGDeviceType(whiteice::resonanz::ResonanzEngine::RE_EEG_EMOTIV_INSIGHT_DEVICE))
 		printf("Hardware: Emotiv Insight EEG\n");
@@ -1,8 +1,93 @@
-
 #include "pictureFeatureVector.h"
 
-#include <dinrhiw.h>
-#include "timing.h"
+#include <SDL_image.h>
+
+#include <algorithm>
+#include <random>
+#include <map>
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+// number of clusters in color distribution (feature vector has 4 values per cluster)
+static const unsigned int PICFEATURES_CLUSTERS = 5;
+
+
+// k-means clustering of rgb points calculated in the calling thread
+// (no background thread or sleep polling), returns cluster means
+static void kmeans_rgb(const std::vector<float>& points, const unsigned int K,
+		       std::vector<float>& means, std::vector<unsigned int>& labels,
+		       std::mt19937& rng)
+{
+  const unsigned int N = points.size()/3;
+  const unsigned int MAXITERS = 50;
+
+  means.resize(3*K);
+  labels.resize(N);
+
+  std::uniform_int_distribution<unsigned int> random_point(0, N-1);
+
+  for(unsigned int k=0;k<K;k++){
+    const unsigned int p = random_point(rng);
+    for(unsigned int d=0;d<3;d++)
+      means[3*k + d] = points[3*p + d];
+  }
+
+  std::vector<float> sums(3*K);
+  std::vector<unsigned int> counts(K);
+
+  for(unsigned int iter=0;iter<MAXITERS;iter++){
+    bool labels_changed = false;
+
+    for(unsigned int i=0;i<N;i++){
+      const float* x = &(points[3*i]);
+      unsigned int best = 0;
+      float bestdist = 1e10f;
+
+      for(unsigned int k=0;k<K;k++){
+	const float dr = x[0] - means[3*k + 0];
+	const float dg = x[1] - means[3*k + 1];
+	const float db = x[2] - means[3*k + 2];
+	const float dist = dr*dr + dg*dg + db*db;
+
+	if(dist < bestdist){
+	  bestdist = dist;
+	  best = k;
+	}
+      }
+
+      if(iter == 0 || labels[i] != best){
+	labels[i] = best;
+	labels_changed = true;
+      }
+    }
+
+    if(labels_changed == false) break; // converged
+
+    std::fill(sums.begin(), sums.end(), 0.0f);
+    std::fill(counts.begin(), counts.end(), 0);
+
+    for(unsigned int i=0;i<N;i++){
+      for(unsigned int d=0;d<3;d++)
+	sums[3*labels[i] + d] += points[3*i + d];
+      counts[labels[i]]++;
+    }
+
+    for(unsigned int k=0;k<K;k++){
+      if(counts[k] > 0){
+	for(unsigned int d=0;d<3;d++)
+	  means[3*k + d] = sums[3*k + d]/counts[k];
+      }
+      else{ // empty cluster: restarts it from a random point
+	const unsigned int p = random_point(rng);
+	for(unsigned int d=0;d<3;d++)
+	  means[3*k + d] = points[3*p + d];
+      }
+    }
+  }
+}
 
 
 bool calculatePicFeatureVector(const SDL_Surface* pic,
@@ -11,23 +96,24 @@ bool calculatePicFeatureVector(const SDL_Surface* pic,
   // creates datapoints from picture, sample N=10.000 points (~ 100x100)
 
   if(pic == NULL) return false;
+  if(pic->w <= 0 || pic->h <= 0) return false;
 
   unsigned int* buffer = (unsigned int*)pic->pixels;
 
-  whiteice::KMeans<> kmeans;
-  std::vector< whiteice::math::vertex<> > points;
+  // each thread has its own random number generator
+  thread_local std::mt19937 rng(std::random_device{}());
+  std::uniform_int_distribution<int> random_x(0, pic->w - 1);
+  std::uniform_int_distribution<int> random_y(0, pic->h - 1);
 
-  double r = 0.0,g = 0.0,b = 0.0;
-  whiteice::math::vertex<> rgb;
-  rgb.resize(3);
+  const unsigned int NPOINTS = 10000;
+  std::vector<float> points(3*NPOINTS);
 
-  for(unsigned int s=0;s<10000;s++){
-    unsigned int x = 0, y = 0;
-    
-    x = rand() % pic->w;
-    y = rand() % pic->h;
+  for(unsigned int s=0;s<NPOINTS;s++){
+    double r = 0.0,g = 0.0,b = 0.0;
+
+    const unsigned int x = random_x(rng);
+    const unsigned int y = random_y(rng);
 
-    
     if(buffer){
       const unsigned int rr = (buffer[x + y*(pic->pitch/4)] & 0xFF0000) >> 16;
       const unsigned int gg = (buffer[x + y*(pic->pitch/4)] & 0x00FF00) >> 8;
@@ -38,64 +124,274 @@ bool calculatePicFeatureVector(const SDL_Surface* pic,
       b = bb/255.0;
     }
 
-    rgb[0] = r;
-    rgb[1] = g;
-    rgb[2] = b;
+    points[3*s + 0] = r;
+    points[3*s + 1] = g;
+    points[3*s + 2] = b;
+  }
+
+  std::vector<float> means;
+  std::vector<unsigned int> labels;
+
+  kmeans_rgb(points, PICFEATURES_CLUSTERS, means, labels, rng);
+
+  // calculates percentages of different clusters;
 
-    points.push_back(rgb);
+  std::vector<unsigned int> Npixels(PICFEATURES_CLUSTERS, 0);
+
+  for(const auto& l : labels)
+    Npixels[l]++;
+
+  // sorts clusters based on N (largest cluster first)
+  std::multimap<unsigned int, unsigned int, std::greater<unsigned int> > Npercluster;
+
+  for(unsigned int k=0;k<PICFEATURES_CLUSTERS;k++){
+    Npercluster.insert(std::pair<unsigned int, unsigned int>(Npixels[k], k));
   }
 
-  // printf("PIC FEATURE VECTOR CALC: %d\n", (int)points.size());
+  features.resize(PICFEATURES_CLUSTERS*4);
+
+  unsigned int index = 0;
 
-  kmeans.startTrain(5, points);
+  for(auto& c : Npercluster){
+    const unsigned int cluster = c.second;
 
-  unsigned int counter = 0;
+    features[index*4 + 0] = means[3*cluster + 0];
+    features[index*4 + 1] = means[3*cluster + 1];
+    features[index*4 + 2] = means[3*cluster + 2];
+    features[index*4 + 3] = (c.first)/((float)NPOINTS);
 
-  while(kmeans.isRunning() && counter < (2*60)){ // max 1 minute
-    millisleep(500);
-    counter++;
+    index++;
   }
 
-  kmeans.stopTrain();
+  return true;
+}
+
 
-  // printf("KMEANS FINISHED\n");
+bool calculatePicFeatureVector(const std::string& filename,
+			       std::vector<float>& features)
+{
+  SDL_Surface* image = IMG_Load(filename.c_str());
+  if(image == NULL) return false;
 
-  // calculates percentages of different clusters;
+  // feature calculation expects 32bit ARGB pixels
+  SDL_Surface* argb = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_ARGB8888, 0);
+  SDL_FreeSurface(image);
 
-  std::map<unsigned int, unsigned int> Npixels;
-  unsigned int N = 0;
+  if(argb == NULL) return false;
 
-  for(unsigned int i=0;i<points.size();i++){
-    unsigned int cluster = kmeans.getClusterIndex(points[i]);
-    Npixels[cluster]++;
-    N++;
+  bool ok = false;
+
+  if(SDL_LockSurface(argb) == 0){
+    ok = calculatePicFeatureVector(argb, features);
+    SDL_UnlockSurface(argb);
   }
 
-  // sorts clusters based on N
-  std::map<unsigned int, unsigned int> Npercluster;
+  SDL_FreeSurface(argb);
+
+  return ok;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+PicFeatureVectorCache::PicFeatureVectorCache(const std::string& cacheFile)
+{
+  this->cacheFile = cacheFile;
+  changed = false;
+  hits = 0;
+  misses = 0;
+}
+
+
+PicFeatureVectorCache::~PicFeatureVectorCache()
+{
+}
+
+
+// cache file format (text): one picture per line
+// <mtime> <size> <number of features> <features..> <filename>
+bool PicFeatureVectorCache::load()
+{
+  entries.clear();
+  changed = false;
+
+  if(cacheFile.length() == 0) return false;
+
+  FILE* handle = fopen(cacheFile.c_str(), "rt");
+  if(handle == NULL) return false;
+
+  char line[8192];
+
+  while(fgets(line, sizeof(line), handle) != NULL){
+    entry e;
+    unsigned int N = 0;
+    int pos = 0;
 
-  for(auto& p : Npixels){
-    Npercluster.insert(std::pair<unsigned int, unsigned int>(p.second, p.first));
+    if(sscanf(line, "%lld %lld %u%n", &e.mtime, &e.size, &N, &pos) != 3)
+      continue;
+
+    if(N > 1000) continue; // corrupted line
+
+    char* p = line + pos;
+    bool ok = true;
+
+    e.features.resize(N);
+
+    for(unsigned int i=0;i<N;i++){
+      int n = 0;
+      if(sscanf(p, "%f%n", &(e.features[i]), &n) != 1){ ok = false; break; }
+      p += n;
+    }
+
+    if(!ok) continue;
+
+    while(*p == ' ') p++;
+
+    std::string filename(p);
+    while(filename.length() > 0 &&
+	  (filename.back() == '\n' || filename.back() == '\r'))
+      filename.pop_back();
+
+    if(filename.length() == 0) continue;
+
+    entries.push_back(std::make_pair(filename, e));
   }
 
-  features.resize(5*4);
+  fclose(handle);
 
-  for(auto& c : Npercluster){
-    const unsigned int cluster = c.second;
+  std::sort(entries.begin(), entries.end(),
+	    [](const std::pair<std::string, entry>& a,
+	       const std::pair<std::string, entry>& b){ return (a.first < b.first); });
+
+  return true;
+}
+
+
+bool PicFeatureVectorCache::save()
+{
+  if(cacheFile.length() == 0) return false;
+  if(changed == false) return true;
+
+  // writes to temporary file first so that cache is never partially written
+  const std::string tmpFile = cacheFile + ".tmp";
+
+  FILE* handle = fopen(tmpFile.c_str(), "wt");
+  if(handle == NULL) return false;
+
+  for(const auto& e : entries){
+    fprintf(handle, "%lld %lld %u", e.second.mtime, e.second.size,
+	    (unsigned int)e.second.features.size());
+
+    for(const auto& f : e.second.features)
+      fprintf(handle, " %.9g", f);
+
+    fprintf(handle, " %s\n", e.first.c_str());
+  }
+
+  if(ferror(handle)){
+    fclose(handle);
+    remove(tmpFile.c_str());
+    return false;
+  }
+
+  fclose(handle);
+
+  if(rename(tmpFile.c_str(), cacheFile.c_str()) != 0){
+    remove(tmpFile.c_str());
+    return false;
+  }
+
+  changed = false;
+
+  return true;
+}
+
+
+bool PicFeatureVectorCache::calculate(const std::vector<std::string>& pictures,
+				      unsigned int first, unsigned int N,
+				      std::vector< std::vector<float> >& features)
+{
+  if(first > pictures.size()) return false;
+  if(first + N > pictures.size()) N = pictures.size() - first;
+
+  if(features.size() < pictures.size())
+    features.resize(pictures.size());
+
+  auto compare = [](const std::pair<std::string, entry>& a, const std::string& b)
+    { return (a.first < b); };
+
+  // finds cached feature vectors and pictures that need to be processed
+  std::vector<unsigned int> work;
+  std::vector< std::pair<long long, long long> > stats(N);
+
+  for(unsigned int i=first;i<first+N;i++){
+    long long mtime = 0, size = 0;
+
+    features[i].clear();
+
+    if(fileStat(pictures[i], mtime, size) == false)
+      continue; // file doesn't exist
+
+    stats[i-first] = std::make_pair(mtime, size);
+
+    auto iter = std::lower_bound(entries.begin(), entries.end(), pictures[i], compare);
+
+    if(iter != entries.end() && iter->first == pictures[i] &&
+       iter->second.mtime == mtime && iter->second.size == size &&
+       iter->second.features.size() > 0)
+    {
+      features[i] = iter->second.features;
+      hits++;
+    }
+    else{
+      work.push_back(i);
+    }
+  }
 
-    features[cluster*4 + 0] = kmeans[cluster][0].c[0];
-    features[cluster*4 + 1] = kmeans[cluster][1].c[0];
-    features[cluster*4 + 2] = kmeans[cluster][2].c[0];
-    features[cluster*4 + 3] = (c.first)/((float)N);
-
-    /*
-    printf("KMEANS CLUSTER SIZE: %f %f %f = %f\n",
-	   features[cluster*4 + 0],
-	   features[cluster*4 + 1],
-	   features[cluster*4 + 2],
-	   features[cluster*4 + 3]);
-    */
+  // decodes pictures and calculates features in parallel
+#pragma omp parallel for schedule(dynamic)
+  for(unsigned int w=0;w<work.size();w++){
+    const unsigned int i = work[w];
+
+    if(calculatePicFeatureVector(pictures[i], features[i]) == false)
+      features[i].clear();
+  }
+
+  // updates cache
+  for(const auto& i : work){
+    misses++;
+
+    if(features[i].size() == 0) continue;
+
+    entry e;
+    e.mtime = stats[i-first].first;
+    e.size  = stats[i-first].second;
+    e.features = features[i];
+
+    auto iter = std::lower_bound(entries.begin(), entries.end(), pictures[i], compare);
+
+    if(iter != entries.end() && iter->first == pictures[i])
+      iter->second = e;
+    else
+      entries.insert(iter, std::make_pair(pictures[i], e));
+
+    changed = true;
   }
 
   return true;
 }
+
+
+bool PicFeatureVectorCache::fileStat(const std::string& filename, long long& mtime, long long& size)
+{
+  struct stat st;
+
+  if(stat(filename.c_str(), &st) != 0)
+    return false;
+
+  mtime = (long long)st.st_mtime;
+  size = (long long)st.st_size;
+
+  return true;
+}
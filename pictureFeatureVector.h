@@ -4,7 +4,7 @@
  * initially calculates only pixel clustering:
  *
  *  top five cluster means and p% value of points that belong to that cluster
- * 
+ *
  * => detect picture color distribution and differentiate between different pictures in machine learning component
  *
  */
@@ -14,9 +14,61 @@
 
 #include <SDL.h>
 #include <vector>
+#include <string>
 
 bool calculatePicFeatureVector(const SDL_Surface* pic,
 			       std::vector<float>& features);
 
+// loads picture from file and calculates its feature vector
+bool calculatePicFeatureVector(const std::string& filename,
+			       std::vector<float>& features);
+
+
+/*
+ * calculates feature vectors of pictures in parallel (pictures are decoded in
+ * worker threads) and keeps results in feature cache file keyed by
+ * picture path, modification time and file size. only new and changed pictures
+ * are recalculated. cacheFile can be empty (no caching).
+ *
+ * features[i] is empty if the picture couldn't be loaded.
+ */
+class PicFeatureVectorCache
+{
+public:
+  PicFeatureVectorCache(const std::string& cacheFile);
+  ~PicFeatureVectorCache();
+
+  // loads cached feature vectors from disk
+  bool load();
+
+  // saves cached feature vectors to disk (only if there are changes)
+  bool save();
+
+  // calculates (or gets from the cache) feature vectors of
+  // pictures[first..first+N-1] and stores them to features vector
+  bool calculate(const std::vector<std::string>& pictures,
+		 unsigned int first, unsigned int N,
+		 std::vector< std::vector<float> >& features);
+
+  unsigned int getCacheHits() const { return hits; }
+  unsigned int getCacheMisses() const { return misses; }
+
+private:
+
+  struct entry {
+    long long mtime;
+    long long size;
+    std::vector<float> features;
+  };
+
+  static bool fileStat(const std::string& filename, long long& mtime, long long& size);
+
+  std::string cacheFile;
+  std::vector< std::pair<std::string, entry> > entries; // sorted by filename
+  bool changed;
+
+  unsigned int hits, misses;
+};
+
 
 #endif
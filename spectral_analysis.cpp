@@ -15,32 +15,151 @@
 
 #include "spectral_analysis.h"
 #include <vector>
+#include <mutex>
 #include <fftw3.h> // GPL
 #include <math.h>
 
 
+// FFTW planner and wisdom functions are not thread-safe
+static std::mutex __fftw_planner_mutex;
+
+
 // returns ||FFT(s)||^2
 bool power_spectral_analysis(const std::vector<double>& s, const double sampling_hz,
 			     std::vector<double>& PF, double& hz_per_sample)
 {
-  // FIXME: we do not care about speed but simplicity so we calculate 
-  // plan each time when using FFTW3
+  // each thread keeps its own plans and buffers between calls
+  thread_local SpectralAnalyzer analyzer;
+  
+  return analyzer.powerSpectrum(s, sampling_hz, PF, hz_per_sample);
+}
+
+
+// uses ||FFT(s)|| for band analysis
+bool spectral_analysis(const std::vector<double>& s, const double sampling_hz,
+		       double& delta, double& theta, double& alpha, 
+		       double& beta,  double& gamma, double& mu)
+{
+  std::vector<double> PF;
+  double hz_per_sample = 0.0;
+  
+  if(!power_spectral_analysis(s, sampling_hz, PF, hz_per_sample))
+    return false;
+  
+  SpectralAnalyzer::bands b;
+  
+  SpectralAnalyzer::bandPowers(PF, hz_per_sample, b);
+  
+  delta = b.delta;
+  theta = b.theta;
+  alpha = b.alpha;
+  beta  = b.beta;
+  gamma = b.gamma;
+  mu    = b.mu;
+  
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+SpectralAnalyzer::SpectralAnalyzer()
+{
+}
+
+
+SpectralAnalyzer::SpectralAnalyzer(double sampling_hz, unsigned int channels,
+				   unsigned int windowSize, unsigned int hop,
+				   window_function window)
+{
+  setup(sampling_hz, channels, windowSize, hop, window);
+}
+
+
+SpectralAnalyzer::~SpectralAnalyzer()
+{
+  std::lock_guard<std::mutex> lock(__fftw_planner_mutex);
+  
+  for(auto& p : plans)
+    freePlan(p.second);
+  
+  plans.clear();
+}
+
+
+bool SpectralAnalyzer::setup(double sampling_hz, unsigned int channels,
+			     unsigned int windowSize, unsigned int hop,
+			     window_function window)
+{
+  if(sampling_hz <= 0.0 || channels == 0 || windowSize < 2 || hop == 0)
+    return false;
   
+  this->sampling_hz = sampling_hz;
+  this->channels = channels;
+  this->windowSize = windowSize;
+  this->hop = hop;
+  
+  // window function
+  this->window.resize(windowSize);
+  windowPower = 0.0;
+  
+  for(unsigned int i=0;i<windowSize;i++){
+    const double x = 2.0*M_PI*i/(windowSize - 1);
+    double w = 1.0;
+    
+    if(window == WINDOW_HANN)
+      w = 0.5 - 0.5*cos(x);
+    else if(window == WINDOW_HAMMING)
+      w = 0.54 - 0.46*cos(x);
+    else if(window == WINDOW_BLACKMAN)
+      w = 0.42 - 0.5*cos(x) + 0.08*cos(2.0*x);
+    
+    this->window[i] = w;
+    windowPower += w*w;
+  }
+  
+  history.resize(channels);
+  for(auto& h : history){
+    h.resize(windowSize);
+    for(auto& v : h) v = 0.0;
+  }
+  
+  position = 0;
+  samples = 0;
+  frames = 0;
+  
+  latestPF.resize(channels);
+  for(auto& pf : latestPF)
+    pf.clear();
+  
+  latestBands.resize(channels);
+  
+  // measures plan already here so that it is not planned while streaming
+  if(getPlan(windowSize, true) == nullptr)
+    return false;
+  
+  return true;
+}
+
+
+bool SpectralAnalyzer::powerSpectrum(const std::vector<double>& s, const double sampling_hz,
+				     std::vector<double>& PF, double& hz_per_sample)
+{
   if(s.size() <= 0 || sampling_hz <= 0.0)
     return false;
   
   const unsigned int N = s.size();
   
-  fftw_plan p;
-  fftw_complex *out = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * N);
+  plan_entry* p = getPlan(N);
+  if(p == nullptr) return false;
   
-  if(out == NULL)
-    return false;
+  for(unsigned int i=0;i<N;i++)
+    p->in[i] = s[i];
   
-  // warning we ignore const in input argument
-  p = fftw_plan_dft_r2c_1d(N, (double*)&(s[0]), out, FFTW_ESTIMATE);
+  fftw_execute((fftw_plan)p->plan);
   
-  fftw_execute(p);
+  const fftw_complex* out = (const fftw_complex*)p->out;
   
   PF.resize(N/2 + 1);
   
@@ -52,58 +171,220 @@ bool power_spectral_analysis(const std::vector<double>& s, const double sampling
   
   hz_per_sample = sampling_hz/N;
   
-  fftw_destroy_plan(p);
-  fftw_free(out);
-  
   return true;
 }
 
 
-// uses ||FFT(s)|| for band analysis
-bool spectral_analysis(const std::vector<double>& s, const double sampling_hz,
-		       double& delta, double& theta, double& alpha, 
-		       double& beta,  double& gamma, double& mu)
+void SpectralAnalyzer::bandPowers(const std::vector<double>& PF, double hz_per_sample,
+				  bands& b)
 {
-  std::vector<double> PF;
-  double hz_per_sample = 0.0;
+  b.delta = 0.0;
+  b.theta = 0.0;
+  b.alpha = 0.0;
+  b.beta  = 0.0;
+  b.gamma = 0.0;
+  b.mu    = 0.0;
+  b.entropy = 0.0;
   
-  if(!power_spectral_analysis(s, sampling_hz, PF, hz_per_sample))
-    return false;
-  
-  delta = 0.0;
-  theta = 0.0;
-  alpha = 0.0;
-  beta  = 0.0;
-  gamma = 0.0;
-  mu    = 0.0;
-  
-  double hz = 0.0;
+  double sumP = 0.0, sumPlogP = 0.0;
   
   for(unsigned int i=0;i<PF.size();i++){
-    if(hz >= 0.0 && hz < 4.0)         delta += sqrt(PF[i]);
-    else if(hz >= 4.0 && hz < 8.0)    theta += sqrt(PF[i]);
-    else if(hz >= 8.0 && hz < 16.0)   alpha += sqrt(PF[i]);
-    else if(hz >= 16.0 && hz < 32.0)   beta += sqrt(PF[i]);
-    else if(hz >= 32.0 && hz < 100.0) gamma += sqrt(PF[i]);
-    else if(hz >= 8.0 && hz < 12.0)      mu += sqrt(PF[i]);
+    const double hz = i*hz_per_sample;
+    const double a = sqrt(PF[i]);
+    
+    if(hz >= 0.0 && hz < 4.0)         b.delta += a;
+    else if(hz >= 4.0 && hz < 8.0)    b.theta += a;
+    else if(hz >= 8.0 && hz < 16.0)   b.alpha += a;
+    else if(hz >= 16.0 && hz < 32.0)  b.beta  += a;
+    else if(hz >= 32.0 && hz < 100.0) b.gamma += a;
+    
+    if(hz >= 8.0 && hz < 12.0)           b.mu += a;
     
-    hz += hz_per_sample;
+    // spectral entropy (same as spectral_entropy()) in the same pass
+    const double p = fabs(PF[i]);
+    sumP += p;
+    if(p > 0.0) sumPlogP += p*log(p);
   }
   
-  
   // normalizes power spectrum to be power/hz [does make sense?]
+  
+  b.delta /= (4.0 - 0.0);
+  b.theta /= (8.0 - 4.0);
+  b.alpha /= (16.0 - 8.0);
+  b.beta  /= (32.0 - 16.0);
+  b.gamma /= (100.0 - 32.0);
+  b.mu    /= (12.0 - 8.0);
+  
+  // H = -sum(p/S * log(p/S)) = log(S) - sum(p*log(p))/S
+  if(sumP > 0.0 && PF.size() > 1)
+    b.entropy = (log(sumP) - sumPlogP/sumP)/log((double)PF.size());
+}
+
 
-  delta /= (4.0 - 0.0);
-  theta /= (8.0 - 4.0);
-  alpha /= (16.0 - 8.0);
-  beta  /= (32.0 - 16.0);
-  gamma /= (100.0 - 32.0);
-  mu    /= (12.0 - 8.0);
+bool SpectralAnalyzer::push(const std::vector<double>& x)
+{
+  if(x.size() != channels || channels == 0)
+    return false;
+  
+  for(unsigned int c=0;c<channels;c++)
+    history[c][position] = x[c];
+  
+  position++;
+  if(position >= windowSize) position = 0;
+  
+  samples++;
+  
+  // calculates new frame every hop samples after the first full window
+  if(samples >= windowSize && ((samples - windowSize) % hop) == 0)
+    return calculateFrame();
   
   return true;
 }
 
 
+bool SpectralAnalyzer::push(const std::vector< std::vector<double> >& samples)
+{
+  for(const auto& x : samples)
+    if(push(x) == false) return false;
+  
+  return true;
+}
+
+
+bool SpectralAnalyzer::getBands(std::vector<bands>& b) const
+{
+  if(frames == 0) return false;
+  
+  b = latestBands;
+  
+  return true;
+}
+
+
+bool SpectralAnalyzer::getPowerSpectrum(unsigned int channel, std::vector<double>& PF,
+					double& hz_per_sample) const
+{
+  if(frames == 0 || channel >= channels) return false;
+  
+  PF = latestPF[channel];
+  hz_per_sample = sampling_hz/windowSize;
+  
+  return true;
+}
+
+
+bool SpectralAnalyzer::loadWisdom(const std::string& filename)
+{
+  std::lock_guard<std::mutex> lock(__fftw_planner_mutex);
+  
+  return (fftw_import_wisdom_from_filename(filename.c_str()) != 0);
+}
+
+
+bool SpectralAnalyzer::saveWisdom(const std::string& filename)
+{
+  std::lock_guard<std::mutex> lock(__fftw_planner_mutex);
+  
+  return (fftw_export_wisdom_to_filename(filename.c_str()) != 0);
+}
+
+
+SpectralAnalyzer::plan_entry* SpectralAnalyzer::getPlan(unsigned int N, bool measure)
+{
+  auto iter = plans.find(N);
+  if(iter != plans.end()){
+    iter->second.used = ++planUses;
+    return &(iter->second);
+  }
+  
+  std::lock_guard<std::mutex> lock(__fftw_planner_mutex);
+  
+  // signal lengths vary: removes least recently used plan (except STFT plan)
+  if(plans.size() >= MAX_PLANS){
+    auto lru = plans.end();
+    
+    for(auto i = plans.begin();i != plans.end();i++){
+      if(i->first == windowSize) continue;
+      if(lru == plans.end() || i->second.used < lru->second.used)
+	lru = i;
+    }
+    
+    if(lru != plans.end()){
+      freePlan(lru->second);
+      plans.erase(lru);
+    }
+  }
+  
+  plan_entry p;
+  p.used = ++planUses;
+  
+  p.in  = (double*)fftw_malloc(sizeof(double) * N);
+  p.out = fftw_malloc(sizeof(fftw_complex) * (N/2 + 1));
+  
+  if(p.in == NULL || p.out == NULL){
+    if(p.in) fftw_free(p.in);
+    if(p.out) fftw_free(p.out);
+    return nullptr;
+  }
+  
+  // FFTW_MEASURE overwrites buffers while planning (data is copied in later)
+  p.plan = fftw_plan_dft_r2c_1d(N, p.in, (fftw_complex*)p.out,
+				measure ? FFTW_MEASURE : FFTW_ESTIMATE);
+  
+  if(p.plan == NULL){
+    fftw_free(p.in);
+    fftw_free(p.out);
+    return nullptr;
+  }
+  
+  plans[N] = p;
+  
+  return &(plans[N]);
+}
+
 
+void SpectralAnalyzer::freePlan(plan_entry& p)
+{
+  fftw_destroy_plan((fftw_plan)p.plan);
+  fftw_free(p.in);
+  fftw_free(p.out);
+}
 
 
+bool SpectralAnalyzer::calculateFrame()
+{
+  plan_entry* p = getPlan(windowSize);
+  if(p == nullptr) return false;
+  
+  const fftw_complex* out = (const fftw_complex*)p->out;
+  const double scale = 1.0/(sampling_hz*windowPower);
+  const double hz_per_sample = sampling_hz/windowSize;
+  
+  for(unsigned int c=0;c<channels;c++){
+    // oldest sample is at the current write position
+    const std::vector<double>& h = history[c];
+    
+    for(unsigned int i=0, j=position;i<windowSize;i++){
+      p->in[i] = window[i]*h[j];
+      j++;
+      if(j >= windowSize) j = 0;
+    }
+    
+    fftw_execute((fftw_plan)p->plan);
+    
+    std::vector<double>& PF = latestPF[c];
+    PF.resize(windowSize/2 + 1);
+    
+    for(unsigned int i=0;i<PF.size();i++){
+      PF[i] = scale * (out[i][0]*out[i][0] + out[i][1]*out[i][1]);
+      if(i != 0 && i != PF.size() - 1)
+	PF[i] *= 2.0;
+    }
+    
+    bandPowers(PF, hz_per_sample, latestBands[c]);
+  }
+  
+  frames++;
+  
+  return true;
+}
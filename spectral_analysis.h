@@ -17,6 +17,8 @@
 #define __spectral_analysis_h
 
 #include <vector>
+#include <map>
+#include <string>
 
 /*
  * returns power in different frequencies of source signal s with sampling frequency sampling_hz
@@ -33,5 +35,116 @@ bool power_spectral_analysis(const std::vector<double>& s, const double sampling
 			     std::vector<double>& PF, double& hz_per_sample);
 
 
+/*
+ * reusable spectral analyzer: keeps FFTW plans and buffers for each window
+ * size, and calculates sliding window STFT band powers and spectral
+ * entropy of multichannel signal in one pass.
+ *
+ * STFT plan is measured (FFTW_MEASURE) once in setup(), plans of other
+ * signal lengths use FFTW_ESTIMATE and at most MAX_PLANS are kept.
+ * FFTW wisdom can be loaded at startup and saved at shutdown so that
+ * measuring plans is done only once.
+ */
+class SpectralAnalyzer
+{
+ public:
+  
+  enum window_function {
+    WINDOW_RECTANGULAR = 0,
+    WINDOW_HANN,
+    WINDOW_HAMMING,
+    WINDOW_BLACKMAN
+  };
+  
+  // band powers (normalized as in spectral_analysis()) and spectral entropy
+  struct bands {
+    double delta, theta, alpha, beta, gamma, mu;
+    double entropy; // normalized spectral entropy [0,1]
+  };
+  
+  SpectralAnalyzer();
+  
+  // sliding window STFT of given number of channels, window size and hop (samples)
+  SpectralAnalyzer(double sampling_hz, unsigned int channels,
+		   unsigned int windowSize, unsigned int hop,
+		   window_function window = WINDOW_HANN);
+  
+  ~SpectralAnalyzer();
+  
+  SpectralAnalyzer(const SpectralAnalyzer&) = delete; // owns FFTW plans
+  SpectralAnalyzer& operator=(const SpectralAnalyzer&) = delete;
+  
+  bool setup(double sampling_hz, unsigned int channels,
+	     unsigned int windowSize, unsigned int hop,
+	     window_function window = WINDOW_HANN);
+  
+  // power spectrum |FFT(s)|^2 of any length signal (no windowing), uses cached plans
+  bool powerSpectrum(const std::vector<double>& s, const double sampling_hz,
+		     std::vector<double>& PF, double& hz_per_sample);
+  
+  // calculates band powers and spectral entropy from power spectrum
+  static void bandPowers(const std::vector<double>& PF, double hz_per_sample, bands& b);
+  
+  // adds one multichannel sample to STFT, calculates new frame every hop samples
+  bool push(const std::vector<double>& x);
+  
+  // adds block of samples (samples[i] is i:th multichannel sample)
+  bool push(const std::vector< std::vector<double> >& samples);
+  
+  // number of STFT frames calculated so far
+  unsigned long long getFrameNumber() const { return frames; }
+  
+  // band powers of the latest STFT frame for each channel
+  bool getBands(std::vector<bands>& b) const;
+  
+  // power spectrum of the latest STFT frame of the channel
+  bool getPowerSpectrum(unsigned int channel, std::vector<double>& PF,
+			double& hz_per_sample) const;
+  
+  // loads FFTW wisdom from file (startup) and saves wisdom to file (shutdown)
+  static bool loadWisdom(const std::string& filename);
+  static bool saveWisdom(const std::string& filename);
+  
+  static const unsigned int MAX_PLANS = 8; // cached plans of powerSpectrum()
+  
+ private:
+  
+  struct plan_entry {
+    void* plan; // fftw_plan
+    double* in;
+    void* out;  // fftw_complex*
+    unsigned long long used; // latest use (LRU)
+  };
+  
+  // returns cached plan for window size N (creates a new one if needed),
+  // measure selects FFTW_MEASURE instead of FFTW_ESTIMATE planning
+  plan_entry* getPlan(unsigned int N, bool measure = false);
+  
+  void freePlan(plan_entry& p);
+  
+  bool calculateFrame();
+  
+  std::map<unsigned int, plan_entry> plans;
+  unsigned long long planUses = 0;
+  
+  double sampling_hz = 0.0;
+  unsigned int channels = 0;
+  unsigned int windowSize = 0;
+  unsigned int hop = 0;
+  
+  std::vector<double> window;
+  double windowPower = 0.0; // sum(w[i]^2)
+  
+  std::vector< std::vector<double> > history; // circular buffers of channels
+  unsigned int position = 0; // next write position in history
+  unsigned long long samples = 0;
+  unsigned long long frames = 0;
+  
+  std::vector< std::vector<double> > latestPF;
+  std::vector<bands> latestBands;
+};
+
+
+
 #endif
 
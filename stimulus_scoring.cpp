@@ -0,0 +1,74 @@
+
+#include "stimulus_scoring.h"
+
+#include <math.h>
+
+
+// compiles AVX-512 and AVX2 versions of the kernel and selects
+// the best one at runtime (default is scalar/SSE code)
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && !defined(__clang__)
+#define STIMULUS_KERNEL_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define STIMULUS_KERNEL_CLONES
+#endif
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    STIMULUS_KERNEL_CLONES
+    void stimulus_error_batch(const float* mean, const float* var,
+			      const unsigned int N, const unsigned int D,
+			      const float* current, const float* target,
+			      const float* targetVariance,
+			      float* error, float* ratio, float* norm)
+    {
+      // accumulates squared norms of error, stdev and mean vectors
+      for(unsigned int n=0;n<N;n++){
+	error[n] = 0.0f;
+	ratio[n] = 0.0f;
+	norm[n] = 0.0f;
+      }
+
+      for(unsigned int d=0;d<D;d++){
+	const float c = current[d];
+	const float t = target[d];
+	const float w = 1.0f/sqrtf(targetVariance[d]);
+
+	const float* md = mean + d*N;
+	const float* vd = var + d*N;
+	float* mn = norm;
+
+#pragma omp simd
+	for(unsigned int n=0;n<N;n++){
+	  // predicted value is clipped to [0,1] interval
+	  float p = c + md[n];
+	  p = (p < 0.0f) ? 0.0f : p;
+	  p = (p > 1.0f) ? 1.0f : p;
+
+	  const float v = fabsf(vd[n]);
+	  const float stdev = sqrtf(v);
+	  
+	  // handles uncertainty in prediction
+	  const float e = (fabsf(t - p) + 0.50f*stdev)*w;
+
+	  error[n] += e*e;
+	  ratio[n] += v;
+	  mn[n] += md[n]*md[n];
+	}
+      }
+
+      for(unsigned int n=0;n<N;n++){
+	error[n] = sqrtf(error[n]);
+
+	if(norm[n] > 0.0f)
+	  ratio[n] = sqrtf(ratio[n]/norm[n]);
+	else
+	  ratio[n] = 1.0f;
+      }
+    }
+    
+  };
+};
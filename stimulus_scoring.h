@@ -0,0 +1,33 @@
+/*
+ * stimulus_scoring
+ *
+ * batched (vectorized) error calculation of predicted stimulus responses.
+ * predictions themselves are not batched: every stimulus has its own
+ * model and preprocessing so they are calculated per stimulus (in parallel)
+ */
+
+#ifndef stimulus_scoring_h
+#define stimulus_scoring_h
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    // calculates errors (weighted distances to the target state) of N predicted
+    // stimulus responses. mean and var are D x N structure-of-arrays matrices:
+    // mean[d*N + n] is predicted change of signal d after stimulus n and
+    // var[d*N + n] is its variance. current, target and targetVariance have D
+    // elements. writes error[n] and stdev/mean ratio[n] of each stimulus.
+    // norm is caller's N element work buffer (no allocations per call)
+    void stimulus_error_batch(const float* mean, const float* var,
+			      const unsigned int N, const unsigned int D,
+			      const float* current, const float* target,
+			      const float* targetVariance,
+			      float* error, float* ratio, float* norm);
+
+  };
+};
+
+#endif
@@ -79,7 +79,51 @@ int main(int argc, char** argv)
   // http://www.mathworks.se/help/signal/ug/psd-estimate-using-fft.html is a good reference test
   printf("TESTCASE2: spectral analysis of delta, gamma, theta, alpha-bands..\n");  
   {
-    fprintf(stderr, "ERROR: spectral_analysis() test function not implemented\n");
+    // 2 channel EEG at 256 Hz: channel 0 has alpha (10 Hz) sinusoid and
+    // channel 1 has theta (6 Hz) sinusoid, STFT with 1 sec hann window
+    const double Fs = 256.0;
+    const double freq[2] = { 10.0, 6.0 };
+    
+    SpectralAnalyzer analyzer(Fs, 2, 256, 32, SpectralAnalyzer::WINDOW_HANN);
+    
+    for(unsigned int i=0;i<4*256;i++){
+      std::vector<double> x(2);
+      
+      for(unsigned int c=0;c<2;c++)
+	x[c] = 10.0*sin(2*M_PI*freq[c]*i/Fs) + 0.1*(((double)rand())/((double)RAND_MAX) - 0.5);
+      
+      if(analyzer.push(x) == false){
+	fprintf(stderr, "ERROR: SpectralAnalyzer::push() FAILED.\n");
+	return -1;
+      }
+    }
+    
+    std::vector<SpectralAnalyzer::bands> b;
+    
+    if(analyzer.getBands(b) == false || b.size() != 2){
+      fprintf(stderr, "ERROR: SpectralAnalyzer::getBands() FAILED.\n");
+      return -1;
+    }
+    
+    printf("STFT frames: %d\n", (int)analyzer.getFrameNumber());
+    
+    for(unsigned int c=0;c<b.size();c++){
+      printf("channel %d (%.0f Hz): delta %f theta %f alpha %f beta %f gamma %f mu %f entropy %f\n",
+	     c, freq[c], b[c].delta, b[c].theta, b[c].alpha, b[c].beta, b[c].gamma, b[c].mu,
+	     b[c].entropy);
+    }
+    
+    if(analyzer.getFrameNumber() != 1 + (4*256 - 256)/32 ||
+       b[0].alpha <= b[0].theta || b[0].alpha <= b[0].beta ||
+       b[1].theta <= b[1].alpha || b[1].theta <= b[1].delta ||
+       b[0].mu <= 0.0)
+    {
+      fprintf(stderr, "ERROR: SpectralAnalyzer band powers are incorrect.\n");
+      return -1;
+    }
+    
+    printf("SPECTRAL ANALYSIS: STFT band powers OK.\n");
+    fflush(stdout);
   }
   
   
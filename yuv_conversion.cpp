@@ -0,0 +1,92 @@
+
+#include "yuv_conversion.h"
+
+
+// compiles AVX2 version of the kernel and selects it at
+// runtime if it is available (default is scalar/SSE code)
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && !defined(__clang__)
+#define YUV_KERNEL_CLONES __attribute__((target_clones("avx2","default")))
+#else
+#define YUV_KERNEL_CLONES
+#endif
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    // 8-bit fixed-point BT.601 coefficients (Y = 0.257R + 0.504G + 0.098B + 16, ..)
+    static inline uint8_t luma(const uint32_t p)
+    {
+      const int r = (p >> 16) & 0xFF;
+      const int g = (p >>  8) & 0xFF;
+      const int b = (p      ) & 0xFF;
+
+      return (uint8_t)(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+    }
+
+
+    YUV_KERNEL_CLONES
+    void rgb32_to_i420(const uint32_t* pixels, const unsigned int pitch,
+		       const unsigned int width, const unsigned int height,
+		       uint8_t* Y, const int ystride,
+		       uint8_t* U, const int ustride,
+		       uint8_t* V, const int vstride)
+    {
+      const unsigned int W2 = (width + 1)/2;
+
+      for(unsigned int y=0;y<height;y+=2){
+	// odd last row and column are paired with themselves
+	const uint32_t* row0 = pixels + y*pitch;
+	const uint32_t* row1 = (y+1 < height) ? (row0 + pitch) : row0;
+
+	uint8_t* y0 = Y + y*ystride;
+	uint8_t* y1 = (y+1 < height) ? (y0 + ystride) : y0;
+
+	uint8_t* u = U + (y/2)*ustride;
+	uint8_t* v = V + (y/2)*vstride;
+
+	const unsigned int pairs = width/2;
+
+#pragma omp simd
+	for(unsigned int x=0;x<pairs;x++){
+	  const uint32_t p00 = row0[2*x], p01 = row0[2*x+1];
+	  const uint32_t p10 = row1[2*x], p11 = row1[2*x+1];
+
+	  y0[2*x] = luma(p00);
+	  y0[2*x+1] = luma(p01);
+	  y1[2*x] = luma(p10);
+	  y1[2*x+1] = luma(p11);
+
+	  // sums of 2x2 block (the average is taken in the final shift)
+	  const int r =
+	    ((p00 >> 16) & 0xFF) + ((p01 >> 16) & 0xFF) + ((p10 >> 16) & 0xFF) + ((p11 >> 16) & 0xFF);
+	  const int g =
+	    ((p00 >> 8) & 0xFF) + ((p01 >> 8) & 0xFF) + ((p10 >> 8) & 0xFF) + ((p11 >> 8) & 0xFF);
+	  const int b =
+	    (p00 & 0xFF) + (p01 & 0xFF) + (p10 & 0xFF) + (p11 & 0xFF);
+
+	  u[x] = (uint8_t)(((-38*r - 74*g + 112*b + 512) >> 10) + 128);
+	  v[x] = (uint8_t)(((112*r - 94*g - 18*b + 512) >> 10) + 128);
+	}
+
+	if(pairs < W2){
+	  const unsigned int x = width - 1;
+	  const uint32_t p0 = row0[x], p1 = row1[x];
+
+	  y0[x] = luma(p0);
+	  y1[x] = luma(p1);
+
+	  const int r = ((p0 >> 16) & 0xFF) + ((p1 >> 16) & 0xFF);
+	  const int g = ((p0 >> 8) & 0xFF) + ((p1 >> 8) & 0xFF);
+	  const int b = (p0 & 0xFF) + (p1 & 0xFF);
+
+	  u[pairs] = (uint8_t)(((-38*r - 74*g + 112*b + 256) >> 9) + 128);
+	  v[pairs] = (uint8_t)(((112*r - 94*g - 18*b + 256) >> 9) + 128);
+	}
+      }
+    }
+
+  };
+};
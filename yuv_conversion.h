@@ -0,0 +1,31 @@
+/*
+ * yuv_conversion
+ *
+ * fixed-point (vectorized) conversion of 32-bit RGB pixels to planar
+ * YUV 4:2:0 (I420) video frames
+ */
+
+#ifndef yuv_conversion_h
+#define yuv_conversion_h
+
+#include <stdint.h>
+
+
+namespace whiteice
+{
+  namespace resonanz
+  {
+
+    // converts width x height pixels (0x00RRGGBB words, pitch words per row)
+    // to Y, U and V planes (BT.601 limited range) in a single pass. each
+    // chroma sample is the average of its 2x2 block of pixels
+    void rgb32_to_i420(const uint32_t* pixels, const unsigned int pitch,
+		       const unsigned int width, const unsigned int height,
+		       uint8_t* Y, const int ystride,
+		       uint8_t* U, const int ustride,
+		       uint8_t* V, const int vstride);
+
+  };
+};
+
+#endif